@@ -26,6 +26,10 @@
 
 #include "Application.hpp"
 
+// Fraction of each frame which may be spent running tasks on the main thread.
+// Tasks which do not fit roll over to the next frame.
+constexpr double MainThreadTaskBudgetFraction = 0.25;
+
 // Exception thrown when the system does not meet minimum requirements.
 class ApplicationRequirementsException : public Exception
 {
@@ -53,11 +57,13 @@ void Application::inner(const std::shared_ptr<GraphicsDevice> &graphicsDevice,
     // Get the display refresh rate. This is usually 60 Hz.
     const double refreshRate = getVideoRefreshRate().value_or(60.0);
 	const auto videoRefreshPeriod = std::chrono::duration<double>(1 / refreshRate);
+    const auto mainThreadTaskBudget = std::chrono::duration_cast<TaskDispatcher::Clock::duration>(videoRefreshPeriod * MainThreadTaskBudgetFraction);
     
     World gameWorld(_log,
                     _preferences,
                     graphicsDevice,
-                    mainThreadDispatcher);
+                    mainThreadDispatcher,
+                    *_threadPoolPolicy);
     
     // Send an event containing the initial window size and scale factor.
     // This will allow the render system to setup projection matrices and such.
@@ -150,7 +156,14 @@ void Application::inner(const std::shared_ptr<GraphicsDevice> &graphicsDevice,
         
         // Sometimes, we need to execute a task specifically on the main thread.
         // For example, a background task needs to update an entity component.
-        mainThreadDispatcher->flush();
+        // A burst of such tasks, e.g., when many chunks finish at once, is
+        // spread over several frames so the frame rate stays smooth.
+        mainThreadDispatcher->flush(mainThreadTaskBudget);
+        const size_t mainThreadBacklog = mainThreadDispatcher->getNumberOfPendingTasks();
+        if (mainThreadBacklog > 0) {
+            _log->trace("{} main thread tasks rolled over to the next frame.",
+                        mainThreadBacklog);
+        }
         
         std::this_thread::sleep_until(nextTime);
     }
@@ -165,18 +178,44 @@ void Application::run()
     // Load user preferences from file.
     {
         boost::filesystem::path prefsFileName = getPrefPath()/"preferences.xml";
-        if (boost::filesystem::exists(prefsFileName)) {
-            std::ifstream inputStream(prefsFileName.c_str());
-            cereal::XMLInputArchive archive(inputStream);
-            archive(cereal::make_nvp("preferences", _preferences));
-            _log->info("Loaded user preferences from file \"{}\": {}",
-                      prefsFileName.string(),
-                      _preferences);
-        } else {
-            // Save the default preferences to file.
+        
+        auto savePreferences = [&]{
             std::ofstream outputStream(prefsFileName.c_str());
             cereal::XMLOutputArchive archive(outputStream);
             archive(cereal::make_nvp("preferences", _preferences));
+        };
+        
+        if (boost::filesystem::exists(prefsFileName)) {
+            bool complete = true;
+            try {
+                std::ifstream inputStream(prefsFileName.c_str());
+                cereal::XMLInputArchive archive(inputStream);
+                archive(cereal::make_nvp("preferences", _preferences));
+            } catch (const cereal::Exception &exception) {
+                // A file saved by an older version lacks the settings added
+                // since then. Settings are loaded in order, so those which
+                // precede the first missing one keep their loaded values and
+                // the rest keep their defaults. Rewrite the file so it lists
+                // every setting.
+                _log->warn("Failed to load all user preferences from file \"{}\": {}",
+                           prefsFileName.string(),
+                           exception.what());
+                complete = false;
+            }
+            
+            if (complete) {
+                _log->info("Loaded user preferences from file \"{}\": {}",
+                          prefsFileName.string(),
+                          _preferences);
+            } else {
+                savePreferences();
+                _log->info("Saved updated user preferences to file \"{}\": {}",
+                          prefsFileName.string(),
+                          _preferences);
+            }
+        } else {
+            // Save the default preferences to file.
+            savePreferences();
             _log->info("Saved default user preferences to file \"{}\": {}",
                       prefsFileName.string(),
                       _preferences);
@@ -185,6 +224,18 @@ void Application::run()
     
     _log->set_level(_preferences.logLevel);
     
+    // Decide how many worker threads each thread pool gets, and where they
+    // run, before any pools are created.
+    {
+        ThreadPoolPolicy::Settings settings;
+        settings.workerBudget = _preferences.workerThreadBudget;
+        settings.pinThreads = _preferences.pinWorkerThreads;
+        settings.groupByNumaNode = _preferences.groupWorkerThreadsByNumaNode;
+        settings.shares = _preferences.workerThreadShares;
+        _threadPoolPolicy = std::make_unique<ThreadPoolPolicy>(settings, getCpuTopology());
+        _log->info("Thread pool policy: {}", _threadPoolPolicy->describe());
+    }
+    
     if (!SDL_HasAVX()) {
         throw AVXUnsupportedException();
     }
@@ -216,7 +267,8 @@ void Application::run()
     }
     
     inner(createDefaultGraphicsDevice(_log, *_window),
-          std::make_shared<TaskDispatcher>("Main Thread Dispatcher", 0));
+          std::make_shared<TaskDispatcher>("Main Thread Dispatcher", 0,
+                                           TaskDispatcher::Inbox));
 
     SDL_DestroyWindow(_window);
     _window = nullptr;
@@ -11,13 +11,58 @@
 #include "AutoreleasePool.hpp"
 #include <algorithm>
 
+// Identifies the dispatcher, and the worker queue within it, which owns the
+// current thread. This lets a task posted from a worker thread go onto that
+// worker's own queue in WorkStealing mode. This also records the priority of
+// the task currently executing on the worker.
+struct WorkerIdentity
+{
+    const TaskDispatcher *dispatcher = nullptr;
+    size_t index = 0;
+    TaskDispatcher::Priority priority = TaskDispatcher::NormalPriority;
+};
+
+static thread_local WorkerIdentity currentWorker;
+
+// Inbox scheduling needs a dispatcher with no workers, and a dispatcher with no
+// workers can only use SharedQueue or Inbox scheduling.
+static TaskDispatcher::Scheduling chooseScheduling(unsigned numThreads,
+                                                   TaskDispatcher::Scheduling scheduling)
+{
+    if (numThreads > 0) {
+        return (scheduling == TaskDispatcher::Inbox) ? TaskDispatcher::SharedQueue : scheduling;
+    } else {
+        return (scheduling == TaskDispatcher::Inbox) ? TaskDispatcher::Inbox : TaskDispatcher::SharedQueue;
+    }
+}
+
 TaskDispatcher::TaskDispatcher(const std::string &name,
-                               unsigned numThreads)
- : _threadShouldExit(false)
+                               unsigned numThreads,
+                               Scheduling scheduling,
+                               std::function<void(unsigned workerIndex)> onWorkerStart)
+ : _scheduling(chooseScheduling(numThreads, scheduling)),
+   _numberOfThreads(numThreads),
+   _threadShouldExit(false),
+   _numberOfDeadlineTasks(0),
+   _nextSequenceNumber(0),
+   _nextWorkerQueue(0),
+   _numberOfSleepingWorkers(0),
+   _inbox(nullptr)
 {
+    for (size_t i = 0; i < NumberOfPriorities; ++i) {
+        _numberOfPendingTasks[i] = 0;
+        _numberOfTimesPassedOver[i] = 0;
+    }
+    
+    if (_scheduling == WorkStealing) {
+        for (unsigned i = 0; i < numThreads; ++i) {
+            _workerQueues.emplace_back(std::make_unique<WorkerQueue>());
+        }
+    }
+    
     for (unsigned i = 0; i < numThreads; ++i) {
-        _threads.emplace_back([this, name]{
-            worker(name);
+        _threads.emplace_back([this, name, i, onWorkerStart]{
+            worker(name, i, onWorkerStart);
         });
     }
 }
@@ -30,67 +75,492 @@ TaskDispatcher::~TaskDispatcher()
 void TaskDispatcher::shutdown()
 {
     AutoreleasePool pool;
-
+    
     _threadShouldExit = true;
     
-    while (!_tasks.empty()) {
-        std::shared_ptr<AbstractTask> task(_tasks.front());
-        _tasks.pop();
-        task->cancel();
+    for (TaskNode *node : drainTasks()) {
+        node->discard();
+    }
+    
+    {
+        // Taking the lock ensures no worker is between checking the predicate
+        // and waiting on the condition variable, so none can miss the wakeup.
+        std::scoped_lock lock(_lockTaskPosted);
+        _cvarTaskPosted.notify_all();
     }
     
-    _cvarTaskPosted.notify_all();
     for (std::thread &thread : _threads) {
-        thread.join();
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // We're being called from a task on one of our own workers. That
+            // worker will exit when the task returns.
+            currentWorker = WorkerIdentity();
+            thread.detach();
+        } else {
+            thread.join();
+        }
     }
     _threads.clear();
 }
 
 void TaskDispatcher::flush()
+{
+    (void)flushUntil(Clock::time_point::max());
+}
+
+size_t TaskDispatcher::flush(Clock::duration budget)
+{
+    return flushUntil(Clock::now() + budget);
+}
+
+size_t TaskDispatcher::flushUntil(Clock::time_point deadline)
 {
     AutoreleasePool pool;
-    std::unique_lock<std::mutex> lock(_lockTaskPosted);
     
+    const bool hasDeadline = (deadline != Clock::time_point::max());
+    size_t numberOfTasksRun = 0;
+    
+    while (!_threadShouldExit) {
+        TaskNode *node = takeTask(NoWorkerQueue);
+        if (!node) {
+            break;
+        }
+        node->execute();
+        numberOfTasksRun++;
+        
+        if (hasDeadline && Clock::now() >= deadline) {
+            break;
+        }
+    }
+    
+    return numberOfTasksRun;
+}
+
+TaskDispatcher::Priority TaskDispatcher::getDefaultPriority() const
+{
+    if (currentWorker.dispatcher == this) {
+        return currentWorker.priority;
+    } else {
+        return NormalPriority;
+    }
+}
+
+TaskDispatcher::ParallelForContext::ParallelForContext(size_t numberOfBlocks_,
+                                                       void *functionObject_,
+                                                       BlockFunction blockFunction_)
+ : numberOfBlocks(numberOfBlocks_),
+   functionObject(functionObject_),
+   blockFunction(blockFunction_),
+   nextBlock(0),
+   numberOfFinishedBlocks(0),
+   failed(false)
+{}
+
+void TaskDispatcher::ParallelForContext::run()
+{
+    while (true) {
+        const size_t block = nextBlock++;
+        if (block >= numberOfBlocks) {
+            return;
+        }
+        
+        if (!failed) {
+            try {
+                blockFunction(functionObject, block);
+            } catch (...) {
+                std::scoped_lock lock(mutex);
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+        
+        if (++numberOfFinishedBlocks == numberOfBlocks) {
+            std::scoped_lock lock(mutex);
+            cvar.notify_all();
+        }
+    }
+}
+
+void TaskDispatcher::ParallelForContext::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cvar.wait(lock, [this]{
+        return numberOfFinishedBlocks == numberOfBlocks;
+    });
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+size_t TaskDispatcher::chooseGrainSize(size_t count, size_t grainSize) const
+{
+    if (grainSize > 0) {
+        return grainSize;
+    }
+    
+    // A few blocks per thread, counting the calling thread, lets the threads
+    // even out the load when some blocks take longer than others.
+    static constexpr size_t BlocksPerThread = 4;
+    const size_t numberOfBlocks = BlocksPerThread * (_numberOfThreads + 1);
+    return std::max<size_t>(1, (count + numberOfBlocks - 1) / numberOfBlocks);
+}
+
+void TaskDispatcher::post(TaskNode *node,
+                          Priority priority,
+                          Clock::time_point deadline)
+{
+    assert(node);
+    assert(priority < NumberOfPriorities);
+    
+    node->priority = priority;
+    node->deadline = deadline;
+    const bool hasDeadline = (deadline != Clock::time_point::max());
+    
+    if (_scheduling == Inbox) {
+        // Count the task before publishing it so the count never goes below
+        // zero when the consumer takes the task right away.
+        _numberOfPendingTasks[priority]++;
+        pushInbox(node);
+        
+        if (_threadShouldExit) {
+            for (TaskNode *drainedNode : drainTasks()) {
+                drainedNode->discard();
+            }
+        }
+        return;
+    }
+    
+    // A worker increments the sleeper count before it checks the pending
+    // counts, and we increment a pending count before we check the sleeper
+    // count. So, either the worker sees our task or we see the sleeper.
+    if (_scheduling == WorkStealing && priority == NormalPriority && !hasDeadline) {
+        // Tasks posted from one of our own workers go onto that worker's
+        // queue. This keeps related work on the same core and away from the
+        // other workers' locks. Tasks from any other thread are spread
+        // round-robin.
+        size_t index;
+        if (currentWorker.dispatcher == this) {
+            index = currentWorker.index;
+        } else {
+            index = _nextWorkerQueue++ % _workerQueues.size();
+        }
+    
+        WorkerQueue &queue = *_workerQueues[index];
+        std::scoped_lock lock(queue.mutex);
+        queue.tasks.pushBack(node);
+        queue.numberOfTasks++;
+    } else {
+        std::scoped_lock lock(_lockLanes);
+        Lane &lane = _lanes[priority];
+        if (hasDeadline) {
+            node->sequenceNumber = _nextSequenceNumber++;
+            lane.deadlines.push(node);
+            _numberOfDeadlineTasks++;
+        } else {
+            lane.tasks.pushBack(node);
+        }
+        _numberOfPendingTasks[priority]++;
+    }
+    
+    // Nothing will run tasks posted after shutdown. Either shutdown() drains
+    // our task or we see the flag and drain it ourselves.
     if (_threadShouldExit) {
+        for (TaskNode *drainedNode : drainTasks()) {
+            drainedNode->discard();
+        }
         return;
     }
     
-    while (!_tasks.empty()) {
-        std::shared_ptr<AbstractTask> taskPtr = _tasks.front();
-        _tasks.pop();
-        
-        assert(taskPtr);
-        taskPtr->execute();
+    if (_numberOfSleepingWorkers > 0) {
+        std::scoped_lock lock(_lockTaskPosted);
+        _cvarTaskPosted.notify_one();
     }
 }
 
-void TaskDispatcher::worker(const std::string &name)
+void TaskDispatcher::worker(const std::string &name,
+                            size_t index,
+                            const std::function<void(unsigned workerIndex)> &onWorkerStart)
 {
     setNameForCurrentThread(name);
-
-    while (true) {
+    if (onWorkerStart) {
+        onWorkerStart((unsigned)index);
+    }
+    currentWorker.dispatcher = this;
+    currentWorker.index = index;
+    
+    while (!_threadShouldExit) {
         AutoreleasePool pool;
-        std::shared_ptr<AbstractTask> taskPtr;
+        TaskNode *node = takeTask(_workerQueues.empty() ? NoWorkerQueue : index);
         
-        {
+        if (node) {
+            currentWorker.priority = (Priority)node->priority;
+            node->execute();
+            currentWorker.priority = NormalPriority;
+            
+            // If the task called shutdown() then this dispatcher may already
+            // be gone. Do not touch it again.
+            if (currentWorker.dispatcher != this) {
+                return;
+            }
+        } else {
             std::unique_lock<std::mutex> lock(_lockTaskPosted);
+            _numberOfSleepingWorkers++;
             _cvarTaskPosted.wait(lock, [this]{
-                return _threadShouldExit || !_tasks.empty();
+                return _threadShouldExit || numberOfPendingTasks() > 0;
             });
-            
-            if (_threadShouldExit) {
-                return;
+            _numberOfSleepingWorkers--;
+        }
+    }
+    
+    currentWorker = WorkerIdentity();
+}
+
+TaskNode* TaskDispatcher::takeTask(size_t index)
+{
+    if (_scheduling == Inbox) {
+        collectInbox();
+    }
+    
+    if (_numberOfDeadlineTasks > 0) {
+        TaskNode *node = takeOverdueTask();
+        if (node) {
+            return node;
+        }
+    }
+    
+    // Starvation guard: a lane which has been passed over too many times gets
+    // the next turn.
+    for (size_t i = NumberOfPriorities - 1; i > 0; --i) {
+        const Priority priority = (Priority)i;
+        if (_numberOfTimesPassedOver[priority] >= StarvationLimit) {
+            TaskNode *node = takeTaskFromLane(priority, index);
+            if (node) {
+                _numberOfTimesPassedOver[priority] = 0;
+                return node;
             }
-            
-            if (_tasks.empty()) {
-                continue;
+        }
+    }
+    
+    for (size_t i = 0; i < NumberOfPriorities; ++i) {
+        const Priority priority = (Priority)i;
+        TaskNode *node = takeTaskFromLane(priority, index);
+        if (node) {
+            _numberOfTimesPassedOver[priority] = 0;
+            for (size_t j = i + 1; j < NumberOfPriorities; ++j) {
+                if (numberOfPendingTasks((Priority)j) > 0) {
+                    _numberOfTimesPassedOver[j]++;
+                }
             }
-            
-            taskPtr = _tasks.front();
-            _tasks.pop();
+            return node;
+        }
+    }
+    
+    return nullptr;
+}
+
+TaskNode* TaskDispatcher::takeTaskFromLane(Priority priority, size_t index)
+{
+    TaskNode *node = nullptr;
+    
+    // In WorkStealing mode, normal priority tasks are usually in the worker
+    // queues. Only take the shared lock when the shared lane has a task.
+    if (_numberOfPendingTasks[priority] > 0) {
+        std::scoped_lock lock(_lockLanes);
+        Lane &lane = _lanes[priority];
+        if (!lane.deadlines.empty()) {
+            node = lane.deadlines.top();
+            lane.deadlines.pop();
+            _numberOfDeadlineTasks--;
+        } else {
+            node = lane.tasks.popFront();
+        }
+        if (node) {
+            _numberOfPendingTasks[priority]--;
+        }
+    }
+    
+    if (!node && priority == NormalPriority && !_workerQueues.empty()) {
+        node = takeTaskFromWorkerQueues(index);
+    }
+    
+    return node;
+}
+
+TaskNode* TaskDispatcher::takeOverdueTask()
+{
+    const auto now = Clock::now();
+    
+    std::scoped_lock lock(_lockLanes);
+    for (Lane &lane : _lanes) {
+        if (!lane.deadlines.empty() && lane.deadlines.top()->deadline <= now) {
+            TaskNode *node = lane.deadlines.top();
+            lane.deadlines.pop();
+            _numberOfDeadlineTasks--;
+            _numberOfPendingTasks[node->priority]--;
+            return node;
+        }
+    }
+    
+    return nullptr;
+}
+
+TaskNode* TaskDispatcher::takeTaskFromWorkerQueues(size_t index)
+{
+    const size_t n = _workerQueues.size();
+    
+    // Take the most recently posted task from our own queue. It is the one
+    // most likely to still be in cache.
+    size_t start = 0;
+    if (index != NoWorkerQueue) {
+        WorkerQueue &queue = *_workerQueues[index];
+        if (queue.numberOfTasks > 0) {
+            std::scoped_lock lock(queue.mutex);
+            TaskNode *node = queue.tasks.popBack();
+            if (node) {
+                queue.numberOfTasks--;
+                return node;
+            }
+        }
+        start = index + 1;
+    }
+    
+    // Steal the oldest task from some other worker.
+    for (size_t i = 0; i < n; ++i) {
+        const size_t victimIndex = (start + i) % n;
+        if (victimIndex == index) {
+            continue;
+        }
+        WorkerQueue &victim = *_workerQueues[victimIndex];
+        if (victim.numberOfTasks <= 0) {
+            continue;
+        }
+        std::scoped_lock lock(victim.mutex);
+        TaskNode *node = victim.tasks.popFront();
+        if (node) {
+            victim.numberOfTasks--;
+            return node;
+        }
+    }
+    
+    return nullptr;
+}
+
+void TaskDispatcher::pushInbox(TaskNode *node)
+{
+    TaskNode *head = _inbox.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!_inbox.compare_exchange_weak(head, node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+}
+
+TaskDispatcher::TaskList TaskDispatcher::takeInbox()
+{
+    TaskList tasks;
+    
+    if (_inbox.load(std::memory_order_relaxed) == nullptr) {
+        return tasks;
+    }
+    
+    // The stack holds the most recently posted task first. Pushing each task
+    // onto the front of the list restores the order in which they were posted.
+    TaskNode *node = _inbox.exchange(nullptr, std::memory_order_acquire);
+    while (node) {
+        TaskNode *next = node->next;
+        node->prev = nullptr;
+        node->next = tasks.head;
+        if (tasks.head) {
+            tasks.head->prev = node;
+        } else {
+            tasks.tail = node;
+        }
+        tasks.head = node;
+        node = next;
+    }
+    
+    return tasks;
+}
+
+void TaskDispatcher::collectInbox()
+{
+    TaskList tasks = takeInbox();
+    if (tasks.empty()) {
+        return;
+    }
+    
+    // Only the flushing thread takes this lock, so it is not contended.
+    std::scoped_lock lock(_lockLanes);
+    while (TaskNode *node = tasks.popFront()) {
+        Lane &lane = _lanes[node->priority];
+        if (node->deadline != Clock::time_point::max()) {
+            node->sequenceNumber = _nextSequenceNumber++;
+            lane.deadlines.push(node);
+            _numberOfDeadlineTasks++;
+        } else {
+            lane.tasks.pushBack(node);
+        }
+    }
+}
+
+std::vector<TaskNode*> TaskDispatcher::drainTasks()
+{
+    std::vector<TaskNode*> tasks;
+    
+    // Everything up to here was counted in the shared queue's counts.
+    {
+        TaskList inbox = takeInbox();
+        while (TaskNode *node = inbox.popFront()) {
+            tasks.push_back(node);
+        }
+    }
+    
+    {
+        std::scoped_lock lock(_lockLanes);
+        for (Lane &lane : _lanes) {
+            while (!lane.deadlines.empty()) {
+                tasks.push_back(lane.deadlines.top());
+                lane.deadlines.pop();
+                _numberOfDeadlineTasks--;
+            }
+            while (TaskNode *node = lane.tasks.popFront()) {
+                tasks.push_back(node);
+            }
+        }
+    }
+    
+    for (const TaskNode *node : tasks) {
+        _numberOfPendingTasks[node->priority]--;
+    }
+    
+    for (auto &queue : _workerQueues) {
+        std::scoped_lock lock(queue->mutex);
+        while (TaskNode *node = queue->tasks.popFront()) {
+            tasks.push_back(node);
+            queue->numberOfTasks--;
+        }
+    }
+
+    return tasks;
+}
+
+std::ptrdiff_t TaskDispatcher::numberOfPendingTasks() const
+{
+    std::ptrdiff_t count = 0;
+    for (size_t i = 0; i < NumberOfPriorities; ++i) {
+        count += numberOfPendingTasks((Priority)i);
+    }
+    return count;
+}
+
+std::ptrdiff_t TaskDispatcher::numberOfPendingTasks(Priority priority) const
+{
+    std::ptrdiff_t count = _numberOfPendingTasks[priority];
+    if (priority == NormalPriority) {
+        for (const auto &queue : _workerQueues) {
+            count += queue->numberOfTasks;
         }
-        
-        assert(taskPtr);
-        taskPtr->execute();
     }
+    return count;
 }
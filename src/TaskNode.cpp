@@ -0,0 +1,127 @@
+//
+//  TaskNode.cpp
+//  PinkTopaz
+//
+
+#include "TaskNode.hpp"
+#include <mutex>
+
+// Pool of free task nodes.
+//
+// Each thread keeps a small cache of free nodes so that most allocations and
+// releases do not take a lock. Nodes are moved between a thread's cache and
+// the shared free list in batches. This matters because nodes are usually
+// allocated on one thread and released on another.
+class TaskNodePool
+{
+public:
+    // Number of nodes moved between a thread cache and the shared free list
+    // at once.
+    static constexpr size_t BatchSize = 32;
+    
+    // Nodes beyond this many in the shared free list are returned to the heap.
+    static constexpr size_t MaxSharedFreeNodes = 4096;
+    
+    static TaskNodePool& get()
+    {
+        static TaskNodePool pool;
+        return pool;
+    }
+    
+    // Move up to BatchSize nodes from the shared free list onto `head'.
+    // Returns the number of nodes moved.
+    size_t takeBatch(TaskNode *&head)
+    {
+        std::scoped_lock lock(_mutex);
+        size_t count = 0;
+        while (_head && count < BatchSize) {
+            TaskNode *node = _head;
+            _head = node->next;
+            node->next = head;
+            head = node;
+            ++count;
+        }
+        _count -= count;
+        return count;
+    }
+    
+    // Move `count' nodes from `head' to the shared free list. Nodes which do
+    // not fit are deleted.
+    void giveBatch(TaskNode *&head, size_t count)
+    {
+        std::scoped_lock lock(_mutex);
+        for (size_t i = 0; i < count && head; ++i) {
+            TaskNode *node = head;
+            head = node->next;
+            if (_count < MaxSharedFreeNodes) {
+                node->next = _head;
+                _head = node;
+                ++_count;
+            } else {
+                delete node;
+            }
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    TaskNode *_head = nullptr;
+    size_t _count = 0;
+};
+
+// A thread's private cache of free nodes.
+struct TaskNodeCache
+{
+    TaskNode *head = nullptr;
+    size_t count = 0;
+    
+    ~TaskNodeCache()
+    {
+        TaskNodePool::get().giveBatch(head, count);
+    }
+};
+
+static thread_local TaskNodeCache taskNodeCache;
+
+TaskNode* TaskNode::allocate()
+{
+    TaskNodeCache &cache = taskNodeCache;
+    if (!cache.head) {
+        cache.count += TaskNodePool::get().takeBatch(cache.head);
+    }
+    if (cache.head) {
+        TaskNode *node = cache.head;
+        cache.head = node->next;
+        --cache.count;
+        return node;
+    }
+    return new TaskNode;
+}
+
+void TaskNode::release(TaskNode *node)
+{
+    TaskNodeCache &cache = taskNodeCache;
+    node->next = cache.head;
+    cache.head = node;
+    ++cache.count;
+    if (cache.count >= 2 * TaskNodePool::BatchSize) {
+        TaskNodePool::get().giveBatch(cache.head, TaskNodePool::BatchSize);
+        cache.count -= TaskNodePool::BatchSize;
+    }
+}
+
+void TaskNode::execute()
+{
+    struct Releaser
+    {
+        TaskNode *node;
+        ~Releaser() { release(node); }
+    } releaser{this};
+    _operation(*this, true);
+}
+
+void TaskNode::discard()
+{
+    _operation(*this, false);
+    release(this);
+}
@@ -0,0 +1,344 @@
+//
+//  IncrementalLightPropagation.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/IncrementalLightPropagation.hpp"
+
+#include <array>
+#include <map>
+
+using namespace glm;
+
+static const std::array<ivec3, 6> neighborDeltas = {{
+    ivec3(-1,  0,  0),
+    ivec3(+1,  0,  0),
+    ivec3( 0,  0, -1),
+    ivec3( 0,  0, +1),
+    ivec3( 0, -1,  0),
+    ivec3( 0, +1,  0),
+}};
+
+IncrementalLightPropagation::IncrementalLightPropagation(const GridIndexer &voxelIndexer,
+                                                         const GridIndexer &chunkIndexer,
+                                                         ChunkFetcher fetchChunk)
+ : _voxelIndexer(voxelIndexer),
+   _chunkSize(voxelIndexer.gridResolution() / chunkIndexer.gridResolution()),
+   _fetchChunk(std::move(fetchChunk)),
+   _lastChunk(nullptr),
+   _lastModifiedChunk(nullptr)
+{}
+
+AABB IncrementalLightPropagation::editVoxel(const vec3 &point, const Voxel &newValue)
+{
+    const ivec3 cellCoords = _voxelIndexer.cellCoordsAtPoint(point);
+    _minModifiedCellCoords = cellCoords;
+    _maxModifiedCellCoords = cellCoords;
+    
+    const Voxel oldValue = get(cellCoords);
+    if (oldValue.value != newValue.value) {
+        // Light is only stored in empty voxels. Solid voxels are dark, and
+        // cannot hold emitters.
+        const unsigned oldSunLight = oldValue.value ? 0 : oldValue.sunLight;
+        const unsigned oldTorchLight = oldValue.value ? 0 : oldValue.torchLight;
+        if (newValue.value && getEmittedLight(cellCoords) > 0) {
+            setEmitter(cellCoords, 0);
+        }
+        set(cellCoords, Voxel(newValue.value, 0, 0));
+        relight(cellCoords, Sunlight, oldSunLight);
+        relight(cellCoords, Torchlight, oldTorchLight);
+    }
+    
+    const AABB minCell = _voxelIndexer.cellAtCellCoords(_minModifiedCellCoords);
+    const AABB maxCell = _voxelIndexer.cellAtCellCoords(_maxModifiedCellCoords);
+    return minCell.unionBox(maxCell);
+}
+
+AABB IncrementalLightPropagation::editEmitters(const std::vector<EmitterEdit> &edits)
+{
+    if (edits.empty()) {
+        return AABB{};
+    }
+    
+    _minModifiedCellCoords = _voxelIndexer.cellCoordsAtPoint(edits.front().point);
+    _maxModifiedCellCoords = _minModifiedCellCoords;
+    
+    // The light emitted into each edited voxel before the edits. A voxel may
+    // be edited more than once, and only the last edit counts.
+    // The voxels are kept in Morton order so that the flood fill starts out
+    // with neighboring sources next to each other in the queue. This makes
+    // the flood fill much friendlier to the cache.
+    std::map<Morton3, std::pair<ivec3, unsigned>> editedCells;
+    
+    for (const EmitterEdit &edit : edits) {
+        assert(edit.light <= MAX_LIGHT);
+        const ivec3 cellCoords = _voxelIndexer.cellCoordsAtPoint(edit.point);
+        if (get(cellCoords).value != 0) {
+            continue;
+        }
+        
+        const unsigned oldEmittedLight = getEmittedLight(cellCoords);
+        if (oldEmittedLight != edit.light) {
+            editedCells.emplace(Morton3(cellCoords), std::make_pair(cellCoords, oldEmittedLight));
+            setEmitter(cellCoords, edit.light);
+        }
+    }
+    
+    // When an emitter is dimmed, the voxel's light may have come from the
+    // emitter. Darken everything lit through it, and then refill from the
+    // other sources. When the voxel was brighter than the emitter, nothing
+    // depended on the emitter and there is nothing to darken.
+    std::queue<RemovalNode> removalQueue;
+    FloodQueue floodQueue;
+    for (const auto &pair : editedCells) {
+        const auto &[cellCoords, oldEmittedLight] = pair.second;
+        Voxel voxel = get(cellCoords);
+        if (getEmittedLight(cellCoords) < oldEmittedLight && voxel.torchLight == oldEmittedLight) {
+            setLight(voxel, Torchlight, 0);
+            set(cellCoords, voxel);
+            removalQueue.push(RemovalNode{cellCoords, oldEmittedLight});
+        }
+    }
+    darken(Torchlight, removalQueue, floodQueue);
+    
+    // Flood light from the emitters one chunk at a time, in Morton order.
+    // The emitters in a chunk are flooded together so that light from each
+    // is spread only as far as it beats the others. Flooding every emitter
+    // at once would do the least work of all, but each level of the flood
+    // would sweep the whole region and thrash the cache.
+    auto iter = editedCells.begin();
+    while (iter != editedCells.end()) {
+        const ivec3 chunkCellCoords = iter->second.first / _chunkSize;
+        for (; iter != editedCells.end() && iter->second.first / _chunkSize == chunkCellCoords; ++iter) {
+            const ivec3 &cellCoords = iter->second.first;
+            Voxel voxel = get(cellCoords);
+            const unsigned emittedLight = getEmittedLight(cellCoords);
+            if (emittedLight > voxel.torchLight) {
+                setLight(voxel, Torchlight, emittedLight);
+                set(cellCoords, voxel);
+                floodQueue[emittedLight].push_back(cellCoords);
+            }
+        }
+        flood(Torchlight, floodQueue);
+    }
+    flood(Torchlight, floodQueue);
+    
+    const AABB minCell = _voxelIndexer.cellAtCellCoords(_minModifiedCellCoords);
+    const AABB maxCell = _voxelIndexer.cellAtCellCoords(_maxModifiedCellCoords);
+    return minCell.unionBox(maxCell);
+}
+
+Voxel IncrementalLightPropagation::get(const ivec3 &cellCoords)
+{
+    ivec3 voxelCellCoords;
+    VoxelDataChunk *chunk = chunkForCell(cellCoords, voxelCellCoords);
+    return chunk->get(voxelCellCoords);
+}
+
+void IncrementalLightPropagation::set(const ivec3 &cellCoords, const Voxel &value)
+{
+    ivec3 voxelCellCoords;
+    VoxelDataChunk *chunk = chunkForCell(cellCoords, voxelCellCoords);
+    chunk->set(voxelCellCoords, value);
+    
+    if (chunk != _lastModifiedChunk) {
+        _modifiedChunks.insert(Morton3(cellCoords / _chunkSize));
+        _lastModifiedChunk = chunk;
+    }
+    _minModifiedCellCoords = min(_minModifiedCellCoords, cellCoords);
+    _maxModifiedCellCoords = max(_maxModifiedCellCoords, cellCoords);
+}
+
+unsigned IncrementalLightPropagation::getEmittedLight(const ivec3 &cellCoords)
+{
+    ivec3 voxelCellCoords;
+    VoxelDataChunk *chunk = chunkForCell(cellCoords, voxelCellCoords);
+    return chunk->getEmittedLight(voxelCellCoords);
+}
+
+void IncrementalLightPropagation::setEmitter(const ivec3 &cellCoords, unsigned light)
+{
+    ivec3 voxelCellCoords;
+    VoxelDataChunk *chunk = chunkForCell(cellCoords, voxelCellCoords);
+    chunk->setEmitter(voxelCellCoords, light);
+    _modifiedChunks.insert(Morton3(cellCoords / _chunkSize));
+    _lastModifiedChunk = chunk;
+}
+
+VoxelDataChunk* IncrementalLightPropagation::chunkForCell(const ivec3 &cellCoords,
+                                                          ivec3 &voxelCellCoords)
+{
+    // Cell coordinates are never negative so integer division rounds down.
+    const ivec3 chunkCellCoords = cellCoords / _chunkSize;
+    voxelCellCoords = cellCoords - chunkCellCoords * _chunkSize;
+    
+    // Consecutive accesses usually fall in the same chunk.
+    if (_lastChunk && chunkCellCoords == _lastChunkCellCoords) {
+        return _lastChunk;
+    }
+    
+    const Morton3 chunkIndex(chunkCellCoords);
+    auto iter = _fetchedChunks.find(chunkIndex);
+    if (iter == _fetchedChunks.end()) {
+        VoxelDataChunk *chunk = _fetchChunk(chunkCellCoords);
+        assert(chunk);
+        iter = _fetchedChunks.emplace(chunkIndex, chunk).first;
+    }
+    
+    _lastChunkCellCoords = chunkCellCoords;
+    _lastChunk = iter->second;
+    return _lastChunk;
+}
+
+void IncrementalLightPropagation::relight(const ivec3 &cellCoords,
+                                          Channel channel,
+                                          unsigned oldLight)
+{
+    std::queue<RemovalNode> removalQueue;
+    FloodQueue floodQueue;
+    
+    if (oldLight > 0) {
+        removalQueue.push(RemovalNode{cellCoords, oldLight});
+    }
+    darken(channel, removalQueue, floodQueue);
+    
+    // Light may flow into the edited voxel from any of its neighbors.
+    Voxel voxel = get(cellCoords);
+    if (voxel.value == 0) {
+        for (const ivec3 &delta : neighborDeltas) {
+            const ivec3 neighborCellCoords = cellCoords + delta;
+            if (_voxelIndexer.inbounds(neighborCellCoords)) {
+                pushFlood(channel, floodQueue, neighborCellCoords);
+            }
+        }
+        
+        // The top layer of the world is open to the sky.
+        if (channel == Sunlight && cellCoords.y == _voxelIndexer.gridResolution().y - 1) {
+            setLight(voxel, channel, MAX_LIGHT);
+            set(cellCoords, voxel);
+            floodQueue[MAX_LIGHT].push_back(cellCoords);
+        }
+    }
+    
+    flood(channel, floodQueue);
+}
+
+void IncrementalLightPropagation::darken(Channel channel,
+                                         std::queue<RemovalNode> &removalQueue,
+                                         FloodQueue &floodQueue)
+{
+    // Darken every voxel which may have received light through the removal
+    // nodes. A neighbor which is brighter than the light it could have
+    // received must have another source, and it will be used to refill the
+    // region.
+    std::vector<ivec3> darkenedEmitters;
+    
+    while (!removalQueue.empty()) {
+        const RemovalNode node = removalQueue.front();
+        removalQueue.pop();
+        
+        for (const ivec3 &delta : neighborDeltas) {
+            const ivec3 neighborCellCoords = node.cellCoords + delta;
+            if (!_voxelIndexer.inbounds(neighborCellCoords)) {
+                continue;
+            }
+            
+            Voxel neighbor = get(neighborCellCoords);
+            const unsigned neighborLight = getLight(neighbor, channel);
+            if (neighbor.value != 0 || neighborLight == 0) {
+                continue;
+            }
+            
+            if (flowsToward(channel, delta) &&
+                neighborLight <= lightReceived(channel, delta, node.light)) {
+                setLight(neighbor, channel, 0);
+                set(neighborCellCoords, neighbor);
+                removalQueue.push(RemovalNode{neighborCellCoords, neighborLight});
+                if (channel == Torchlight && getEmittedLight(neighborCellCoords) > 0) {
+                    darkenedEmitters.push_back(neighborCellCoords);
+                }
+            } else {
+                floodQueue[neighborLight].push_back(neighborCellCoords);
+            }
+        }
+    }
+    
+    // Emitters are relit only once the removal is finished. Otherwise, the
+    // removal may pass through them again.
+    for (const ivec3 &cellCoords : darkenedEmitters) {
+        Voxel voxel = get(cellCoords);
+        const unsigned emittedLight = getEmittedLight(cellCoords);
+        if (emittedLight > voxel.torchLight) {
+            setLight(voxel, Torchlight, emittedLight);
+            set(cellCoords, voxel);
+            floodQueue[emittedLight].push_back(cellCoords);
+        }
+    }
+}
+
+void IncrementalLightPropagation::flood(Channel channel, FloodQueue &queue)
+{
+    // Expand the brightest voxels first. Light only ever dims as it flows, so
+    // a voxel has its final light by the time its bucket is reached, and it
+    // is expanded only once. Sunlight may fall without dimming, so a bucket
+    // may grow while it is being expanded.
+    for (unsigned level = MAX_LIGHT; level > 0; --level) {
+        std::vector<ivec3> &bucket = queue[level];
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            const ivec3 cellCoords = bucket[i];
+        
+            // Skip cells which have been brightened since they were queued.
+            // They are also queued in a brighter bucket.
+            const Voxel voxel = get(cellCoords);
+            if (voxel.value != 0 || getLight(voxel, channel) != level) {
+                continue;
+            }
+            
+            for (const ivec3 &delta : neighborDeltas) {
+                if (!flowsToward(channel, delta)) {
+                    continue;
+                }
+            
+                const ivec3 neighborCellCoords = cellCoords + delta;
+                if (!_voxelIndexer.inbounds(neighborCellCoords)) {
+                    continue;
+                }
+                
+                Voxel neighbor = get(neighborCellCoords);
+                const unsigned received = lightReceived(channel, delta, level);
+                if (neighbor.value == 0 && received > getLight(neighbor, channel)) {
+                    setLight(neighbor, channel, received);
+                    set(neighborCellCoords, neighbor);
+                    queue[received].push_back(neighborCellCoords);
+                }
+            }
+        }
+        bucket.clear();
+    }
+}
+
+void IncrementalLightPropagation::pushFlood(Channel channel,
+                                            FloodQueue &queue,
+                                            const ivec3 &cellCoords)
+{
+    const Voxel voxel = get(cellCoords);
+    const unsigned light = getLight(voxel, channel);
+    if (voxel.value == 0 && light > 0) {
+        queue[light].push_back(cellCoords);
+    }
+}
+
+bool IncrementalLightPropagation::flowsToward(Channel channel, const ivec3 &delta)
+{
+    return (channel == Torchlight) || (delta.y <= 0);
+}
+
+unsigned IncrementalLightPropagation::lightReceived(Channel channel,
+                                                    const ivec3 &delta,
+                                                    unsigned light)
+{
+    if (channel == Sunlight && delta.y < 0 && light == MAX_LIGHT) {
+        return MAX_LIGHT;
+    }
+    return (light > 0) ? (light - 1) : 0;
+}
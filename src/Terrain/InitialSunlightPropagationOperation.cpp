@@ -10,16 +10,64 @@
 #include "Terrain/TerrainConfig.hpp"
 #include "Grid/GridIndexerRange.hpp"
 
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using namespace glm;
 
+static inline unsigned popcount(uint32_t bits)
+{
+#if defined(_MSC_VER)
+    return __popcnt(bits);
+#else
+    return __builtin_popcount(bits);
+#endif
+}
+
+// Returns the index of the lowest set bit. The bits must not be zero.
+static inline int lowestSetBit(uint32_t bits)
+{
+    assert(bits != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
 InitialSunlightPropagationOperation::InitialSunlightPropagationOperation(std::shared_ptr<spdlog::logger> log,
                                                                          PersistentVoxelChunks &persistentVoxelChunks,
-                                                                         const std::shared_ptr<TaskDispatcher> &dispatcher)
+                                                                         const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                                                         PropagationMode mode,
+                                                                         PropagationKernel kernel)
  : _log(log),
    _chunks(persistentVoxelChunks),
-   _dispatcher(dispatcher)
+   _dispatcher(dispatcher),
+   _mode(mode),
+   _kernel(kernel),
+   _numberOfNodesVisited(0),
+   _numberOfChunksStored(0),
+   _numberOfVoxelsInShafts(0)
 {}
 
+InitialSunlightPropagationOperation::Statistics
+InitialSunlightPropagationOperation::getStatistics() const
+{
+    Statistics statistics;
+    statistics.numberOfChunksFetched = _chunks.getNumberOfFetches();
+    statistics.numberOfNodesVisited = _numberOfNodesVisited;
+    statistics.numberOfChunksStored = _numberOfChunksStored;
+    statistics.numberOfVoxelsInShafts = _numberOfVoxelsInShafts;
+    return statistics;
+}
+
 void InitialSunlightPropagationOperation::performInitialSunlightPropagationIfNecessary(const AABB &region)
 {
     const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
@@ -46,39 +94,35 @@ void InitialSunlightPropagationOperation::performInitialSunlightPropagationIfNec
         }
     });
     
-    // Fetch missing chunks.
-    auto futuresFetchChunks = _dispatcher->map(missingChunks, [&, this](const Morton3 &chunkIndex){
-        (void)_chunks.get(chunkIndex.decode());
-    });
-    waitForAll(futuresFetchChunks);
+    // Fetch missing chunks. The calling thread helps with the fetch instead of
+    // blocking while it waits for the dispatcher to get around to it.
+    const std::vector<Morton3> chunksToFetch(missingChunks.begin(), missingChunks.end());
+    _dispatcher->parallelFor(0, chunksToFetch.size(), [&, this](size_t i){
+        (void)_chunks.get(chunksToFetch[i].decode());
+    }, 1);
     
-    // For each column, propagate sunlight if the columns is incomplete.
-    // TODO: We can improve on this by seeding all columns at once and running through the BFS queue one time.
-    bool modifiedAnyChunk = false;
-    auto processColumn = [&](ivec3 chunkCoords){
-        // Have all chunks in the column already undergone initial propagation?
-        bool columnIsComplete = true;
+    // Have all chunks in the column already undergone initial propagation?
+    auto isColumnComplete = [&](ivec3 chunkCoords){
         for (chunkCoords.y = 0; chunkCoords.y < res.y; ++chunkCoords.y) {
             const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(chunkCoords);
             VoxelDataChunk *chunkPtr = _chunks.get(chunkIndex);
             assert(chunkPtr);
             if (!chunkPtr->complete) {
-                columnIsComplete = false;
-                break;
+                return false;
             }
         }
+        return true;
+    };
         
-        if (!columnIsComplete) {
+    // Columns which underwent propagation. These are the only columns whose
+    // chunks need to be saved, and each is listed only once.
+    std::vector<ivec3> modifiedColumns;
+    
+    // For each column, propagate sunlight if the column is incomplete.
+    auto processColumn = [&](ivec3 chunkCoords){
+        if (!isColumnComplete(chunkCoords)) {
             propagateSunlight(chunkCoords);
-            modifiedAnyChunk = true;
-            
-            // Note that we'll want to save these changes back to disk later.
-            for (chunkCoords.y = 0; chunkCoords.y < res.y; ++chunkCoords.y) {
-                const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(chunkCoords);
-                VoxelDataChunk *chunkPtr = _chunks.get(chunkIndex);
-                assert(chunkPtr);
-                chunkPtr->complete = true;
-            }
+            modifiedColumns.push_back(chunkCoords);
         }
     };
     
@@ -109,18 +153,32 @@ void InitialSunlightPropagationOperation::performInitialSunlightPropagationIfNec
     if (useFastPath) {
         const ivec3 chunkCoords = chunkIndexer.cellCoordsAtPoint(region.center);
         processColumn(chunkCoords);
+    } else if (_mode == Batched || _mode == Parallel) {
+        iterateColumns([&](ivec3 chunkCoords){
+            if (!isColumnComplete(chunkCoords)) {
+                modifiedColumns.push_back(chunkCoords);
+            }
+        });
+        if (!modifiedColumns.empty() && _mode == Parallel) {
+            propagateSunlightInParallel(modifiedColumns, minChunkCoords, maxChunkCoords);
+        } else if (!modifiedColumns.empty()) {
+            propagateSunlight(modifiedColumns, minChunkCoords, maxChunkCoords);
+        }
     } else {
         iterateColumns(processColumn);
     }
     
-    // Kick off background tasks to save changes to disk.
-    if (modifiedAnyChunk) {
-        iterateColumns([&](ivec3 chunkCoords){
-            for (chunkCoords.y = 0; chunkCoords.y < res.y; ++chunkCoords.y) {
-                const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(chunkCoords);
-                _chunks.store(chunkIndex, _dispatcher);
-            }
-        });
+    // Mark the columns as complete and queue the changes to be saved to disk
+    // in the background.
+    for (ivec3 chunkCoords : modifiedColumns) {
+        for (chunkCoords.y = 0; chunkCoords.y < res.y; ++chunkCoords.y) {
+            const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(chunkCoords);
+            VoxelDataChunk *chunkPtr = _chunks.get(chunkIndex);
+            assert(chunkPtr);
+            chunkPtr->complete = true;
+            _chunks.store(chunkIndex);
+            _numberOfChunksStored++;
+        }
     }
 }
 
@@ -173,6 +231,137 @@ void InitialSunlightPropagationOperation::propagateSunlight(const ivec3 &targetC
                              sunlightQueue);
     }
     
+    floodSunlightFromSeeds(sunlightQueue);
+}
+
+void InitialSunlightPropagationOperation::propagateSunlight(const std::vector<ivec3> &targetColumns,
+                                                            const ivec3 &minColumnCoords,
+                                                            const ivec3 &maxColumnCoords)
+{
+    std::queue<LightNode> sunlightQueue;
+    
+    constexpr int b = TERRAIN_CHUNK_SIZE;
+    constexpr int a = MAX_LIGHT;
+    
+    // Seed each column within one step of a target column. Columns are
+    // tracked on a grid which covers the region plus a border of one column.
+    const ivec3 origin = minColumnCoords - ivec3(1, 0, 1);
+    const int width = maxColumnCoords.x - minColumnCoords.x + 2;
+    const int depth = maxColumnCoords.z - minColumnCoords.z + 2;
+    std::vector<bool> seeded(width * depth, false);
+    
+    for (const ivec3 &targetColumnCoords : targetColumns) {
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const ivec3 columnCoords(targetColumnCoords.x + dx, 0, targetColumnCoords.z + dz);
+                const ivec3 local = columnCoords - origin;
+                const size_t i = local.x + local.z * width;
+                if (seeded[i]) {
+                    continue;
+                }
+                seeded[i] = true;
+                
+                // Columns within the region are seeded entirely. The flood
+                // fill may reach into the border columns, but no further.
+                // So, border columns are only seeded in the band of voxels
+                // close enough to the region for light to reach it.
+                ivec3 minSeedCorner(0, 0, 0), maxSeedCorner(b, 0, b);
+                if (columnCoords.x < minColumnCoords.x) {
+                    minSeedCorner.x = b - a;
+                } else if (columnCoords.x >= maxColumnCoords.x) {
+                    maxSeedCorner.x = a;
+                }
+                if (columnCoords.z < minColumnCoords.z) {
+                    minSeedCorner.z = b - a;
+                } else if (columnCoords.z >= maxColumnCoords.z) {
+                    maxSeedCorner.z = a;
+                }
+                
+                seedSunlightInColumn(columnCoords,
+                                     minSeedCorner,
+                                     maxSeedCorner,
+                                     sunlightQueue);
+            }
+        }
+    }
+    
+    floodSunlightFromSeeds(sunlightQueue);
+}
+
+void InitialSunlightPropagationOperation::propagateSunlightInParallel(const std::vector<ivec3> &targetColumns,
+                                                                      const ivec3 &minColumnCoords,
+                                                                      const ivec3 &maxColumnCoords)
+{
+    constexpr int groupSize = 3;
+    constexpr int numberOfColors = 4;
+    
+    struct Group
+    {
+        ivec3 minColumnCoords, maxColumnCoords;
+        std::vector<ivec3> targetColumns;
+    };
+    
+    const int width = (maxColumnCoords.x - minColumnCoords.x + groupSize - 1) / groupSize;
+    const int depth = (maxColumnCoords.z - minColumnCoords.z + groupSize - 1) / groupSize;
+    std::vector<Group> groups(width * depth);
+    
+    for (int groupZ = 0; groupZ < depth; ++groupZ) {
+        for (int groupX = 0; groupX < width; ++groupX) {
+            Group &group = groups[groupX + groupZ * width];
+            group.minColumnCoords = minColumnCoords + ivec3(groupX, 0, groupZ) * groupSize;
+            group.maxColumnCoords = min(group.minColumnCoords + ivec3(groupSize, 0, groupSize), maxColumnCoords);
+        }
+    }
+    
+    for (const ivec3 &columnCoords : targetColumns) {
+        const ivec3 groupCoords = (columnCoords - minColumnCoords) / groupSize;
+        groups[groupCoords.x + groupCoords.z * width].targetColumns.push_back(columnCoords);
+    }
+    
+    std::array<std::vector<const Group *>, numberOfColors> groupsOfColor;
+    for (int groupZ = 0; groupZ < depth; ++groupZ) {
+        for (int groupX = 0; groupX < width; ++groupX) {
+            const Group &group = groups[groupX + groupZ * width];
+            const int groupColor = (groupX & 1) | ((groupZ & 1) << 1);
+            if (!group.targetColumns.empty()) {
+                groupsOfColor[groupColor].push_back(&group);
+            }
+        }
+    }
+    
+    // Grouping seeds border columns again, which is only worth it when
+    // groups actually run concurrently.
+    const bool anyConcurrentGroups = std::any_of(groupsOfColor.begin(), groupsOfColor.end(), [](const auto &groupsOfOneColor){
+        return groupsOfOneColor.size() > 1;
+    });
+    if (_dispatcher->getNumberOfThreads() <= 1 || !anyConcurrentGroups) {
+        propagateSunlight(targetColumns, minColumnCoords, maxColumnCoords);
+        return;
+    }
+    
+    for (const auto &groupsOfOneColor : groupsOfColor) {
+        _dispatcher->parallelFor(0, groupsOfOneColor.size(), [&](size_t i){
+            const Group &group = *groupsOfOneColor[i];
+            propagateSunlight(group.targetColumns,
+                              group.minColumnCoords,
+                              group.maxColumnCoords);
+        }, 1);
+    }
+}
+
+void InitialSunlightPropagationOperation::floodSunlightFromSeeds(std::queue<LightNode> &sunlightQueue)
+{
+    if (_kernel == Shafts) {
+        floodSunlightInShafts(sunlightQueue);
+    } else {
+        floodSunlight(sunlightQueue);
+    }
+}
+
+void InitialSunlightPropagationOperation::floodSunlight(std::queue<LightNode> &sunlightQueue)
+{
+    size_t numberOfNodesVisited = 0;
+    
     // Perform the flood fill using a breadth-first iteration of voxels.
     while (!sunlightQueue.empty()) {
         const LightNode &node = sunlightQueue.front();
@@ -180,6 +369,7 @@ void InitialSunlightPropagationOperation::propagateSunlight(const ivec3 &targetC
         const ivec3 chunkCoords = node.chunkCellCoords;
         const ivec3 voxelCoords = node.voxelCellCoords;
         sunlightQueue.pop();
+        numberOfNodesVisited++;
         
         floodNeighbor(chunk, chunkCoords, voxelCoords, ivec3(-1,  0,  0), sunlightQueue, false);
         floodNeighbor(chunk, chunkCoords, voxelCoords, ivec3(+1,  0,  0), sunlightQueue, false);
@@ -187,6 +377,243 @@ void InitialSunlightPropagationOperation::propagateSunlight(const ivec3 &targetC
         floodNeighbor(chunk, chunkCoords, voxelCoords, ivec3( 0,  0, +1), sunlightQueue, false);
         floodNeighbor(chunk, chunkCoords, voxelCoords, ivec3( 0, -1,  0), sunlightQueue, true);
     }
+    
+    _numberOfNodesVisited += numberOfNodesVisited;
+}
+
+void InitialSunlightPropagationOperation::floodSunlightInShafts(std::queue<LightNode> &sunlightQueue)
+{
+    // The flood fill lights every voxel straight below a voxel of full
+    // sunlight, down to the first solid voxel, and each of those voxels
+    // spreads full sunlight further down in turn. So, the seeds grow into
+    // vertical shafts of full sunlight. These are filled here in bulk. The
+    // flood fill settles on the same light no matter which order it visits
+    // voxels, so afterward it only needs to spread light sideways out of the
+    // shafts.
+    
+    // Chunks are visited from the top of the world down. This ensures all the
+    // light which enters a chunk from above has been gathered before the
+    // chunk is filled.
+    auto higherChunksFirst = [](const ivec3 &a, const ivec3 &b){
+        return std::make_tuple(-a.y, a.x, a.z) < std::make_tuple(-b.y, b.x, b.z);
+    };
+    std::map<ivec3, std::pair<VoxelDataChunk *, LayerRows>, decltype(higherChunksFirst)> entering(higherChunksFirst);
+    
+    while (!sunlightQueue.empty()) {
+        const LightNode &node = sunlightQueue.front();
+        assert(node.voxelCellCoords.y == (int)TERRAIN_CHUNK_SIZE - 1);
+        auto &pair = entering[node.chunkCellCoords];
+        pair.first = node.chunkPtr;
+        pair.second[node.voxelCellCoords.z] |= 1u << node.voxelCellCoords.x;
+        sunlightQueue.pop();
+    }
+    
+    const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
+    std::vector<ShaftFaces> faces;
+    
+    for (const auto &[chunkCellCoords, pair] : entering) {
+        faces.emplace_back();
+        const LayerRows exiting = fillShaftsInChunk(pair.first,
+                                                    chunkCellCoords,
+                                                    pair.second,
+                                                    faces.back(),
+                                                    sunlightQueue);
+        
+        uint32_t anyExiting = 0;
+        for (const uint32_t row : exiting) {
+            anyExiting |= row;
+        }
+        
+        // Shafts continue into the chunk below, unless they have reached the
+        // bottom of the world. Inserting into the map does not disturb the
+        // iteration, and the chunk below sorts after this one.
+        const ivec3 belowCellCoords = chunkCellCoords - ivec3(0, 1, 0);
+        if (anyExiting && belowCellCoords.y >= 0) {
+            auto &below = entering[belowCellCoords];
+            if (!below.first) {
+                below.first = _chunks.get(chunkIndexer.indexAtCellCoords(belowCellCoords));
+            }
+            for (size_t z = 0; z < TERRAIN_CHUNK_SIZE; ++z) {
+                below.second[z] |= exiting[z];
+            }
+        }
+    }
+    
+    for (const ShaftFaces &chunkFaces : faces) {
+        spillFromShaftFaces(chunkFaces, sunlightQueue);
+    }
+    
+    floodSunlight(sunlightQueue);
+}
+
+InitialSunlightPropagationOperation::LayerRows
+InitialSunlightPropagationOperation::fillShaftsInChunk(VoxelDataChunk *chunkPtr,
+                                                       const ivec3 &chunkCellCoords,
+                                                       const LayerRows &entering,
+                                                       ShaftFaces &faces,
+                                                       std::queue<LightNode> &sunlightQueue)
+{
+    assert(chunkPtr);
+    assert(chunkPtr->gridResolution() == ivec3(TERRAIN_CHUNK_SIZE));
+    
+    constexpr int size = TERRAIN_CHUNK_SIZE;
+    
+    faces.chunkPtr = chunkPtr;
+    faces.chunkCellCoords = chunkCellCoords;
+    
+    // Sunlight never enters a solid voxel.
+    if (chunkPtr->getType() == VoxelDataChunk::Ground) {
+        return LayerRows{};
+    }
+    
+    LayerRows lit = entering;
+    
+    auto recordFaces = [&](int y){
+        faces.minZ[y] = lit[0];
+        faces.maxZ[y] = lit[size - 1];
+        for (int z = 0; z < size; ++z) {
+            faces.minX[y] |= (lit[z] & 1u) << z;
+            faces.maxX[y] |= (lit[z] >> (size - 1)) << z;
+        }
+    };
+    
+    // Every voxel of a sky chunk is empty and already has full sunlight. The
+    // shafts pass straight through, and there is nowhere within the chunk for
+    // light to spill into.
+    if (chunkPtr->getType() == VoxelDataChunk::Sky) {
+        size_t numberOfVoxelsInShafts = 0;
+        for (int y = 0; y < size; ++y) {
+            recordFaces(y);
+        }
+        for (const uint32_t row : lit) {
+            numberOfVoxelsInShafts += popcount(row) * size;
+        }
+        _numberOfVoxelsInShafts += numberOfVoxelsInShafts;
+        return lit;
+    }
+    
+    // The voxels of the current layer, indexed by Z and then by X.
+    std::array<std::array<Voxel, size>, size> layer;
+    size_t numberOfVoxelsInShafts = 0;
+    
+    for (int y = size - 1; y >= 0; --y) {
+        // Read the layer and find its solid voxels.
+        LayerRows solid{};
+        for (int z = 0; z < size; ++z) {
+            for (int x = 0; x < size; ++x) {
+                const Voxel voxel = chunkPtr->get(ivec3(x, y, z));
+                layer[z][x] = voxel;
+                solid[z] |= (uint32_t)voxel.value << x;
+            }
+        }
+        
+        // Full sunlight falls straight down until it reaches a solid voxel.
+        uint32_t anyLit = 0;
+        for (int z = 0; z < size; ++z) {
+            lit[z] &= ~solid[z];
+            anyLit |= lit[z];
+        }
+        if (!anyLit) {
+            break;
+        }
+        
+        for (int z = 0; z < size; ++z) {
+            for (uint32_t bits = lit[z]; bits; bits &= bits - 1) {
+                const int x = lowestSetBit(bits);
+                Voxel &voxel = layer[z][x];
+                if (voxel.sunLight != MAX_LIGHT) {
+                    voxel.sunLight = MAX_LIGHT;
+                    chunkPtr->set(ivec3(x, y, z), voxel);
+                }
+            }
+            numberOfVoxelsInShafts += popcount(lit[z]);
+        }
+        
+        // Light spills sideways out of the shafts into empty voxels which are
+        // not in a shaft themselves. This follows the same rule as
+        // floodNeighbor().
+        for (int z = 0; z < size; ++z) {
+            uint32_t spill = (lit[z] << 1) | (lit[z] >> 1);
+            if (z > 0) {
+                spill |= lit[z - 1];
+            }
+            if (z < size - 1) {
+                spill |= lit[z + 1];
+            }
+            spill &= ~(lit[z] | solid[z]);
+            
+            for (; spill; spill &= spill - 1) {
+                const int x = lowestSetBit(spill);
+                Voxel &voxel = layer[z][x];
+                if ((voxel.sunLight + 2) <= MAX_LIGHT) {
+                    voxel.sunLight = MAX_LIGHT - 1;
+                    const ivec3 voxelCellCoords(x, y, z);
+                    chunkPtr->set(voxelCellCoords, voxel);
+                    sunlightQueue.emplace(LightNode(chunkPtr,
+                                                    chunkCellCoords,
+                                                    voxelCellCoords));
+                }
+            }
+        }
+        
+        recordFaces(y);
+    }
+    
+    _numberOfVoxelsInShafts += numberOfVoxelsInShafts;
+    return lit;
+}
+
+void InitialSunlightPropagationOperation::spillFromShaftFaces(const ShaftFaces &faces,
+                                                              std::queue<LightNode> &sunlightQueue)
+{
+    constexpr int size = TERRAIN_CHUNK_SIZE;
+    const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
+    
+    struct Side
+    {
+        ivec3 delta;
+        const LayerRows &rows;
+        bool alongZ;
+        int fixed;
+    };
+    const std::array<Side, 4> sides = {{
+        {ivec3(-1, 0,  0), faces.minX, true,  0},
+        {ivec3(+1, 0,  0), faces.maxX, true,  size - 1},
+        {ivec3( 0, 0, -1), faces.minZ, false, 0},
+        {ivec3( 0, 0, +1), faces.maxZ, false, size - 1},
+    }};
+    
+    for (const Side &side : sides) {
+        uint32_t anyLit = 0;
+        for (const uint32_t row : side.rows) {
+            anyLit |= row;
+        }
+        if (!anyLit) {
+            continue;
+        }
+        
+        // Sky chunks already have full sunlight everywhere, and ground chunks
+        // are solid, so light can only spill into a chunk of mixed voxels.
+        const ivec3 neighborChunkCellCoords = faces.chunkCellCoords + side.delta;
+        if (!chunkIndexer.inbounds(neighborChunkCellCoords)) {
+            continue;
+        }
+        const Morton3 neighborIndex = chunkIndexer.indexAtCellCoords(neighborChunkCellCoords);
+        const auto neighborType = _chunks.get(neighborIndex)->getType();
+        if (neighborType == VoxelDataChunk::Sky || neighborType == VoxelDataChunk::Ground) {
+            continue;
+        }
+        
+        for (int y = 0; y < size; ++y) {
+            for (uint32_t bits = side.rows[y]; bits; bits &= bits - 1) {
+                const int i = lowestSetBit(bits);
+                const ivec3 voxelCellCoords = side.alongZ ? ivec3(side.fixed, y, i) : ivec3(i, y, side.fixed);
+                floodNeighbor(faces.chunkPtr, faces.chunkCellCoords,
+                              voxelCellCoords, side.delta,
+                              sunlightQueue, false);
+            }
+        }
+    }
 }
 
 void InitialSunlightPropagationOperation::seedSunlightInColumn(const ivec3 &columnCoords,
@@ -141,10 +141,12 @@ void MesherMarchingCubes::polygonizeGridCell(StaticMesh &geometry,
 }
 
 StaticMesh MesherMarchingCubes::extract(const Array3D<Voxel> &voxels,
-                                        const AABB &aabb)
+                                        const AABB &aabb,
+                                        const CancellationToken &cancellationToken)
 {
     constexpr float isosurface = 0.5f;
     StaticMesh geometry;
+    size_t count = 0;
     
     // Offset to align with the grid cells used by marching cubes.
     const AABB insetAABB = aabb.inset(LLL);
@@ -161,6 +163,10 @@ StaticMesh MesherMarchingCubes::extract(const Array3D<Voxel> &voxels,
     };
     
     for (const vec3 pos : points(voxels, insetAABB)) {
+        if (++count % CancellationCheckInterval == 0) {
+            cancellationToken.throwIfCancelled();
+        }
+        
         const vec3 vertexPositions[NUM_CUBE_VERTS] = {
             pos + posOffset[0],
             pos + posOffset[1],
@@ -396,31 +396,104 @@ void MesherNaiveSurfaceNets::emitFace(StaticMesh &geometry,
     geometry.addVertices(vertices);
 }
 
+void MesherNaiveSurfaceNets::extractBlock(StaticMesh &geometry,
+                                          const Array3D<Voxel> &voxels,
+                                          const VoxelPlanes &planes,
+                                          const ivec3 &mins,
+                                          const ivec3 &maxs,
+                                          size_t &count,
+                                          const CancellationToken &cancellationToken)
+{
+    for (int z = mins.z; z < maxs.z; ++z) {
+        for (int y = mins.y; y < maxs.y; ++y) {
+            for (int x = mins.x; x < maxs.x; ++x) {
+                if (++count % CancellationCheckInterval == 0) {
+                    cancellationToken.throwIfCancelled();
+                }
+                
+                const ivec3 cellCoords(x, y, z);
+                const Morton3 thisIndex = voxels.indexAtCellCoords(cellCoords);
+                
+                if (planes.isOccupied(thisIndex)) {
+                    continue;
+                }
+                
+                for (size_t i = 0; i < NUM_FACES; ++i) {
+                    Morton3 thatIndex(thisIndex);
+                    switch (i) {
+                        case 0: thatIndex.incZ(); break; // FRONT
+                        case 1: thatIndex.decX(); break; // LEFT
+                        case 2: thatIndex.decZ(); break; // BACK
+                        case 3: thatIndex.incX(); break; // RIGHT
+                        case 4: thatIndex.incY(); break; // TOP
+                        case 5: thatIndex.decY(); break; // BOTTOM
+                    };
+                    
+                    if (planes.isOccupied(thatIndex)) {
+                        const AABB cell = voxels.cellAtCellCoords(cellCoords);
+                        const Voxel &thisVoxel = voxels.reference(thisIndex);
+                        emitFace(geometry, thisVoxel, voxels, cell, i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Returns true if the block exists and every voxel in it is empty.
+static bool isEmptyBlock(const VoxelPlanes &planes, const ivec3 &blockCoords)
+{
+    const ivec3 blockRes = planes.getOccupancyBlockResolution();
+    return all(greaterThanEqual(blockCoords, ivec3(0))) &&
+           all(lessThan(blockCoords, blockRes)) &&
+           planes.getOccupancyBlock(blockCoords) == 0;
+}
+
+// Returns true if no voxel in the block can produce a face. Faces are only
+// produced by empty voxels which neighbor an occupied voxel. So, a block can
+// be skipped when it is solid, or when it and its six neighbors are empty.
+static bool canSkipBlock(const VoxelPlanes &planes, const ivec3 &blockCoords)
+{
+    const uint64_t occupancy = planes.getOccupancyBlock(blockCoords);
+    
+    if (occupancy == VoxelPlanes::OccupancyBlockFull) {
+        return true;
+    }
+    
+    return occupancy == 0 &&
+           isEmptyBlock(planes, blockCoords + ivec3( 1,  0,  0)) &&
+           isEmptyBlock(planes, blockCoords + ivec3(-1,  0,  0)) &&
+           isEmptyBlock(planes, blockCoords + ivec3( 0,  1,  0)) &&
+           isEmptyBlock(planes, blockCoords + ivec3( 0, -1,  0)) &&
+           isEmptyBlock(planes, blockCoords + ivec3( 0,  0,  1)) &&
+           isEmptyBlock(planes, blockCoords + ivec3( 0,  0, -1));
+}
+
 StaticMesh MesherNaiveSurfaceNets::extract(const Array3D<Voxel> &voxels,
-                                           const AABB &aabb)
+                                           const AABB &aabb,
+                                           const CancellationToken &cancellationToken)
 {
     StaticMesh geometry;
+    size_t count = 0;
     
-    for (const auto cellCoords : slice(voxels, aabb)) {
-        const AABB cell = voxels.cellAtCellCoords(cellCoords);
-        const Morton3 thisIndex = voxels.indexAtCellCoords(cellCoords);
-        const Voxel &thisVoxel = voxels.reference(thisIndex);
+    // Occupancy is much cheaper to test in the planar representation, and it
+    // lets us skip whole blocks of voxels which cannot produce any faces.
+    const VoxelPlanes planes(voxels);
+    constexpr int blockSize = VoxelPlanes::OccupancyBlockSize;
         
-        if (thisVoxel.value == 0) {
-            for (size_t i = 0; i < NUM_FACES; ++i) {
-                Morton3 thatIndex(thisIndex);
-                switch (i) {
-                    case 0: thatIndex.incZ(); break; // FRONT
-                    case 1: thatIndex.decX(); break; // LEFT
-                    case 2: thatIndex.decZ(); break; // BACK
-                    case 3: thatIndex.incX(); break; // RIGHT
-                    case 4: thatIndex.incY(); break; // TOP
-                    case 5: thatIndex.decY(); break; // BOTTOM
-                };
-                const Voxel &thatVoxel = voxels.reference(thatIndex);
-                
-                if (thatVoxel.value > 0) {
-                    emitFace(geometry, thisVoxel, voxels, cell, i);
+    const ivec3 minCellCoords = voxels.cellCoordsAtPoint(aabb.mins());
+    const ivec3 maxCellCoords = voxels.cellCoordsAtPointRoundUp(aabb.maxs());
+    const ivec3 minBlockCoords = minCellCoords / blockSize;
+    const ivec3 maxBlockCoords = (maxCellCoords + ivec3(blockSize - 1)) / blockSize;
+        
+    for (int bz = minBlockCoords.z; bz < maxBlockCoords.z; ++bz) {
+        for (int by = minBlockCoords.y; by < maxBlockCoords.y; ++by) {
+            for (int bx = minBlockCoords.x; bx < maxBlockCoords.x; ++bx) {
+                const ivec3 blockCoords(bx, by, bz);
+                if (!canSkipBlock(planes, blockCoords)) {
+                    const ivec3 mins = max(blockCoords * blockSize, minCellCoords);
+                    const ivec3 maxs = min((blockCoords + ivec3(1)) * blockSize, maxCellCoords);
+                    extractBlock(geometry, voxels, planes, mins, maxs, count, cancellationToken);
                 }
             }
         }
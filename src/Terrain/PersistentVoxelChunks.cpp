@@ -14,15 +14,26 @@ PersistentVoxelChunks::PersistentVoxelChunks(std::shared_ptr<spdlog::logger> log
                                              const glm::ivec3 gridResolution,
                                              unsigned chunkSize,
                                              std::unique_ptr<MapRegionStore> &&mapRegionStore,
-                                             std::function<std::unique_ptr<VoxelDataChunk>(const AABB &cell, Morton3 index)> factory)
+                                             std::function<std::unique_ptr<VoxelDataChunk>(const AABB &cell, Morton3 index)> factory,
+                                             std::shared_ptr<TaskDispatcher> dispatcher,
+                                             size_t memoryBudget)
  : GridIndexer(boundingBox, gridResolution),
    _log(log),
    _chunks(boundingBox, gridResolution / (int)chunkSize),
    _mapRegionStore(std::move(mapRegionStore)),
-   _factory(factory)
+   _factory(factory),
+   _dispatcher(std::move(dispatcher)),
+   _memoryBudget(memoryBudget),
+   _nextGeneration(1),
+   _residentBytes(0),
+   _dirtyBytes(0),
+   _saveActor(log, _dispatcher, [this](const Morton3 &index, const VoxelDataChunk &chunk){
+       _mapRegionStore->store(_chunks.cellAtCellCoords(index.decode()), index, chunk);
+   })
 {}
 
-Array3D<Voxel> PersistentVoxelChunks::loadSubRegion(const AABB &region)
+Array3D<Voxel> PersistentVoxelChunks::loadSubRegion(const AABB &region,
+                                                    const CancellationToken &cancellationToken)
 {
     // Adjust the region so that it includes the full extent of all voxels that
     // fall within it. For example, the region may only pass through a portion
@@ -34,20 +45,20 @@ Array3D<Voxel> PersistentVoxelChunks::loadSubRegion(const AABB &region)
     const glm::ivec3 res = countCellsInRegion(adjustedRegion);
     Array3D<Voxel> dst(adjustedRegion, res);
     
-    // Fetch all the chunks in the region.
-    for (auto cellCoords : slice(_chunks, adjustedRegion)) {
+    // Fetch all the chunks in the region. Each chunk is its own block as
+    // fetching a chunk may require generating it, which is expensive. The
+    // chunks write to disjoint parts of the destination array.
+    _dispatcher->parallelFor(sliceBlocks(_chunks, adjustedRegion, 1), [&](const glm::ivec3 &cellCoords){
+        cancellationToken.throwIfCancelled();
         const AABB chunkBoundingBox = _chunks.cellAtCellCoords(cellCoords);
         VoxelDataChunk chunk = load(chunkBoundingBox);
         
         // It is entirely possible that the sub-region is not the full size of
-        // the chunk. Iterate over chunk voxels that fall within the region.
-        // Copy each of those voxels into the destination array.
+        // the chunk. Copy the chunk voxels that fall within the region into
+        // the destination array.
         const AABB subRegion = chunk.boundingBox().intersect(adjustedRegion);
-        for (const auto voxelCoords : slice(chunk, subRegion)) {
-            const auto voxelCenter = chunk.cellCenterAtCellCoords(voxelCoords);
-            dst.mutableReference(voxelCenter) = chunk.get(voxelCoords);
-        }
-    }
+        chunk.copyCellsTo(dst, subRegion);
+    });
     
     return dst;
 }
@@ -102,32 +113,55 @@ void PersistentVoxelChunks::store(const VoxelDataChunk &chunkToStore)
     }
     const Morton3 chunkIndex = _chunks.indexAtCellCoords(chunkCellCoords);
     
+    // Pin the chunk so it cannot be evicted, and then reloaded from file,
+    // before the save below has finished.
+    pin(chunkIndex);
     _chunks.set(chunkIndex, std::make_shared<VoxelDataChunk>(chunkToStore));
+    noteResident(chunkIndex, chunkToStore);
+    const uint64_t generation = markDirty(chunkIndex, chunkToStore);
     
     // Save the modified chunk back to disk.
-    _mapRegionStore->store(chunkBoundingBox, chunkIndex, chunkToStore);
+    _saveActor.storeNow(chunkIndex, chunkToStore);
+    
+    {
+        std::scoped_lock lock(_mutexResidency);
+        markCleanIfCurrent(_residency[chunkIndex], generation);
+    }
+    unpin(chunkIndex);
 }
 
-void PersistentVoxelChunks::store(Morton3 chunkIndex, const std::shared_ptr<TaskDispatcher> &dispatcher)
+void PersistentVoxelChunks::store(Morton3 chunkIndex)
 {
-    // AFOX_TODO: If a chunk is enqueued twice then it will be saved twice. Instead, consider adding an actor which enqueues the index, stashes the chunk object in something like a sparse grid, and then only saves the most recent version as it processes the queue.
-    glm::ivec3 chunkCellCoords;
-    chunkIndex.decode(chunkCellCoords);
     auto maybeChunk = getIfExists(chunkIndex);
     if (maybeChunk) {
         std::shared_ptr<VoxelDataChunk> chunkPtr = *maybeChunk;
         VoxelDataChunk chunk(*chunkPtr); // copy it
-        dispatcher->async([this, chunkIndex, chunkCellCoords, chunk]{
-            const AABB chunkBoundingBox = _chunks.cellAtCellCoords(chunkCellCoords);
-            _mapRegionStore->store(chunkBoundingBox, chunkIndex, chunk);
+        const uint64_t generation = markDirty(chunkIndex, chunk);
+        _saveActor.store(chunkIndex, std::move(chunk), [this, chunkIndex, generation]{
+            std::scoped_lock lock(_mutexResidency);
+            auto iter = _residency.find(chunkIndex);
+            if (iter != _residency.end()) {
+                markCleanIfCurrent(iter->second, generation);
+                eraseIfUnused(chunkIndex);
+            }
         });
     }
 }
 
+void PersistentVoxelChunks::flush()
+{
+    _saveActor.flush();
+    _log->info("Saved {} voxel chunks for {} store requests.",
+               _saveActor.getNumberOfWrites(),
+               _saveActor.getNumberOfStoreRequests());
+}
+
 std::shared_ptr<VoxelDataChunk>
 PersistentVoxelChunks::get(const AABB &cell, Morton3 index)
 {
-    return _chunks.get(index, [=]{
+    bool inserted = false;
+    std::shared_ptr<VoxelDataChunk> chunk = _chunks.getOrCreate(index, [&]{
+        inserted = true;
         auto maybeVoxels = _mapRegionStore->load(cell, index);
         if (maybeVoxels) {
             return std::make_shared<VoxelDataChunk>(*maybeVoxels);
@@ -137,6 +171,19 @@ PersistentVoxelChunks::get(const AABB &cell, Morton3 index)
             return chunkPtr;
         }
     });
+    
+    if (inserted) {
+        noteResident(index, *chunk);
+        enforceMemoryBudget();
+    } else {
+        std::scoped_lock lock(_mutexResidency);
+        auto iter = _residency.find(index);
+        if (iter != _residency.end() && iter->second.resident) {
+            _lru.reference(index);
+        }
+    }
+    
+    return chunk;
 }
 
 boost::optional<std::shared_ptr<VoxelDataChunk>>
@@ -149,3 +196,177 @@ const GridIndexer& PersistentVoxelChunks::getChunkIndexer() const
 {
     return _chunks;
 }
+
+void PersistentVoxelChunks::pin(Morton3 index)
+{
+    std::scoped_lock lock(_mutexResidency);
+    _residency[index].pinCount++;
+}
+
+void PersistentVoxelChunks::unpin(Morton3 index)
+{
+    {
+        std::scoped_lock lock(_mutexResidency);
+        Residency &residency = _residency[index];
+        assert(residency.pinCount > 0);
+        residency.pinCount--;
+        eraseIfUnused(index);
+    }
+    
+    // Chunks which were skipped while pinned may be evicted now.
+    enforceMemoryBudget();
+}
+
+size_t PersistentVoxelChunks::getResidentBytes() const
+{
+    return _residentBytes;
+}
+
+size_t PersistentVoxelChunks::getDirtyBytes() const
+{
+    return _dirtyBytes;
+}
+
+size_t PersistentVoxelChunks::getNumberOfChunkWrites() const
+{
+    return _saveActor.getNumberOfWrites();
+}
+
+void PersistentVoxelChunks::noteResident(Morton3 index, const VoxelDataChunk &chunk)
+{
+    std::scoped_lock lock(_mutexResidency);
+    Residency &residency = _residency[index];
+    residency.resident = true;
+    setResidentBytes(residency, chunk.getNumberOfResidentBytes());
+    _lru.reference(index);
+}
+
+uint64_t PersistentVoxelChunks::markDirty(Morton3 index, const VoxelDataChunk &chunk)
+{
+    std::scoped_lock lock(_mutexResidency);
+    Residency &residency = _residency[index];
+    
+    // The chunk may have changed size if it was modified in place.
+    if (residency.resident) {
+        setResidentBytes(residency, chunk.getNumberOfResidentBytes());
+    }
+    
+    if (residency.dirtyGeneration == 0) {
+        _dirtyBytes += residency.bytes;
+    }
+    residency.dirtyGeneration = _nextGeneration++;
+    return residency.dirtyGeneration;
+}
+
+void PersistentVoxelChunks::markCleanIfCurrent(Residency &residency, uint64_t generation)
+{
+    if (residency.dirtyGeneration == generation) {
+        residency.dirtyGeneration = 0;
+        _dirtyBytes -= residency.bytes;
+    }
+}
+
+void PersistentVoxelChunks::setResidentBytes(Residency &residency, size_t bytes)
+{
+    _residentBytes += bytes;
+    _residentBytes -= residency.bytes;
+    if (residency.dirtyGeneration != 0) {
+        _dirtyBytes += bytes;
+        _dirtyBytes -= residency.bytes;
+    }
+    residency.bytes = bytes;
+}
+
+void PersistentVoxelChunks::eraseIfUnused(Morton3 index)
+{
+    auto iter = _residency.find(index);
+    if (iter != _residency.end()) {
+        const Residency &residency = iter->second;
+        if (!residency.resident && residency.pinCount == 0 && residency.dirtyGeneration == 0) {
+            _residency.erase(iter);
+        }
+    }
+}
+
+void PersistentVoxelChunks::enforceMemoryBudget()
+{
+    if (_residentBytes <= _memoryBudget) {
+        return;
+    }
+    
+    std::unique_lock<std::mutex> evictionLock(_mutexEviction, std::try_to_lock);
+    if (!evictionLock) {
+        return;
+    }
+    
+    size_t numberOfChunksEvicted = 0;
+    size_t numberOfChunksSaved = 0;
+    std::vector<Morton3> skippedChunks;
+    
+    std::unique_lock<std::mutex> lock(_mutexResidency);
+    
+    while (_residentBytes > _memoryBudget) {
+        auto maybeIndex = _lru.pop();
+        if (!maybeIndex) {
+            break; // Everything which remains is pinned.
+        }
+        
+        const Morton3 index = *maybeIndex;
+        auto iter = _residency.find(index);
+        if (iter == _residency.end() || !iter->second.resident) {
+            continue;
+        }
+        
+        if (iter->second.pinCount > 0) {
+            skippedChunks.push_back(index);
+            continue;
+        }
+        
+        // Save a dirty chunk before evicting it. The lock is not held while
+        // writing to file. A chunk which is not pinned is not being modified
+        // in place, so the copy is consistent.
+        if (iter->second.dirtyGeneration != 0) {
+            const uint64_t generation = iter->second.dirtyGeneration;
+            auto maybeChunk = _chunks.get(index);
+            if (!maybeChunk) {
+                skippedChunks.push_back(index);
+                continue;
+            }
+            const VoxelDataChunk chunk(**maybeChunk); // copy it
+            
+            lock.unlock();
+            _saveActor.storeNow(index, chunk);
+            numberOfChunksSaved++;
+            lock.lock();
+            
+            // The chunk may have been pinned or modified while we were saving
+            // it. If so then it has to stay.
+            iter = _residency.find(index);
+            assert(iter != _residency.end());
+            markCleanIfCurrent(iter->second, generation);
+            if (iter->second.pinCount > 0 || iter->second.dirtyGeneration != 0) {
+                skippedChunks.push_back(index);
+                continue;
+            }
+        }
+        
+        _chunks.remove(index);
+        setResidentBytes(iter->second, 0);
+        iter->second.resident = false;
+        eraseIfUnused(index);
+        numberOfChunksEvicted++;
+    }
+    
+    for (const Morton3 index : skippedChunks) {
+        _lru.reference(index);
+    }
+    
+    const size_t residentBytes = _residentBytes;
+    const size_t dirtyBytes = _dirtyBytes;
+    lock.unlock();
+    
+    _log->trace("Evicted {} voxel chunks and saved {} of them. "\
+                "Now, {} bytes are resident and {} bytes are dirty.",
+                numberOfChunksEvicted, numberOfChunksSaved,
+                residentBytes, dirtyBytes);
+}
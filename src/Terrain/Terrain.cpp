@@ -28,18 +28,35 @@ constexpr unsigned InitialVoxelDataSeed = 52;
 // counterproductive. So, this is disabled by default.
 constexpr bool EnableFrustumCulling = false;
 
+// The mesh rebuild actor keeps this many batches in flight per worker thread.
+constexpr unsigned MeshBatchesInFlightPerThread = 2;
+
 
 Terrain::~Terrain()
 {
-    _dispatcherHighPriority->shutdown();
+    // The rebuild actor waits for batches in flight, which run on the
+    // dispatcher, so it must stop first. Tasks on the dispatcher may still
+    // reference the actor so it must not be destroyed until the dispatcher
+    // has shutdown.
+    _meshRebuildActor->shutdown();
+    _dispatcher->shutdown();
     _meshRebuildActor.reset();
-    _dispatcherVoxelData->shutdown();
+    
+    _log->info("{} of {} mesh rebuilds found their voxel chunks already resident. Prefetched {} chunk columns.",
+               _prefetcher->getNumberOfResidentRebuilds(),
+               _prefetcher->getNumberOfRebuilds(),
+               _prefetcher->getNumberOfPrefetches());
+    
+    // Any chunk saves still waiting for the dispatcher were not written when
+    // it shut down. Write them now, on this thread.
+    _voxels->flush();
 }
 
 Terrain::Terrain(const Preferences &preferences,
                  std::shared_ptr<spdlog::logger> log,
                  const std::shared_ptr<GraphicsDevice> &graphicsDevice,
                  const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher,
+                 const ThreadPoolPolicy &threadPoolPolicy,
                  entityx::EventManager &events,
                  glm::vec3 initialCameraPosition)
  : _graphicsDevice(graphicsDevice),
@@ -50,10 +67,12 @@ Terrain::Terrain(const Preferences &preferences,
    _startTime(std::chrono::steady_clock::now()),
    _drawListNeedsRebuild(false)
 {
-    const unsigned numberOfHardwareThreads = std::max(1u, std::thread::hardware_concurrency());
-    
-    _dispatcherHighPriority = std::make_shared<TaskDispatcher>("Terrain High Priority TaskDispatcher", 1);
-    _dispatcherVoxelData = std::make_shared<TaskDispatcher>("Voxel Data TaskDispatcher", numberOfHardwareThreads);
+    // No terrain task blocks a worker while waiting for a region lock, so a
+    // single worker makes progress. The process-wide policy decides how many.
+    _dispatcher = std::make_shared<TaskDispatcher>("Terrain TaskDispatcher",
+                                                   threadPoolPolicy.getNumberOfThreads("terrain"),
+                                                   TaskDispatcher::WorkStealing,
+                                                   threadPoolPolicy.getWorkerStartHook("terrain"));
     
     // Load terrain texture array from a single image.
     TextureArrayLoader textureArrayLoader(graphicsDevice);
@@ -108,10 +127,18 @@ Terrain::Terrain(const Preferences &preferences,
         mustRegenerateMap = true;
     }
     
-    _voxels = createVoxelData(_dispatcherVoxelData,
+    _voxels = createVoxelData(_dispatcher,
                               _journal->getVoxelDataSeed(),
                               mapDirectory);
     
+    // Fault in voxel chunks ahead of the camera so that meshes at the horizon
+    // do not have to wait for voxel generation.
+    _prefetcher = std::make_shared<TerrainPrefetcher>(_log,
+                                                      _voxels,
+                                                      _dispatcher,
+                                                      _activeRegionSize,
+                                                      preferences.prefetchLookahead);
+    
     const AABB meshGridBoundingBox = _voxels->boundingBox().inset(glm::vec3((float)TERRAIN_CHUNK_SIZE, (float)TERRAIN_CHUNK_SIZE, (float)TERRAIN_CHUNK_SIZE));
     const glm::ivec3 meshGridResolution = _voxels->countCellsInRegion(meshGridBoundingBox) / (int)TERRAIN_CHUNK_SIZE;
     
@@ -123,15 +150,18 @@ Terrain::Terrain(const Preferences &preferences,
     const unsigned workingSetCount = std::pow(1 + 2*_activeRegionSize / TERRAIN_CHUNK_SIZE, 3);
     _meshes->setCountLimit(2*workingSetCount);
     
-    // Setup an actor to rebuild chunks.
+    // Setup an actor to rebuild chunks. Batches in flight do not occupy a
+    // thread while they wait on locks, so allow a few more batches than there
+    // are threads. This keeps the workers busy without letting the actor
+    // commit to batches far from the camera.
     _meshRebuildActor = std::make_unique<TerrainRebuildActor>(_log,
-                                                              numberOfHardwareThreads,
+                                                              MeshBatchesInFlightPerThread * _dispatcher->getNumberOfThreads(),
                                                               _cameraPosition,
                                                               mainThreadDispatcher,
                                                               events,
                                                               _startTime,
                                                               [=](const TerrainRebuildActor::Batch &batch){
-                                                                  rebuildNextMeshBatch(batch);
+                                                                  return rebuildNextMeshBatch(batch);
                                                               });
     
     // When voxels change, we need to extract a polygonal mesh representation
@@ -169,8 +199,9 @@ void Terrain::setTerrainUniforms(const TerrainUniforms &uniforms)
     // Extract the camera position from the camera transform.
     const glm::vec3 cameraPos = glm::vec3(glm::inverse(uniforms.view)[3]);
     _cameraPosition = cameraPos;
-    _dispatcherHighPriority->async([this]{
-        _meshRebuildActor->setSearchPoint(_cameraPosition);
+    _prefetcher->update(cameraPos, std::chrono::steady_clock::now());
+    _dispatcher->async(TaskDispatcher::HighPriority, [this]{
+        _meshRebuildActor->setSearchPoint(_cameraPosition, getActiveRegion());
     });
     
     // We'll use the MVP later to extract the camera frustum.
@@ -231,16 +262,19 @@ float Terrain::getFogDensity() const
     return fogDensity;
 }
 
-void Terrain::readerTransaction(const AABB &region, std::function<void(Array3D<Voxel> &&data)> fn)
+Future<std::vector<Array3D<Voxel>>> Terrain::asyncReaderTransaction(const AABB &region,
+                                                                    TaskDispatcher::Priority priority,
+                                                                    const CancellationToken &cancellationToken)
 {
-    _voxels->readerTransaction(region, fn);
+    return _voxels->asyncReaderTransaction(_dispatcher, priority, {region}, cancellationToken);
 }
 
-void Terrain::writerTransaction(const std::shared_ptr<TerrainOperation> &operation)
+Future<void> Terrain::asyncWriterTransaction(const std::shared_ptr<TerrainOperation> &operation,
+                                             TaskDispatcher::Priority priority)
 {
     assert(operation);
     _journal->add(operation);
-    _voxels->writerTransaction(*operation);
+    return _voxels->asyncWriterTransaction(_dispatcher, priority, operation);
 }
 
 void Terrain::rebuildMeshInResponseToChanges(const AABB &voxelAffectedRegion)
@@ -268,7 +302,7 @@ void Terrain::rebuildMeshInResponseToChanges(const AABB &voxelAffectedRegion)
     _meshRebuildActor->push(meshCellsToRebuild);
 }
 
-void Terrain::rebuildNextMeshBatch(const TerrainRebuildActor::Batch &batch)
+Future<void> Terrain::rebuildNextMeshBatch(const TerrainRebuildActor::Batch &batch)
 {
     PROFILER(TerrainRebuildNextMesh);
     
@@ -284,17 +318,30 @@ void Terrain::rebuildNextMeshBatch(const TerrainRebuildActor::Batch &batch)
         // perform surface extraction.
         const AABB voxelBox = cell.box.inset(-2.f * _voxels->cellDimensions());
         
+        // Keep track of how often the voxels are already resident. This
+        // measures how well the prefetcher keeps ahead of the camera.
+        _prefetcher->noteRebuild(_voxels->isResident(voxelBox));
+        
         voxelBoxes.push_back(voxelBox);
     }
     
-    _voxels->readerTransaction(voxelBoxes, [&](size_t index, Array3D<Voxel> &&voxels){
-        const TerrainRebuildActor::Cell &cell = requestedCells.at(index);
-        auto terrainMesh = std::make_shared<TerrainMesh>(cell.box, _defaultMesh, _graphicsDevice, _mesher);
-        terrainMesh->rebuild(voxels, cell.progress);
-        _meshes->set(cell.box.center, terrainMesh);
+    // The rebuild actor cancels the batch if it leaves the active region. In
+    // that case, the future throws CancelledException and the actor cleans
+    // up. The batch outlives the future so it is safe to refer to its cells.
+    // Meshes are extracted from copies of the voxels in a continuation, so
+    // the lock on the region is not held while they are built.
+    const CancellationToken &cancellationToken = batch.cancellationToken();
+    auto transaction = _voxels->asyncReaderTransaction(_dispatcher, _dispatcher->getDefaultPriority(), voxelBoxes, cancellationToken);
+    
+    return transaction.then([=, &requestedCells](std::vector<Array3D<Voxel>> &&voxels){
+        _dispatcher->parallelFor(0, voxels.size(), [&](size_t index){
+            const TerrainRebuildActor::Cell &cell = requestedCells.at(index);
+            auto terrainMesh = std::make_shared<TerrainMesh>(cell.box, _defaultMesh, _graphicsDevice, _mesher);
+            terrainMesh->rebuild(voxels[index], cell.progress, cancellationToken);
+            _meshes->set(cell.box.center, terrainMesh);
+        }, 1);
+        requestDrawListRebuild();
     });
-    
-    requestDrawListRebuild();
 }
 
 std::unique_ptr<TransactedVoxelData>
@@ -303,7 +350,7 @@ Terrain::createVoxelData(const std::shared_ptr<TaskDispatcher> &dispatcherVoxelD
                          const boost::filesystem::path &mapDirectory)
 {
     // First, we need a voxel data generator to create terrain from noise.
-    auto generator = std::make_unique<VoxelDataGenerator>(voxelDataSeed);
+    auto generator = std::make_unique<VoxelDataGenerator>(voxelDataSeed, dispatcherVoxelData);
     
     // Next, setup a map file on disk to record the shape of the terrain.
     const auto mapRegionBox = generator->boundingBox();
@@ -338,7 +385,7 @@ void Terrain::requestDrawListRebuild()
     std::scoped_lock lock(_lockDrawListNeedsRebuild);
     if (!_drawListNeedsRebuild) {
         _drawListNeedsRebuild = true;
-        _dispatcherHighPriority->async(rebuildIfNecessary);
+        _dispatcher->async(TaskDispatcher::HighPriority, rebuildIfNecessary);
     }
 }
 
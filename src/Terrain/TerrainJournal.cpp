@@ -11,6 +11,7 @@
 // Must include all types of terrain operations here in order for serialization
 // to work correctly.
 #include "Terrain/TerrainOperationEditPoint.hpp"
+#include "Terrain/TerrainOperationEditLight.hpp"
 
 #include <cereal/types/vector.hpp>
 #include <cereal/archives/xml.hpp>
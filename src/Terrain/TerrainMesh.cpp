@@ -57,13 +57,15 @@ RenderableStaticMesh TerrainMesh::getMesh() const
     return _mesh;
 }
 
-void TerrainMesh::rebuild(const Array3D<Voxel> &voxels, TerrainProgressTracker &progress)
+void TerrainMesh::rebuild(const Array3D<Voxel> &voxels,
+                          TerrainProgressTracker &progress,
+                          const CancellationToken &cancellationToken)
 {
     std::scoped_lock lock(_lockMeshInFlight);
     
     progress.setState(TerrainProgressEvent::ExtractingSurface);
     
-    StaticMesh mesh = _mesher->extract(voxels, _meshBox);
+    StaticMesh mesh = _mesher->extract(voxels, _meshBox, cancellationToken);
     
     std::shared_ptr<Buffer> vertexBuffer = nullptr;
     
@@ -0,0 +1,19 @@
+//
+//  TerrainOperationEditLight.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/TerrainOperationEditLight.hpp"
+#include "Terrain/VoxelData.hpp"
+
+TerrainOperationEditLight::TerrainOperationEditLight(glm::vec3 location,
+                                                     unsigned light)
+ : TerrainOperation({location, glm::vec3(0.1f)}), // The operation affects a single voxel at the specified point in space.
+   _location(location),
+   _light(light)
+{}
+
+AABB TerrainOperationEditLight::perform(VoxelData &voxelData)
+{
+    return voxelData.editLightEmitter(_location, _light);
+}
@@ -16,7 +16,7 @@ TerrainOperationEditPoint::TerrainOperationEditPoint(glm::vec3 location,
    _newValue(newValue)
 {}
 
-void TerrainOperationEditPoint::perform(VoxelData &voxelData)
+AABB TerrainOperationEditPoint::perform(VoxelData &voxelData)
 {
-    voxelData.editSingleVoxel(_location, _newValue);
+    return voxelData.editSingleVoxel(_location, _newValue);
 }
@@ -0,0 +1,209 @@
+//
+//  TerrainPrefetcher.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/TerrainPrefetcher.hpp"
+#include "Terrain/TerrainConfig.hpp"
+#include "Grid/GridIndexerRange.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace glm;
+
+// Returns true if the boxes overlap when viewed from above. Boxes which only
+// touch along an edge do not overlap.
+static bool overlapsInXZ(const AABB &a, const AABB &b)
+{
+    const vec3 aMin = a.mins(), aMax = a.maxs();
+    const vec3 bMin = b.mins(), bMax = b.maxs();
+    return (aMax.x > bMin.x) && (aMin.x < bMax.x) &&
+           (aMax.z > bMin.z) && (aMin.z < bMax.z);
+}
+
+TerrainPrefetcher::TerrainPrefetcher(std::shared_ptr<spdlog::logger> log,
+                                     std::shared_ptr<TransactedVoxelData> voxels,
+                                     std::shared_ptr<TaskDispatcher> dispatcher,
+                                     float activeRegionSize,
+                                     float lookahead)
+ : TerrainPrefetcher(std::move(log),
+                     *voxels,
+                     [voxels](const AABB &region){
+                         return voxels->isResident(region);
+                     },
+                     [voxels](const AABB &region){
+                         return voxels->prefetch(region);
+                     },
+                     std::move(dispatcher),
+                     activeRegionSize,
+                     lookahead)
+{}
+
+TerrainPrefetcher::TerrainPrefetcher(std::shared_ptr<spdlog::logger> log,
+                                     const GridIndexer &voxelIndexer,
+                                     ResidencyCheck isResident,
+                                     Prefetch prefetch,
+                                     std::shared_ptr<TaskDispatcher> dispatcher,
+                                     float activeRegionSize,
+                                     float lookahead)
+ : _log(std::move(log)),
+   _isResident(std::move(isResident)),
+   _prefetch(std::move(prefetch)),
+   _dispatcher(std::move(dispatcher)),
+   _activeRegionSize(activeRegionSize),
+   _lookahead(lookahead),
+   _columns(voxelIndexer.boundingBox(),
+            ivec3(voxelIndexer.gridResolution().x / (int)TERRAIN_CHUNK_SIZE,
+                  1,
+                  voxelIndexer.gridResolution().z / (int)TERRAIN_CHUNK_SIZE)),
+   _maxColumnsInFlight(std::max<size_t>(1, _dispatcher->getNumberOfThreads())),
+   _hasPreviousPosition(false),
+   _velocity(0.f),
+   _schedulingPending(false),
+   _numberOfRebuilds(0),
+   _numberOfResidentRebuilds(0),
+   _numberOfPrefetches(0)
+{}
+
+void TerrainPrefetcher::update(const vec3 &cameraPosition, Clock::time_point now)
+{
+    if (_lookahead <= 0.f) {
+        return;
+    }
+    
+    std::scoped_lock lock(_mutex);
+    
+    if (_hasPreviousPosition) {
+        const float dt = std::chrono::duration<float>(now - _previousTime).count();
+        if (dt <= 0.f) {
+            return;
+        }
+        
+        // Exponential smoothing, which is independent of the frame rate.
+        const vec3 instantaneousVelocity = (cameraPosition - _previousPosition) / dt;
+        const float alpha = 1.f - std::exp(-dt / VelocityTimeConstant);
+        _velocity += (instantaneousVelocity - _velocity) * alpha;
+    }
+    
+    _hasPreviousPosition = true;
+    _previousPosition = cameraPosition;
+    _previousTime = now;
+    
+    if (_schedulingPending || length(_velocity) < MinimumSpeed) {
+        return;
+    }
+    
+    _schedulingPending = true;
+    _dispatcher->async(TaskDispatcher::LowPriority, [weakSelf = weak_from_this()]{
+        if (auto self = weakSelf.lock()) {
+            self->schedulePrefetches();
+        }
+    });
+}
+
+vec3 TerrainPrefetcher::getVelocity() const
+{
+    std::scoped_lock lock(_mutex);
+    return _velocity;
+}
+
+void TerrainPrefetcher::noteRebuild(bool resident)
+{
+    _numberOfRebuilds++;
+    if (resident) {
+        _numberOfResidentRebuilds++;
+    }
+}
+
+void TerrainPrefetcher::schedulePrefetches()
+{
+    vec3 cameraPosition, velocity;
+    {
+        std::scoped_lock lock(_mutex);
+        _schedulingPending = false;
+        cameraPosition = _previousPosition;
+        velocity = _velocity;
+        if (_columnsInFlight.size() >= _maxColumnsInFlight) {
+            return;
+        }
+    }
+    
+    if (_dispatcher->isShutdown()) {
+        return;
+    }
+    
+    const vec3 predictedPosition = cameraPosition + velocity * _lookahead;
+    const AABB currentRegion = getActiveRegion(cameraPosition);
+    const AABB predictedRegion = getActiveRegion(predictedPosition);
+    if (!doBoxesIntersect(_columns.boundingBox(), {predictedPosition, vec3(_activeRegionSize)})) {
+        return;
+    }
+    
+    // The rebuild path already takes care of the current active region. So,
+    // only prefetch the columns which are about to enter it.
+    struct Candidate
+    {
+        float distance;
+        Morton3 index;
+        AABB box;
+    };
+    std::vector<Candidate> candidates;
+    for (const ivec3 cellCoords : slice(_columns, predictedRegion)) {
+        const AABB columnBox = _columns.cellAtCellCoords(cellCoords);
+        if (overlapsInXZ(columnBox, currentRegion)) {
+            continue;
+        }
+        const vec2 delta(columnBox.center.x - predictedPosition.x,
+                         columnBox.center.z - predictedPosition.z);
+        candidates.push_back(Candidate{dot(delta, delta),
+                                       _columns.indexAtCellCoords(cellCoords),
+                                       columnBox});
+    }
+    
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b){
+        return a.distance < b.distance;
+    });
+    
+    for (const Candidate &candidate : candidates) {
+        if (_isResident(candidate.box)) {
+            continue;
+        }
+        
+        std::scoped_lock lock(_mutex);
+        if (_columnsInFlight.size() >= _maxColumnsInFlight) {
+            break;
+        }
+        if (!_columnsInFlight.insert(candidate.index).second) {
+            continue;
+        }
+        _dispatcher->async(TaskDispatcher::LowPriority, [weakSelf = weak_from_this(), candidate]{
+            if (auto self = weakSelf.lock()) {
+                self->prefetchColumn(candidate.index, candidate.box);
+            }
+        });
+    }
+}
+
+void TerrainPrefetcher::prefetchColumn(Morton3 index, const AABB &columnBox)
+{
+    try {
+        if (!_dispatcher->isShutdown() && _prefetch(columnBox)) {
+            _numberOfPrefetches++;
+        }
+    } catch(const std::exception &exception) {
+        // Prefetching is only an optimization. The rebuild path will try
+        // again, and report the error, if the voxels are really needed.
+        _log->warn("Failed to prefetch the column at {}: {}", columnBox, exception.what());
+    }
+    
+    std::scoped_lock lock(_mutex);
+    _columnsInFlight.erase(index);
+}
+
+AABB TerrainPrefetcher::getActiveRegion(const vec3 &cameraPosition) const
+{
+    const AABB horizonBox = {cameraPosition, vec3(_activeRegionSize)};
+    return _columns.boundingBox().intersect(horizonBox);
+}
@@ -7,8 +7,6 @@
 //
 
 #include "Terrain/TerrainRebuildActor.hpp"
-#include "ThreadName.hpp"
-#include "AutoreleasePool.hpp"
 #include <glm/gtx/string_cast.hpp>
 #include <unordered_map>
 
@@ -32,41 +30,58 @@ namespace std {
 // and small changes will not affect the sorting.
 constexpr float searchPointThreshold = 8.f;
 
+// Pending batches are ordered by distance from the search point to within
+// this width. There is no point in being more precise than the threshold for
+// moving the search point.
+constexpr float pendingBatchBucketWidth = searchPointThreshold;
+
 TerrainRebuildActor::~TerrainRebuildActor()
 {
-    _threadShouldExit = true;
-    _cvar.notify_all();
-    for (auto& thread : _threads) {
-        thread.join();
+    shutdown();
+}
+
+void TerrainRebuildActor::shutdown()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _isShutdown = true;
+    _pendingBatches.removeIf([this](Batch &batch){
+        forgetCancelledBatch(batch);
+        return true;
+    });
+    for (const Batch &batch : _batchesInFlight) {
+        batch.cancellationToken().cancel();
     }
+    _cvar.wait(lock, [this]{
+        return _batchesInFlight.empty();
+    });
 }
 
 TerrainRebuildActor::TerrainRebuildActor(std::shared_ptr<spdlog::logger> log,
-                                         unsigned numThreads,
+                                         unsigned maxBatchesInFlight,
                                          glm::vec3 initialSearchPoint,
                                          std::shared_ptr<TaskDispatcher> mainThreadDispatcher,
                                          entityx::EventManager &events,
                                          std::chrono::steady_clock::time_point appStartTime,
-                                         std::function<void(const Batch &)> &&processBatch)
-: _threadShouldExit(false),
+                                         std::function<Future<void>(const Batch &)> &&processBatch)
+: _isShutdown(false),
+  _isStartingBatches(false),
+  _maxBatchesInFlight(std::max(1u, maxBatchesInFlight)),
   _processBatch(std::move(processBatch)),
+  _pendingBatches(pendingBatchBucketWidth, initialSearchPoint),
   _searchPoint(initialSearchPoint),
   _mainThreadDispatcher(mainThreadDispatcher),
   _events(events),
   _log(log),
   _appStartTime(appStartTime)
-{
-    for (size_t i = 0; i < numThreads; ++i) {
-        _threads.emplace_back([this]{
-            setNameForCurrentThread("TerrainRebuildActor");
-            worker();
-        });
-    }
-}
+{}
 
 void TerrainRebuildActor::push(const std::vector<std::pair<Morton3, AABB>> &cells)
 {
-    std::scoped_lock lock(_lock);
+    std::unique_lock<std::mutex> lock(_lock);
+    
+    if (_isShutdown) {
+        return;
+    }
     
     int numberAdded = 0;
     std::unordered_map<glm::ivec2, std::vector<Cell>> mapColumnToCells;
@@ -100,69 +115,138 @@ void TerrainRebuildActor::push(const std::vector<std::pair<Morton3, AABB>> &cell
     _log->trace("Added {} chunks in push()", numberAdded);
     if (numberAdded > 0) {
         for (auto &pair : mapColumnToCells) {
-            _pendingBatches.emplace_back(std::move(pair.second));
-        }
-        sort();
-        if (mapColumnToCells.size() == 1) {
-            _cvar.notify_one();
-        } else {
-            _cvar.notify_all();
+            _pendingBatches.push(Batch(std::move(pair.second)));
         }
     }
+    
+    lock.unlock();
+    startBatches();
 }
 
-void TerrainRebuildActor::setSearchPoint(glm::vec3 searchPoint)
+void TerrainRebuildActor::setSearchPoint(glm::vec3 searchPoint, const AABB &activeRegion)
 {
     std::scoped_lock lock(_lock);
     if (glm::distance(_searchPoint, searchPoint) > searchPointThreshold) {
         _log->trace("Updating search point from {} to {}",
                     glm::to_string(_searchPoint), glm::to_string(searchPoint));
         _searchPoint = searchPoint;
-        sort();
+        cancelBatchesOutside(activeRegion);
+        _pendingBatches.setSearchPoint(searchPoint);
     }
 }
 
-void TerrainRebuildActor::worker()
+void TerrainRebuildActor::startBatches()
 {
-    while (!_threadShouldExit) {
-        AutoreleasePool pool;
+    {
+        std::scoped_lock lock(_lock);
+        if (_isStartingBatches) {
+            // The thread which is already starting batches will notice any
+            // change we care about because it checks again, under the lock,
+            // before starting each batch.
+            return;
+        }
+        _isStartingBatches = true;
+    }
         
-        // Wait for a cell to work on.
-        boost::optional<Batch> maybeBatch;
+    while (true) {
+        std::list<Batch>::iterator batch;
         {
-            std::unique_lock<std::mutex> lock(_lock);
-            _cvar.wait(lock, [this]{
-                return _threadShouldExit || !_pendingBatches.empty();
-            });
-            if (!(_threadShouldExit || _pendingBatches.empty())) {
-                maybeBatch = boost::make_optional(std::move(_pendingBatches.front()));
-                _pendingBatches.pop_front();
+            std::scoped_lock lock(_lock);
+            if (_isShutdown ||
+                _pendingBatches.empty() ||
+                _batchesInFlight.size() >= _maxBatchesInFlight) {
+                _isStartingBatches = false;
+                return;
             }
+            _batchesInFlight.emplace_back(_pendingBatches.pop());
+            batch = std::prev(_batchesInFlight.end());
+        }
+        
+        std::shared_ptr<Future<void>> future;
+        try {
+            future = std::make_shared<Future<void>>(_processBatch(*batch));
+        } catch (const CancelledException &) {
+            finishBatch(batch, true);
+            continue;
+        } catch (const std::exception &exception) {
+            _log->error("Failed to start processing a batch: {}", exception.what());
+            finishBatch(batch, true);
+            continue;
         }
         
-        if (maybeBatch) {
-            Batch &batch = *maybeBatch;
-            _processBatch(batch);
-         
-            // Remove from the set only at the very end.
-            std::unique_lock<std::mutex> lock(_lock);
-            for (Cell &cell : batch.requestedCells()) {
+        // The future holds a reference to itself through the continuation
+        // until the continuation runs. If the future is already ready then
+        // the continuation runs right here and finishBatch() cannot start the
+        // next batch itself, because we are still starting batches.
+        future->onReady([this, batch, future]{
+            bool cancelled = false;
+            try {
+                future->get();
+            } catch (const CancelledException &) {
+                cancelled = true;
+            } catch (const std::exception &exception) {
+                _log->error("Failed to process a batch: {}", exception.what());
+                cancelled = true;
+            }
+            finishBatch(batch, cancelled);
+        });
+    }
+}
+
+void TerrainRebuildActor::finishBatch(std::list<Batch>::iterator batch,
+                                      bool cancelled)
+{
+    {
+        // Remove from the set only at the very end.
+        std::scoped_lock lock(_lock);
+        if (cancelled) {
+            forgetCancelledBatch(*batch);
+        } else {
+            for (Cell &cell : batch->requestedCells()) {
                 cell.progress.setState(TerrainProgressEvent::Complete);
                 cell.progress.dump();
                 _set.erase(cell.setIterator);
             }
         }
+        _batchesInFlight.erase(batch);
+        _cvar.notify_all();
     }
+        
+    startBatches();
 }
 
-void TerrainRebuildActor::sort()
+void TerrainRebuildActor::cancelBatchesOutside(const AABB &activeRegion)
 {
-    std::sort(_pendingBatches.begin(), _pendingBatches.end(),
-              [searchPoint=_searchPoint](const Batch& batch1, const Batch& batch2){
-                  const AABB &a = batch1.boundingBox();
-                  const AABB &b = batch2.boundingBox();
-                  const auto distA = glm::distance(a.center, searchPoint);
-                  const auto distB = glm::distance(b.center, searchPoint);
-                  return distA < distB;
-              });
+    // Batches in flight are removed when processing finishes, once the
+    // processing notices the cancellation.
+    for (const Batch &batch : _batchesInFlight) {
+        if (!batch.intersects(activeRegion)) {
+            batch.cancellationToken().cancel();
+        }
+    }
+    
+    // Queued batches can be dropped right now.
+    const size_t numberCancelled = _pendingBatches.removeIf([&](Batch &batch){
+        if (batch.intersects(activeRegion)) {
+            return false;
+        }
+        forgetCancelledBatch(batch);
+        return true;
+    });
+    
+    if (numberCancelled > 0) {
+        _log->trace("Cancelled {} batches outside the active region {}",
+                    numberCancelled, activeRegion);
+    }
+}
+
+void TerrainRebuildActor::forgetCancelledBatch(Batch &batch)
+{
+    // Removing the cells from the set allows them to be requested again if
+    // they come back into the active region. Marking them complete removes
+    // them from the progress display.
+    for (Cell &cell : batch.requestedCells()) {
+        cell.progress.setState(TerrainProgressEvent::Complete);
+        _set.erase(cell.setIterator);
+    }
 }
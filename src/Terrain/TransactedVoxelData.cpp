@@ -13,38 +13,206 @@ TransactedVoxelData::TransactedVoxelData(std::unique_ptr<VoxelData> &&source)
    _source(std::move(source))
 {}
 
-void TransactedVoxelData::readerTransaction(const AABB &region, std::function<void(Array3D<Voxel> &&data)> fn)
+void TransactedVoxelData::readerTransaction(const AABB &region,
+                                            std::function<void(Array3D<Voxel> &&data)> fn,
+                                            const CancellationToken &cancellationToken)
 {
     const AABB lockedRegion = _source->getSunlightRegion(region);
     auto mutex = _lockArbitrator.writerMutex(lockedRegion);
     std::scoped_lock lock(mutex);
-    fn(_source->load(region));
+    cancellationToken.throwIfCancelled();
+    fn(_source->load(region, cancellationToken));
 }
 
 void TransactedVoxelData::readerTransaction(const std::vector<AABB> regions,
-                                            std::function<void(size_t index, Array3D<Voxel> &&data)> fn)
+                                            std::function<void(size_t index, Array3D<Voxel> &&data)> fn,
+                                            const CancellationToken &cancellationToken)
 {
-    AABB lockedRegion = _source->getSunlightRegion(regions.front());
-    for (const AABB &region : regions) {
-        lockedRegion = lockedRegion.unionBox(_source->getSunlightRegion(region));
-    }
-    auto mutex = _lockArbitrator.writerMutex(lockedRegion);
+    auto mutex = _lockArbitrator.writerMutex(getLockedRegion(regions));
     std::scoped_lock lock(mutex);
     
     for (size_t i = 0; i < regions.size(); ++i) {
-        fn(i, _source->load(regions[i]));
+        cancellationToken.throwIfCancelled();
+        fn(i, _source->load(regions[i], cancellationToken));
+    }
+}
+
+Future<std::vector<Array3D<Voxel>>>
+TransactedVoxelData::asyncReaderTransaction(const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                            TaskDispatcher::Priority priority,
+                                            std::vector<AABB> regions,
+                                            const CancellationToken &cancellationToken)
+{
+    const AABB lockedRegion = getLockedRegion(regions);
+    auto transaction = std::make_shared<AsyncReaderTransaction>(AsyncReaderTransaction{
+        dispatcher,
+        priority,
+        std::move(regions),
+        cancellationToken,
+        _lockArbitrator.writerMutex(lockedRegion),
+        Promise<std::vector<Array3D<Voxel>>>()
+    });
+    
+    auto future = transaction->promise.getFuture(dispatcher);
+    
+    // If the dispatcher discards the task then the promise is broken when the
+    // transaction object is destroyed.
+    dispatcher->dispatch(priority, [this, transaction]{
+        fetchReaderTransaction(transaction);
+    });
+    
+    return future;
+}
+
+void TransactedVoxelData::fetchReaderTransaction(const std::shared_ptr<AsyncReaderTransaction> &transaction)
+{
+    try {
+        for (const AABB &region : transaction->regions) {
+            transaction->cancellationToken.throwIfCancelled();
+            _source->fetch(region, transaction->cancellationToken);
+        }
+    } catch (...) {
+        transaction->promise.setException(std::current_exception());
+        return;
+    }
+    
+    transaction->dispatcher->dispatch(transaction->priority, [this, transaction]{
+        attemptReaderTransaction(transaction);
+    });
+}
+
+void TransactedVoxelData::attemptReaderTransaction(const std::shared_ptr<AsyncReaderTransaction> &transaction)
+{
+    if (transaction->cancellationToken.isCancelled()) {
+        transaction->promise.setResultOf([&]() -> std::vector<Array3D<Voxel>> {
+            transaction->cancellationToken.throwIfCancelled();
+            return {};
+        });
+        return;
+    }
+    
+    // The lock is only held while the transaction is actually running. If it
+    // were held while a task waits in the dispatcher's queue then workers
+    // blocked on the same region could starve the dispatcher.
+    if (!transaction->mutex.try_lock()) {
+        transaction->mutex.notifyWhenAvailable([this, transaction]{
+            transaction->dispatcher->dispatch(transaction->priority, [this, transaction]{
+                attemptReaderTransaction(transaction);
+            });
+        });
+        return;
+    }
+    
+    // The result is published after the lock is released so that work which
+    // continues from it never holds the lock.
+    std::vector<Array3D<Voxel>> voxels;
+    try {
+        std::scoped_lock lock(std::adopt_lock, transaction->mutex);
+        const auto &regions = transaction->regions;
+        const auto &cancellationToken = transaction->cancellationToken;
+        voxels.reserve(regions.size());
+        for (const AABB &region : regions) {
+            cancellationToken.throwIfCancelled();
+            voxels.push_back(_source->load(region, cancellationToken));
+        }
+    } catch (...) {
+        transaction->promise.setException(std::current_exception());
+        return;
     }
+    transaction->promise.setValue(std::move(voxels));
 }
 
 void TransactedVoxelData::writerTransaction(TerrainOperation &operation)
 {
     const AABB lockedRegion = boundingBox().intersect(_source->getAccessRegionForOperation(operation));
     
+    AABB modifiedRegion;
     {
         auto mutex = _lockArbitrator.writerMutex(lockedRegion);
         std::scoped_lock lock(mutex);
-        operation.perform(*_source);
+        modifiedRegion = operation.perform(*_source);
+    }
+    
+    onWriterTransaction(boundingBox().intersect(modifiedRegion));
+}
+
+Future<void> TransactedVoxelData::asyncWriterTransaction(const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                                        TaskDispatcher::Priority priority,
+                                                        std::shared_ptr<TerrainOperation> operation)
+{
+    assert(operation);
+    const AABB lockedRegion = boundingBox().intersect(_source->getAccessRegionForOperation(*operation));
+    auto transaction = std::make_shared<AsyncWriterTransaction>(AsyncWriterTransaction{
+        dispatcher,
+        priority,
+        std::move(operation),
+        _lockArbitrator.writerMutex(lockedRegion),
+        Promise<void>()
+    });
+    
+    Future<void> future = transaction->promise.getFuture(dispatcher);
+    
+    // If the dispatcher discards the task then the promise is broken when the
+    // transaction object is destroyed.
+    dispatcher->dispatch(priority, [this, transaction]{
+        attemptWriterTransaction(transaction);
+    });
+    
+    return future;
+}
+
+void TransactedVoxelData::attemptWriterTransaction(const std::shared_ptr<AsyncWriterTransaction> &transaction)
+{
+    if (!transaction->mutex.try_lock()) {
+        transaction->mutex.notifyWhenAvailable([this, transaction]{
+            transaction->dispatcher->dispatch(transaction->priority, [this, transaction]{
+                attemptWriterTransaction(transaction);
+            });
+        });
+        return;
     }
     
-    onWriterTransaction(lockedRegion);
+    AABB modifiedRegion;
+    try {
+        std::scoped_lock lock(std::adopt_lock, transaction->mutex);
+        modifiedRegion = transaction->operation->perform(*_source);
+    } catch (...) {
+        transaction->promise.setException(std::current_exception());
+        return;
+    }
+    
+    transaction->promise.setResultOf([&]{
+        onWriterTransaction(boundingBox().intersect(modifiedRegion));
+    });
+}
+
+bool TransactedVoxelData::prefetch(const AABB &region)
+{
+    const AABB lockedRegion = _source->getSunlightRegion(region);
+    auto mutex = _lockArbitrator.writerMutex(lockedRegion);
+    if (!mutex.try_lock()) {
+        return false;
+    }
+    std::scoped_lock lock(std::adopt_lock, mutex);
+    _source->prefetch(region);
+    return true;
+}
+
+bool TransactedVoxelData::isResident(const AABB &region)
+{
+    return _source->isResident(region);
+}
+
+void TransactedVoxelData::flush()
+{
+    _source->flush();
+}
+
+AABB TransactedVoxelData::getLockedRegion(const std::vector<AABB> &regions) const
+{
+    AABB lockedRegion = _source->getSunlightRegion(regions.front());
+    for (const AABB &region : regions) {
+        lockedRegion = lockedRegion.unionBox(_source->getSunlightRegion(region));
+    }
+    return lockedRegion;
 }
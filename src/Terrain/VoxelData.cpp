@@ -10,9 +10,47 @@
 #include "Terrain/TerrainConfig.hpp"
 #include "Grid/GridIndexerRange.hpp"
 #include "Terrain/InitialSunlightPropagationOperation.hpp"
+#include "Terrain/IncrementalLightPropagation.hpp"
 
 using namespace glm;
 
+namespace {
+
+// Pins every chunk fetched through it until it is destroyed. This ensures
+// chunks cannot be evicted while they are modified in place, even when the
+// modification fails part way through.
+class PinnedChunks
+{
+public:
+    PinnedChunks(PersistentVoxelChunks &chunks) : _chunks(chunks) {}
+    
+    ~PinnedChunks()
+    {
+        for (const Morton3 index : _pinnedChunks) {
+            _chunks.unpin(index);
+        }
+    }
+    
+    PinnedChunks(const PinnedChunks &) = delete;
+    PinnedChunks& operator=(const PinnedChunks &) = delete;
+    
+    // Pins the chunk and then returns it, creating it if necessary.
+    VoxelDataChunk* get(const AABB &cell, Morton3 index)
+    {
+        _pinnedChunks.push_back(index);
+        _chunks.pin(index);
+        _fetchedChunks.push_back(_chunks.get(cell, index));
+        return _fetchedChunks.back().get();
+    }
+    
+private:
+    PersistentVoxelChunks &_chunks;
+    std::vector<Morton3> _pinnedChunks;
+    std::vector<std::shared_ptr<VoxelDataChunk>> _fetchedChunks;
+};
+
+} // anonymous namespace
+
 VoxelData::VoxelData(std::shared_ptr<spdlog::logger> log,
                      std::unique_ptr<VoxelDataGenerator> &&source,
                      unsigned chunkSize,
@@ -28,51 +66,160 @@ VoxelData::VoxelData(std::shared_ptr<spdlog::logger> log,
           std::move(mapRegionStore),
           [=](const AABB &cell, Morton3 index){
               return createNewChunk(cell, index);
-          }),
+          },
+          dispatcher,
+          VOXEL_CHUNK_MEMORY_BUDGET),
   _dispatcher(dispatcher)
 {}
 
-Array3D<Voxel> VoxelData::load(const AABB &region)
+Array3D<Voxel> VoxelData::load(const AABB &region,
+                               const CancellationToken &cancellationToken)
 {
     {
         InitialSunlightPropagationOperation operation(_log, _chunks, _dispatcher);
         operation.performInitialSunlightPropagationIfNecessary(region);
     }
     
-    return _chunks.loadSubRegion(region);
+    return _chunks.loadSubRegion(region, cancellationToken);
+}
+
+void VoxelData::prefetch(const AABB &region)
+{
+    InitialSunlightPropagationOperation operation(_log, _chunks, _dispatcher);
+    operation.performInitialSunlightPropagationIfNecessary(region);
+}
+
+void VoxelData::fetch(const AABB &region,
+                      const CancellationToken &cancellationToken)
+{
+    // Lighting the region touches the full height of the columns around it.
+    // Chunks are created atomically, so two threads which fetch the same chunk
+    // get the same one.
+    const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
+    const AABB chunkRegion = chunkIndexer.boundingBox().intersect(getSunlightRegion(region));
+    _dispatcher->parallelFor(sliceBlocks(chunkIndexer, chunkRegion, 1), [&](const ivec3 &cellCoords){
+        cancellationToken.throwIfCancelled();
+        const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(cellCoords);
+        if (!_chunks.getIfExists(chunkIndex)) {
+            (void)_chunks.get(chunkIndexer.cellAtCellCoords(cellCoords), chunkIndex);
+        }
+    });
 }
 
-void VoxelData::editSingleVoxel(const vec3 &point, const Voxel &value)
+bool VoxelData::isResident(const AABB &region)
 {
-    // TODO: Update lighting in the region surrounding the point and return the region where voxels actually did change.
     const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
-    const AABB chunkBoundingBox = chunkIndexer.cellAtPoint(point);
-    const Morton3 chunkIndex = chunkIndexer.indexAtPoint(point);
-    auto chunkPtr = _chunks.get(chunkBoundingBox, chunkIndex);
-    chunkPtr->set(point, value);
-    _chunks.store(chunkIndex, _dispatcher);
+    const AABB chunkRegion = chunkIndexer.boundingBox().intersect(region);
+    for (const auto cellCoords : slice(chunkIndexer, chunkRegion)) {
+        if (!_chunks.getIfExists(chunkIndexer.indexAtCellCoords(cellCoords))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AABB VoxelData::editSingleVoxel(const vec3 &point, const Voxel &value)
+{
+    return editWithIncrementalLighting(point, [&](IncrementalLightPropagation &lighting){
+        return lighting.editVoxel(point, value);
+    });
+}
+
+AABB VoxelData::editLightEmitter(const vec3 &point, unsigned light)
+{
+    return editWithIncrementalLighting(point, [&](IncrementalLightPropagation &lighting){
+        return lighting.editEmitters({IncrementalLightPropagation::EmitterEdit{point, light}});
+    });
+}
+
+AABB VoxelData::editWithIncrementalLighting(const vec3 &point,
+                                            const std::function<AABB(IncrementalLightPropagation &)> &edit)
+{
+    // Relighting reads and writes voxels around the edit. These must have
+    // undergone initial sunlight propagation first.
+    const AABB lightingRegion = boundingBox().intersect(getLightingRegion({point, vec3(0.f)}));
+    {
+        InitialSunlightPropagationOperation operation(_log, _chunks, _dispatcher);
+        operation.performInitialSunlightPropagationIfNecessary(lightingRegion);
+    }
+    
+    // Chunks must not be evicted while they are modified in place.
+    const GridIndexer &chunkIndexer = _chunks.getChunkIndexer();
+    PinnedChunks pinnedChunks(_chunks);
+    IncrementalLightPropagation lighting(*this, chunkIndexer, [&](const ivec3 &chunkCellCoords){
+        const Morton3 chunkIndex = chunkIndexer.indexAtCellCoords(chunkCellCoords);
+        return pinnedChunks.get(chunkIndexer.cellAtCellCoords(chunkCellCoords), chunkIndex);
+    });
+    
+    // Chunks which were modified before a failure must be saved too, or the
+    // changes which were made to them in place would be lost on eviction.
+    AABB modifiedRegion;
+    try {
+        modifiedRegion = edit(lighting);
+    } catch (...) {
+        storeModifiedChunks(lighting);
+        throw;
+    }
+    storeModifiedChunks(lighting);
+    
+    return modifiedRegion;
+}
+
+void VoxelData::storeModifiedChunks(const IncrementalLightPropagation &lighting)
+{
+    for (const Morton3 chunkIndex : lighting.getModifiedChunks()) {
+        _chunks.store(chunkIndex);
+    }
+}
+
+void VoxelData::flush()
+{
+    _chunks.flush();
 }
 
 AABB VoxelData::getAccessRegionForOperation(TerrainOperation &operation)
 {
     AABB region = _source->snapRegionToCellBoundaries(operation.getAffectedRegion());
-    region = _chunks.getChunkIndexer().snapRegionToCellBoundaries(region);
+    region = boundingBox().intersect(getLightingRegion(region));
+    return getSunlightRegion(region);
+}
+
+AABB VoxelData::getLightingRegion(const AABB &editedRegion) const
+{
+    // Light changes spread no more than MAX_LIGHT voxels to the side of the
+    // edit, and the voxels one step beyond that are read too. Sunlight changes
+    // may spread any distance downward so the region spans the full height of
+    // the world.
+    const float reach = (float)MAX_LIGHT + 1.f;
+    AABB region = editedRegion.inset(-vec3(reach, 0.f, reach));
+    
+    vec3 mins = region.mins();
+    mins.y = boundingBox().mins().y;
+    
+    vec3 maxs = region.maxs();
+    maxs.y = boundingBox().maxs().y;
+    
+    region.center = (maxs + mins) * 0.5f;
+    region.extent = (maxs - mins) * 0.5f;
+    
     return region;
 }
 
 std::unique_ptr<VoxelDataChunk>
 VoxelData::createNewChunk(const AABB &cell, Morton3 chunkIndex)
 {
-    if (cell.center.y > 64.f || cell.center.y < 0.f) {
-        const auto adjusted = _source->snapRegionToCellBoundaries(cell);
-        const auto res = _source->countCellsInRegion(adjusted);
-        if (cell.center.y < 0.f) {
-            return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createGroundChunk(adjusted, res));
-        } else {
-            return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createSkyChunk(adjusted, res));
-        }
+    // Avoid generating chunks which are certainly uniform.
+    const VoxelDataGenerator::Classification classification = _source->classify(cell);
+    if (classification == VoxelDataGenerator::Mixed) {
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createCompactChunk(_source->copy(cell)));
+    }
+    
+    const auto adjusted = _source->snapRegionToCellBoundaries(cell);
+    const auto res = _source->countCellsInRegion(adjusted);
+    if (classification == VoxelDataGenerator::Ground) {
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createGroundChunk(adjusted, res));
     } else {
-        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createArrayChunk(_source->copy(cell)));
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createSkyChunk(adjusted, res));
     }
 }
 
@@ -11,6 +11,8 @@
 #include "Grid/GridIndexerRange.hpp"
 #include "Noise/SimplexNoise.hpp"
 
+#include <algorithm>
+
 using namespace glm;
 
 static constexpr int size = TERRAIN_SIZE;
@@ -18,6 +20,19 @@ static constexpr int border = TERRAIN_CHUNK_SIZE;
 static constexpr int extent = size + border;
 static constexpr int res = (size + border) * 2;
 
+// Parameters of the rolling hills.
+static constexpr float terrainHeight = 20.f;
+
+// Parameters of the giant floating mountain.
+static const vec3 mountainCenter(50.f, 50.f, 80.f);
+static constexpr float mountainRadius = 30.f;
+static constexpr float mountainTurbScale = 15.f;
+
+// SimplexNoise is scaled to stay just inside [-1,+1], and the four octaves of
+// noiseAtPointWithFourOctaves() are weighted 1/2 + 1/4 + 1/8 + 1/16.
+static constexpr float maxNoise = 1.f;
+static constexpr float maxNoiseWithFourOctaves = 0.9375f;
+
 // Return a value between -1 and +1 so that a line through the y-axis maps to a
 // smooth gradient of values from -1 to +1.
 inline float groundGradient(float terrainHeight, const vec3 &p)
@@ -34,7 +49,6 @@ inline float groundGradient(float terrainHeight, const vec3 &p)
 // Generates a voxel for the specified point and returns it in `outVoxel'.
 static void generateTerrainVoxel(const Noise &noiseSource0,
                                  const Noise &noiseSource1,
-                                 float terrainHeight,
                                  const vec3 &p,
                                  Voxel &outVoxel)
 {
@@ -58,14 +72,13 @@ static void generateTerrainVoxel(const Noise &noiseSource0,
         // applying turbulence to the surface. The upper hemisphere is also
         // squashed to make the top flatter.
         
-        vec3 mountainCenter(50.f, 50.f, 80.f);
         vec3 toMountainCenter = mountainCenter - p;
         float distance = length(toMountainCenter);
-        float radius = 30.0f;
+        float radius = mountainRadius;
         
         // Apply turbulence to the surface of the mountain.
         float freqScale = 0.70f;
-        float turbScale = 15.0f;
+        float turbScale = mountainTurbScale;
         
         // Avoid generating noise when too far away from the center to matter.
         if(distance > 2.0f * radius) {
@@ -91,30 +104,83 @@ static void generateTerrainVoxel(const Noise &noiseSource0,
     outVoxel.value = (groundLayer || floatingMountain) ? true : false;
 }
 
-VoxelDataGenerator::VoxelDataGenerator(unsigned seed)
+VoxelDataGenerator::VoxelDataGenerator(unsigned seed,
+                                       std::shared_ptr<TaskDispatcher> dispatcher)
  : GridIndexer(AABB{glm::vec3(0.f, 0.f, 0.f), glm::vec3((float)extent, (float)extent, (float)extent)},
                glm::ivec3(res, res, res)),
                _noiseSource0(std::make_unique<SimplexNoise>(seed)),
-               _noiseSource1(std::make_unique<SimplexNoise>(seed + 1))
+               _noiseSource1(std::make_unique<SimplexNoise>(seed + 1)),
+               _dispatcher(std::move(dispatcher))
 {}
 
 Array3D<Voxel> VoxelDataGenerator::copy(const AABB &region) const
 {
-    static constexpr float terrainHeight = 20.f;
-    
     const AABB adjusted = snapRegionToCellBoundaries(region);
     const auto res = countCellsInRegion(adjusted);
     Array3D<Voxel> dst(adjusted, res);
     
-    for (const auto cellCoords : slice(dst, adjusted)) {
+    auto generate = [&](const glm::ivec3 &cellCoords){
         const auto cellCenter = dst.cellCenterAtCellCoords(cellCoords);
         Voxel &value = dst.mutableReference(cellCoords);
         generateTerrainVoxel(*_noiseSource0,
                              *_noiseSource1,
-                             terrainHeight,
                              cellCenter,
                              value);
+    };
+    
+    // Each block of cells is a contiguous run of the Morton-ordered array, so
+    // threads do not write to the same cache lines.
+    if (_dispatcher) {
+        _dispatcher->parallelFor(sliceBlocks(dst, adjusted), generate);
+    } else {
+        for (const auto cellCoords : slice(dst, adjusted)) {
+            generate(cellCoords);
+        }
     }
     
     return dst;
 }
+
+VoxelDataGenerator::Classification
+VoxelDataGenerator::classify(const AABB &region) const
+{
+    // copy() samples the noise at cell centers so only consider those.
+    const AABB adjusted = snapRegionToCellBoundaries(region);
+    const vec3 inset = min(cellDimensions() * 0.5f, adjusted.extent);
+    const vec3 minCenter = adjusted.mins() + inset;
+    const vec3 maxCenter = adjusted.maxs() - inset;
+    
+    // The ground layer is solid where p.y + t <= terrainHeight/2, and the
+    // turbulence t never exceeds terrainHeight/2 in magnitude. So, the ground
+    // is certainly solid at or below y=0 and certainly empty above
+    // y=terrainHeight. The floating mountain does not matter below y=0.
+    const float maxTurbulence = (terrainHeight / 2.0f) * maxNoise;
+    if (maxCenter.y <= (terrainHeight / 2.0f) - maxTurbulence) {
+        return Ground;
+    }
+    if (minCenter.y <= (terrainHeight / 2.0f) + maxTurbulence) {
+        return Mixed;
+    }
+    
+    // The floating mountain is solid where distance+t < radius. So, it lies
+    // entirely within a sphere whose radius is the sum of the mountain radius
+    // and the largest turbulence. Also, the flattened top means that a point
+    // at a height dy above the center is only solid if dy-turb < radius-3*dy,
+    // which puts a ceiling on the mountain.
+    //
+    // Sky chunks are fully lit by the sun so the region must be clear of the
+    // mountain all the way up to the top of the world, not just within it.
+    const float maxMountainTurbulence = mountainTurbScale * maxNoiseWithFourOctaves;
+    const float outerRadius = mountainRadius + maxMountainTurbulence;
+    const float mountainTop = mountainCenter.y + outerRadius / 4.0f;
+    if (minCenter.y < mountainTop) {
+        const vec3 columnMax(maxCenter.x, std::max(maxCenter.y, mountainTop), maxCenter.z);
+        const vec3 closest = clamp(mountainCenter, minCenter, columnMax);
+        const vec3 delta = closest - mountainCenter;
+        if (dot(delta, delta) < outerRadius * outerRadius) {
+            return Mixed;
+        }
+    }
+    
+    return Sky;
+}
@@ -115,9 +115,53 @@ static std::vector<uint8_t> decompress(const std::vector<uint8_t> &input)
 }
 
 VoxelDataSerializer::VoxelDataSerializer()
- : VOXEL_MAGIC('lxov'), VOXEL_VERSION(2)
+ : VOXEL_MAGIC('lxov'), VOXEL_VERSION(3), VOXEL_VERSION_WITHOUT_EMITTERS(2)
 {}
 
+size_t VoxelDataSerializer::getEmitterTableSize(const std::vector<uint8_t> &bytes,
+                                                size_t offset)
+{
+    uint32_t numberOfEmitters = 0;
+    if (bytes.size() < offset + sizeof(numberOfEmitters)) {
+        throw VoxelDataException("Voxel Data emitter table is missing.");
+    }
+    memcpy((void *)&numberOfEmitters, (const void *)(bytes.data() + offset), sizeof(numberOfEmitters));
+    
+    const size_t size = sizeof(numberOfEmitters) + numberOfEmitters * sizeof(LightEmitter);
+    if (bytes.size() < offset + size) {
+        throw VoxelDataException("Voxel Data emitter table is truncated. "
+                                 "Expected {} emitters.", numberOfEmitters);
+    }
+    
+    return size;
+}
+
+std::vector<LightEmitter> VoxelDataSerializer::loadEmitters(const std::vector<uint8_t> &bytes,
+                                                            size_t offset,
+                                                            const glm::ivec3 &gridResolution)
+{
+    uint32_t numberOfEmitters = 0;
+    memcpy((void *)&numberOfEmitters, (const void *)(bytes.data() + offset), sizeof(numberOfEmitters));
+    offset += sizeof(numberOfEmitters);
+    
+    std::vector<LightEmitter> emitters(numberOfEmitters);
+    memcpy((void *)emitters.data(), (const void *)(bytes.data() + offset), numberOfEmitters * sizeof(LightEmitter));
+    
+    for (const LightEmitter &emitter : emitters) {
+        if (emitter.x >= gridResolution.x ||
+            emitter.y >= gridResolution.y ||
+            emitter.z >= gridResolution.z ||
+            emitter.light == 0 || emitter.light > MAX_LIGHT) {
+            throw VoxelDataException("Voxel Data emitter is invalid: "
+                                     "({}, {}, {}) with light {}",
+                                     (unsigned)emitter.x, (unsigned)emitter.y,
+                                     (unsigned)emitter.z, (unsigned)emitter.light);
+        }
+    }
+    
+    return emitters;
+}
+
 VoxelDataChunk VoxelDataSerializer::load(const AABB &boundingBox,
                                          const std::vector<uint8_t> &bytes)
 {
@@ -129,7 +173,7 @@ VoxelDataChunk VoxelDataSerializer::load(const AABB &boundingBox,
         throw VoxelDataMagicNumberException(header.magic, VOXEL_MAGIC);
     }
     
-    if (header.version != VOXEL_VERSION) {
+    if (header.version != VOXEL_VERSION && header.version != VOXEL_VERSION_WITHOUT_EMITTERS) {
         throw VoxelDataIncompatibleVersionException(header.version, VOXEL_VERSION);
     }
     
@@ -143,22 +187,41 @@ VoxelDataChunk VoxelDataSerializer::load(const AABB &boundingBox,
     
     bool complete = (header.complete != 0);
     
+    if (bytes.size() < sizeof(Header) + header.len) {
+        throw VoxelDataException("Voxel Data is truncated. Expected {} "
+                                 "compressed bytes.", header.len);
+    }
+    
+    // The block data store pads the bytes it returns, so the extent of the
+    // payload is given by the header and the emitter table, and not by the
+    // size of the buffer. Version 2 only checksums the compressed bytes.
+    size_t payloadSize = header.len;
+    if (header.version != VOXEL_VERSION_WITHOUT_EMITTERS) {
+        payloadSize += getEmitterTableSize(bytes, sizeof(Header) + header.len);
+    }
+    
+    const std::vector<uint8_t> payload(bytes.begin() + sizeof(Header), bytes.begin() + sizeof(Header) + payloadSize);
+    const uint32_t s = computeChecksum(payload);
+    if (header.checksum != s) {
+        throw VoxelDataChecksumException(header.checksum, s);
+    }
+    
+    std::vector<LightEmitter> emitters;
+    if (header.version != VOXEL_VERSION_WITHOUT_EMITTERS) {
+        emitters = loadEmitters(bytes, sizeof(Header) + header.len, gridResolution);
+    }
+    
     switch (header.chunkType) {
         case CHUNK_TYPE_ARRAY:
         {
             const std::vector<uint8_t> compressedBytes(header.compressedBytes, header.compressedBytes + header.len);
-            
-            uint32_t s = computeChecksum(compressedBytes);
-            if (header.checksum != s) {
-                throw VoxelDataChecksumException(header.checksum, s);
-            }
-            
             const std::vector<uint8_t> decompressedBytes = decompress(compressedBytes);
             Array3D<Voxel> voxels(boundingBox, gridResolution);
             memcpy((void *)voxels.data(), (const void *)decompressedBytes.data(), decompressedBytes.size());
             
-            auto chunk = VoxelDataChunk::createArrayChunk(std::move(voxels));
+            auto chunk = VoxelDataChunk::createCompactChunk(std::move(voxels));
             chunk.complete = complete;
+            chunk.setEmitters(std::move(emitters));
             return chunk;
         }
             
@@ -166,6 +229,7 @@ VoxelDataChunk VoxelDataSerializer::load(const AABB &boundingBox,
         {
             auto chunk = VoxelDataChunk::createSkyChunk(boundingBox, gridResolution);
             chunk.complete = complete;
+            chunk.setEmitters(std::move(emitters));
             return chunk;
         }
             
@@ -173,6 +237,7 @@ VoxelDataChunk VoxelDataSerializer::load(const AABB &boundingBox,
         {
             auto chunk = VoxelDataChunk::createGroundChunk(boundingBox, gridResolution);;
             chunk.complete = complete;
+            chunk.setEmitters(std::move(emitters));
             return chunk;
         }
             
@@ -191,13 +256,26 @@ std::vector<uint8_t> VoxelDataSerializer::store(const VoxelDataChunk &chunk)
     // Compress the voxel data.
     const std::vector<uint8_t> compressedBytes = compress(uncompressedBytes);
     
+    // Build the payload which follows the header. This is the compressed
+    // voxel data followed by the table of light emitters.
+    const std::vector<LightEmitter> &emitters = chunk.getEmitters();
+    const uint32_t numberOfEmitters = (uint32_t)emitters.size();
+    const size_t numberOfEmitterBytes = numberOfEmitters * sizeof(LightEmitter);
+    std::vector<uint8_t> payload(compressedBytes.size() + sizeof(numberOfEmitters) + numberOfEmitterBytes);
+    uint8_t *cursor = payload.data();
+    memcpy((void *)cursor, (const void *)compressedBytes.data(), compressedBytes.size());
+    cursor += compressedBytes.size();
+    memcpy((void *)cursor, (const void *)&numberOfEmitters, sizeof(numberOfEmitters));
+    cursor += sizeof(numberOfEmitters);
+    memcpy((void *)cursor, (const void *)emitters.data(), numberOfEmitterBytes);
+    
     // Build the serialized voxel data structure and the header.
-    std::vector<uint8_t> serializedData(compressedBytes.size() + sizeof(Header));
+    std::vector<uint8_t> serializedData(payload.size() + sizeof(Header));
     
     Header &header = *((Header *)serializedData.data());
     header.magic = VOXEL_MAGIC;
     header.version = VOXEL_VERSION;
-    header.checksum = computeChecksum(compressedBytes);
+    header.checksum = computeChecksum(payload);
     header.w = res.x;
     header.h = res.y;
     header.d = res.z;
@@ -205,6 +283,11 @@ std::vector<uint8_t> VoxelDataSerializer::store(const VoxelDataChunk &chunk)
     
     switch (chunk.getType()) {
         case VoxelDataChunk::Array:
+            // fall through
+        
+        case VoxelDataChunk::Palette:
+            // Paletted chunks are saved as plain arrays. The palette is
+            // rebuilt when the chunk is loaded.
             header.chunkType = CHUNK_TYPE_ARRAY;
             break;
             
@@ -223,8 +306,8 @@ std::vector<uint8_t> VoxelDataSerializer::store(const VoxelDataChunk &chunk)
     header.complete = chunk.complete ? 1 : 0;
     
     memcpy((void *)header.compressedBytes,
-           (const void *)compressedBytes.data(),
-           compressedBytes.size());
+           (const void *)payload.data(),
+           payload.size());
 
     return serializedData;
 }
@@ -14,6 +14,7 @@
 #include "Grid/GridRaycast.hpp"
 #include "WireframeCube.hpp"
 #include "Terrain/TerrainOperationEditPoint.hpp"
+#include "Terrain/TerrainOperationEditLight.hpp"
 
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp> // for glm::translate()
@@ -21,8 +22,8 @@
 
 TerrainCursorSystem::TerrainCursorSystem(std::shared_ptr<spdlog::logger> log,
                                          const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher)
- : _dispatcher(std::make_shared<TaskDispatcher>("TerrainCursorSystem", 1)),
-   _mainThreadDispatcher(mainThreadDispatcher),
+ : _mainThreadDispatcher(mainThreadDispatcher),
+   _pendingEdits(std::make_shared<PendingEdits>()),
    _needsUpdate(false),
    _mouseDownCounter(0),
    _log(log)
@@ -95,6 +96,12 @@ void TerrainCursorSystem::update(entityx::EntityManager &es,
                 setBlockUnderCursor(cursor, events, /* value = */ false, /* usePlacePos = */ false);
             });
         }
+        
+        if (event.button == SDL_BUTTON_MIDDLE && !event.down) {
+            es.each<TerrainCursor>([&](entityx::Entity cursorEntity, TerrainCursor &cursor) {
+                placeLightUnderCursor(cursor);
+            });
+        }
     } // while there are pending events
 }
 
@@ -133,68 +140,55 @@ void TerrainCursorSystem::requestCursorUpdate(const glm::mat4 &cameraTerrainTran
     TerrainCursor &cursor = *cursorEntity.component<TerrainCursor>().get();
     
     // Cancel a pending cursor update, if there is one.
-    if (cursor.cancellationToken) {
-        cursor.cancellationToken->store(true);
-    }
+    cursor.cancellationToken.cancel();
+    cursor.cancellationToken = CancellationToken::create();
 
-    cursor.cancellationToken = std::make_shared<std::atomic<bool>>(false);
+    const vec3 cameraEye(inverse(cameraTerrainTransform)[3]);
+    const quat cameraOrientation = toQuat(transpose(cameraTerrainTransform));
+    const vec3 rayDir = cameraOrientation * vec3(0, 0, -1);
+    const Ray ray(cameraEye, rayDir);
+    const AABB voxelBox{cameraEye, vec3(maxPlaceDistance+1)};
 
-    // Schedule a task to asynchronously compute the updated cursor position.
-    _dispatcher->async([startTime=std::chrono::steady_clock::now(),
-                        cameraTerrainTransform,
-                        terrain=terrain,
-                        cancellationToken=cursor.cancellationToken,
-                        log=_log]{
+    // Read the voxels around the camera asynchronously. This runs at high
+    // priority on the terrain's dispatcher so that it is not stuck behind bulk
+    // voxel generation, and no worker waits for the lock in the meantime. The
+    // transaction is skipped if it is cancelled before it starts.
+    terrain->asyncReaderTransaction(voxelBox,
+                                    TaskDispatcher::HighPriority,
+                                    cursor.cancellationToken)
+    .then(_mainThreadDispatcher, [startTime=std::chrono::steady_clock::now(),
+                                  ray,
+                                  log=_log,
+                                  cancellationToken=cursor.cancellationToken,
+                                  cursorEntity=std::move(cursorEntity)](std::vector<Array3D<Voxel>> &&voxelsOfRegions) mutable{
 
-        if (cancellationToken && cancellationToken->load()) {
-            throw BrokenPromiseException();
-        }
-        
-        const vec3 cameraEye(inverse(cameraTerrainTransform)[3]);
-        const quat cameraOrientation = toQuat(transpose(cameraTerrainTransform));
-        const vec3 rayDir = cameraOrientation * vec3(0, 0, -1);
-        const Ray ray(cameraEye, rayDir);
-        const AABB voxelBox{cameraEye, vec3(maxPlaceDistance+1)};
+        // This task executes on the main thread because we'll be using it to
+        // update our entity's components. Casting the ray only visits a few
+        // voxels so it is cheap enough to do here too.
+
+        cancellationToken.throwIfCancelled();
         
+        const Array3D<Voxel> &voxels = voxelsOfRegions.front();
         bool active = false;
         glm::vec3 cursorPos, placePos;
         
         try {
-            terrain->readerTransaction(voxelBox, [&](Array3D<Voxel> &&voxels){
-                for (const auto &pos : slice(voxels, ray, maxPlaceDistance)) {
-                    const Voxel &voxel = voxels.reference(pos);
-                    
-                    if (voxel.value != 0.f) {
-                        active = true;
-                        cursorPos = pos;
-                        break;
-                    } else {
-                        placePos = pos;
-                    }
+            for (const auto &pos : slice(voxels, ray, maxPlaceDistance)) {
+                const Voxel &voxel = voxels.reference(pos);
+                
+                if (voxel.value != 0.f) {
+                    active = true;
+                    cursorPos = pos;
+                    break;
+                } else {
+                    placePos = pos;
                 }
-            });
-        } catch (OutOfBoundsException e) {
+            }
+        } catch (const OutOfBoundsException &e) {
             log->error("TerrainCursorSystem::requestCursorUpdate triggered OutOfBoundsException: {}", e.what());
-            throw BrokenPromiseException();
-        }
-        
-        // Return a tuple containing the updated cursor value and the start time
-        // of the computation.
-        return std::make_tuple(active, cursorPos, placePos, startTime);
-
-    }).then(_mainThreadDispatcher, [log=_log,
-                                    cancellationToken=cursor.cancellationToken,
-                                    cursorEntity=std::move(cursorEntity)](auto tuple) mutable{
-
-        // This task executes on the main thread because we'll be using it to
-        // update our entity's components.
-
-        if (cancellationToken && cancellationToken->load()) {
-            throw BrokenPromiseException();
+            return;
         }
         
-        const auto& [active, cursorPos, placePos, startTime] = tuple;
-        
         // The entity or these components may have been destroyed in the
         // interim. Check first.
         if (cursorEntity.valid()) {
@@ -240,8 +234,22 @@ void TerrainCursorSystem::setBlockUnderCursor(TerrainCursor &cursor,
     
     glm::vec3 location = usePlacePos ? cursor.placePos : cursor.pos;
     Voxel voxel{value};
-    entityx::Entity terrainEntity = cursor.terrainEntity;
+    scheduleOperation(cursor.terrainEntity, std::make_shared<TerrainOperationEditPoint>(location, voxel));
+}
     
+void TerrainCursorSystem::placeLightUnderCursor(TerrainCursor &cursor)
+{
+    if (!cursor.active) {
+        return;
+    }
+    
+    // The light is placed in the empty voxel in front of the cursor.
+    scheduleOperation(cursor.terrainEntity, std::make_shared<TerrainOperationEditLight>(cursor.placePos, MAX_LIGHT));
+}
+
+void TerrainCursorSystem::scheduleOperation(entityx::Entity terrainEntity,
+                                            std::shared_ptr<TerrainOperation> operation)
+{
     if (!terrainEntity.valid()) {
         return;
     }
@@ -251,13 +259,61 @@ void TerrainCursorSystem::setBlockUnderCursor(TerrainCursor &cursor,
     if (handleTerrain.valid()) {
         _needsUpdate = true;
         
-        // Schedule a task to asynchronously update the terrain.
-        // We do this off the main thread because it may block on a lock to
-        // access the terrain.
-        auto operation = std::make_shared<TerrainOperationEditPoint>(location, voxel);
+        // Update the terrain asynchronously, off the main thread, as the
+        // edit must wait for a lock to access the terrain and it is recorded
+        // in the journal on file.
         std::shared_ptr<Terrain> terrain = handleTerrain.get()->terrain;
-        _dispatcher->async([terrain, operation]{
-            terrain->writerTransaction(operation);
-        });
+        
+        // Edits must be applied in the order they were made. Only one edit is
+        // in flight at a time, and each one starts the next when it finishes.
+        // The queue is shared with the edits as this system may be destroyed
+        // before they finish.
+        bool mustStartEdits = false;
+        {
+            std::scoped_lock lock(_pendingEdits->lock);
+            _pendingEdits->edits.emplace(terrain, operation);
+            if (!_pendingEdits->taskPending) {
+                _pendingEdits->taskPending = true;
+                mustStartEdits = true;
+            }
+        }
+        
+        if (mustStartEdits) {
+            terrain->getDispatcher()->dispatch(TaskDispatcher::HighPriority, [log=_log, pendingEdits=_pendingEdits]{
+                applyNextPendingEdit(log, pendingEdits);
+            });
+        }
     }
 }
+
+void TerrainCursorSystem::applyNextPendingEdit(const std::shared_ptr<spdlog::logger> &log,
+                                               const std::shared_ptr<PendingEdits> &pendingEdits)
+{
+    std::pair<std::shared_ptr<Terrain>, std::shared_ptr<TerrainOperation>> edit;
+    
+    {
+        std::scoped_lock lock(pendingEdits->lock);
+        if (pendingEdits->edits.empty()) {
+            pendingEdits->taskPending = false;
+            return;
+        }
+        edit = std::move(pendingEdits->edits.front());
+        pendingEdits->edits.pop();
+    }
+    
+    const auto &[terrain, operation] = edit;
+    auto future = std::make_shared<Future<void>>(terrain->asyncWriterTransaction(operation, TaskDispatcher::HighPriority));
+    
+    // Move on to the next edit whether or not this one succeeded. The future
+    // is kept alive until then so that the failure can be logged.
+    future->onReady([log, pendingEdits, future, dispatcher=terrain->getDispatcher()]{
+        dispatcher->dispatch(TaskDispatcher::HighPriority, [log, pendingEdits, future]{
+            try {
+                future->get();
+            } catch (const std::exception &exception) {
+                log->error("TerrainCursorSystem::applyNextPendingEdit failed to apply an edit: {}", exception.what());
+            }
+            applyNextPendingEdit(log, pendingEdits);
+        });
+    });
+}
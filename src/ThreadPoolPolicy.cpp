@@ -0,0 +1,208 @@
+//
+//  ThreadPoolPolicy.cpp
+//  PinkTopaz
+//
+
+#include "ThreadPoolPolicy.hpp"
+#include "Exception.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+// Divides the worker budget among subsystems in proportion to their shares.
+// This uses the largest remainder method, so the allotments add up to exactly
+// the budget. Every subsystem gets at least one worker, which is taken from
+// the largest allotment. When there are at least as many subsystems as
+// workers in the budget, or no subsystem has a share, each gets one worker.
+static std::map<std::string, unsigned> apportionWorkers(const std::map<std::string, float> &shares,
+                                                        unsigned budget)
+{
+    std::map<std::string, unsigned> counts;
+    
+    float totalShare = 0.f;
+    for (const auto &pair : shares) {
+        totalShare += std::max(0.f, pair.second);
+    }
+    
+    if (totalShare <= 0.f || shares.size() >= budget) {
+        for (const auto &pair : shares) {
+            counts[pair.first] = 1;
+        }
+        return counts;
+    }
+    
+    // Give each subsystem the whole part of its quota, and then hand out the
+    // workers which remain to the largest fractional parts.
+    std::vector<std::pair<float, std::string>> remainders;
+    unsigned assigned = 0;
+    for (const auto &pair : shares) {
+        const float quota = std::max(0.f, pair.second) / totalShare * budget;
+        const unsigned count = (unsigned)std::floor(quota);
+        counts[pair.first] = count;
+        assigned += count;
+        remainders.emplace_back(quota - count, pair.first);
+    }
+    std::stable_sort(remainders.begin(), remainders.end(), [](const auto &a, const auto &b){
+        return a.first > b.first;
+    });
+    for (size_t i = 0; assigned < budget; ++i) {
+        counts[remainders[i % remainders.size()].second]++;
+        assigned++;
+    }
+    
+    // There are fewer subsystems than workers, so some allotment has more
+    // than one worker to give up.
+    for (auto &pair : counts) {
+        if (pair.second == 0) {
+            auto largest = std::max_element(counts.begin(), counts.end(), [](const auto &a, const auto &b){
+                return a.second < b.second;
+            });
+            assert(largest->second > 1);
+            largest->second--;
+            pair.second = 1;
+        }
+    }
+    
+    return counts;
+}
+
+ThreadPoolPolicy::ThreadPoolPolicy(const Settings &settings,
+                                   const CpuTopology &topology)
+ : _settings(settings),
+   _topology(topology)
+{
+    if (_topology.nodes.empty() || _topology.numberOfCpus() == 0) {
+        throw Exception("ThreadPoolPolicy: the topology has no CPUs");
+    }
+    
+    const unsigned numberOfCpus = _topology.numberOfCpus();
+    if (_settings.workerBudget > 0) {
+        _workerBudget = _settings.workerBudget;
+    } else {
+        _workerBudget = std::max(1u, numberOfCpus - 1);
+    }
+    
+    const std::map<std::string, unsigned> counts = apportionWorkers(_settings.shares, _workerBudget);
+    
+    // Walk the CPUs node by node so that a subsystem's slice of CPUs tends to
+    // fall within a single node. The first CPU is left for the main thread,
+    // unless that would leave the workers with nothing.
+    std::vector<unsigned> cpus;
+    for (const auto &node : _topology.nodes) {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+    size_t nextCpu = (cpus.size() > 1) ? 1 : 0;
+    
+    for (const auto &pair : _settings.shares) {
+        Allotment allotment;
+        allotment.numberOfThreads = counts.at(pair.first);
+        
+        for (unsigned i = 0; i < allotment.numberOfThreads; ++i) {
+            allotment.cpus.push_back(cpus[nextCpu]);
+            nextCpu = (nextCpu + 1) % cpus.size();
+        }
+        
+        _allotments[pair.first] = std::move(allotment);
+    }
+}
+
+unsigned ThreadPoolPolicy::getNumberOfThreads(const std::string &subsystem) const
+{
+    auto iter = _allotments.find(subsystem);
+    if (iter == _allotments.end()) {
+        return 1;
+    }
+    return iter->second.numberOfThreads;
+}
+
+std::vector<unsigned> ThreadPoolPolicy::getAffinity(const std::string &subsystem,
+                                                    unsigned workerIndex) const
+{
+    if (!_settings.pinThreads) {
+        return {};
+    }
+    
+    auto iter = _allotments.find(subsystem);
+    if (iter == _allotments.end() || iter->second.cpus.empty()) {
+        return {};
+    }
+    
+    const auto &cpus = iter->second.cpus;
+    const unsigned cpu = cpus[workerIndex % cpus.size()];
+    if (_settings.groupByNumaNode) {
+        return nodeContaining(cpu);
+    } else {
+        return {cpu};
+    }
+}
+
+std::function<void(unsigned workerIndex)> ThreadPoolPolicy::getWorkerStartHook(const std::string &subsystem) const
+{
+    if (!_settings.pinThreads || !isThreadAffinitySupported()) {
+        return nullptr;
+    }
+    
+    std::vector<std::vector<unsigned>> affinity;
+    for (unsigned i = 0, n = getNumberOfThreads(subsystem); i < n; ++i) {
+        affinity.emplace_back(getAffinity(subsystem, i));
+    }
+    
+    return [affinity=std::move(affinity)](unsigned workerIndex){
+        if (workerIndex < affinity.size() && !affinity[workerIndex].empty()) {
+            try {
+                setAffinityForCurrentThread(affinity[workerIndex]);
+            } catch (const Exception &) {
+                // Pinning is only an optimization. The worker can run
+                // anywhere.
+            }
+        }
+    };
+}
+
+std::string ThreadPoolPolicy::describe() const
+{
+    auto describeCpus = [](std::ostream &os, const std::vector<unsigned> &cpus){
+        os << "{";
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            os << (i == 0 ? "" : ", ") << cpus[i];
+        }
+        os << "}";
+    };
+    
+    std::stringstream os;
+    os << _topology.numberOfCpus() << " CPUs in "
+       << _topology.nodes.size() << " NUMA node(s)";
+    for (size_t i = 0; i < _topology.nodes.size(); ++i) {
+        os << "\n\tnode " << i << ": ";
+        describeCpus(os, _topology.nodes[i]);
+    }
+    
+    os << "\nWorker budget: " << _workerBudget << " threads";
+    if (_settings.pinThreads && isThreadAffinitySupported()) {
+        os << (_settings.groupByNumaNode ? ", pinned to NUMA nodes" : ", pinned to CPUs");
+    } else {
+        os << ", not pinned";
+    }
+    
+    for (const auto &pair : _allotments) {
+        os << "\n\t" << pair.first << ": " << pair.second.numberOfThreads << " threads";
+        if (_settings.pinThreads && isThreadAffinitySupported()) {
+            os << " on CPUs ";
+            describeCpus(os, pair.second.cpus);
+        }
+    }
+    
+    return os.str();
+}
+
+const std::vector<unsigned>& ThreadPoolPolicy::nodeContaining(unsigned cpu) const
+{
+    for (const auto &node : _topology.nodes) {
+        if (std::find(node.begin(), node.end(), cpu) != node.end()) {
+            return node;
+        }
+    }
+    assert(!"unreachable");
+    return _topology.nodes.front();
+}
@@ -23,7 +23,8 @@
 World::World(std::shared_ptr<spdlog::logger> log,
              const Preferences &preferences,
              const std::shared_ptr<GraphicsDevice> &graphicsDevice,
-             const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher)
+             const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher,
+             const ThreadPoolPolicy &threadPoolPolicy)
  : _log(log),
    _preferences(preferences)
 {
@@ -59,6 +60,7 @@ World::World(std::shared_ptr<spdlog::logger> log,
                                                          _log,
                                                          graphicsDevice,
                                                          mainThreadDispatcher,
+                                                         threadPoolPolicy,
                                                          events,
                                                          cameraPosition);
     entityx::Entity terrainEntity = entities.create();
@@ -0,0 +1,146 @@
+//
+//  DistanceBucketQueueBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "Grid/DistanceBucketQueue.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Stands in for a batch of terrain cells waiting to be meshed.
+struct Item
+{
+    glm::vec3 position;
+    std::vector<int> payload;
+};
+
+struct ItemPosition
+{
+    glm::vec3 operator()(const Item &item) const
+    {
+        return item.position;
+    }
+};
+
+// Simulates the terrain rebuild actor during load. Cells are pushed in groups
+// while the camera moves, and a few are popped between pushes as workers pick
+// them up.
+struct Scenario
+{
+    static constexpr size_t numberOfCells = 50'000;
+    static constexpr size_t cellsPerPush = 250;
+    static constexpr size_t popsPerPush = 50;
+    static constexpr float cameraStep = 10.f;
+};
+
+static std::vector<glm::vec3> generateCellPositions()
+{
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> dist(-64, 64);
+    std::vector<glm::vec3> positions;
+    for (size_t i = 0; i < Scenario::numberOfCells; ++i) {
+        positions.emplace_back(16.f * dist(generator), 0.f, 16.f * dist(generator));
+    }
+    return positions;
+}
+
+static glm::vec3 cameraPositionAfterPush(size_t pushIndex)
+{
+    return glm::vec3(Scenario::cameraStep * pushIndex, 0.f, 0.f);
+}
+
+// The previous approach: re-sort a deque on every push and camera move.
+static auto benchmarkSortedDeque(const std::vector<glm::vec3> &positions)
+{
+    std::deque<Item> queue;
+    glm::vec3 searchPoint(0.f);
+    
+    auto sort = [&]{
+        std::sort(queue.begin(), queue.end(), [&](const Item &a, const Item &b){
+            return glm::distance(a.position, searchPoint) < glm::distance(b.position, searchPoint);
+        });
+    };
+    
+    size_t numberPopped = 0;
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0, pushIndex = 0; i < positions.size(); i += Scenario::cellsPerPush, ++pushIndex) {
+        for (size_t j = i; j < std::min(positions.size(), i + Scenario::cellsPerPush); ++j) {
+            queue.push_back(Item{positions[j], std::vector<int>(4)});
+        }
+        sort();
+        
+        searchPoint = cameraPositionAfterPush(pushIndex);
+        sort();
+        
+        for (size_t j = 0; j < Scenario::popsPerPush && !queue.empty(); ++j) {
+            queue.pop_front();
+            numberPopped++;
+        }
+    }
+    while (!queue.empty()) {
+        queue.pop_front();
+        numberPopped++;
+    }
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    if (numberPopped != positions.size()) {
+        std::cerr << "unexpected number of items popped" << std::endl;
+    }
+    return finishTime - startTime;
+}
+
+static auto benchmarkDistanceBucketQueue(const std::vector<glm::vec3> &positions)
+{
+    DistanceBucketQueue<Item, ItemPosition> queue(8.f, glm::vec3(0.f));
+    
+    size_t numberPopped = 0;
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0, pushIndex = 0; i < positions.size(); i += Scenario::cellsPerPush, ++pushIndex) {
+        for (size_t j = i; j < std::min(positions.size(), i + Scenario::cellsPerPush); ++j) {
+            queue.push(Item{positions[j], std::vector<int>(4)});
+        }
+        
+        queue.setSearchPoint(cameraPositionAfterPush(pushIndex));
+        
+        for (size_t j = 0; j < Scenario::popsPerPush && !queue.empty(); ++j) {
+            (void)queue.pop();
+            numberPopped++;
+        }
+    }
+    while (!queue.empty()) {
+        (void)queue.pop();
+        numberPopped++;
+    }
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    if (numberPopped != positions.size()) {
+        std::cerr << "unexpected number of items popped" << std::endl;
+    }
+    return finishTime - startTime;
+}
+
+int main(int argc, char *argv[])
+{
+    using ms = std::chrono::milliseconds;
+    const auto positions = generateCellPositions();
+    
+    const auto sortedDuration = benchmarkSortedDeque(positions);
+    const auto bucketDuration = benchmarkDistanceBucketQueue(positions);
+    
+    std::cout << "Pushing " << positions.size() << " cells while moving the search point"
+              << std::endl
+              << "  sorted deque: "
+              << std::chrono::duration_cast<ms>(sortedDuration).count()
+              << " ms" << std::endl
+              << "  distance bucket queue: "
+              << std::chrono::duration_cast<ms>(bucketDuration).count()
+              << " ms" << std::endl;
+    
+    return 0;
+}
@@ -0,0 +1,204 @@
+//
+//  TaskDispatcherBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "TaskDispatcher.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <numeric>
+#include <thread>
+
+// Many tiny tasks posted from a single external thread. Every task goes
+// through the dispatcher's queue(s) so this mostly measures lock contention.
+static auto benchmarkExternalPosting(TaskDispatcher::Scheduling scheduling,
+                                     unsigned numThreads,
+                                     size_t numTasks)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads, scheduling);
+    std::atomic<size_t> counter(0);
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    auto futures = dispatcher->map(numTasks, [&]{ counter++; });
+    waitForAll(futures);
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+// As above, but with fire-and-forget tasks which have no Future.
+static auto benchmarkExternalDispatch(TaskDispatcher::Scheduling scheduling,
+                                      unsigned numThreads,
+                                      size_t numTasks)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads, scheduling);
+    std::atomic<size_t> counter(0);
+    std::promise<void> done;
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < numTasks; ++i) {
+        dispatcher->dispatch([&]{
+            if (++counter == numTasks) {
+                done.set_value();
+            }
+        });
+    }
+    done.get_future().wait();
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+// A few coarse tasks each fan out into many tiny tasks from the worker
+// threads. This is the pattern used by the terrain code, where a batch of
+// chunks fans out into per-chunk work.
+static auto benchmarkNestedPosting(TaskDispatcher::Scheduling scheduling,
+                                   unsigned numThreads,
+                                   size_t numOuterTasks,
+                                   size_t numInnerTasks)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads, scheduling);
+    std::atomic<size_t> counter(0);
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    auto outer = dispatcher->map(numOuterTasks, [&]{
+        return dispatcher->map(numInnerTasks, [&]{ counter++; });
+    });
+    for (auto &future : outer) {
+        auto inner = future.get();
+        waitForAll(inner);
+    }
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+// Fine-grained per-element work, e.g., per-voxel work, with one task per
+// element through map().
+static auto benchmarkFineGrainedMap(TaskDispatcher::Scheduling scheduling,
+                                    unsigned numThreads,
+                                    size_t numElements)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads, scheduling);
+    std::vector<float> output(numElements);
+    std::vector<size_t> indices(numElements);
+    std::iota(indices.begin(), indices.end(), 0);
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    auto futures = dispatcher->map(indices, [&](size_t index){
+        output[index] = std::sqrt((float)index);
+    });
+    waitForAll(futures);
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+// The same work through parallelFor(), which hands out blocks of elements.
+static auto benchmarkFineGrainedParallelFor(TaskDispatcher::Scheduling scheduling,
+                                            unsigned numThreads,
+                                            size_t numElements)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads, scheduling);
+    std::vector<float> output(numElements);
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    dispatcher->parallelFor(0, numElements, [&](size_t index){
+        output[index] = std::sqrt((float)index);
+    });
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+// Several threads post tiny tasks to a dispatcher with no workers while one
+// thread flushes it, like the main thread dispatcher.
+static auto benchmarkMainThreadPosting(TaskDispatcher::Scheduling scheduling,
+                                       unsigned numProducers,
+                                       size_t numTasksPerProducer)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", 0, scheduling);
+    const size_t numTasks = numProducers * numTasksPerProducer;
+    size_t counter = 0;
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> producers;
+    for (unsigned i = 0; i < numProducers; ++i) {
+        producers.emplace_back([&]{
+            for (size_t j = 0; j < numTasksPerProducer; ++j) {
+                dispatcher->dispatch([&]{ counter++; });
+            }
+        });
+    }
+    while (counter < numTasks) {
+        dispatcher->flush(std::chrono::milliseconds(4));
+    }
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    dispatcher->shutdown();
+    return finishTime - startTime;
+}
+
+static const char* schedulingName(TaskDispatcher::Scheduling scheduling)
+{
+    switch (scheduling) {
+        case TaskDispatcher::SharedQueue: return "SharedQueue";
+        case TaskDispatcher::WorkStealing: return "WorkStealing";
+        case TaskDispatcher::Inbox: return "Inbox";
+    }
+    return "Unknown";
+}
+
+int main(int argc, char *argv[])
+{
+    using ms = std::chrono::milliseconds;
+    const unsigned numThreads = std::max(2u, std::thread::hardware_concurrency());
+    
+    for (auto scheduling : {TaskDispatcher::SharedQueue, TaskDispatcher::WorkStealing}) {
+        const auto externalDuration = benchmarkExternalPosting(scheduling, numThreads, 1'000'000);
+        const auto dispatchDuration = benchmarkExternalDispatch(scheduling, numThreads, 1'000'000);
+        const auto nestedDuration = benchmarkNestedPosting(scheduling, numThreads, numThreads * 4, 25'000);
+        const auto mapDuration = benchmarkFineGrainedMap(scheduling, numThreads, 1'000'000);
+        const auto parallelForDuration = benchmarkFineGrainedParallelFor(scheduling, numThreads, 1'000'000);
+        
+        std::cout << schedulingName(scheduling) << " (" << numThreads << " threads)"
+                  << std::endl
+                  << "  external posting: "
+                  << std::chrono::duration_cast<ms>(externalDuration).count()
+                  << " ms" << std::endl
+                  << "  external posting with dispatch(): "
+                  << std::chrono::duration_cast<ms>(dispatchDuration).count()
+                  << " ms" << std::endl
+                  << "  nested posting: "
+                  << std::chrono::duration_cast<ms>(nestedDuration).count()
+                  << " ms" << std::endl
+                  << "  per-element work with map(): "
+                  << std::chrono::duration_cast<ms>(mapDuration).count()
+                  << " ms" << std::endl
+                  << "  per-element work with parallelFor(): "
+                  << std::chrono::duration_cast<ms>(parallelForDuration).count()
+                  << " ms" << std::endl;
+    }
+    
+    for (auto scheduling : {TaskDispatcher::SharedQueue, TaskDispatcher::Inbox}) {
+        const auto duration = benchmarkMainThreadPosting(scheduling, numThreads, 250'000);
+        std::cout << schedulingName(scheduling) << " (no workers, "
+                  << numThreads << " producers)" << std::endl
+                  << "  posting to a flushed dispatcher: "
+                  << std::chrono::duration_cast<ms>(duration).count()
+                  << " ms" << std::endl;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,193 @@
+//
+//  InitialSunlightPropagationBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/InitialSunlightPropagationOperation.hpp"
+#include "Terrain/VoxelDataGenerator.hpp"
+#include "Terrain/TerrainConfig.hpp"
+
+#include <boost/filesystem.hpp>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+// Lights a square region of columns of chunks from a cold start, once for each
+// propagation mode and kernel. This is done for a region of 8x8 columns, and
+// for a region of 16x16 columns, which is the size of the default active
+// region. That reaches 256 voxels to either side of the camera. The regions
+// surround the floating mountain so the flood fill has some interesting terrain
+// to work through. This is repeated for terrain generated from several seeds.
+struct Scenario
+{
+    static constexpr std::array<int, 2> regionSizesInColumns = {{8, 16}};
+    static constexpr std::array<unsigned, 3> terrainSeeds = {{52, 1337, 90210}};
+    
+    // Voxels in this band of heights are compared between the two modes.
+    static constexpr float comparisonMinY = -32.f;
+    static constexpr float comparisonMaxY = 96.f;
+};
+
+static const char* nameOfMode(InitialSunlightPropagationOperation::PropagationMode mode)
+{
+    switch (mode) {
+        case InitialSunlightPropagationOperation::PerColumn: return "PerColumn";
+        case InitialSunlightPropagationOperation::Batched: return "Batched";
+        case InitialSunlightPropagationOperation::Parallel: return "Parallel";
+    }
+    return "Unknown";
+}
+
+static const char* nameOfKernel(InitialSunlightPropagationOperation::PropagationKernel kernel)
+{
+    switch (kernel) {
+        case InitialSunlightPropagationOperation::Scalar: return "Scalar";
+        case InitialSunlightPropagationOperation::Shafts: return "Shafts";
+    }
+    return "Unknown";
+}
+
+// Returns a new chunk in the same way as VoxelData::createNewChunk().
+static std::unique_ptr<VoxelDataChunk> createChunk(const VoxelDataGenerator &generator,
+                                                   const AABB &cell)
+{
+    const auto classification = generator.classify(cell);
+    if (classification == VoxelDataGenerator::Mixed) {
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createCompactChunk(generator.copy(cell)));
+    }
+    
+    const auto adjusted = generator.snapRegionToCellBoundaries(cell);
+    const auto res = generator.countCellsInRegion(adjusted);
+    if (classification == VoxelDataGenerator::Ground) {
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createGroundChunk(adjusted, res));
+    } else {
+        return std::make_unique<VoxelDataChunk>(VoxelDataChunk::createSkyChunk(adjusted, res));
+    }
+}
+
+// The outcome of lighting the region once.
+struct Result
+{
+    // The voxels of the comparison band.
+    Array3D<Voxel> voxels;
+    
+    // The time taken to light the region.
+    std::chrono::milliseconds duration;
+};
+
+// Lights the region with a cold chunk cache and an empty map directory.
+// numberOfColumns -- The width and depth of the region, in columns of chunks.
+static Result run(const std::shared_ptr<spdlog::logger> &log,
+                  const std::shared_ptr<TaskDispatcher> &dispatcher,
+                  const VoxelDataGenerator &generator,
+                  int numberOfColumns,
+                  InitialSunlightPropagationOperation::PropagationMode mode,
+                  InitialSunlightPropagationOperation::PropagationKernel kernel)
+{
+    using ms = std::chrono::milliseconds;
+    
+    const float regionExtent = numberOfColumns * TERRAIN_CHUNK_SIZE / 2.f;
+    const AABB boundingBox = generator.boundingBox();
+    const glm::ivec3 gridResolution = generator.gridResolution();
+    
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(mapDirectory);
+    const glm::ivec3 mapRegionRes = glm::max(glm::ivec3(1), gridResolution / (int)MAP_REGION_SIZE);
+    auto mapRegionStore = std::make_unique<MapRegionStore>(log, mapDirectory, boundingBox, mapRegionRes);
+    
+    auto chunks = std::make_unique<PersistentVoxelChunks>(log,
+                                                          boundingBox,
+                                                          gridResolution,
+                                                          TERRAIN_CHUNK_SIZE,
+                                                          std::move(mapRegionStore),
+                                                          [&](const AABB &cell, Morton3){
+                                                              return createChunk(generator, cell);
+                                                          },
+                                                          dispatcher,
+                                                          VOXEL_CHUNK_MEMORY_BUDGET);
+    
+    const glm::vec3 center(64.f, 0.f, 64.f);
+    std::chrono::milliseconds duration;
+    {
+        const AABB region{
+            center,
+            glm::vec3(regionExtent, boundingBox.extent.y, regionExtent)
+        };
+        
+        InitialSunlightPropagationOperation operation(log, *chunks, dispatcher, mode, kernel);
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        operation.performInitialSunlightPropagationIfNecessary(region);
+        const auto finishTime = std::chrono::high_resolution_clock::now();
+        
+        duration = std::chrono::duration_cast<ms>(finishTime - startTime);
+        const auto statistics = operation.getStatistics();
+        std::cout << nameOfMode(mode) << " propagation with the "
+                  << nameOfKernel(kernel) << " kernel through "
+                  << numberOfColumns << "x" << numberOfColumns
+                  << " cold columns on " << dispatcher->getNumberOfThreads() << " threads" << std::endl
+                  << "  " << duration.count() << " ms, "
+                  << statistics.numberOfNodesVisited << " BFS nodes visited, "
+                  << statistics.numberOfVoxelsInShafts << " voxels filled in shafts, "
+                  << statistics.numberOfChunksFetched << " chunks fetched, "
+                  << statistics.numberOfChunksStored << " chunks saved" << std::endl;
+    }
+    
+    const float height = Scenario::comparisonMaxY - Scenario::comparisonMinY;
+    const AABB comparisonRegion{
+        glm::vec3(center.x, Scenario::comparisonMinY + height / 2.f, center.z),
+        glm::vec3(regionExtent, height / 2.f, regionExtent)
+    };
+    Result result{chunks->loadSubRegion(comparisonRegion), duration};
+    
+    // Finish saving chunks before removing the map directory.
+    chunks.reset();
+    boost::filesystem::remove_all(mapDirectory);
+    
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    auto log = spdlog::stdout_color_mt("console");
+    log->set_level(spdlog::level::warn);
+    
+    const unsigned numThreads = std::max(2u, std::thread::hardware_concurrency());
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads);
+    
+    bool same = true;
+    for (const int numberOfColumns : Scenario::regionSizesInColumns) {
+        for (const unsigned seed : Scenario::terrainSeeds) {
+            std::cout << "Terrain seed " << seed << std::endl;
+            const VoxelDataGenerator generator(seed);
+            
+            // PerColumn with the Scalar kernel is the original operation, and
+            // the reference which the other modes and kernels must match.
+            const auto perColumn = run(log, dispatcher, generator, numberOfColumns,
+                                       InitialSunlightPropagationOperation::PerColumn,
+                                       InitialSunlightPropagationOperation::Scalar);
+            const auto batched = run(log, dispatcher, generator, numberOfColumns,
+                                     InitialSunlightPropagationOperation::Batched,
+                                     InitialSunlightPropagationOperation::Shafts);
+            const auto scalar = run(log, dispatcher, generator, numberOfColumns,
+                                    InitialSunlightPropagationOperation::Batched,
+                                    InitialSunlightPropagationOperation::Scalar);
+            const auto parallel = run(log, dispatcher, generator, numberOfColumns,
+                                      InitialSunlightPropagationOperation::Parallel,
+                                      InitialSunlightPropagationOperation::Shafts);
+            
+            const double speedup = (double)batched.duration.count() / std::max(1LL, (long long)parallel.duration.count());
+            std::cout << "Parallel is " << speedup << "x as fast as Batched" << std::endl;
+            
+            // Every mode and kernel must light the region as the reference does.
+            same = same &&
+                   (batched.voxels == perColumn.voxels) &&
+                   (scalar.voxels == perColumn.voxels) &&
+                   (parallel.voxels == perColumn.voxels);
+        }
+    }
+    std::cout << "Sunlight in all modes and kernels is " << (same ? "identical to PerColumn Scalar" : "DIFFERENT from PerColumn Scalar") << std::endl;
+    
+    dispatcher->shutdown();
+    return same ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+//
+//  PersistentVoxelChunksBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/PersistentVoxelChunks.hpp"
+#include "Terrain/TerrainConfig.hpp"
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+// Reads mesh-sized regions of voxels from a warm cache, as the terrain mesher
+// does. A region of 36^3 voxels touches up to eight chunks.
+struct Scenario
+{
+    static constexpr float worldExtent = 128.f;
+    static constexpr float worldHeightExtent = 32.f;
+    static constexpr float regionExtent = 18.f;
+    static constexpr size_t numberOfReads = 4000;
+};
+
+static std::vector<AABB> generateRegions()
+{
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> horizontal(Scenario::regionExtent, 2.f * Scenario::worldExtent - Scenario::regionExtent);
+    std::uniform_real_distribution<float> vertical(Scenario::regionExtent, 2.f * Scenario::worldHeightExtent - Scenario::regionExtent);
+    std::vector<AABB> regions;
+    for (size_t i = 0; i < Scenario::numberOfReads; ++i) {
+        const glm::vec3 center(horizontal(generator), vertical(generator), horizontal(generator));
+        regions.push_back(AABB{center, glm::vec3(Scenario::regionExtent)});
+    }
+    return regions;
+}
+
+int main(int argc, char *argv[])
+{
+    using ms = std::chrono::milliseconds;
+    
+    auto log = spdlog::stdout_color_mt("console");
+    log->set_level(spdlog::level::warn);
+    
+    const unsigned numThreads = std::max(2u, std::thread::hardware_concurrency());
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads);
+    
+    const AABB boundingBox{
+        glm::vec3(Scenario::worldExtent, Scenario::worldHeightExtent, Scenario::worldExtent),
+        glm::vec3(Scenario::worldExtent, Scenario::worldHeightExtent, Scenario::worldExtent)
+    };
+    const glm::ivec3 gridResolution = glm::ivec3(boundingBox.extent * 2.f);
+    
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(mapDirectory);
+    const glm::ivec3 mapRegionRes = glm::max(glm::ivec3(1), gridResolution / (int)MAP_REGION_SIZE);
+    auto mapRegionStore = std::make_unique<MapRegionStore>(log, mapDirectory, boundingBox, mapRegionRes);
+    
+    {
+        PersistentVoxelChunks chunks(log,
+                                     boundingBox,
+                                     gridResolution,
+                                     TERRAIN_CHUNK_SIZE,
+                                     std::move(mapRegionStore),
+                                     [](const AABB &cell, Morton3){
+                                         const glm::ivec3 res(TERRAIN_CHUNK_SIZE);
+                                         auto chunk = VoxelDataChunk::createGroundChunk(cell, res);
+                                         chunk.convertToArray();
+                                         return std::make_unique<VoxelDataChunk>(std::move(chunk));
+                                     },
+                                     dispatcher,
+                                     VOXEL_CHUNK_MEMORY_BUDGET);
+        
+        // Fault in every chunk so the timed reads come from the cache.
+        (void)chunks.loadSubRegion(boundingBox);
+        
+        const auto regions = generateRegions();
+        size_t numberOfVoxels = 0;
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        for (const AABB &region : regions) {
+            const glm::ivec3 res = chunks.loadSubRegion(region).gridResolution();
+            numberOfVoxels += res.x * res.y * res.z;
+        }
+        const auto finishTime = std::chrono::high_resolution_clock::now();
+        
+        const auto duration = std::chrono::duration_cast<ms>(finishTime - startTime);
+        std::cout << "loadSubRegion of " << regions.size() << " regions of 36^3 voxels on "
+                  << numThreads << " threads" << std::endl
+                  << "  " << duration.count() << " ms, "
+                  << (1000.0 * regions.size() / std::max<long long>(1, duration.count()))
+                  << " regions per second, "
+                  << numberOfVoxels << " voxels copied" << std::endl;
+    }
+    
+    dispatcher->shutdown();
+    boost::filesystem::remove_all(mapDirectory);
+    return 0;
+}
@@ -0,0 +1,169 @@
+//
+//  TorchLightPropagationBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "Terrain/IncrementalLightPropagation.hpp"
+#include "Terrain/TerrainConfig.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+
+// Places many torch light emitters above rolling ground, and times how long it
+// takes to propagate their light. The emitters are placed in one batch, and
+// then again one at a time in a fresh world for comparison.
+struct Scenario
+{
+    static constexpr int chunksWide = 8;
+    static constexpr int chunksHigh = 4;
+    static constexpr size_t numberOfEmitters = 10000;
+};
+
+// A world of chunks held in memory. Nothing is saved.
+class World
+{
+public:
+    const glm::ivec3 chunkGridResolution;
+    const glm::ivec3 gridResolution;
+    const GridIndexer voxelIndexer;
+    const GridIndexer chunkIndexer;
+    
+    World()
+     : chunkGridResolution(Scenario::chunksWide, Scenario::chunksHigh, Scenario::chunksWide),
+       gridResolution(chunkGridResolution * (int)TERRAIN_CHUNK_SIZE),
+       voxelIndexer(boundingBox(gridResolution), gridResolution),
+       chunkIndexer(boundingBox(gridResolution), chunkGridResolution)
+    {
+        // The bottom layer of chunks is rolling ground, and the rest is sky.
+        for (int z = 0; z < chunkGridResolution.z; ++z) {
+            for (int y = 0; y < chunkGridResolution.y; ++y) {
+                for (int x = 0; x < chunkGridResolution.x; ++x) {
+                    const glm::ivec3 chunkCellCoords(x, y, z);
+                    const AABB cell = chunkIndexer.cellAtCellCoords(chunkCellCoords);
+                    const glm::ivec3 res(TERRAIN_CHUNK_SIZE);
+                    auto chunk = std::make_unique<VoxelDataChunk>(VoxelDataChunk::createSkyChunk(cell, res));
+                    if (y == 0) {
+                        fillGround(*chunk, chunkCellCoords);
+                    }
+                    _chunks.push_back(std::move(chunk));
+                }
+            }
+        }
+    }
+    
+    VoxelDataChunk* chunkAt(const glm::ivec3 &chunkCellCoords)
+    {
+        const int index = chunkCellCoords.x + chunkGridResolution.x * (chunkCellCoords.y + chunkGridResolution.y * chunkCellCoords.z);
+        return _chunks[index].get();
+    }
+    
+    Voxel get(const glm::ivec3 &cellCoords)
+    {
+        const glm::ivec3 chunkCellCoords = cellCoords / (int)TERRAIN_CHUNK_SIZE;
+        return chunkAt(chunkCellCoords)->get(cellCoords - chunkCellCoords * (int)TERRAIN_CHUNK_SIZE);
+    }
+    
+    // Places the emitters and propagates their light.
+    // batchSize -- The number of emitters placed with each call to
+    //              IncrementalLightPropagation::editEmitters().
+    void placeEmitters(const std::vector<IncrementalLightPropagation::EmitterEdit> &emitters,
+                       size_t batchSize)
+    {
+        IncrementalLightPropagation lighting(voxelIndexer, chunkIndexer, [&](const glm::ivec3 &chunkCellCoords){
+            return chunkAt(chunkCellCoords);
+        });
+        for (size_t i = 0; i < emitters.size(); i += batchSize) {
+            const auto begin = emitters.begin() + i;
+            const auto end = emitters.begin() + std::min(i + batchSize, emitters.size());
+            lighting.editEmitters(std::vector<IncrementalLightPropagation::EmitterEdit>(begin, end));
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<VoxelDataChunk>> _chunks;
+    
+    static AABB boundingBox(const glm::ivec3 &gridResolution)
+    {
+        const glm::vec3 extent = glm::vec3(gridResolution) * 0.5f;
+        return AABB{extent, extent};
+    }
+    
+    static void fillGround(VoxelDataChunk &chunk, const glm::ivec3 &chunkCellCoords)
+    {
+        const int size = (int)TERRAIN_CHUNK_SIZE;
+        for (int z = 0; z < size; ++z) {
+            for (int x = 0; x < size; ++x) {
+                const int wx = chunkCellCoords.x * size + x;
+                const int wz = chunkCellCoords.z * size + z;
+                const int height = 16 + (int)(8.f * std::sin(wx * 0.1f) * std::cos(wz * 0.1f));
+                for (int y = 0; y < size; ++y) {
+                    chunk.set(glm::ivec3(x, y, z), Voxel(y < height, 0, 0));
+                }
+            }
+        }
+    }
+};
+
+static std::vector<IncrementalLightPropagation::EmitterEdit> generateEmitters(World &world)
+{
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> horizontal(0, world.gridResolution.x - 1);
+    std::uniform_int_distribution<int> vertical(0, world.gridResolution.y - 1);
+    std::uniform_int_distribution<unsigned> light(MAX_LIGHT / 2, MAX_LIGHT);
+    
+    std::vector<IncrementalLightPropagation::EmitterEdit> emitters;
+    while (emitters.size() < Scenario::numberOfEmitters) {
+        const glm::ivec3 cellCoords(horizontal(generator), vertical(generator), horizontal(generator));
+        if (world.get(cellCoords).value == 0) {
+            const glm::vec3 point = world.voxelIndexer.cellCenterAtCellCoords(cellCoords);
+            emitters.push_back({point, light(generator)});
+        }
+    }
+    return emitters;
+}
+
+static long long timePlacement(World &world,
+                               const std::vector<IncrementalLightPropagation::EmitterEdit> &emitters,
+                               size_t batchSize)
+{
+    using ms = std::chrono::milliseconds;
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    world.placeEmitters(emitters, batchSize);
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<ms>(finishTime - startTime).count();
+}
+
+int main(int argc, char *argv[])
+{
+    World batchedWorld, sequentialWorld;
+    const auto emitters = generateEmitters(batchedWorld);
+    
+    const long long batchedMs = timePlacement(batchedWorld, emitters, emitters.size());
+    const long long sequentialMs = timePlacement(sequentialWorld, emitters, 1);
+    
+    const glm::ivec3 res = batchedWorld.gridResolution;
+    std::cout << "Propagating " << emitters.size() << " torch light emitters through "
+              << res.x << "x" << res.y << "x" << res.z << " voxels" << std::endl
+              << "  Batched: " << batchedMs << " ms" << std::endl
+              << "  One at a time: " << sequentialMs << " ms" << std::endl;
+    
+    // The order of placement must not affect the result.
+    size_t numberOfMismatches = 0;
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                const glm::ivec3 cellCoords(x, y, z);
+                if (batchedWorld.get(cellCoords) != sequentialWorld.get(cellCoords)) {
+                    numberOfMismatches++;
+                }
+            }
+        }
+    }
+    std::cout << "Torch light in both worlds is "
+              << (numberOfMismatches == 0 ? "identical" : "DIFFERENT") << std::endl;
+    
+    return (numberOfMismatches == 0) ? 0 : 1;
+}
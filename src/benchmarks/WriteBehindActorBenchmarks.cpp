@@ -0,0 +1,151 @@
+//
+//  WriteBehindActorBenchmarks.cpp
+//  PinkTopaz
+//
+
+#include "WriteBehindActor.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Simulates the chunk saves made during initial world load. Each sunlight
+// pass covers the columns of a mesh batch plus a margin of one column on each
+// side, and then re-stores every chunk in those columns. Neighboring passes
+// overlap, so most chunks are stored several times.
+struct Scenario
+{
+    static constexpr int worldColumns = 32;
+    static constexpr int columnHeight = 8;
+    static constexpr int batchColumns = 2;
+    static constexpr int margin = 1;
+    static constexpr size_t chunkBytes = 32 * 1024;
+    static constexpr auto passDuration = std::chrono::microseconds(500);
+};
+
+using Chunk = std::vector<uint8_t>;
+
+// Stands in for compressing a chunk and writing it to the map file.
+static void compressAndWrite(const Chunk &chunk, std::atomic<size_t> &numberOfWrites)
+{
+    volatile uint32_t checksum = 0;
+    for (uint8_t byte : chunk) {
+        checksum = checksum * 31 + byte;
+    }
+    numberOfWrites++;
+}
+
+// Stands in for the voxel generation and flood fill done by a sunlight pass.
+static void busyWait(std::chrono::microseconds duration)
+{
+    const auto deadline = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < deadline) {}
+}
+
+// Runs every sunlight pass on the dispatcher. `store' is called for each
+// chunk a pass modifies.
+template<typename StoreFunction>
+static void runPasses(const std::shared_ptr<TaskDispatcher> &dispatcher, StoreFunction &&store)
+{
+    // Each pass is identified by the column at its minimum corner.
+    std::vector<int> passes;
+    for (int x = 0; x < Scenario::worldColumns; x += Scenario::batchColumns) {
+        for (int z = 0; z < Scenario::worldColumns; z += Scenario::batchColumns) {
+            passes.push_back(x * Scenario::worldColumns + z);
+        }
+    }
+    
+    auto futures = dispatcher->map(passes, [&](int pass){
+        busyWait(Scenario::passDuration);
+        const int passX = pass / Scenario::worldColumns;
+        const int passZ = pass % Scenario::worldColumns;
+        const Chunk chunk(Scenario::chunkBytes, (uint8_t)pass);
+        const int minX = std::max(0, passX - Scenario::margin);
+        const int minZ = std::max(0, passZ - Scenario::margin);
+        const int maxX = std::min(Scenario::worldColumns, passX + Scenario::batchColumns + Scenario::margin);
+        const int maxZ = std::min(Scenario::worldColumns, passZ + Scenario::batchColumns + Scenario::margin);
+        for (int x = minX; x < maxX; ++x) {
+            for (int z = minZ; z < maxZ; ++z) {
+                for (int y = 0; y < Scenario::columnHeight; ++y) {
+                    const int key = (x * Scenario::worldColumns + z) * Scenario::columnHeight + y;
+                    store(key, chunk);
+                }
+            }
+        }
+    });
+    waitForAll(futures);
+}
+
+// The previous approach: every store posts its own save task.
+static auto benchmarkSaveTaskPerStore(unsigned numThreads, size_t &numberOfStores, size_t &numberOfWrites)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads);
+    std::atomic<size_t> stores(0), writes(0);
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    runPasses(dispatcher, [&](int, const Chunk &chunk){
+        stores++;
+        dispatcher->dispatch([chunk, &writes]{
+            compressAndWrite(chunk, writes);
+        });
+    });
+    dispatcher->flush();
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    numberOfStores = stores;
+    numberOfWrites = writes;
+    return finishTime - startTime;
+}
+
+static auto benchmarkWriteBehindActor(unsigned numThreads, size_t &numberOfStores, size_t &numberOfWrites)
+{
+    auto dispatcher = std::make_shared<TaskDispatcher>("Benchmark", numThreads);
+    std::atomic<size_t> writes(0);
+    auto log = std::make_shared<spdlog::logger>("Benchmark", std::make_shared<spdlog::sinks::null_sink_mt>());
+    WriteBehindActor<int, Chunk> actor(log, dispatcher, [&](const int &, const Chunk &chunk){
+        compressAndWrite(chunk, writes);
+    });
+    
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    runPasses(dispatcher, [&](int key, const Chunk &chunk){
+        actor.store(key, chunk);
+    });
+    actor.flush();
+    const auto finishTime = std::chrono::high_resolution_clock::now();
+    
+    dispatcher->shutdown();
+    numberOfStores = actor.getNumberOfStoreRequests();
+    numberOfWrites = writes;
+    return finishTime - startTime;
+}
+
+int main(int argc, char *argv[])
+{
+    using ms = std::chrono::milliseconds;
+    const unsigned numThreads = std::max(2u, std::thread::hardware_concurrency());
+    const size_t numberOfChunks = Scenario::worldColumns * Scenario::worldColumns * Scenario::columnHeight;
+    
+    size_t directStores = 0, directWrites = 0;
+    const auto directDuration = benchmarkSaveTaskPerStore(numThreads, directStores, directWrites);
+    
+    size_t actorStores = 0, actorWrites = 0;
+    const auto actorDuration = benchmarkWriteBehindActor(numThreads, actorStores, actorWrites);
+    
+    std::cout << "Initial load of " << numberOfChunks << " chunks on "
+              << numThreads << " threads" << std::endl
+              << "  save task per store: " << directStores << " stores, "
+              << directWrites << " writes, "
+              << std::chrono::duration_cast<ms>(directDuration).count()
+              << " ms" << std::endl
+              << "  write-behind actor: " << actorStores << " stores, "
+              << actorWrites << " writes, "
+              << std::chrono::duration_cast<ms>(actorDuration).count()
+              << " ms" << std::endl;
+    
+    return 0;
+}
@@ -16,6 +16,7 @@
 #include "Renderer/GraphicsDevice.hpp"
 #include "TaskDispatcher.hpp"
 #include "Preferences.hpp"
+#include "ThreadPoolPolicy.hpp"
 
 
 // The central game loop, basically.
@@ -35,6 +36,7 @@ private:
     SDL_Window *_window;
     std::shared_ptr<spdlog::logger> _log;
     Preferences _preferences;
+    std::unique_ptr<ThreadPoolPolicy> _threadPoolPolicy;
 };
 
 #endif /* Application_hpp */
@@ -0,0 +1,76 @@
+//
+//  CancellationToken.hpp
+//  PinkTopaz
+//
+
+#ifndef CancellationToken_hpp
+#define CancellationToken_hpp
+
+#include "Exception.hpp"
+#include <atomic>
+#include <memory>
+
+// Exception thrown when an operation notices that it has been cancelled.
+class CancelledException : public Exception
+{
+public:
+    CancelledException() : Exception("CancelledException") {}
+    
+    template<typename... Args>
+    CancelledException(Args&&... args)
+    : Exception(std::forward<Args>(args)...)
+    {}
+};
+
+// Lets one thread ask long-running work on another thread to stop early.
+//
+// Copies of a token share the same state, so cancelling one cancels them all.
+// Cancellation is cooperative. The work must check the token periodically,
+// usually with throwIfCancelled(), and unwind when it has been cancelled.
+//
+// A default constructed token can never be cancelled. It is cheap to copy, so
+// APIs can accept a token by default without cost to callers who do not care.
+class CancellationToken
+{
+public:
+    // Constructs a token which can never be cancelled.
+    CancellationToken() = default;
+    
+    // Returns a new token which can be cancelled.
+    static CancellationToken create()
+    {
+        return CancellationToken(std::make_shared<std::atomic<bool>>(false));
+    }
+    
+    // Request that work observing this token stop. This has no effect on a
+    // token which cannot be cancelled.
+    void cancel() const
+    {
+        if (_cancelled) {
+            _cancelled->store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    // Returns true if cancel() has been called on this token, or a copy of it.
+    bool isCancelled() const
+    {
+        return _cancelled && _cancelled->load(std::memory_order_relaxed);
+    }
+    
+    // Throws CancelledException if the token has been cancelled.
+    void throwIfCancelled() const
+    {
+        if (isCancelled()) {
+            throw CancelledException();
+        }
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> _cancelled;
+    
+    CancellationToken(std::shared_ptr<std::atomic<bool>> cancelled)
+     : _cancelled(std::move(cancelled))
+    {}
+};
+
+#endif /* CancellationToken_hpp */
@@ -10,6 +10,7 @@
 #define Array3D_hpp
 
 #include <glm/vec3.hpp>
+#include <algorithm>
 #include <vector>
 
 #include "AABB.hpp"
@@ -168,6 +169,76 @@ public:
         return (size_t)index <= _maxValidIndex;
     }
     
+    // Copies a box of cells from another array into this one.
+    // This works entirely in integer cell space. The box is divided into
+    // aligned sub-blocks which are contiguous in Morton order in both arrays,
+    // and each of those is copied at once. Cells on the ragged edges of the
+    // box are copied one at a time.
+    // src -- The array to copy from.
+    // srcOrigin -- Cell coordinates of the minimum corner of the box in `src'.
+    // dstOrigin -- Cell coordinates of the minimum corner of the box in this
+    //              array.
+    // size -- The number of cells along each axis of the box.
+    void copyCells(const Array3D<CellType> &src,
+                   const glm::ivec3 &srcOrigin,
+                   const glm::ivec3 &dstOrigin,
+                   const glm::ivec3 &size)
+    {
+        checkCellBox(dstOrigin, size);
+        src.checkCellBox(srcOrigin, size);
+        
+        // A sub-block is contiguous in both arrays only when it is aligned in
+        // both. So, the block size is limited by the alignment of the offset
+        // between the two boxes.
+        const glm::ivec3 delta = dstOrigin - srcOrigin;
+        const int blockSize = chooseBlockSize(delta.x | delta.y | delta.z, size);
+        
+        const CellType *srcCells = src._cells.data();
+        CellType *dstCells = _cells.data();
+        
+        forEachBlock(srcOrigin, size, blockSize, [&](const glm::ivec3 &srcCellCoords, size_t count){
+            const size_t srcIndex = (size_t)Morton3(srcCellCoords);
+            const size_t dstIndex = (size_t)Morton3(srcCellCoords + delta);
+            std::copy_n(srcCells + srcIndex, count, dstCells + dstIndex);
+        }, [&](const glm::ivec3 &mins, const glm::ivec3 &maxs){
+            for (int z = mins.z; z < maxs.z; ++z) {
+                for (int y = mins.y; y < maxs.y; ++y) {
+                    for (int x = mins.x; x < maxs.x; ++x) {
+                        const glm::ivec3 srcCellCoords(x, y, z);
+                        dstCells[(size_t)Morton3(srcCellCoords + delta)] = srcCells[(size_t)Morton3(srcCellCoords)];
+                    }
+                }
+            }
+        });
+    }
+    
+    // Sets every cell in a box to the specified value.
+    // Like `copyCells', this works in integer cell space and fills aligned
+    // sub-blocks which are contiguous in Morton order at once.
+    // value -- The value to assign to each cell.
+    // origin -- Cell coordinates of the minimum corner of the box.
+    // size -- The number of cells along each axis of the box.
+    void fillCells(const CellType &value,
+                   const glm::ivec3 &origin,
+                   const glm::ivec3 &size)
+    {
+        checkCellBox(origin, size);
+        const int blockSize = chooseBlockSize(0, size);
+        CellType *cells = _cells.data();
+        
+        forEachBlock(origin, size, blockSize, [&](const glm::ivec3 &cellCoords, size_t count){
+            std::fill_n(cells + (size_t)Morton3(cellCoords), count, value);
+        }, [&](const glm::ivec3 &mins, const glm::ivec3 &maxs){
+            for (int z = mins.z; z < maxs.z; ++z) {
+                for (int y = mins.y; y < maxs.y; ++y) {
+                    for (int x = mins.x; x < maxs.x; ++x) {
+                        cells[(size_t)Morton3(glm::ivec3(x, y, z))] = value;
+                    }
+                }
+            }
+        });
+    }
+    
     // Returns a pointer to the raw data. Useful for serialization.
     void* data()
     {
@@ -181,8 +252,91 @@ public:
     }
     
 private:
+    // The largest sub-block used by `copyCells' and `fillCells'. A block of
+    // this size holds 512 cells, which is plenty to amortize the overhead.
+    static constexpr int MaxBlockSize = 8;
+    
     const size_t _maxValidIndex;
     std::vector<CellType> _cells;
+    
+    // Throws when the box of cells does not lie within the grid.
+    void checkCellBox(const glm::ivec3 &origin, const glm::ivec3 &size) const
+    {
+        if constexpr (EnableVerboseBoundsChecking) {
+            const glm::ivec3 res = gridResolution();
+            if (origin.x < 0 || origin.y < 0 || origin.z < 0 ||
+                size.x < 0 || size.y < 0 || size.z < 0 ||
+                origin.x + size.x > res.x ||
+                origin.y + size.y > res.y ||
+                origin.z + size.z > res.z) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException\nboundingBox={}\norigin={}\nsize={}\ngridResolution={}",
+                                                       boundingBox(),
+                                                       glm::to_string(origin),
+                                                       glm::to_string(size),
+                                                       glm::to_string(res)));
+            }
+        }
+    }
+    
+    // Chooses the largest power-of-two block size such that blocks aligned
+    // to the box's coordinate space are also aligned after an offset with the
+    // specified bits, and which is no larger than the box.
+    static int chooseBlockSize(int offsetBits, const glm::ivec3 &size)
+    {
+        const int smallestDimension = std::min(size.x, std::min(size.y, size.z));
+        int blockSize = MaxBlockSize;
+        while (blockSize > 1 && ((offsetBits & (blockSize - 1)) != 0 || blockSize > smallestDimension)) {
+            blockSize >>= 1;
+        }
+        return blockSize;
+    }
+    
+    // Visits a box of cells in pieces which are contiguous in Morton order.
+    // Each aligned block of `blockSize' cells on a side which lies entirely
+    // within the box is passed to `blockFn'. The remaining cells on the
+    // ragged edges of the box are passed to `cellsFn' as smaller boxes. When
+    // the block size is one, the whole box is passed to `cellsFn'.
+    // blockFn -- Called with the cell coordinates of the first cell in the
+    //            block and the number of cells in the block.
+    // cellsFn -- Called with the minimum cell coordinates of the box, and the
+    //            cell coordinates one past the maximum corner of the box.
+    template<typename BlockFunction, typename CellsFunction>
+    static void forEachBlock(const glm::ivec3 &origin,
+                             const glm::ivec3 &size,
+                             int blockSize,
+                             BlockFunction &&blockFn,
+                             CellsFunction &&cellsFn)
+    {
+        const glm::ivec3 end = origin + size;
+        
+        if (blockSize == 1) {
+            cellsFn(origin, end);
+            return;
+        }
+        
+        const size_t cellsPerBlock = (size_t)blockSize * blockSize * blockSize;
+        
+        // Round the origin down so that blocks are aligned.
+        const int mask = ~(blockSize - 1);
+        const glm::ivec3 first(origin.x & mask, origin.y & mask, origin.z & mask);
+        
+        for (int bz = first.z; bz < end.z; bz += blockSize) {
+            for (int by = first.y; by < end.y; by += blockSize) {
+                for (int bx = first.x; bx < end.x; bx += blockSize) {
+                    const glm::ivec3 blockMins(bx, by, bz);
+                    const glm::ivec3 blockEnd = blockMins + glm::ivec3(blockSize);
+                    
+                    if (blockMins.x >= origin.x && blockEnd.x <= end.x &&
+                        blockMins.y >= origin.y && blockEnd.y <= end.y &&
+                        blockMins.z >= origin.z && blockEnd.z <= end.z) {
+                        blockFn(blockMins, cellsPerBlock);
+                    } else {
+                        cellsFn(glm::max(blockMins, origin), glm::min(blockEnd, end));
+                    }
+                }
+            }
+        }
+    }
 };
 
 #endif /* Array3D_hpp */
@@ -10,14 +10,196 @@
 #define ConcurrentSparseGrid_hpp
 
 #include "Grid/GridIndexer.hpp"
-#include "Grid/GridLRU.hpp"
-#include <unordered_map>
+#include <boost/optional.hpp>
+#include <array>
+#include <future>
 #include <mutex>
+#include <shared_mutex>
+#include <vector>
 
+// A slot in the directory of a ConcurrentSparseGrid.
+template<typename Value>
+struct ConcurrentSparseGridSlot
+{
+    enum State {
+        Empty,
+        Full,
+        Creating,
+        Erased
+    };
+    
+    State state = Empty;
+    Morton3 key;
+    boost::optional<Value> value;
+    
+    // Becomes ready when a slot in the Creating state has been populated.
+    std::shared_future<void> creation;
+};
+
+// Directory of slots for a ConcurrentSparseGrid which hashes keys into a table.
+// This places no limit on the extent of the grid.
+//
+// The table is split into shards. Each shard is an open-addressing table with
+// linear probing, protected by its own reader-writer lock, so readers of the
+// same shard do not block one another.
+template<typename Value, size_t NumberOfShards = 64>
+class HashedGridDirectory
+{
+    static_assert((NumberOfShards & (NumberOfShards - 1)) == 0,
+                  "The number of shards must be a power of two.");
+
+public:
+    using Key = Morton3;
+    using Slot = ConcurrentSparseGridSlot<Value>;
+    
+    // One shard of the table.
+    // Erased slots are left as tombstones until the table is next rebuilt.
+    struct Shard
+    {
+        static constexpr size_t InitialCapacity = 16;
+    
+        mutable std::shared_mutex mutex;
+        std::vector<Slot> slots;
+        size_t count = 0;
+        size_t tombstones = 0;
+        
+        Shard() : slots(InitialCapacity) {}
+        
+        // Returns the slot for the key, or nullptr if there is none.
+        Slot* find(Key key)
+        {
+            const size_t mask = slots.size() - 1;
+            for (size_t i = probeStart(key) & mask; ; i = (i + 1) & mask) {
+                Slot &slot = slots[i];
+                if (slot.state == Slot::Empty) {
+                    return nullptr;
+                } else if (slot.state != Slot::Erased && slot.key == key) {
+                    return &slot;
+                }
+            }
+        }
+        
+        const Slot* find(Key key) const
+        {
+            return const_cast<Shard *>(this)->find(key);
+        }
+        
+        // Inserts a slot for a key which is not already in the table.
+        Slot* insert(Key key)
+        {
+            // Keep the table at most half full, counting tombstones, so
+            // probe sequences stay short and always reach an empty slot.
+            if ((count + tombstones + 1) * 2 > slots.size()) {
+                rebuild((count + 1) * 4);
+            }
+            
+            const size_t mask = slots.size() - 1;
+            size_t i = probeStart(key) & mask;
+            while (slots[i].state == Slot::Full || slots[i].state == Slot::Creating) {
+                i = (i + 1) & mask;
+            }
+            
+            Slot &slot = slots[i];
+            if (slot.state == Slot::Erased) {
+                tombstones--;
+            }
+            slot.key = key;
+            count++;
+            return &slot;
+        }
+        
+        void erase(Slot *slot)
+        {
+            slot->state = Slot::Erased;
+            slot->value = boost::none;
+            slot->creation = std::shared_future<void>();
+            count--;
+            tombstones++;
+        }
+        
+    private:
+        // Moves all live slots into a new table with at least the specified
+        // capacity, dropping tombstones.
+        void rebuild(size_t minimumCapacity)
+        {
+            size_t capacity = InitialCapacity;
+            while (capacity < minimumCapacity) {
+                capacity *= 2;
+            }
+            
+            std::vector<Slot> oldSlots(capacity);
+            oldSlots.swap(slots);
+            tombstones = 0;
+            
+            const size_t mask = slots.size() - 1;
+            for (Slot &oldSlot : oldSlots) {
+                if (oldSlot.state == Slot::Full || oldSlot.state == Slot::Creating) {
+                    size_t i = probeStart(oldSlot.key) & mask;
+                    while (slots[i].state != Slot::Empty) {
+                        i = (i + 1) & mask;
+                    }
+                    slots[i] = std::move(oldSlot);
+                }
+            }
+        }
+    };
+    
+    // The hashed directory does not depend on the grid resolution.
+    explicit HashedGridDirectory(const glm::ivec3 &) {}
+    
+    // Returns the shard which holds the key, or nullptr if there is none.
+    inline Shard* findShard(Key key)
+    {
+        return &getShard(key);
+    }
+    
+    inline const Shard* findShard(Key key) const
+    {
+        return &_shards[mix(key) >> 58 & (NumberOfShards - 1)];
+    }
+    
+    // Returns the shard which holds the key.
+    inline Shard& getShard(Key key)
+    {
+        return _shards[mix(key) >> 58 & (NumberOfShards - 1)];
+    }
+    
+    template<typename FunctionType>
+    void forEachShard(FunctionType &&fn) const
+    {
+        for (const Shard &shard : _shards) {
+            fn(shard);
+        }
+    }
+
+private:
+    std::array<Shard, NumberOfShards> _shards;
+    
+    // Morton codes of nearby cells differ mostly in their low bits. Mix the
+    // bits so that neighbors spread out across shards and slots.
+    static inline uint64_t mix(Key key)
+    {
+        return (uint64_t)key * 0x9E3779B97F4A7C15ull;
+    }
+    
+    static inline size_t probeStart(Key key)
+    {
+        const uint64_t h = mix(key);
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+    
 // ConcurrentSparseGrid divides space into a regular grid of cells where each
 // cell is associated with an element. It supports multiple, concurrent readers
 // and writers.
-template<typename Value, size_t NumberOfBuckets = 4093>
+//
+// Elements are kept in a directory of slots, which is split into shards. Each
+// shard is protected by its own reader-writer lock, so readers of the same
+// shard do not block one another. Lookups never modify the directory.
+//
+// The `Directory' parameter selects how slots are found. HashedGridDirectory
+// is suitable for any grid. DenseGridDirectory is faster for bounded grids.
+template<typename Value, typename Directory = HashedGridDirectory<Value>>
 class ConcurrentSparseGrid : public GridIndexer
 {
 public:
@@ -27,41 +209,105 @@ public:
     ConcurrentSparseGrid() = delete;
     
     ConcurrentSparseGrid(const AABB &boundingBox,
-                         const glm::ivec3 &gridResolution,
-                         size_t numberOfBuckets = NumberOfBuckets)
-     : GridIndexer(boundingBox, gridResolution)
-    {
-        buckets.resize(numberOfBuckets);
-    }
+                         const glm::ivec3 &gridResolution)
+     : GridIndexer(boundingBox, gridResolution),
+       _directory(gridResolution)
+    {}
     
     // Return the element at the specified index, if there is one.
-    boost::optional<Value> get(Key key)
+    // An element which is still being created by getOrCreate() is not
+    // returned.
+    boost::optional<Value> get(Key key) const
     {
-        Bucket& bucket = getBucket(key);
-        std::scoped_lock lock(bucket.mutex);
-        return bucket.slots[key];
+        const Shard *shard = _directory.findShard(key);
+        if (!shard) {
+            return boost::none;
+        }
+        std::shared_lock lock(shard->mutex);
+        const Slot *slot = shard->find(key);
+        if (slot && slot->state == Slot::Full) {
+            return slot->value;
+        }
+        return boost::none;
     }
     
     // Return the element at the specified index.
-    // If the slot is empty then this uses `factory' to populate the slot.
+    // If the slot is empty then this uses `factory' to populate the slot. The
+    // factory runs without holding any locks, and it is called at most once for
+    // each key. Other threads which want the same key wait for it to finish.
+    // If the factory throws then the exception is passed to those threads too,
+    // and the slot is left empty.
     template<typename FactoryType>
-    Value get(Key key, FactoryType &&factory)
+    Value getOrCreate(Key key, FactoryType &&factory)
     {
-        auto maybeChunk = get(key);
-        if (!maybeChunk) {
-            set(key, factory());
-            maybeChunk = get(key);
+        Shard &shard = _directory.getShard(key);
+        
+        while (true) {
+            std::shared_future<void> creation;
+            
+            {
+                std::shared_lock lock(shard.mutex);
+                const Slot *slot = shard.find(key);
+                if (slot && slot->state == Slot::Full) {
+                    return *slot->value;
+                }
+            }
+            
+            std::promise<void> promise;
+            {
+                std::unique_lock lock(shard.mutex);
+                Slot *slot = shard.find(key);
+                if (slot && slot->state == Slot::Full) {
+                    return *slot->value;
+                } else if (slot && slot->state == Slot::Creating) {
+                    creation = slot->creation;
+                } else {
+                    slot = shard.insert(key);
+                    slot->state = Slot::Creating;
+                    slot->creation = promise.get_future().share();
+                }
+            }
+            
+            if (creation.valid()) {
+                // Another thread is running the factory for this key. Wait for
+                // it and then look again.
+                creation.get();
+                continue;
+            }
+            
+            boost::optional<Value> value;
+            try {
+                value = factory();
+            } catch(...) {
+                {
+                    std::unique_lock lock(shard.mutex);
+                    Slot *slot = shard.find(key);
+                    if (slot && slot->state == Slot::Creating) {
+                        shard.erase(slot);
+                    }
+                }
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+            
+            Value result = publish(shard, key, std::move(*value));
+            promise.set_value();
+            return result;
         }
-        assert(maybeChunk);
-        return *maybeChunk;
     }
     
     // Set the element at the specified index to the specified value.
     void set(Key key, Value value)
     {
-        Bucket& bucket = getBucket(key);
-        std::scoped_lock lock(bucket.mutex);
-        bucket.slots[key] = value;
+        Shard &shard = _directory.getShard(key);
+        std::unique_lock lock(shard.mutex);
+        Slot *slot = shard.find(key);
+        if (!slot) {
+            slot = shard.insert(key);
+        }
+        slot->state = Slot::Full;
+        slot->value = std::move(value);
+        slot->creation = std::shared_future<void>();
     }
     
     // Set the element at the specified point to the specified value.
@@ -79,29 +325,53 @@ public:
     
     // Removes the element associated with the given index.
     // The element is discarded and the associated slot becomes empty.
+    // An element which is still being created is not affected.
     inline void remove(Key key)
     {
-        Bucket& bucket = getBucket(key);
-        std::scoped_lock lock(bucket.mutex);
-        bucket.slots.erase(key);
+        Shard *shard = _directory.findShard(key);
+        if (!shard) {
+            return;
+        }
+        std::unique_lock lock(shard->mutex);
+        Slot *slot = shard->find(key);
+        if (slot && slot->state == Slot::Full) {
+            shard->erase(slot);
+        }
     }
     
-private:
-    struct Bucket
+    // Returns the number of elements in the grid.
+    size_t size() const
     {
-        std::mutex mutex;
-        std::unordered_map<Key, boost::optional<Value>> slots;
-        
-        Bucket() = default;
-        Bucket(const Bucket &bucket) : slots(bucket.slots) {}
-    };
+        size_t count = 0;
+        _directory.forEachShard([&](const Shard &shard){
+            std::shared_lock lock(shard.mutex);
+            count += shard.count;
+        });
+        return count;
+    }
+
+private:
+    using Shard = typename Directory::Shard;
+    using Slot = typename Directory::Slot;
     
-    std::vector<Bucket> buckets;
-    std::hash<Key> _hasher;
+    Directory _directory;
     
-    inline Bucket& getBucket(Key key)
+    // Stores the value created for the key, and returns the value which is now
+    // in the grid. If the value was set while the factory was running then
+    // that value wins.
+    Value publish(Shard &shard, Key key, Value value)
     {
-        return buckets[_hasher(key) % buckets.size()];
+        std::unique_lock lock(shard.mutex);
+        Slot *slot = shard.find(key);
+        if (!slot) {
+            slot = shard.insert(key);
+        } else if (slot->state == Slot::Full) {
+            return *slot->value;
+        }
+        slot->state = Slot::Full;
+        slot->value = std::move(value);
+        slot->creation = std::shared_future<void>();
+        return *slot->value;
     }
 };
 
@@ -0,0 +1,153 @@
+//
+//  DenseGridDirectory.hpp
+//  PinkTopaz
+//
+
+#ifndef DenseGridDirectory_hpp
+#define DenseGridDirectory_hpp
+
+#include "Grid/ConcurrentSparseGrid.hpp"
+#include <atomic>
+#include <memory>
+
+// Directory of slots for a ConcurrentSparseGrid over a bounded grid.
+//
+// Slots are stored densely in Morton order so finding the slot for a key is an
+// indexed load rather than a hash and a probe. Slots are allocated in bricks of
+// 8x8x8 cells, which are contiguous in Morton order. A brick is allocated the
+// first time one of its cells is written, so the directory stays small when
+// only part of the grid is used. Each brick is a shard with its own
+// reader-writer lock.
+//
+// Bricks are never freed until the directory is destroyed, so readers may load
+// brick pointers without taking any lock.
+template<typename Value>
+class DenseGridDirectory
+{
+    static constexpr unsigned BrickShift = 9;
+    static constexpr size_t CellsPerBrick = (size_t)1 << BrickShift;
+
+public:
+    using Key = Morton3;
+    using Slot = ConcurrentSparseGridSlot<Value>;
+    
+    // One brick of the directory.
+    // Slots are never tombstones. An erased slot is simply empty again.
+    struct Shard
+    {
+        mutable std::shared_mutex mutex;
+        std::array<Slot, CellsPerBrick> slots;
+        size_t count = 0;
+        
+        // Returns the slot for the key, or nullptr if there is none.
+        inline Slot* find(Key key)
+        {
+            Slot &slot = slots[(size_t)key & (CellsPerBrick - 1)];
+            return (slot.state == Slot::Empty) ? nullptr : &slot;
+        }
+        
+        inline const Slot* find(Key key) const
+        {
+            return const_cast<Shard *>(this)->find(key);
+        }
+        
+        // Returns the slot for a key which is not already in the directory.
+        inline Slot* insert(Key key)
+        {
+            Slot &slot = slots[(size_t)key & (CellsPerBrick - 1)];
+            slot.key = key;
+            count++;
+            return &slot;
+        }
+        
+        inline void erase(Slot *slot)
+        {
+            slot->state = Slot::Empty;
+            slot->value = boost::none;
+            slot->creation = std::shared_future<void>();
+            count--;
+        }
+    };
+    
+    ~DenseGridDirectory()
+    {
+        for (size_t i = 0; i < _numberOfBricks; ++i) {
+            delete _bricks[i].load(std::memory_order_relaxed);
+        }
+    }
+    
+    DenseGridDirectory(const DenseGridDirectory &) = delete;
+    DenseGridDirectory& operator=(const DenseGridDirectory &) = delete;
+    
+    // Constructor.
+    // gridResolution -- The number of cells along each axis of the grid.
+    explicit DenseGridDirectory(const glm::ivec3 &gridResolution)
+     : _maxValidIndex(Morton3::encode(gridResolution - glm::ivec3(1, 1, 1))),
+       _numberOfBricks((_maxValidIndex >> BrickShift) + 1),
+       _bricks(new std::atomic<Shard *>[_numberOfBricks])
+    {
+        for (size_t i = 0; i < _numberOfBricks; ++i) {
+            _bricks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    
+    // Returns the brick which holds the key, or nullptr if it has not been
+    // allocated yet.
+    inline Shard* findShard(Key key)
+    {
+        const size_t index = (size_t)key;
+        if (index > _maxValidIndex) {
+            return nullptr;
+        }
+        return _bricks[index >> BrickShift].load(std::memory_order_acquire);
+    }
+    
+    inline const Shard* findShard(Key key) const
+    {
+        return const_cast<DenseGridDirectory *>(this)->findShard(key);
+    }
+    
+    // Returns the brick which holds the key, allocating it if necessary.
+    Shard& getShard(Key key)
+    {
+        const size_t index = (size_t)key;
+        if constexpr (EnableVerboseBoundsChecking) {
+            if (index > _maxValidIndex) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- index={} ; maxValidIndex={}",
+                                                       index, _maxValidIndex));
+            }
+        }
+        
+        std::atomic<Shard *> &brickPtr = _bricks[index >> BrickShift];
+        Shard *brick = brickPtr.load(std::memory_order_acquire);
+        if (!brick) {
+            // Another thread may allocate the same brick at the same time.
+            // Only one of them is installed.
+            auto newBrick = std::make_unique<Shard>();
+            if (brickPtr.compare_exchange_strong(brick, newBrick.get(),
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_acquire)) {
+                brick = newBrick.release();
+            }
+        }
+        return *brick;
+    }
+    
+    template<typename FunctionType>
+    void forEachShard(FunctionType &&fn) const
+    {
+        for (size_t i = 0; i < _numberOfBricks; ++i) {
+            const Shard *brick = _bricks[i].load(std::memory_order_acquire);
+            if (brick) {
+                fn(*brick);
+            }
+        }
+    }
+
+private:
+    const size_t _maxValidIndex;
+    const size_t _numberOfBricks;
+    std::unique_ptr<std::atomic<Shard *>[]> _bricks;
+};
+
+#endif /* DenseGridDirectory_hpp */
@@ -0,0 +1,187 @@
+//
+//  DistanceBucketQueue.hpp
+//  PinkTopaz
+//
+
+#ifndef DistanceBucketQueue_hpp
+#define DistanceBucketQueue_hpp
+
+#include <glm/glm.hpp>
+#include <cassert>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+// A priority queue of items ordered by their distance from a search point.
+//
+// Items are kept in buckets, where each bucket is a ring of fixed width around
+// the search point. Pushing an item is constant time and popping an item takes
+// the oldest item in the nearest non-empty bucket. Items in the same bucket are
+// not ordered by distance, so the order is only exact to within the width of a
+// bucket.
+//
+// Moving the search point does not do any work right away. The items are
+// redistributed among the buckets on the next call to pop(), in linear time and
+// without sorting. Many moves between pops cost the same as one.
+//
+// PositionFunction is a function object which returns the position of an item
+// as a glm::vec3.
+template<typename ItemType, typename PositionFunction>
+class DistanceBucketQueue
+{
+public:
+    // Constructor.
+    // bucketWidth -- The width of each ring of distance around the search
+    //                point. Items closer together than this may be popped in
+    //                any order.
+    // searchPoint -- The initial search point.
+    // position -- Function object which returns the position of an item.
+    DistanceBucketQueue(float bucketWidth,
+                        glm::vec3 searchPoint,
+                        PositionFunction position = PositionFunction())
+     : _bucketWidth(bucketWidth),
+       _searchPoint(searchPoint),
+       _position(position),
+       _lowestBucket(0),
+       _size(0),
+       _searchPointChanged(false)
+    {
+        assert(bucketWidth > 0.f);
+    }
+    
+    // Returns true if there are no items in the queue.
+    inline bool empty() const
+    {
+        return _size == 0;
+    }
+    
+    // Returns the number of items in the queue.
+    inline size_t size() const
+    {
+        return _size;
+    }
+    
+    // Returns the current search point.
+    inline const glm::vec3& getSearchPoint() const
+    {
+        return _searchPoint;
+    }
+    
+    // Add an item to the queue.
+    void push(ItemType &&item)
+    {
+        const size_t index = bucketIndex(item);
+        bucketAt(index).emplace_back(std::move(item));
+        if (_size == 0 || index < _lowestBucket) {
+            _lowestBucket = index;
+        }
+        _size++;
+    }
+    
+    // Remove and return the item nearest the search point, to within the
+    // width of a bucket. The queue must not be empty.
+    ItemType pop()
+    {
+        assert(!empty());
+        
+        if (_searchPointChanged) {
+            redistribute();
+        }
+        
+        while (_buckets[_lowestBucket].empty()) {
+            _lowestBucket++;
+        }
+        
+        auto &bucket = _buckets[_lowestBucket];
+        ItemType item = std::move(bucket.front());
+        bucket.pop_front();
+        _size--;
+        return item;
+    }
+    
+    // Move the search point. This is cheap. The items are redistributed
+    // lazily on the next call to pop().
+    void setSearchPoint(glm::vec3 searchPoint)
+    {
+        _searchPoint = searchPoint;
+        _searchPointChanged = true;
+    }
+    
+    // Remove every item for which the predicate returns true. The predicate
+    // may modify the item before it is removed.
+    // Returns the number of items which were removed.
+    template<typename PredicateType>
+    size_t removeIf(PredicateType &&predicate)
+    {
+        size_t numberRemoved = 0;
+        for (auto &bucket : _buckets) {
+            auto iter = bucket.begin();
+            while (iter != bucket.end()) {
+                if (predicate(*iter)) {
+                    iter = bucket.erase(iter);
+                    numberRemoved++;
+                } else {
+                    ++iter;
+                }
+            }
+        }
+        _size -= numberRemoved;
+        return numberRemoved;
+    }
+    
+    // Remove all items.
+    void clear()
+    {
+        _buckets.clear();
+        _lowestBucket = 0;
+        _size = 0;
+        _searchPointChanged = false;
+    }
+
+private:
+    using Bucket = std::deque<ItemType>;
+    
+    const float _bucketWidth;
+    glm::vec3 _searchPoint;
+    PositionFunction _position;
+    std::vector<Bucket> _buckets;
+    size_t _lowestBucket;
+    size_t _size;
+    bool _searchPointChanged;
+    
+    // Returns the index of the bucket for the item given the current search
+    // point.
+    size_t bucketIndex(const ItemType &item) const
+    {
+        const float distance = glm::distance(_position(item), _searchPoint);
+        return (size_t)std::floor(distance / _bucketWidth);
+    }
+    
+    // Returns the bucket at the index, adding buckets as needed.
+    Bucket& bucketAt(size_t index)
+    {
+        if (index >= _buckets.size()) {
+            _buckets.resize(index + 1);
+        }
+        return _buckets[index];
+    }
+    
+    // Move every item into the correct bucket for the current search point.
+    // Items keep their relative order within each bucket.
+    void redistribute()
+    {
+        std::vector<Bucket> oldBuckets;
+        oldBuckets.swap(_buckets);
+        _size = 0;
+        _lowestBucket = 0;
+        _searchPointChanged = false;
+        
+        for (auto &bucket : oldBuckets) {
+            for (auto &item : bucket) {
+                push(std::move(item));
+            }
+        }
+    }
+};
+
+#endif /* DistanceBucketQueue_hpp */
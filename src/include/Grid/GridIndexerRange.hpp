@@ -10,6 +10,7 @@
 #define GridIndexerRange_hpp
 
 #include "GridIndexer.hpp"
+#include <cassert>
 
 template<typename PointType>
 class ExclusiveIterator
@@ -203,4 +204,73 @@ inline auto slice(const GridIndexer &grid, const AABB &region)
     return Range<ExclusiveIterator<glm::ivec3>>(begin, end);
 }
 
+// A slice of the grid which has been split into blocks of nearby cells. Each
+// block is itself a range over cell coordinates. Blocks are the unit of work
+// for TaskDispatcher::parallelFor(), and are ordered in the same way as the
+// cells of a slice.
+class SliceBlocks
+{
+public:
+    using BlockType = Range<ExclusiveIterator<glm::ivec3>>;
+    
+    SliceBlocks() = delete;
+    
+    SliceBlocks(glm::ivec3 minCellCoords, glm::ivec3 maxCellCoords, int blockSize)
+     : _min(minCellCoords),
+       _max(maxCellCoords),
+       _blockSize(blockSize),
+       _count(glm::max(glm::ivec3(0), (maxCellCoords - minCellCoords + (blockSize - 1)) / blockSize))
+    {
+        assert(blockSize > 0);
+    }
+    
+    // Returns the number of blocks.
+    size_t size() const
+    {
+        return (size_t)_count.x * (size_t)_count.y * (size_t)_count.z;
+    }
+    
+    // Returns the range of cell coordinates for the specified block.
+    BlockType operator[](size_t index) const
+    {
+        assert(index < size());
+        
+        const int y = (int)(index % _count.y);
+        index /= _count.y;
+        const int x = (int)(index % _count.x);
+        const int z = (int)(index / _count.x);
+        
+        const glm::ivec3 mins = _min + glm::ivec3(x, y, z) * _blockSize;
+        const glm::ivec3 maxs = glm::min(mins + glm::ivec3(_blockSize), _max);
+        
+        ExclusiveIterator<glm::ivec3> begin(mins, maxs, mins);
+        ExclusiveIterator<glm::ivec3> end(mins, maxs, maxs);
+        return BlockType(begin, end);
+    }
+
+private:
+    glm::ivec3 _min, _max;
+    int _blockSize;
+    glm::ivec3 _count;
+};
+
+// Return a SliceBlocks object which splits a sub-region of the grid into cubic
+// blocks of cells, `blockSize' cells on a side. Blocks at the far edges of the
+// region may be smaller. The default block size is chosen so that a block of
+// an Array3D<Voxel> fits comfortably within the L1 cache.
+inline SliceBlocks sliceBlocks(const GridIndexer &grid, const AABB &region, int blockSize = 8)
+{
+    if constexpr (EnableVerboseBoundsChecking) {
+        if (!grid.inbounds(region)) {
+            throw OutOfBoundsException(fmt::format("OutOfBoundsException -- grid.boundingBox={} ; region={}",
+                                                   grid.boundingBox(), region));
+        }
+    }
+    
+    const auto minCellCoords = grid.cellCoordsAtPoint(region.mins());
+    const auto maxCellCoords = grid.cellCoordsAtPointRoundUp(region.maxs());
+    
+    return SliceBlocks(minCellCoords, maxCellCoords, blockSize);
+}
+
 #endif /* GridIndexerRange_hpp */
@@ -51,6 +51,12 @@ public:
         return boost::make_optional(key);
     }
     
+    // Returns the number of items in the LRU list.
+    size_t size() const
+    {
+        return _list.size();
+    }
+    
     // Remove all items from the LRU list.
     void clear()
     {
@@ -0,0 +1,319 @@
+//
+//  PalettedArray3D.hpp
+//  PinkTopaz
+//
+
+#ifndef PalettedArray3D_hpp
+#define PalettedArray3D_hpp
+
+#include <glm/vec3.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "Array3D.hpp"
+
+// A regular grid in space where each cell is associated with some object of the
+// type specified by `CellType'. Unlike Array3D, each cell stores a small index
+// into a palette of the distinct values which appear in the grid. Grids which
+// contain only a handful of distinct values take a fraction of the memory.
+//
+// Indices are one, two, or four bits wide. The indices widen as the palette
+// grows. Once the palette is full, set() drops values which no cell uses any
+// more to make room. If every value is still in use then set() refuses values
+// which are not already in the palette and the caller must fall back to an
+// Array3D.
+//
+// Like Array3D, cells are stored in Morton order.
+template<typename CellType>
+class PalettedArray3D : public GridIndexer
+{
+public:
+    using GridIndexer::boundingBox;
+    using GridIndexer::gridResolution;
+    using GridIndexer::indexAtPoint;
+    using GridIndexer::indexAtCellCoords;
+    using GridIndexer::cellCoordsAtPoint;
+    using GridIndexer::inbounds;
+    
+    // The largest number of distinct values the grid can hold.
+    static constexpr size_t MaxPaletteSize = 16;
+    
+    ~PalettedArray3D() = default;
+    
+    // No default constructor.
+    PalettedArray3D() = delete;
+    
+    // Constructor. The grid is initially filled with `initialValue'.
+    // box -- The region of space this grid of objects represents.
+    // res -- The number of cells along each axis.
+    // initialValue -- The value of every cell in the new grid.
+    PalettedArray3D(const AABB &box, glm::ivec3 res, const CellType &initialValue)
+     : GridIndexer(box, res),
+       _maxValidIndex(Morton3::encode(res - glm::ivec3(1, 1, 1))),
+       _bitsPerIndex(1),
+       _palette{initialValue},
+       _words(countWords(_maxValidIndex+1, _bitsPerIndex), 0)
+    {}
+    
+    // Returns a paletted copy of the array, or boost::none when the array has
+    // more distinct values than fit in the palette.
+    static boost::optional<PalettedArray3D<CellType>> fromArray(const Array3D<CellType> &array)
+    {
+        const CellType *cells = (const CellType *)array.data();
+        const size_t numberOfCells = (size_t)array.indexAtCellCoords(array.gridResolution() - glm::ivec3(1, 1, 1)) + 1;
+        
+        PalettedArray3D<CellType> result(array.boundingBox(), array.gridResolution(), cells[0]);
+        for (size_t i = 0; i < numberOfCells; ++i) {
+            if (!result.set(Morton3(i), cells[i])) {
+                return boost::none;
+            }
+        }
+        return result;
+    }
+    
+    // Returns a copy of the grid as a plain Array3D.
+    Array3D<CellType> toArray() const
+    {
+        Array3D<CellType> array(boundingBox(), gridResolution());
+        CellType *cells = (CellType *)array.data();
+        for (size_t i = 0; i <= _maxValidIndex; ++i) {
+            cells[i] = _palette[getPaletteIndex(i)];
+        }
+        return array;
+    }
+    
+    // Gets the value of the cell in which the point resides.
+    inline CellType get(const glm::vec3 &p) const
+    {
+        if constexpr (EnableVerboseBoundsChecking) {
+            if (!inbounds(p)) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- boundingBox={} ; p={}",
+                                                       boundingBox(),
+                                                       glm::to_string(p)));
+            }
+        }
+        return get(indexAtPoint(p));
+    }
+    
+    // Gets the value of the cell at the given cell coordinates.
+    inline CellType get(const glm::ivec3 &cellCoords) const
+    {
+        return get(indexAtCellCoords(cellCoords));
+    }
+    
+    // Gets the value of the cell for the specified index.
+    inline CellType get(Morton3 index) const
+    {
+        checkIndex(index);
+        return _palette[getPaletteIndex((size_t)index)];
+    }
+    
+    // Sets the value of the cell in which the point resides.
+    // Returns false, and leaves the grid unmodified, if the value is not in
+    // the palette and the palette is full of values which are in use.
+    inline bool set(const glm::vec3 &p, const CellType &value)
+    {
+        if constexpr (EnableVerboseBoundsChecking) {
+            if (!inbounds(p)) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- boundingBox={} ; p={}",
+                                                       boundingBox(),
+                                                       glm::to_string(p)));
+            }
+        }
+        return set(indexAtPoint(p), value);
+    }
+    
+    // Sets the value of the cell at the given cell coordinates.
+    // Returns false, and leaves the grid unmodified, if the value is not in
+    // the palette and the palette is full of values which are in use.
+    inline bool set(const glm::ivec3 &cellCoords, const CellType &value)
+    {
+        return set(indexAtCellCoords(cellCoords), value);
+    }
+    
+    // Sets the value of the cell for the specified index.
+    // Returns false, and leaves the grid unmodified, if the value is not in
+    // the palette and the palette is full of values which are in use.
+    bool set(Morton3 index, const CellType &value)
+    {
+        checkIndex(index);
+        
+        size_t paletteIndex = findInPalette(value);
+        if (paletteIndex == _palette.size()) {
+            if (_palette.size() == MaxPaletteSize) {
+                if (!compactPalette((size_t)index)) {
+                    return false;
+                }
+                paletteIndex = _palette.size();
+            }
+            _palette.push_back(value);
+            if (paletteIndex >= ((size_t)1 << _bitsPerIndex)) {
+                widenIndices();
+            }
+        }
+        
+        setPaletteIndex((size_t)index, paletteIndex);
+        return true;
+    }
+    
+    // Copies a box of cells into the specified array.
+    // srcOrigin -- Cell coordinates of the minimum corner of the box in this
+    //              grid.
+    // dstOrigin -- Cell coordinates of the minimum corner of the box in `dst'.
+    // size -- The number of cells along each axis of the box.
+    void copyCellsTo(Array3D<CellType> &dst,
+                     const glm::ivec3 &srcOrigin,
+                     const glm::ivec3 &dstOrigin,
+                     const glm::ivec3 &size) const
+    {
+        const glm::ivec3 delta = dstOrigin - srcOrigin;
+        const glm::ivec3 end = srcOrigin + size;
+        CellType *dstCells = (CellType *)dst.data();
+        
+        for (int z = srcOrigin.z; z < end.z; ++z) {
+            for (int y = srcOrigin.y; y < end.y; ++y) {
+                for (int x = srcOrigin.x; x < end.x; ++x) {
+                    const glm::ivec3 srcCellCoords(x, y, z);
+                    const size_t srcIndex = (size_t)Morton3(srcCellCoords);
+                    dstCells[(size_t)Morton3(srcCellCoords + delta)] = _palette[getPaletteIndex(srcIndex)];
+                }
+            }
+        }
+    }
+    
+    // Returns the number of distinct values in the palette.
+    inline size_t getPaletteSize() const
+    {
+        return _palette.size();
+    }
+    
+    // Returns the width, in bits, of each cell's palette index.
+    inline unsigned getBitsPerIndex() const
+    {
+        return _bitsPerIndex;
+    }
+    
+    // Returns the number of bytes used to store the cells and the palette.
+    size_t getNumberOfBytes() const
+    {
+        return _words.size() * sizeof(uint64_t) + _palette.size() * sizeof(CellType);
+    }
+
+private:
+    const size_t _maxValidIndex;
+    unsigned _bitsPerIndex;
+    std::vector<CellType> _palette;
+    std::vector<uint64_t> _words;
+    
+    static constexpr unsigned BitsPerWord = 64;
+    
+    static size_t countWords(size_t numberOfCells, unsigned bitsPerIndex)
+    {
+        const size_t cellsPerWord = BitsPerWord / bitsPerIndex;
+        return (numberOfCells + cellsPerWord - 1) / cellsPerWord;
+    }
+    
+    inline void checkIndex(Morton3 index) const
+    {
+        if constexpr (EnableVerboseBoundsChecking) {
+            if ((size_t)index > _maxValidIndex) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- boundingBox={} ; index={} ; maxValidIndex={}",
+                                                       boundingBox(),
+                                                       (size_t)index,
+                                                       _maxValidIndex));
+            }
+        }
+    }
+    
+    // Returns the position of the value in the palette, or the size of the
+    // palette if the value is not present.
+    inline size_t findInPalette(const CellType &value) const
+    {
+        return std::find(_palette.begin(), _palette.end(), value) - _palette.begin();
+    }
+    
+    // Indices never straddle two words as the index width divides 64.
+    inline size_t getPaletteIndex(size_t cellIndex) const
+    {
+        const size_t bitOffset = cellIndex * _bitsPerIndex;
+        const uint64_t mask = ((uint64_t)1 << _bitsPerIndex) - 1;
+        return (_words[bitOffset / BitsPerWord] >> (bitOffset % BitsPerWord)) & mask;
+    }
+    
+    inline void setPaletteIndex(size_t cellIndex, size_t paletteIndex)
+    {
+        const size_t bitOffset = cellIndex * _bitsPerIndex;
+        const unsigned shift = bitOffset % BitsPerWord;
+        const uint64_t mask = (((uint64_t)1 << _bitsPerIndex) - 1) << shift;
+        uint64_t &word = _words[bitOffset / BitsPerWord];
+        word = (word & ~mask) | (((uint64_t)paletteIndex << shift) & mask);
+    }
+    
+    // Doubles the width of each index to make room for a larger palette.
+    void widenIndices()
+    {
+        std::array<size_t, MaxPaletteSize> identity;
+        for (size_t i = 0; i < identity.size(); ++i) {
+            identity[i] = i;
+        }
+        repackIndices(_bitsPerIndex * 2, identity);
+    }
+    
+    // Drops palette values which are not used by any cell, other than the
+    // cell at `ignoredCellIndex', which the caller is about to overwrite. The
+    // indices narrow to fit the smaller palette.
+    // Returns false, and leaves the grid unmodified, if every value is used.
+    bool compactPalette(size_t ignoredCellIndex)
+    {
+        std::array<bool, MaxPaletteSize> used{};
+        for (size_t i = 0; i <= _maxValidIndex; ++i) {
+            if (i != ignoredCellIndex) {
+                used[getPaletteIndex(i)] = true;
+            }
+        }
+        
+        std::array<size_t, MaxPaletteSize> remap{};
+        std::vector<CellType> palette;
+        for (size_t i = 0; i < _palette.size(); ++i) {
+            if (used[i]) {
+                remap[i] = palette.size();
+                palette.push_back(_palette[i]);
+            }
+        }
+        if (palette.size() == _palette.size()) {
+            return false;
+        }
+        
+        unsigned bitsPerIndex = 1;
+        while (((size_t)1 << bitsPerIndex) < palette.size()) {
+            bitsPerIndex *= 2;
+        }
+        repackIndices(bitsPerIndex, remap);
+        _palette = std::move(palette);
+        return true;
+    }
+    
+    // Rewrites every index with the specified width, mapping each old palette
+    // index `i' to `remap[i]'.
+    void repackIndices(unsigned bitsPerIndex,
+                       const std::array<size_t, MaxPaletteSize> &remap)
+    {
+        const unsigned oldBitsPerIndex = _bitsPerIndex;
+        std::vector<uint64_t> oldWords(countWords(_maxValidIndex+1, bitsPerIndex), 0);
+        oldWords.swap(_words);
+        
+        const uint64_t oldMask = ((uint64_t)1 << oldBitsPerIndex) - 1;
+        _bitsPerIndex = bitsPerIndex;
+        
+        for (size_t i = 0; i <= _maxValidIndex; ++i) {
+            const size_t bitOffset = i * oldBitsPerIndex;
+            const size_t paletteIndex = (oldWords[bitOffset / BitsPerWord] >> (bitOffset % BitsPerWord)) & oldMask;
+            setPaletteIndex(i, remap[paletteIndex]);
+        }
+    }
+};
+
+#endif /* PalettedArray3D_hpp */
@@ -13,7 +13,9 @@
 #include "GridIndexer.hpp" // for doBoxesIntersect()
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <list>
+#include <vector>
 
 // Assists in locking a region of space when accessing a grid concurrently.
 class RegionMutualExclusionArbitrator
@@ -24,7 +26,7 @@ public:
     
     // Represents a region of space for which we need mutually exclusive access.
     // Supports either a reader or a writer depending on TokenType.
-    // Satisfies BasicLockable and can be used with std::scoped_lock.
+    // Satisfies Lockable and can be used with std::scoped_lock.
     template<typename TokenType>
     class RegionMutex
     {
@@ -44,6 +46,24 @@ public:
             _arbitrator.unlock(_token);
         }
         
+        bool try_lock()
+        {
+            return _arbitrator.tryLock(_token, _region);
+        }
+        
+        // Calls the function once it appears the region can be locked,
+        // without blocking the calling thread. It may be called immediately
+        // on this thread, or later on whichever thread releases the
+        // conflicting lock. So, it must be cheap. Usually, it just posts a
+        // task which calls try_lock().
+        //
+        // The region is not reserved for the caller. Some other thread may
+        // take the lock before the caller gets around to calling try_lock().
+        void notifyWhenAvailable(std::function<void()> callback)
+        {
+            _arbitrator.notifyWhenAvailable(_token, _region, std::move(callback));
+        }
+        
     private:
         RegionMutualExclusionArbitrator &_arbitrator;
         TokenType _token;
@@ -68,10 +88,19 @@ public:
     }
     
 private:
+    // A callback waiting for a region to become available.
+    struct Waiter
+    {
+        AABB region;
+        bool isWriter;
+        std::function<void()> callback;
+    };
+    
     std::mutex _mutex;
     std::condition_variable _cvar;
     std::list<AABB> _readerTransactions;
     std::list<AABB> _writerTransactions;
+    std::list<Waiter> _waiters;
     
     // Lock a region of space for reading.
     // Returns a token which can be used to unlock it.
@@ -97,22 +126,107 @@ private:
         token.iter = _writerTransactions.begin();
     }
     
+    // Lock a region of space for reading, if that can be done immediately.
+    bool tryLock(ReaderToken &token, const AABB &region)
+    {
+        std::scoped_lock lock(_mutex);
+        if (!readerCanEnter(region)) {
+            return false;
+        }
+        _readerTransactions.push_front(region);
+        token.iter = _readerTransactions.begin();
+        return true;
+    }
+    
+    // Lock a region of space for writing, if that can be done immediately.
+    bool tryLock(WriterToken &token, const AABB &region)
+    {
+        std::scoped_lock lock(_mutex);
+        if (!writerCanEnter(region)) {
+            return false;
+        }
+        _writerTransactions.push_front(region);
+        token.iter = _writerTransactions.begin();
+        return true;
+    }
+    
     // Unlock a region preiously locked for reading.
     void unlock(ReaderToken &token)
     {
-        std::scoped_lock lock(_mutex);
-        _readerTransactions.erase(token.iter);
-        token.iter = _readerTransactions.end();
-        _cvar.notify_all();
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::scoped_lock lock(_mutex);
+            _readerTransactions.erase(token.iter);
+            token.iter = _readerTransactions.end();
+            _cvar.notify_all();
+            callbacks = takeWaitersWhichCanEnter();
+        }
+        for (auto &callback : callbacks) {
+            callback();
+        }
     }
     
     // Unlock a region preiously locked for writing.
     void unlock(WriterToken &token)
     {
-        std::scoped_lock lock(_mutex);
-        _writerTransactions.erase(token.iter);
-        token.iter = _writerTransactions.end();
-        _cvar.notify_all();
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::scoped_lock lock(_mutex);
+            _writerTransactions.erase(token.iter);
+            token.iter = _writerTransactions.end();
+            _cvar.notify_all();
+            callbacks = takeWaitersWhichCanEnter();
+        }
+        for (auto &callback : callbacks) {
+            callback();
+        }
+    }
+    
+    // Call the callback once a reader could enter the region.
+    void notifyWhenAvailable(ReaderToken &, const AABB &region,
+                             std::function<void()> callback)
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            if (!readerCanEnter(region)) {
+                _waiters.push_back(Waiter{region, false, std::move(callback)});
+                return;
+            }
+        }
+        callback();
+    }
+    
+    // Call the callback once a writer could enter the region.
+    void notifyWhenAvailable(WriterToken &, const AABB &region,
+                             std::function<void()> callback)
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            if (!writerCanEnter(region)) {
+                _waiters.push_back(Waiter{region, true, std::move(callback)});
+                return;
+            }
+        }
+        callback();
+    }
+    
+    // Remove waiters whose regions are now available and return their
+    // callbacks. The caller must hold `_mutex', and must call the callbacks
+    // after releasing it.
+    std::vector<std::function<void()>> takeWaitersWhichCanEnter()
+    {
+        std::vector<std::function<void()>> callbacks;
+        auto iter = _waiters.begin();
+        while (iter != _waiters.end()) {
+            const bool canEnter = iter->isWriter ? writerCanEnter(iter->region) : readerCanEnter(iter->region);
+            if (canEnter) {
+                callbacks.emplace_back(std::move(iter->callback));
+                iter = _waiters.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+        return callbacks;
     }
     
     // Test whether the specified region overlaps a region of any existing
@@ -11,7 +11,11 @@
 
 #include <spdlog/fmt/ostr.h>
 #include <cereal/archives/xml.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
 #include <spdlog/spdlog.h>
+#include <map>
+#include <string>
 
 
 // Allow serializing spdlog::level::level_enum with cereal.
@@ -47,37 +51,80 @@ struct Preferences
     spdlog::level::level_enum logLevel;
     float activeRegionSize;
     
+    // Voxel chunks are prefetched where the camera is predicted to be this
+    // many seconds from now. Zero disables prefetching.
+    float prefetchLookahead;
+    
+    // Total number of worker threads for all thread pools. Zero selects a
+    // budget based on the number of CPUs.
+    unsigned workerThreadBudget;
+    
+    // Pin worker threads to CPUs. Only supported on Linux and Windows.
+    bool pinWorkerThreads;
+    
+    // When pinning, pin each worker thread to a NUMA node rather than a CPU.
+    bool groupWorkerThreadsByNumaNode;
+    
+    // Relative share of the worker thread budget given to each subsystem.
+    std::map<std::string, float> workerThreadShares;
+    
     Preferences()
      : showQueuedChunks(false),
        smoothTerrain(true),
        logLevel(spdlog::level::info),
-       activeRegionSize(256.f)
+       activeRegionSize(256.f),
+       prefetchLookahead(2.f),
+       workerThreadBudget(0),
+       pinWorkerThreads(false),
+       groupWorkerThreadsByNumaNode(true),
+       workerThreadShares{{"terrain", 1.f}}
     {}
     
     // Permits logging with spdlog.
     template<typename OStream>
     friend OStream& operator<<(OStream &os, const Preferences &prefs)
     {
-        return os << "Preferences {"
-                  << "\n\tshowQueuedChunks: "
-                  << (prefs.showQueuedChunks ? "true" : "false")
-                  << "\n\tsmoothTerrain: "
-                  << (prefs.smoothTerrain ? "true" : "false")
-                  << "\n\tlogLevel: "
-                  << spdlog::level::to_str(prefs.logLevel)
-                  << "\n\tactiveRegionSize: "
-                  << prefs.activeRegionSize
+        os << "Preferences {"
+           << "\n\tshowQueuedChunks: "
+           << (prefs.showQueuedChunks ? "true" : "false")
+           << "\n\tsmoothTerrain: "
+           << (prefs.smoothTerrain ? "true" : "false")
+           << "\n\tlogLevel: "
+           << spdlog::level::to_str(prefs.logLevel)
+           << "\n\tactiveRegionSize: "
+           << prefs.activeRegionSize
+           << "\n\tprefetchLookahead: "
+           << prefs.prefetchLookahead
+           << "\n\tworkerThreadBudget: "
+           << prefs.workerThreadBudget
+           << "\n\tpinWorkerThreads: "
+           << (prefs.pinWorkerThreads ? "true" : "false")
+           << "\n\tgroupWorkerThreadsByNumaNode: "
+           << (prefs.groupWorkerThreadsByNumaNode ? "true" : "false")
+           << "\n\tworkerThreadShares: {";
+        for (const auto &pair : prefs.workerThreadShares) {
+            os << " " << pair.first << ": " << pair.second;
+        }
+        return os << " }"
                   << "\n}";
     }
     
     // Permits serialization with cereal.
+    // Settings load in the order listed here. Loading a file saved by an older
+    // version stops at the first setting it lacks, and that setting and the
+    // ones after it keep their defaults. So, add new settings at the end.
     template<typename Archive>
     void serialize(Archive &archive)
     {
         archive(CEREAL_NVP(showQueuedChunks),
                 CEREAL_NVP(smoothTerrain),
                 CEREAL_NVP(logLevel),
-                CEREAL_NVP(activeRegionSize));
+                CEREAL_NVP(activeRegionSize),
+                CEREAL_NVP(workerThreadBudget),
+                CEREAL_NVP(pinWorkerThreads),
+                CEREAL_NVP(groupWorkerThreadsByNumaNode),
+                CEREAL_NVP(workerThreadShares),
+                CEREAL_NVP(prefetchLookahead));
     }
 };
 
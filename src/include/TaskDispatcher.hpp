@@ -10,16 +10,26 @@
 #define TaskDispatcher_hpp
 
 #include "Exception.hpp"
+#include "TaskNode.hpp"
+#include "CancellationToken.hpp"
 
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <cassert>
 #include <atomic>
-#include <future>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 
 // Exception thrown when a promise is broken.
 class BrokenPromiseException : public Exception
@@ -33,47 +43,200 @@ public:
     {}
 };
 
-class AbstractTask : public std::enable_shared_from_this<AbstractTask>
-{
-public:
-    virtual ~AbstractTask() = default;
-    virtual void cancel() = 0;
-    virtual void execute() = 0;
-};
-
+// State shared between a Future and the task which produces its result.
+// The result is either a value or an exception. Continuations may be attached
+// to the state. These run on whichever thread publishes the result, so they
+// must be cheap. Usually, they just post another task.
 template<typename ResultType>
-class Task : public AbstractTask
+class SharedState
 {
-    std::atomic<bool> _cancelled;
-    std::packaged_task<ResultType()> _task;
-    
 public:
-    Task() = delete;
+    using ValueType = typename std::conditional<std::is_void<ResultType>::value, bool, ResultType>::type;
+    
+    SharedState() : _ready(false), _cancelled(false), _continuations(nullptr) {}
+    
+    ~SharedState()
+    {
+        while (_continuations) {
+            TaskNode *node = _continuations;
+            _continuations = node->next;
+            node->discard();
+        }
+    }
+    
+    // Publish the result value and run continuations.
+    template<typename... Args>
+    void setValue(Args&&... args)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        assert(!_ready);
+        if constexpr (std::is_void<ResultType>::value) {
+            _value.emplace(true);
+        } else {
+            _value.emplace(std::forward<Args>(args)...);
+        }
+        publish(lock);
+    }
+        
+    // Publish an exception as the result and run continuations.
+    void setException(std::exception_ptr exception)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        assert(!_ready);
+        _exception = exception;
+        publish(lock);
+    }
     
+    // Publish a BrokenPromiseException as the result and run continuations.
+    void breakPromise()
+    {
+        try {
+            throw BrokenPromiseException();
+        } catch (...) {
+            setException(std::current_exception());
+        }
+    }
+    
+    // Call the function, and publish its return value or exception.
     template<typename FunctionObjectType>
-    Task(FunctionObjectType &&fn)
-     : _cancelled(false),
-       _task([this, f=std::move(fn)]() mutable {
-           if (_cancelled) {
-               throw BrokenPromiseException();
-           }
-           return f();
-       })
-    {}
+    void setResultOf(FunctionObjectType &&fn)
+    {
+        try {
+            if constexpr (std::is_void<ResultType>::value) {
+                fn();
+                setValue();
+            } else {
+                setValue(fn());
+            }
+        } catch (...) {
+            setException(std::current_exception());
+        }
+    }
     
-    void cancel() override
+    // Call the specified function once the result is ready. If the result is
+    // already ready then the function is called immediately.
+    template<typename FunctionObjectType>
+    void onReady(FunctionObjectType &&continuation)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_ready) {
+                TaskNode *node = TaskNode::make(std::move(continuation));
+                node->next = _continuations;
+                _continuations = node;
+                return;
+            }
+        }
+        continuation();
+    }
+        
+    bool isReady()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _ready;
+    }
+    
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cvar.wait(lock, [this]{ return _ready; });
+    }
+    
+    // Wait for the result. Either returns the value, moving it out of the
+    // shared state, or rethrows the exception.
+    ResultType get()
+    {
+        wait();
+        if (_exception) {
+            std::rethrow_exception(_exception);
+        }
+        if constexpr (!std::is_void<ResultType>::value) {
+            return std::move(*_value);
+        }
+    }
+    
+    // Request that the task producing the result not be run.
+    void cancel()
     {
         _cancelled = true;
     }
     
-    void execute() override
+    bool isCancelled() const
+    {
+        return _cancelled;
+    }
+    
+private:
+    std::mutex _mutex;
+    std::condition_variable _cvar;
+    bool _ready;
+    std::atomic<bool> _cancelled;
+    std::optional<ValueType> _value;
+    std::exception_ptr _exception;
+    
+    // Continuations are kept in a linked list of task nodes, in reverse order.
+    TaskNode *_continuations;
+    
+    void publish(std::unique_lock<std::mutex> &lock)
+    {
+        _ready = true;
+        
+        // Reverse the list so that continuations run in the order they were
+        // added.
+        TaskNode *continuations = nullptr;
+        while (_continuations) {
+            TaskNode *node = _continuations;
+            _continuations = node->next;
+            node->next = continuations;
+            continuations = node;
+        }
+        
+        lock.unlock();
+        _cvar.notify_all();
+        
+        while (continuations) {
+            TaskNode *node = continuations;
+            continuations = node->next;
+            node->execute();
+        }
+    }
+};
+
+// Function object which runs a task and publishes the result to its shared
+// state. This is what actually sits in the dispatcher's queue. If it is
+// destroyed without being called, e.g., because the dispatcher was shutdown,
+// then the waiting future gets a BrokenPromiseException.
+template<typename ResultType, typename FunctionObjectType>
+class TaskInvoker
+{
+    std::shared_ptr<SharedState<ResultType>> _state;
+    FunctionObjectType _fn;
+
+public:
+    TaskInvoker(std::shared_ptr<SharedState<ResultType>> state,
+                FunctionObjectType &&fn)
+     : _state(std::move(state)),
+       _fn(std::move(fn))
+    {}
+    
+    TaskInvoker(TaskInvoker &&invoker) = default;
+    TaskInvoker(const TaskInvoker &invoker) = delete;
+    
+    ~TaskInvoker()
     {
-        _task();
+        if (_state) {
+            _state->breakPromise();
+        }
     }
     
-    std::future<ResultType> getFuture()
+    void operator()()
     {
-        return _task.get_future();
+        auto state = std::move(_state);
+        if (state->isCancelled()) {
+            state->breakPromise();
+        } else {
+            state->setResultOf(_fn);
+        }
     }
 };
 
@@ -83,108 +246,225 @@ template<typename ResultType>
 class Future
 {
 private:
-    std::future<ResultType> _future;
+    std::shared_ptr<SharedState<ResultType>> _state;
     std::shared_ptr<TaskDispatcher> _dispatcher;
-    std::shared_ptr<Task<ResultType>> _task;
     
 public:
     ~Future() = default;
     Future() = delete;
     Future(const Future &future) = delete;
     Future(Future &&future) = default;
+    Future& operator=(Future &&future) = default;
     
-    Future(std::future<ResultType> &&future,
-           const std::shared_ptr<TaskDispatcher> &dispatcher,
-           const std::shared_ptr<Task<ResultType>> &task)
-     : _future(std::move(future)),
-       _dispatcher(dispatcher),
-       _task(task)
+    Future(std::shared_ptr<SharedState<ResultType>> state,
+           std::shared_ptr<TaskDispatcher> dispatcher)
+     : _state(std::move(state)),
+       _dispatcher(std::move(dispatcher))
     {}
     
-    bool isValid()
+    // Returns false if the future has been moved-from, e.g., by then().
+    bool isValid() const
     {
-        return _future.is_valid();
+        return _state != nullptr;
     }
     
     bool isReady()
     {
-        return _future.is_ready();
+        assert(_state);
+        return _state->isReady();
     }
     
     void wait()
     {
-        _future.wait();
+        assert(_state);
+        _state->wait();
     }
     
     ResultType get()
     {
-        return _future.get();
+        assert(_state);
+        return _state->get();
     }
     
     void cancel()
     {
-        assert(_task);
-        _task->cancel();
+        assert(_state);
+        _state->cancel();
+    }
+    
+    // Returns the dispatcher on which continuations are scheduled by default.
+    const std::shared_ptr<TaskDispatcher>& getDispatcher() const
+    {
+        return _dispatcher;
+    }
+    
+    // Call the specified function once the result is ready. The function runs
+    // on the thread which publishes the result so it must be cheap.
+    // This is intended for building combinators such as whenAll().
+    template<typename FunctionObjectType>
+    void onReady(FunctionObjectType &&continuation)
+    {
+        assert(_state);
+        _state->onReady(std::move(continuation));
     }
     
     // Build a compound future.
     //
-    // This method will dispatch a task on the current dispatcher to wait for
-    // the result of this future. Then, once the result is obtained, it will
-    // execute the specified function `fn'.
+    // Once the result of this future is ready, a task is dispatched on the
+    // current dispatcher to execute the specified function `fn'. No thread
+    // waits on the result in the meantime.
     //
     // The function `fn' is expected to accept a single parameter of the same
-    // type as the future's result type.
+    // type as the future's result type, or no parameters if that is void. If
+    // this future's task threw an exception then `fn' is not called and the
+    // exception is passed along to the returned future.
     //
     // After this call, the Future is left in a moved-from state.
     template<typename FunctionType>
-    auto then(FunctionType &&fn)
-    {
-        auto task = std::move(_task);
-        auto future = std::move(_future);
-        auto dispatcher = std::move(_dispatcher);
-        auto thenCont = [fn=std::move(fn), future=std::move(future)]() mutable {
-            return fn(future.get());
-        };
-        return dispatcher->async(std::move(thenCont));
-    }
+    auto then(FunctionType &&fn);
     
     // Build a compound future where the next link runs on the given dispatcher.
     // This method permits the construction of compound futures where each link
     // executes on a different task queue.
     //
-    // This method will dispatch a task on the current dispatcher to wait for
-    // the result of this future. Then, once the result is obtained, it will
-    // dispatch a task for `fn' on the specified second dispatcher.
-    //
-    // The function `fn' is expected to accept a single parameter of the same
-    // type as the future's result type.
-    //
     // After this call, the Future is left in a moved-from state.
     template<typename Dispatcher, typename FunctionType>
-    auto then(Dispatcher secondDispatcher, FunctionType &&fn)
-    {
-        auto task = std::move(_task);
-        auto future = std::move(_future);
-        auto dispatcher = std::move(_dispatcher);
-        auto thenCont = [secondDispatcher, fn=std::move(fn), future=std::move(future)]() mutable {
-            auto result = future.get();
-            auto secondFuture = secondDispatcher->async([r=std::move(result), fn=std::move(fn)]() mutable {
-                return fn(r);
-            });
-            return secondFuture.get();
-        };
-        return dispatcher->async(std::move(thenCont));
+    auto then(Dispatcher secondDispatcher, FunctionType &&fn);
+};
+
+// The producing side of a Future whose result is published by some means
+// other than a task on a dispatcher. For example, by a callback which fires
+// when an asynchronous lock is acquired.
+//
+// If the promise is destroyed without publishing a result then the waiting
+// future gets a BrokenPromiseException.
+template<typename ResultType>
+class Promise
+{
+private:
+    std::shared_ptr<SharedState<ResultType>> _state;
+
+public:
+    Promise() : _state(std::make_shared<SharedState<ResultType>>()) {}
+    Promise(const Promise &promise) = delete;
+    Promise(Promise &&promise) = default;
+    
+    ~Promise()
+    {
+        if (_state) {
+            _state->breakPromise();
+        }
+    }
+    
+    // Returns a future for the result. Continuations on the future are
+    // scheduled on the specified dispatcher.
+    Future<ResultType> getFuture(std::shared_ptr<TaskDispatcher> dispatcher)
+    {
+        assert(_state);
+        return Future<ResultType>(_state, std::move(dispatcher));
+    }
+    
+    // Publish the result value. This may be called only once.
+    template<typename... Args>
+    void setValue(Args&&... args)
+    {
+        assert(_state);
+        auto state = std::move(_state);
+        state->setValue(std::forward<Args>(args)...);
+    }
+    
+    // Call the function and publish its return value or exception. This may
+    // be called only once.
+    template<typename FunctionObjectType>
+    void setResultOf(FunctionObjectType &&fn)
+    {
+        assert(_state);
+        auto state = std::move(_state);
+        state->setResultOf(std::forward<FunctionObjectType>(fn));
+    }
+    
+    // Publish an exception as the result. This may be called only once.
+    void setException(std::exception_ptr exception)
+    {
+        assert(_state);
+        auto state = std::move(_state);
+        state->setException(exception);
     }
 };
 
 class TaskDispatcher : public std::enable_shared_from_this<TaskDispatcher>
 {
 public:
+    using Clock = std::chrono::steady_clock;
+    
+    // Selects the policy used to distribute tasks among the worker threads.
+    enum Scheduling
+    {
+        // All workers pull tasks from a single set of queues guarded by one
+        // lock.
+        SharedQueue,
+        
+        // Each worker has its own deque of normal priority tasks. Tasks posted
+        // from a worker thread go onto that worker's own deque. Tasks posted
+        // from any other thread are distributed round-robin. Idle workers
+        // steal tasks from the deques of other workers.
+        WorkStealing,
+        
+        // There are no worker threads. Tasks are pushed onto a lock-free
+        // inbox and only run when flush() is called. Posting a task never
+        // takes a lock, so this suits the main thread, which is fed by many
+        // producers. The flushing thread moves tasks from the inbox into the
+        // priority lanes, so priorities and deadlines are still honored.
+        Inbox
+    };
+    
+    // Tasks are queued in lanes according to their priority. A worker always
+    // takes a task from the highest priority lane which has one, except that
+    // a lower priority lane which has been passed over too many times in a row
+    // is given the next turn. This keeps bulk work moving under a steady
+    // stream of high priority tasks.
+    enum Priority
+    {
+        // Latency sensitive work, e.g., work which the next frame depends on.
+        HighPriority,
+        
+        // Bulk work, e.g., voxel generation.
+        NormalPriority,
+        
+        // Speculative work which may be deferred indefinitely.
+        LowPriority
+    };
+    
+    static constexpr size_t NumberOfPriorities = 3;
+    
+    // The number of times in a row that a lower priority lane with queued
+    // tasks may be passed over before it is given the next turn.
+    static constexpr unsigned StarvationLimit = 8;
+    
     TaskDispatcher() = delete;
-    TaskDispatcher(const std::string &name, unsigned numThreads);
+    
+    // Constructor.
+    // name -- Name given to each worker thread. Useful for debugging.
+    // numThreads -- The number of worker threads. A dispatcher with zero
+    //               threads only executes tasks when flush() is called.
+    // scheduling -- Policy for distributing tasks among worker threads.
+    //               A dispatcher with zero threads uses SharedQueue unless
+    //               Inbox is requested. Inbox is only used with zero threads.
+    // onWorkerStart -- Optional function called on each worker thread, with
+    //                  the worker's index, before it runs any tasks. This can
+    //                  be used to set the thread's CPU affinity.
+    TaskDispatcher(const std::string &name,
+                   unsigned numThreads,
+                   Scheduling scheduling = SharedQueue,
+                   std::function<void(unsigned workerIndex)> onWorkerStart = nullptr);
+    
     ~TaskDispatcher();
     
+    // Returns the scheduling policy in use by this dispatcher.
+    inline Scheduling getScheduling() const {
+        return _scheduling;
+    }
+    
     // Returns true if the dispatcher is shutting down or has already shutdown.
     // Tasks can use this to check whether they should cancel themselves.
     inline bool isShutdown() const {
@@ -192,11 +472,32 @@ public:
     }
     
     // Finish all scheduled tasks and exit all threads.
+    // This may be called from a task running on this dispatcher. In that case,
+    // the worker thread running the task exits once the task returns.
     void shutdown();
     
     // Finish all scheduled tasks.
     void flush();
     
+    // Run scheduled tasks until there are none left or until the time budget
+    // is spent. At least one task is run, if there is one. Tasks which do not
+    // fit in the budget remain queued for the next call.
+    // Returns the number of tasks which were run.
+    size_t flush(Clock::duration budget);
+    
+    // Returns the number of tasks which are queued and have not started yet.
+    // On a dispatcher which is flushed once per frame, this is the backlog
+    // which has rolled over to the next frame.
+    inline size_t getNumberOfPendingTasks() const {
+        return (size_t)std::max<std::ptrdiff_t>(0, numberOfPendingTasks());
+    }
+    
+    // Returns the priority given to tasks which do not specify one. This is
+    // the priority of the task currently executing on the calling thread, if
+    // that is a worker of this dispatcher, so that work spawned by a high
+    // priority task is also high priority. Otherwise, it is NormalPriority.
+    Priority getDefaultPriority() const;
+    
     // For each element of the range, calls the specified function
     // asynchronously, passing the element a parameter. The corresponding
     // function return values are accessible through a vector of Future objects
@@ -208,9 +509,10 @@ public:
         using ResultType = typename std::result_of<FunctionObjectType(IterationType)>::type;
         
         std::vector<Future<ResultType>> futures;
+        const Priority priority = getDefaultPriority();
         
         for (const auto obj : range) {
-            futures.emplace_back(async([functionObject, obj]{
+            futures.emplace_back(async(priority, [functionObject, obj]{
                 return functionObject(obj);
             }));
         }
@@ -227,8 +529,9 @@ public:
         using ResultType = typename std::result_of<FunctionObjectType()>::type;
         std::vector<Future<ResultType>> tasks;
         tasks.reserve(count);
+        const Priority priority = getDefaultPriority();
         for (size_t i = 0; i < count; ++i) {
-            tasks.emplace_back(async(std::move(functionObject)));
+            tasks.emplace_back(async(priority, std::move(functionObject)));
         }
         return tasks;
     }
@@ -240,32 +543,506 @@ public:
     // accept no parameters.
     template<typename FunctionObjectType>
     auto async(FunctionObjectType &&functionObject)
+    {
+        return async(getDefaultPriority(), std::move(functionObject));
+    }
+    
+    // Schedule a task with the specified priority.
+    template<typename FunctionObjectType>
+    auto async(Priority priority, FunctionObjectType &&functionObject)
+    {
+        return async(priority, Clock::time_point::max(), std::move(functionObject));
+    }
+    
+    // Schedule a task with the specified priority and deadline.
+    // Within a lane, tasks with a deadline are taken before tasks without one,
+    // earliest deadline first. Once the deadline has passed, the task is taken
+    // ahead of all other tasks, regardless of priority.
+    template<typename FunctionObjectType>
+    auto async(Priority priority,
+               Clock::time_point deadline,
+               FunctionObjectType &&functionObject)
     {
         using ResultType = typename std::result_of<FunctionObjectType()>::type;
-        auto taskPtr = std::make_shared<Task<ResultType>>(std::move(functionObject));
+        auto state = std::make_shared<SharedState<ResultType>>();
+        postTask(state, std::move(functionObject), priority, deadline);
+        return Future<ResultType>(std::move(state), shared_from_this());
+    }
+    
+    // Schedule a task which observes the specified cancellation token. If the
+    // token is cancelled before the task starts then the task is not run and
+    // the future throws CancelledException. A task which runs for a long time
+    // should also capture the token and check it periodically.
+    template<typename FunctionObjectType>
+    auto async(const CancellationToken &cancellationToken,
+               FunctionObjectType &&functionObject)
+    {
+        return async(getDefaultPriority(), cancellationToken, std::move(functionObject));
+    }
+    
+    // Schedule a task with the specified priority which observes the specified
+    // cancellation token.
+    template<typename FunctionObjectType>
+    auto async(Priority priority,
+               const CancellationToken &cancellationToken,
+               FunctionObjectType &&functionObject)
+    {
+        return async(priority, [cancellationToken, f=std::move(functionObject)]() mutable {
+            cancellationToken.throwIfCancelled();
+            return f();
+        });
+    }
+    
+    // Schedule a task to be run asynchronously on a thread in the pool, and
+    // forget about it. This is cheaper than async() as there is no Future, and
+    // small function objects do not require any allocation at all.
+    // The function object may have any return type, but the return value is
+    // discarded. Exceptions thrown by the function object are also discarded.
+    template<typename FunctionObjectType>
+    void dispatch(FunctionObjectType &&functionObject)
+    {
+        dispatch(getDefaultPriority(), std::move(functionObject));
+    }
+    
+    // Schedule a fire-and-forget task with the specified priority.
+    template<typename FunctionObjectType>
+    void dispatch(Priority priority, FunctionObjectType &&functionObject)
+    {
+        dispatch(priority, Clock::time_point::max(), std::move(functionObject));
+    }
+    
+    // Schedule a fire-and-forget task with the specified priority and
+    // deadline.
+    template<typename FunctionObjectType>
+    void dispatch(Priority priority,
+                  Clock::time_point deadline,
+                  FunctionObjectType &&functionObject)
+    {
+        post(TaskNode::make([f=std::move(functionObject)]() mutable {
+            try {
+                f();
+            } catch (...) {
+                // Nobody is listening for the result, nor for the exception.
+            }
+        }), priority, deadline);
+    }
+    
+    // Calls the function for each index in [first, last), in parallel.
+    //
+    // Unlike map(), this does not create a task and a future per element. The
+    // range is split into blocks of consecutive indices and a few tasks take
+    // blocks until none remain. The calling thread processes blocks too, and
+    // only ever waits for blocks which some other thread has already started.
+    // So, this may be called from a task running on this dispatcher, and even
+    // from within another call to parallelFor(), without risk of deadlock.
+    //
+    // If the function throws an exception then blocks which have not started
+    // are skipped, and the exception is rethrown once the rest have finished.
+    //
+    // grainSize -- The number of indices in each block. Pass zero to choose a
+    //              block size which gives each thread a few blocks.
+    template<typename FunctionObjectType>
+    void parallelFor(size_t first, size_t last,
+                     FunctionObjectType &&functionObject,
+                     size_t grainSize = 0)
+    {
+        if (first >= last) {
+            return;
+        }
         
-        {
-            std::unique_lock<std::mutex> lock(_lockTaskPosted);
-            _tasks.push(std::dynamic_pointer_cast<AbstractTask>(taskPtr));
+        const size_t blockSize = chooseGrainSize(last - first, grainSize);
+        const size_t numberOfBlocks = (last - first + blockSize - 1) / blockSize;
+        
+        forEachBlock(numberOfBlocks, [&](size_t block){
+            const size_t begin = first + block * blockSize;
+            const size_t end = std::min(last, begin + blockSize);
+            for (size_t i = begin; i < end; ++i) {
+                functionObject(i);
+            }
+        });
+    }
+    
+    // Calls the function for each element of each block in the collection, in
+    // parallel. Each block is processed by a single thread. The collection
+    // must provide size() and operator[], and each block must be a range.
+    // For example, sliceBlocks() splits a slice of a grid into blocks of
+    // nearby cells.
+    template<typename BlockCollectionType, typename FunctionObjectType>
+    void parallelFor(const BlockCollectionType &blocks,
+                     FunctionObjectType &&functionObject)
+    {
+        forEachBlock(blocks.size(), [&](size_t block){
+            for (const auto obj : blocks[block]) {
+                functionObject(obj);
+            }
+        });
+    }
+    
+    // Maps each index in [first, last) to a value and combines the values with
+    // the reduce function, in parallel. Each block of the range is reduced
+    // separately, starting from `identity', and then the blocks are combined
+    // in order. So, the reduce function must be associative, but need not be
+    // commutative.
+    template<typename ValueType, typename MapFunctionType, typename ReduceFunctionType>
+    ValueType parallelReduce(size_t first, size_t last,
+                             ValueType identity,
+                             MapFunctionType &&mapFunction,
+                             ReduceFunctionType &&reduceFunction,
+                             size_t grainSize = 0)
+    {
+        if (first >= last) {
+            return identity;
         }
-        _cvarTaskPosted.notify_one();
         
-        return Future<ResultType>(std::move(taskPtr->getFuture()),
-                                  shared_from_this(),
-                                  taskPtr);
+        const size_t blockSize = chooseGrainSize(last - first, grainSize);
+        const size_t numberOfBlocks = (last - first + blockSize - 1) / blockSize;
+        std::vector<std::optional<ValueType>> partials(numberOfBlocks);
+        
+        forEachBlock(numberOfBlocks, [&](size_t block){
+            const size_t begin = first + block * blockSize;
+            const size_t end = std::min(last, begin + blockSize);
+            ValueType partial = identity;
+            for (size_t i = begin; i < end; ++i) {
+                partial = reduceFunction(std::move(partial), mapFunction(i));
+            }
+            partials[block].emplace(std::move(partial));
+        });
+        
+        return combinePartials(std::move(identity), partials, reduceFunction);
     }
     
+    // Maps each element of each block in the collection to a value and
+    // combines the values with the reduce function, in parallel.
+    template<typename BlockCollectionType, typename ValueType, typename MapFunctionType, typename ReduceFunctionType>
+    ValueType parallelReduce(const BlockCollectionType &blocks,
+                             ValueType identity,
+                             MapFunctionType &&mapFunction,
+                             ReduceFunctionType &&reduceFunction)
+    {
+        std::vector<std::optional<ValueType>> partials(blocks.size());
+        
+        forEachBlock(blocks.size(), [&](size_t block){
+            ValueType partial = identity;
+            for (const auto obj : blocks[block]) {
+                partial = reduceFunction(std::move(partial), mapFunction(obj));
+            }
+            partials[block].emplace(std::move(partial));
+        });
+        
+        return combinePartials(std::move(identity), partials, reduceFunction);
+    }
+    
+    // Returns the number of worker threads the dispatcher was created with.
+    inline unsigned getNumberOfThreads() const {
+        return _numberOfThreads;
+    }
+
 private:
-    void worker(const std::string &name);
+    template<typename ResultType> friend class Future;
     
+    // Enqueue a task which publishes its result to the specified shared state.
+    template<typename ResultType, typename FunctionObjectType>
+    void postTask(const std::shared_ptr<SharedState<ResultType>> &state,
+                  FunctionObjectType &&functionObject,
+                  Priority priority,
+                  Clock::time_point deadline)
+    {
+        using Invoker = TaskInvoker<ResultType, typename std::decay<FunctionObjectType>::type>;
+        post(TaskNode::make(Invoker(state, std::move(functionObject))), priority, deadline);
+    }
+    
+    // Blocks of a parallelFor() which remain to be processed, and the means
+    // for the calling thread to wait for those which are being processed.
+    // Helper tasks may outlive the call, so this is reference counted. Once
+    // every block has been taken, the block function is never called again.
+    struct ParallelForContext
+    {
+        using BlockFunction = void (*)(void *functionObject, size_t block);
+        
+        const size_t numberOfBlocks;
+        void * const functionObject;
+        const BlockFunction blockFunction;
+        std::atomic<size_t> nextBlock;
+        std::atomic<size_t> numberOfFinishedBlocks;
+        std::atomic<bool> failed;
+        std::exception_ptr exception;
+        std::mutex mutex;
+        std::condition_variable cvar;
+        
+        ParallelForContext(size_t numberOfBlocks,
+                           void *functionObject,
+                           BlockFunction blockFunction);
+        
+        // Take and process blocks until there are none left.
+        void run();
+        
+        // Wait for all blocks to finish, then rethrow the first exception, if
+        // there was one.
+        void wait();
+    };
+    
+    // Calls the function for each block index in [0, numberOfBlocks). Helper
+    // tasks are posted to process blocks in parallel with the calling thread.
+    template<typename BlockFunctionType>
+    void forEachBlock(size_t numberOfBlocks, BlockFunctionType &&blockFunction)
+    {
+        using F = typename std::remove_reference<BlockFunctionType>::type;
+        
+        if (numberOfBlocks == 0) {
+            return;
+        }
+        
+        auto context = std::make_shared<ParallelForContext>(numberOfBlocks, (void *)&blockFunction, [](void *functionObject, size_t block){
+            (*static_cast<F *>(functionObject))(block);
+        });
+        
+        // There is no point in posting more helpers than there are workers,
+        // and the calling thread takes a block itself.
+        const size_t numberOfHelpers = std::min(numberOfBlocks - 1, (size_t)_numberOfThreads);
+        const Priority priority = getDefaultPriority();
+        for (size_t i = 0; i < numberOfHelpers; ++i) {
+            post(TaskNode::make([context]{
+                context->run();
+            }), priority, Clock::time_point::max());
+        }
+        
+        context->run();
+        context->wait();
+    }
+    
+    // Returns the block size to use for a parallelFor() over `count' indices.
+    size_t chooseGrainSize(size_t count, size_t grainSize) const;
+    
+    // Combines the partial results of a parallelReduce() in order.
+    template<typename ValueType, typename ReduceFunctionType>
+    static ValueType combinePartials(ValueType identity,
+                                     std::vector<std::optional<ValueType>> &partials,
+                                     ReduceFunctionType &reduceFunction)
+    {
+        ValueType result = std::move(identity);
+        for (auto &partial : partials) {
+            assert(partial);
+            result = reduceFunction(std::move(result), std::move(*partial));
+        }
+        return result;
+    }
+    
+    // An intrusive doubly-linked list of task nodes.
+    struct TaskList
+    {
+        TaskNode *head = nullptr;
+        TaskNode *tail = nullptr;
+        
+        inline bool empty() const
+        {
+            return head == nullptr;
+        }
+        
+        inline void pushBack(TaskNode *node)
+        {
+            node->next = nullptr;
+            node->prev = tail;
+            if (tail) {
+                tail->next = node;
+            } else {
+                head = node;
+            }
+            tail = node;
+        }
+        
+        inline TaskNode* popFront()
+        {
+            TaskNode *node = head;
+            if (node) {
+                head = node->next;
+                if (head) {
+                    head->prev = nullptr;
+                } else {
+                    tail = nullptr;
+                }
+            }
+            return node;
+        }
+        
+        inline TaskNode* popBack()
+        {
+            TaskNode *node = tail;
+            if (node) {
+                tail = node->prev;
+                if (tail) {
+                    tail->next = nullptr;
+                } else {
+                    head = nullptr;
+                }
+            }
+            return node;
+        }
+    };
+    
+    // Orders task nodes by deadline and then in the order they were posted.
+    struct LaterDeadline
+    {
+        inline bool operator()(const TaskNode *a, const TaskNode *b) const
+        {
+            if (a->deadline != b->deadline) {
+                return a->deadline > b->deadline;
+            }
+            return a->sequenceNumber > b->sequenceNumber;
+        }
+    };
+    
+    // A deque of tasks owned by a single worker thread in WorkStealing mode.
+    // The owner pushes and pops at the back. Thieves take from the front.
+    // The count lets thieves pass over an empty queue without locking it.
+    struct alignas(64) WorkerQueue
+    {
+        std::mutex mutex;
+        TaskList tasks;
+        std::atomic<std::ptrdiff_t> numberOfTasks{0};
+    };
+    
+    // A lane of the shared queue. Tasks with a deadline are kept in a heap.
+    // Tasks without a deadline are kept in FIFO order.
+    struct Lane
+    {
+        std::priority_queue<TaskNode*, std::vector<TaskNode*>, LaterDeadline> deadlines;
+        TaskList tasks;
+    };
+    
+    // Enqueue the task according to the scheduling policy and wake a worker.
+    void post(TaskNode *node,
+              Priority priority,
+              Clock::time_point deadline);
+    
+    // Runs a worker thread.
+    // index -- Index of the worker's own queue in `_workerQueues', if any.
+    void worker(const std::string &name,
+                size_t index,
+                const std::function<void(unsigned workerIndex)> &onWorkerStart);
+    
+    // Take the next task to execute, or return nullptr if there are no tasks.
+    // index -- Index of the calling worker's own queue in `_workerQueues', or
+    //          NoWorkerQueue if the caller is not a worker.
+    TaskNode* takeTask(size_t index);
+    
+    // Take a task from the lane for the specified priority, else return
+    // nullptr.
+    TaskNode* takeTaskFromLane(Priority priority, size_t index);
+    
+    // Take the task with the earliest deadline if that deadline has passed,
+    // else return nullptr.
+    TaskNode* takeOverdueTask();
+    
+    // Pop a task from the back of the worker's own queue, else steal one from
+    // the front of some other worker's queue.
+    TaskNode* takeTaskFromWorkerQueues(size_t index);
+    
+    // Run queued tasks on the calling thread until there are none left or
+    // the deadline has passed. Returns the number of tasks which were run.
+    size_t flushUntil(Clock::time_point deadline);
+    
+    // Push the task onto the inbox. This is lock-free.
+    void pushInbox(TaskNode *node);
+    
+    // Take every task from the inbox and return them in the order in which
+    // they were posted.
+    TaskList takeInbox();
+    
+    // Move tasks from the inbox into the lanes of the shared queue.
+    void collectInbox();
+    
+    // Removes every queued task and returns them.
+    std::vector<TaskNode*> drainTasks();
+    
+    // Returns the number of tasks waiting in all queues.
+    std::ptrdiff_t numberOfPendingTasks() const;
+    
+    // Returns the number of tasks of the specified priority waiting in all
+    // queues.
+    std::ptrdiff_t numberOfPendingTasks(Priority priority) const;
+    
+    static constexpr size_t NoWorkerQueue = SIZE_MAX;
+    
+    const Scheduling _scheduling;
+    const unsigned _numberOfThreads;
     std::vector<std::thread> _threads;
     std::mutex _lockTaskPosted;
     std::condition_variable _cvarTaskPosted;
     std::mutex _lockTaskCompleted;
-    std::queue<std::shared_ptr<AbstractTask>> _tasks;
     std::atomic<bool> _threadShouldExit;
+    
+    // The shared queue. This holds all tasks in SharedQueue mode. In
+    // WorkStealing mode, this holds tasks which are not normal priority, or
+    // which have a deadline. Sequence numbers order tasks with the same
+    // deadline, so only tasks with a deadline are given one. The next
+    // sequence number is guarded by `_lockLanes'.
+    std::mutex _lockLanes;
+    std::array<Lane, NumberOfPriorities> _lanes;
+    std::atomic<size_t> _numberOfDeadlineTasks;
+    uint64_t _nextSequenceNumber;
+    
+    // Per-priority count of tasks in the shared queue, including the inbox,
+    // and of the number of times in a row that lane has been passed over for
+    // a higher priority lane. Tasks in the worker queues are counted by those
+    // queues so that posting to a worker queue does not touch a cache line
+    // which is shared by all workers.
+    std::array<std::atomic<std::ptrdiff_t>, NumberOfPriorities> _numberOfPendingTasks;
+    std::array<std::atomic<unsigned>, NumberOfPriorities> _numberOfTimesPassedOver;
+    
+    // State used by the WorkStealing scheduling policy.
+    std::vector<std::unique_ptr<WorkerQueue>> _workerQueues;
+    std::atomic<size_t> _nextWorkerQueue;
+    
+    // Workers only touch `_lockTaskPosted' when going to sleep, or when waking
+    // a sleeping worker, so the lock is rarely contended.
+    std::atomic<unsigned> _numberOfSleepingWorkers;
+    
+    // State used by the Inbox scheduling policy. This is a stack of task nodes
+    // linked through `next'. Producers push with compare-and-swap, and the
+    // consumer takes the whole stack at once.
+    std::atomic<TaskNode*> _inbox;
 };
 
+template<typename ResultType>
+template<typename FunctionType>
+auto Future<ResultType>::then(FunctionType &&fn)
+{
+    auto dispatcher = _dispatcher;
+    return then(std::move(dispatcher), std::move(fn));
+}
+
+template<typename ResultType>
+template<typename Dispatcher, typename FunctionType>
+auto Future<ResultType>::then(Dispatcher secondDispatcher, FunctionType &&fn)
+{
+    assert(_state);
+    assert(secondDispatcher);
+    
+    auto link = [state=_state, fn=std::move(fn)]() mutable {
+        if constexpr (std::is_void<ResultType>::value) {
+            state->get();
+            return fn();
+        } else {
+            return fn(state->get());
+        }
+    };
+    using NextResultType = decltype(link());
+    
+    auto nextState = std::make_shared<SharedState<NextResultType>>();
+    auto state = std::move(_state);
+    _dispatcher.reset();
+    
+    std::shared_ptr<TaskDispatcher> dispatcher = secondDispatcher;
+    state->onReady([dispatcher, nextState, link=std::move(link)]() mutable {
+        dispatcher->postTask(nextState,
+                             std::move(link),
+                             dispatcher->getDefaultPriority(),
+                             TaskDispatcher::Clock::time_point::max());
+    });
+    
+    return Future<NextResultType>(std::move(nextState), std::move(dispatcher));
+}
+
 // Wait for all futures in the range to complete.
 template<typename FutureCollectionType> inline
 void waitForAll(FutureCollectionType &futures)
@@ -275,4 +1052,115 @@ void waitForAll(FutureCollectionType &futures)
     }
 }
 
+// Returns a future which becomes ready once all of the specified futures are
+// ready. Its result is a vector of their results, in the same order. If any of
+// them threw an exception then the returned future rethrows the first one.
+// No thread waits for the results in the meantime.
+//
+// The futures are left in a moved-from state. Continuations on the returned
+// future are scheduled on the dispatcher of the first future.
+template<typename ResultType>
+auto whenAll(std::vector<Future<ResultType>> &futures)
+{
+    using AllResultType = typename std::conditional<std::is_void<ResultType>::value, void, std::vector<ResultType>>::type;
+    
+    struct Context
+    {
+        std::vector<Future<ResultType>> futures;
+        std::atomic<size_t> remaining;
+        std::shared_ptr<SharedState<AllResultType>> state;
+    };
+    
+    auto context = std::make_shared<Context>();
+    context->futures = std::move(futures);
+    context->remaining = context->futures.size();
+    context->state = std::make_shared<SharedState<AllResultType>>();
+    
+    std::shared_ptr<TaskDispatcher> dispatcher;
+    if (!context->futures.empty()) {
+        dispatcher = context->futures.front().getDispatcher();
+    }
+    Future<AllResultType> result(context->state, dispatcher);
+    
+    auto finish = [](Context &context){
+        context.state->setResultOf([&]{
+            if constexpr (std::is_void<ResultType>::value) {
+                for (auto &future : context.futures) {
+                    future.get();
+                }
+            } else {
+                std::vector<ResultType> results;
+                results.reserve(context.futures.size());
+                for (auto &future : context.futures) {
+                    results.emplace_back(future.get());
+                }
+                return results;
+            }
+        });
+        context.futures.clear();
+    };
+    
+    if (context->futures.empty()) {
+        finish(*context);
+    } else {
+        for (auto &future : context->futures) {
+            future.onReady([context, finish]{
+                if (--context->remaining == 0) {
+                    finish(*context);
+                }
+            });
+        }
+    }
+    
+    return result;
+}
+
+// Returns a future which becomes ready once any one of the specified futures
+// is ready. Its result is the index of that future, paired with its result if
+// the result type is not void. If that future threw an exception then the
+// returned future rethrows it. The results of the other futures are discarded.
+//
+// The futures are left in a moved-from state. There must be at least one.
+// Continuations on the returned future are scheduled on the dispatcher of the
+// first future.
+template<typename ResultType>
+auto whenAny(std::vector<Future<ResultType>> &futures)
+{
+    using AnyResultType = typename std::conditional<std::is_void<ResultType>::value, size_t, std::pair<size_t, ResultType>>::type;
+    
+    struct Context
+    {
+        std::vector<Future<ResultType>> futures;
+        std::atomic<bool> done;
+        std::shared_ptr<SharedState<AnyResultType>> state;
+    };
+    
+    assert(!futures.empty());
+    
+    auto context = std::make_shared<Context>();
+    context->futures = std::move(futures);
+    context->done = false;
+    context->state = std::make_shared<SharedState<AnyResultType>>();
+    
+    Future<AnyResultType> result(context->state, context->futures.front().getDispatcher());
+    
+    for (size_t index = 0, n = context->futures.size(); index < n; ++index) {
+        context->futures[index].onReady([context, index]{
+            if (!context->done.exchange(true)) {
+                context->state->setResultOf([&]{
+                    Future<ResultType> &future = context->futures[index];
+                    if constexpr (std::is_void<ResultType>::value) {
+                        future.get();
+                        return index;
+                    } else {
+                        return std::make_pair(index, future.get());
+                    }
+                });
+            }
+        });
+    }
+    
+    return result;
+}
+
 #endif /* TaskDispatcher_hpp */
@@ -0,0 +1,110 @@
+//
+//  TaskNode.hpp
+//  PinkTopaz
+//
+
+#ifndef TaskNode_hpp
+#define TaskNode_hpp
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A unit of work queued on a TaskDispatcher.
+//
+// Nodes are intrusive so that queuing a task never allocates. Small function
+// objects are stored inline in the node, and larger ones are moved to the
+// heap. Nodes themselves are recycled through a pool with per-thread caches.
+// So, in the steady state, posting a small task does not touch the heap.
+class TaskNode
+{
+public:
+    // Function objects up to this size are stored in the node itself.
+    static constexpr size_t InlineStorageSize = 80;
+    
+    // Links used by the dispatcher's intrusive queues.
+    TaskNode *next;
+    TaskNode *prev;
+    
+    // Scheduling attributes set by the dispatcher.
+    unsigned priority;
+    std::chrono::steady_clock::time_point deadline;
+    uint64_t sequenceNumber;
+    
+    // Get a node from the pool and move the function object into it.
+    // The function object must accept no parameters. Its return value, if
+    // any, is discarded.
+    template<typename FunctionObjectType>
+    static TaskNode* make(FunctionObjectType &&functionObject)
+    {
+        using F = typename std::decay<FunctionObjectType>::type;
+        TaskNode *node = allocate();
+        
+        if constexpr (sizeof(F) <= InlineStorageSize && alignof(F) <= alignof(std::max_align_t)) {
+            new (node->_storage) F(std::forward<FunctionObjectType>(functionObject));
+            node->_operation = [](TaskNode &self, bool shouldExecute){
+                F &f = *std::launder(reinterpret_cast<F*>(self._storage));
+                Destroyer<F> destroyer{f};
+                if (shouldExecute) {
+                    f();
+                }
+            };
+        } else {
+            new (node->_storage) F*(new F(std::forward<FunctionObjectType>(functionObject)));
+            node->_operation = [](TaskNode &self, bool shouldExecute){
+                F *f = *std::launder(reinterpret_cast<F**>(self._storage));
+                Deleter<F> deleter{f};
+                if (shouldExecute) {
+                    (*f)();
+                }
+            };
+        }
+        
+        return node;
+    }
+    
+    // Call the function object and then return the node to the pool.
+    // The node must not be used after this call.
+    void execute();
+    
+    // Return the node to the pool without calling the function object.
+    // The node must not be used after this call.
+    void discard();
+
+private:
+    // Executes the function object if `shouldExecute' is true, and then
+    // destroys it in either case.
+    using Operation = void (*)(TaskNode &node, bool shouldExecute);
+    
+    template<typename F>
+    struct Destroyer
+    {
+        F &f;
+        ~Destroyer() { f.~F(); }
+    };
+    
+    template<typename F>
+    struct Deleter
+    {
+        F *f;
+        ~Deleter() { delete f; }
+    };
+    
+    Operation _operation;
+    alignas(std::max_align_t) unsigned char _storage[InlineStorageSize];
+    
+    TaskNode() = default;
+    
+    // Get an uninitialized node from the pool.
+    static TaskNode* allocate();
+    
+    // Return a node to the pool.
+    static void release(TaskNode *node);
+    
+    friend class TaskNodePool;
+};
+
+#endif /* TaskNode_hpp */
@@ -0,0 +1,198 @@
+//
+//  IncrementalLightPropagation.hpp
+//  PinkTopaz
+//
+
+#ifndef IncrementalLightPropagation_hpp
+#define IncrementalLightPropagation_hpp
+
+#include "Terrain/VoxelDataChunk.hpp"
+#include "Grid/GridIndexer.hpp"
+
+#include <array>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+// Updates lighting in the neighborhood of an edited voxel.
+//
+// Relighting the whole column with InitialSunlightPropagationOperation is far
+// too slow for interactive edits. Instead, this runs the usual pair of flood
+// fills for each light channel, sunlight and torch light. The first flood fill
+// removes all light which may have passed through the edited voxel. The second
+// floods light back into that region from the voxels which bound it. Only
+// voxels whose light actually depends on the edited voxel are touched.
+//
+// Sunlight follows the same rules as the initial propagation. It flows
+// sideways and down, but never up, and the brightest sunlight falls straight
+// down without dimming. Torch light flows in all six directions and always
+// dims. Neither enters solid voxels. Torch light comes from the light emitters
+// stored in each chunk.
+//
+// Light is flooded outward from many sources at once with a queue which is
+// bucketed by light level. Brighter voxels are expanded first, so each voxel is
+// expanded at most once however many of those sources reach it. This makes
+// placing many emitters in one batch cheaper than placing them one by one.
+//
+// Sunlight changes extend any distance below the edit but no more than
+// MAX_LIGHT voxels to the side. Torch light changes extend no more than
+// MAX_LIGHT voxels in any direction. The voxels just beyond this are read, but
+// not written. The neighborhood is expected to have undergone initial sunlight
+// propagation already.
+class IncrementalLightPropagation
+{
+public:
+    // Returns the chunk at the specified cell coordinates in the chunk grid.
+    using ChunkFetcher = std::function<VoxelDataChunk*(const glm::ivec3 &chunkCellCoords)>;
+    
+    // No default constructor.
+    IncrementalLightPropagation() = delete;
+    
+    // Constructor.
+    // voxelIndexer -- Indexer for the grid of voxels.
+    // chunkIndexer -- Indexer for the grid of chunks. This covers the same
+    //                 region of space as the grid of voxels.
+    // fetchChunk -- Closure which returns the chunk for the specified cell of
+    //               the chunk grid. Each chunk is fetched at most once and
+    //               must remain valid until the object is destroyed.
+    IncrementalLightPropagation(const GridIndexer &voxelIndexer,
+                                const GridIndexer &chunkIndexer,
+                                ChunkFetcher fetchChunk);
+    
+    // Edits a single voxel and updates lighting to match.
+    // The light values of `newValue' are ignored. Light is derived from the
+    // surrounding voxels instead. Making the voxel solid removes any light
+    // emitter it holds.
+    // Returns a bounding box which contains all voxels that changed.
+    AABB editVoxel(const glm::vec3 &point, const Voxel &newValue);
+    
+    // A request to change the light emitted into a single voxel.
+    struct EmitterEdit
+    {
+        // A point within the voxel.
+        glm::vec3 point;
+        
+        // The torch light to emit, in [0, MAX_LIGHT]. Zero removes the
+        // emitter.
+        unsigned light;
+    };
+    
+    // Places, changes, or removes many light emitters at once and updates
+    // torch light to match.
+    // Emitters can only be placed in empty voxels. Edits which would place an
+    // emitter in a solid voxel are ignored. Making a voxel solid with
+    // editVoxel() removes any emitter it holds.
+    // Returns a bounding box which contains all voxels that changed.
+    AABB editEmitters(const std::vector<EmitterEdit> &edits);
+    
+    // Returns the indices of chunks which have been modified. These need to
+    // be saved.
+    inline const std::unordered_set<Morton3>& getModifiedChunks() const
+    {
+        return _modifiedChunks;
+    }
+
+private:
+    enum Channel
+    {
+        Sunlight,
+        Torchlight
+    };
+    
+    // Cells from which light floods outward, bucketed by their light.
+    using FloodQueue = std::array<std::vector<glm::ivec3>, MAX_LIGHT + 1>;
+    
+    // A node in the removal flood fill.
+    struct RemovalNode
+    {
+        // Cell coordinates of the voxel in the grid of voxels.
+        glm::ivec3 cellCoords;
+        
+        // The light the voxel had before it was darkened.
+        unsigned light;
+    };
+    
+    const GridIndexer &_voxelIndexer;
+    const glm::ivec3 _chunkSize;
+    ChunkFetcher _fetchChunk;
+    std::unordered_map<Morton3, VoxelDataChunk *> _fetchedChunks;
+    std::unordered_set<Morton3> _modifiedChunks;
+    
+    // The chunk which was accessed last, which saves a hash lookup on most
+    // accesses.
+    glm::ivec3 _lastChunkCellCoords;
+    VoxelDataChunk *_lastChunk;
+    
+    // The chunk which was modified last. It is already in _modifiedChunks.
+    VoxelDataChunk *_lastModifiedChunk;
+    
+    // Bounds of the cells modified during the current edit.
+    glm::ivec3 _minModifiedCellCoords, _maxModifiedCellCoords;
+    
+    // Gets the voxel at the specified cell coordinates in the grid of voxels.
+    Voxel get(const glm::ivec3 &cellCoords);
+    
+    // Sets the voxel at the specified cell coordinates in the grid of voxels.
+    void set(const glm::ivec3 &cellCoords, const Voxel &value);
+    
+    // Returns the chunk which holds the specified cell of the grid of voxels.
+    // cellCoords -- The cell coordinates in the grid of voxels.
+    // voxelCellCoords -- Returns the cell coordinates of the voxel within the
+    //                    chunk.
+    VoxelDataChunk* chunkForCell(const glm::ivec3 &cellCoords,
+                                 glm::ivec3 &voxelCellCoords);
+    
+    // Returns the torch light emitted into the specified cell of the grid of
+    // voxels, or zero if there is no emitter there.
+    unsigned getEmittedLight(const glm::ivec3 &cellCoords);
+    
+    // Changes the light emitter at the specified cell of the grid of voxels.
+    // This does not change the light stored in any voxel.
+    void setEmitter(const glm::ivec3 &cellCoords, unsigned light);
+    
+    // Darkens every voxel which may have received light through the edited
+    // voxel, and then floods light back into the darkened region.
+    // cellCoords -- The cell coordinates of the edited voxel.
+    // channel -- The light channel to update.
+    // oldLight -- The light the edited voxel had before the edit.
+    void relight(const glm::ivec3 &cellCoords, Channel channel, unsigned oldLight);
+    
+    // Runs the flood fill which darkens voxels until the removal queue is
+    // empty. Voxels on the boundary of the darkened region remain lit, and
+    // are added to the flood queue so they can refill it. Darkened emitters
+    // are relit and added to the flood queue too.
+    void darken(Channel channel,
+                std::queue<RemovalNode> &removalQueue,
+                FloodQueue &floodQueue);
+    
+    // Runs the flood fill which spreads light until the queue is empty.
+    void flood(Channel channel, FloodQueue &queue);
+    
+    // Adds a cell to the flood queue if it is an empty voxel with some light.
+    void pushFlood(Channel channel, FloodQueue &queue, const glm::ivec3 &cellCoords);
+    
+    // Returns true if light of the channel flows from a voxel to its neighbor
+    // at the specified offset.
+    static bool flowsToward(Channel channel, const glm::ivec3 &delta);
+    
+    // Returns the light a voxel would receive from a neighbor in the specified
+    // direction, which has the specified light.
+    static unsigned lightReceived(Channel channel, const glm::ivec3 &delta, unsigned light);
+    
+    static inline unsigned getLight(const Voxel &voxel, Channel channel)
+    {
+        return (channel == Sunlight) ? voxel.sunLight : voxel.torchLight;
+    }
+    
+    static inline void setLight(Voxel &voxel, Channel channel, unsigned light)
+    {
+        if (channel == Sunlight) {
+            voxel.sunLight = light;
+        } else {
+            voxel.torchLight = light;
+        }
+    }
+};
+
+#endif /* IncrementalLightPropagation_hpp */
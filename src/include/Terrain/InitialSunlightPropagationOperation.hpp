@@ -11,16 +11,75 @@
 
 #include "Terrain/PersistentVoxelChunks.hpp"
 #include "Terrain/TerrainOperation.hpp"
-#include "Grid/ConcurrentSparseGrid.hpp"
+#include "Terrain/TerrainConfig.hpp"
 #include "TaskDispatcher.hpp"
 
 #include <spdlog/spdlog.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
 #include <queue>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
 // Propagates sunlight through newly created voxel data chunks.
 class InitialSunlightPropagationOperation
 {
 public:
+    // Selects how sunlight is propagated through a region of many columns.
+    enum PropagationMode
+    {
+        // Run a separate flood fill for each column, seeded from the 3x3
+        // neighborhood of columns around it.
+        PerColumn,
+        
+        // Seed every column which needs propagation, and the neighbors of
+        // those columns, and then run a single flood fill for the region.
+        Batched,
+        
+        // Split the region into groups of 3x3 columns and run a Batched flood
+        // fill for each group. Groups which are far enough apart to never
+        // touch the same chunk are lit concurrently on the dispatcher.
+        // Groups seed their border columns again, so this visits more nodes
+        // than Batched. It falls back to Batched when there is nothing to
+        // gain from the extra work. It is not the default, as its speedup on
+        // a multi-core machine has not been measured yet.
+        Parallel
+    };
+    
+    // Selects how sunlight spreads from the seeds once they have been placed.
+    enum PropagationKernel
+    {
+        // Spread sunlight one voxel at a time with a breadth-first flood fill.
+        Scalar,
+        
+        // Fill the vertical shafts of full sunlight a whole layer of a chunk at
+        // a time, with bitmask operations over rows of 32 voxels. Only the
+        // light which spills sideways out of the shafts goes through the
+        // breadth-first flood fill. The result is the same as Scalar.
+        Shafts
+    };
+    
+    // Counts the work done by the operation.
+    struct Statistics
+    {
+        // The number of chunks fetched from the persistent chunk store.
+        size_t numberOfChunksFetched = 0;
+        
+        // The number of nodes taken from the sunlight flood fill queue.
+        size_t numberOfNodesVisited = 0;
+        
+        // The number of chunks queued to be saved.
+        size_t numberOfChunksStored = 0;
+        
+        // The number of voxels lit by filling shafts of full sunlight in bulk,
+        // rather than by the flood fill.
+        size_t numberOfVoxelsInShafts = 0;
+    };
+    
     // No default constructor.
     InitialSunlightPropagationOperation() = delete;
     
@@ -31,9 +90,14 @@ public:
     //                          generator.
     // dispatcher -- Dispatcher used to fetch voxels data from the generator.
     //               This permits parallel fetch and generation of voxel data.
+    //               In the Parallel mode, groups of columns are lit on it too.
+    // mode -- How to propagate sunlight through regions of many columns.
+    // kernel -- How to spread sunlight from the seeds.
     InitialSunlightPropagationOperation(std::shared_ptr<spdlog::logger> log,
                                         PersistentVoxelChunks &persistentVoxelChunks,
-                                        const std::shared_ptr<TaskDispatcher> &dispatcher);
+                                        const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                        PropagationMode mode = Batched,
+                                        PropagationKernel kernel = Shafts);
     
     // For all chunks in the specified region, perform initial sunlight
     // propagation if it has not yet been done.
@@ -43,31 +107,65 @@ public:
     // region -- The region we should examine.
     void performInitialSunlightPropagationIfNecessary(const AABB &region);
     
+    // Returns counters describing the work done by the operation so far.
+    Statistics getStatistics() const;
+    
 private:
     // Adapt the PersistentVoxelChunks object to provide more convenient API.
+    // Every chunk fetched through the adapter is pinned until the adapter is
+    // destroyed. This ensures chunks cannot be evicted while the propagation
+    // holds raw pointers to them, or before modified chunks have been stored.
     class ChunksAdapter
     {
     public:
         ChunksAdapter(PersistentVoxelChunks &persistentVoxelChunks)
-         : _persistentVoxelChunks(persistentVoxelChunks)
-        {}
+         : _persistentVoxelChunks(persistentVoxelChunks),
+           _numberOfSlots((size_t)Morton3::encode(persistentVoxelChunks.getChunkIndexer().gridResolution() - glm::ivec3(1, 1, 1)) + 1),
+           _fetchedChunks((std::atomic<VoxelDataChunk *> *)std::calloc(_numberOfSlots, sizeof(std::atomic<VoxelDataChunk *>)),
+                          &std::free),
+           _numberOfFetches(0)
+        {
+            if (!_fetchedChunks) {
+                throw std::bad_alloc();
+            }
+        }
+        
+        ~ChunksAdapter()
+        {
+            for (const auto &pinned : _pinnedChunks) {
+                _persistentVoxelChunks.unpin(pinned.first);
+            }
+        }
         
         // Re-saves the chunk for the specified index.
         // This is useful when a chunk is retrieved via get() and then modified.
-        inline void store(Morton3 index, const std::shared_ptr<TaskDispatcher> &dispatcher)
+        inline void store(Morton3 index)
+        {
+            _persistentVoxelChunks.store(index);
+        }
+        
+        // Returns the number of distinct chunks fetched through the adapter.
+        inline size_t getNumberOfFetches() const
         {
-            _persistentVoxelChunks.store(index, dispatcher);
+            return _numberOfFetches;
         }
         
         // Returns the chunk, creating it if necessary, but prefering to fetch it
         // from the map region file.
         // index -- A unique index to identify the chunk in the sparse grid.
-        VoxelDataChunk* get(Morton3 index)
+        // Chunks which were already fetched through this adapter are found
+        // with a single load from a dense array. This matters in the inner
+        // loop of the sunlight flood fill. Only the first fetch of a chunk
+        // takes a lock.
+        inline VoxelDataChunk* get(Morton3 index)
         {
-            const AABB boundingBox = getChunkIndexer().cellAtCellCoords(index.decode());
-            std::shared_ptr<VoxelDataChunk> smartPointerChunk = _persistentVoxelChunks.get(boundingBox, index);
-            VoxelDataChunk *pointerChunk = smartPointerChunk.get();
-            return pointerChunk;
+            assert((size_t)index < _numberOfSlots);
+            std::atomic<VoxelDataChunk *> &slot = _fetchedChunks[(size_t)index];
+            VoxelDataChunk *chunk = slot.load(std::memory_order_acquire);
+            if (chunk) {
+                return chunk;
+            }
+            return fetch(index, slot);
         }
         
         // Returns true if the specified chunk is missing from the grid.
@@ -92,6 +190,57 @@ private:
     private:
         // Backing data store for voxel data chunks.
         PersistentVoxelChunks &_persistentVoxelChunks;
+        
+        // One more than the largest index of a chunk in the grid.
+        const size_t _numberOfSlots;
+        
+        // Chunks which have been fetched through this adapter, in slots which
+        // are stored densely in Morton order. The array is allocated with
+        // calloc() because it spans the whole world, and the zeroed pages of a
+        // large allocation are not touched until a chunk in them is fetched.
+        // A zeroed slot is null.
+        std::unique_ptr<std::atomic<VoxelDataChunk *>[], decltype(&std::free)> _fetchedChunks;
+        
+        // Chunks which have been pinned by this adapter. These references keep
+        // alive the chunks in `_fetchedChunks'. Chunks are fetched in parallel
+        // so this is protected by a lock.
+        std::mutex _mutexPinnedChunks;
+        std::vector<std::pair<Morton3, std::shared_ptr<VoxelDataChunk>>> _pinnedChunks;
+        
+        std::atomic<size_t> _numberOfFetches;
+        
+        // Fetches a chunk which is not in its slot yet, pins it, and fills
+        // the slot. The chunk is pinned before it is fetched so that it cannot
+        // be evicted in between. Several threads may race to fetch the same
+        // chunk. They get the same chunk from the backing store, and only the
+        // first to fill the slot keeps its pin.
+        VoxelDataChunk* fetch(Morton3 index, std::atomic<VoxelDataChunk *> &slot)
+        {
+            _persistentVoxelChunks.pin(index);
+            const AABB boundingBox = getChunkIndexer().cellAtCellCoords(index.decode());
+            std::shared_ptr<VoxelDataChunk> chunk;
+            try {
+                chunk = _persistentVoxelChunks.get(boundingBox, index);
+            } catch (...) {
+                _persistentVoxelChunks.unpin(index);
+                throw;
+            }
+            
+            VoxelDataChunk *existingChunk;
+            {
+                std::scoped_lock lock(_mutexPinnedChunks);
+                existingChunk = slot.load(std::memory_order_relaxed);
+                if (!existingChunk) {
+                    _pinnedChunks.emplace_back(index, chunk);
+                    _numberOfFetches++;
+                    slot.store(chunk.get(), std::memory_order_release);
+                    return chunk.get();
+                }
+            }
+            
+            _persistentVoxelChunks.unpin(index);
+            return existingChunk;
+        }
     };
     
     // A node in the sunlight propagation BFS queue.
@@ -116,6 +265,30 @@ private:
         {}
     };
     
+    // One layer of a chunk as a bitmask per row. Bit x of row z stands for the
+    // voxel at (x, z) within the layer.
+    using LayerRows = std::array<uint32_t, TERRAIN_CHUNK_SIZE>;
+    static_assert(TERRAIN_CHUNK_SIZE == 32, "Rows of a chunk must fit in 32 bits.");
+    
+    // The voxels of full sunlight on the sides of a chunk. Light may spill
+    // from these into the neighboring chunks.
+    struct ShaftFaces
+    {
+        // The chunk which holds the shafts.
+        VoxelDataChunk *chunkPtr = nullptr;
+        
+        // The cell coordinates of that chunk.
+        glm::ivec3 chunkCellCoords;
+        
+        // Lit voxels on the sides where X is minimal and maximal. Bit z of
+        // element y stands for the voxel at (y, z) on that side.
+        LayerRows minX{}, maxX{};
+        
+        // Lit voxels on the sides where Z is minimal and maximal. Bit x of
+        // element y stands for the voxel at (x, y) on that side.
+        LayerRows minZ{}, maxZ{};
+    };
+    
     // Logger to use.
     std::shared_ptr<spdlog::logger> _log;
     
@@ -124,9 +297,21 @@ private:
     
     // Dispatcher used to fetch voxels data from the generator. We do this
     // to provide the opportunity for the voxel data generator to generate the
-    // chunks in parallel.
+    // chunks in parallel. Groups of columns are lit on it too.
     std::shared_ptr<TaskDispatcher> _dispatcher;
     
+    // How to propagate sunlight through regions of many columns.
+    const PropagationMode _mode;
+    
+    // How to spread sunlight from the seeds.
+    const PropagationKernel _kernel;
+    
+    // Groups of columns may be lit concurrently, so these are atomic.
+    // Flood fills count in local variables and add the totals when done.
+    std::atomic<size_t> _numberOfNodesVisited;
+    size_t _numberOfChunksStored;
+    std::atomic<size_t> _numberOfVoxelsInShafts;
+    
     // Propagate sunlight for chunks in the local neighborhood surrounding the
     // target column. When this returns, chunks in the target column will have
     // correct sunlight values. Chunks in neighboring columns may have partial
@@ -135,6 +320,78 @@ private:
     //                       The Y coordinate is ignored.
     void propagateSunlight(const glm::ivec3 &targetColumnCoords);
     
+    // Propagate sunlight for many columns at once with a single flood fill.
+    // Each neighbor of a target column is seeded only once, no matter how
+    // many target columns it borders. When this returns, chunks in the target
+    // columns will have correct sunlight values.
+    // targetColumns -- The X and Z coordinates of the columns to work on.
+    //                  The Y coordinates are ignored.
+    // minColumnCoords -- The minimum corner of the region of columns which
+    //                    holds all the target columns. The flood fill may
+    //                    reach one column beyond this region, but no further.
+    //                    The Y coordinate is ignored.
+    // maxColumnCoords -- The maximum corner of that region, exclusive.
+    //                    The Y coordinate is ignored.
+    void propagateSunlight(const std::vector<glm::ivec3> &targetColumns,
+                           const glm::ivec3 &minColumnCoords,
+                           const glm::ivec3 &maxColumnCoords);
+    
+    // Propagate sunlight for many columns by splitting them into groups of
+    // 3x3 columns and running a Batched flood fill for each group.
+    // The flood fill for a group never reaches more than one column beyond
+    // the group. Groups are given one of four colors by the parity of their
+    // position, so groups of the same color are three columns apart and
+    // never touch the same chunk. The groups of each color are lit
+    // concurrently on the dispatcher, one color after another.
+    // If the dispatcher has only one worker thread, or if no color has more
+    // than one group to light, then this runs a single Batched flood fill.
+    // When this returns, chunks in the target columns will have correct
+    // sunlight values. This gives the same result as Batched.
+    // targetColumns -- The X and Z coordinates of the columns to work on.
+    //                  The Y coordinates are ignored.
+    // minColumnCoords -- The minimum corner of the region of columns which
+    //                    holds all the target columns.
+    //                    The Y coordinate is ignored.
+    // maxColumnCoords -- The maximum corner of that region, exclusive.
+    //                    The Y coordinate is ignored.
+    void propagateSunlightInParallel(const std::vector<glm::ivec3> &targetColumns,
+                                     const glm::ivec3 &minColumnCoords,
+                                     const glm::ivec3 &maxColumnCoords);
+    
+    // Spreads sunlight from the seeds in the queue with the selected kernel.
+    void floodSunlightFromSeeds(std::queue<LightNode> &sunlightQueue);
+    
+    // Runs the sunlight flood fill until the queue is empty.
+    void floodSunlight(std::queue<LightNode> &sunlightQueue);
+    
+    // Fills the shafts of full sunlight which fall straight down from the
+    // seeds in the queue, and then runs the flood fill for the light which
+    // spills sideways out of the shafts.
+    // sunlightQueue -- Holds the seeds, all of which lie in the top layer of
+    //                  their chunks.
+    void floodSunlightInShafts(std::queue<LightNode> &sunlightQueue);
+    
+    // Fills shafts of full sunlight through a single chunk, one layer at a
+    // time. Light which spills sideways into voxels within the chunk is added
+    // to the queue.
+    // chunkPtr -- A pointer to the chunk to fill.
+    // chunkCellCoords -- The cell coordinates of the chunk.
+    // entering -- The columns of full sunlight entering the top layer.
+    // faces -- Returns the lit voxels on the sides of the chunk.
+    // sunlightQueue -- The flood-fill BFS queue.
+    // Returns the columns of full sunlight which leave the bottom layer.
+    LayerRows fillShaftsInChunk(VoxelDataChunk *chunkPtr,
+                                const glm::ivec3 &chunkCellCoords,
+                                const LayerRows &entering,
+                                ShaftFaces &faces,
+                                std::queue<LightNode> &sunlightQueue);
+    
+    // Spills sunlight from the sides of the shafts in one chunk into the
+    // neighboring chunks. This must wait until every shaft has been filled,
+    // else light may spill into a voxel which is about to join a shaft.
+    void spillFromShaftFaces(const ShaftFaces &faces,
+                             std::queue<LightNode> &sunlightQueue);
+    
     // Seeds initial sunlight in the specified column, populating the queue.
     // columnCoords -- The X and Z coordinates of the column to work on.
     //                 The Y coordinate is ignored.
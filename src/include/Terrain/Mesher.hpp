@@ -12,6 +12,7 @@
 #include "Terrain/Voxel.hpp"
 #include "Grid/Array3D.hpp"
 #include "Renderer/StaticMesh.hpp"
+#include "CancellationToken.hpp"
 
 // Accepts voxels and produces a triangle mesh for the specified isosurface.
 class Mesher
@@ -20,12 +21,18 @@ public:
     virtual ~Mesher() = default;
     
     // Returns a triangle mesh for the isosurface between value=0 and value=1.
+    // If the cancellation token is cancelled during extraction then this
+    // throws CancelledException.
     virtual StaticMesh
     extract(const Array3D<Voxel> &voxels,
-            const AABB &region) = 0;
+            const AABB &region,
+            const CancellationToken &cancellationToken = CancellationToken()) = 0;
     
 protected:
     Mesher() = default;
+    
+    // Meshers check the cancellation token once per this many cells.
+    static constexpr size_t CancellationCheckInterval = 1024;
 };
 
 #endif /* Mesher_hpp */
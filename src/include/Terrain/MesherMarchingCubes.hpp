@@ -20,7 +20,8 @@ public:
     
     // Returns a triangle mesh for the isosurface between value=0 and value=1.
     virtual StaticMesh extract(const Array3D<Voxel> &voxels,
-                               const AABB &region) override;
+                               const AABB &region,
+                               const CancellationToken &cancellationToken = CancellationToken()) override;
     
 private:
     // For marching cubes, we sample a cube where each vertex is a voxel in the
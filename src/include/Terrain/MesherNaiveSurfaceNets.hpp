@@ -10,6 +10,7 @@
 #define MesherNaiveSurfaceNets_hpp
 
 #include "Terrain/Mesher.hpp"
+#include "Terrain/VoxelPlanes.hpp"
 #include "Preferences.hpp"
 #include <array>
 #include <glm/glm.hpp>
@@ -27,7 +28,8 @@ public:
     
     // Returns a triangle mesh for the isosurface between value=0 and value=1.
     virtual StaticMesh extract(const Array3D<Voxel> &voxels,
-                               const AABB &region) override;
+                               const AABB &region,
+                               const CancellationToken &cancellationToken = CancellationToken()) override;
     
 private:
     bool _smoothTerrain;
@@ -98,6 +100,18 @@ private:
                   const Array3D<Voxel> &voxels,
                   const AABB &cell,
                   size_t face);
+    
+    // Emits faces for each voxel in the specified box of voxels.
+    // mins -- The minimum cell coordinates of the box.
+    // maxs -- The cell coordinates one past the maximum corner of the box.
+    // count -- Counts voxels so we can periodically check for cancellation.
+    void extractBlock(StaticMesh &geometry,
+                      const Array3D<Voxel> &voxels,
+                      const VoxelPlanes &planes,
+                      const glm::ivec3 &mins,
+                      const glm::ivec3 &maxs,
+                      size_t &count,
+                      const CancellationToken &cancellationToken);
 };
 
 #endif /* MesherNaiveSurfaceNets_hpp */
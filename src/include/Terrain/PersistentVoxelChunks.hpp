@@ -9,14 +9,25 @@
 #ifndef PersistentVoxelChunks_hpp
 #define PersistentVoxelChunks_hpp
 
-#include "Grid/ConcurrentSparseGrid.hpp"
+#include "Grid/DenseGridDirectory.hpp"
+#include "Grid/GridLRU.hpp"
 #include "Terrain/MapRegionStore.hpp"
 #include "Terrain/VoxelDataChunk.hpp"
 #include "TaskDispatcher.hpp"
+#include "WriteBehindActor.hpp"
 
 #include <spdlog/spdlog.h>
+#include <atomic>
+#include <unordered_map>
 
 // Store/Load voxel chunks to file.
+//
+// Chunks are cached in memory and evicted in least-recently used order when
+// the cache exceeds its memory budget. Modified chunks are saved to file before
+// they are evicted. Chunks which have been pinned are never evicted.
+//
+// Modified chunks are saved in the background by a write-behind actor. A chunk
+// which is modified several times before it can be saved is only saved once.
 class PersistentVoxelChunks : public GridIndexer
 {
 public:
@@ -30,12 +41,17 @@ public:
     // chunkSize -- The size of chunk to use.
     // mapRegionStore -- The map file in which to persist chunks.
     // factory -- Closure to invoke to populate a new chunk.
+    // dispatcher -- Dispatcher used to load chunks in parallel.
+    // memoryBudget -- Chunks are evicted to keep the number of resident bytes
+    //                 at or under this limit.
     PersistentVoxelChunks(std::shared_ptr<spdlog::logger> log,
                           const AABB &boundingBox,
                           const glm::ivec3 gridResolution,
                           unsigned chunkSize,
                           std::unique_ptr<MapRegionStore> &&mapRegionStore,
-                          std::function<std::unique_ptr<VoxelDataChunk>(const AABB &cell, Morton3 index)> factory);
+                          std::function<std::unique_ptr<VoxelDataChunk>(const AABB &cell, Morton3 index)> factory,
+                          std::shared_ptr<TaskDispatcher> dispatcher,
+                          size_t memoryBudget);
     
     // Returns a new chunk for the corresponding region of space.
     // The chunk is populated using data gathered from the underlying source.
@@ -46,11 +62,16 @@ public:
     // Copies voxels of the specified sub-region of the grid to an array and
     // returns that. May fault in missing voxels to satisfy the request.
     // The specified region may be any AABB within the bounds of the grid.
-    Array3D<Voxel> loadSubRegion(const AABB &region);
+    // Chunks are loaded and copied in parallel. The cancellation token is
+    // checked before each chunk. If it has been cancelled then this throws
+    // CancelledException.
+    Array3D<Voxel> loadSubRegion(const AABB &region,
+                                 const CancellationToken &cancellationToken = CancellationToken());
     
     // Stores the voxels of the specified sub-region to the grid.
-    // Each chunk touched by the specified voxel data is converted to an Array
-    // chunk to accomodate the changes.
+    // A sky or ground chunk touched by the specified voxel data is converted
+    // to a Palette chunk to accomodate the changes, and a Palette chunk
+    // becomes an Array chunk once it holds too many distinct voxel values.
     // The specified region may be any AABB within the bounds of the grid.
     void storeSubRegion(const Array3D<Voxel> &voxels);
     
@@ -58,6 +79,7 @@ public:
     // The specified region of space must exactly match the position and size of
     // one of the chunks used internally by PersistentVoxelChunks.
     // May fault in missing voxels to satisfy the request.
+    // The returned chunk is a copy-on-write snapshot, which is cheap to take.
     VoxelDataChunk load(const AABB &region);
     
     // Stores the specified chunk immediately.
@@ -66,9 +88,35 @@ public:
     void store(const VoxelDataChunk &voxels);
     
     // Re-saves the chunk for the specified index.
-    // The save is done asynchronously on the specified task dispatcher.
+    // The save is done later, in the background, and replaces any save of the
+    // same chunk which is still pending.
     // This is useful when a chunk is retrieved via get() and then modified.
-    void store(Morton3 index, const std::shared_ptr<TaskDispatcher> &dispatcher);
+    // The chunk is considered to be dirty until the save finishes.
+    void store(Morton3 index);
+    
+    // Saves all modified chunks to file before returning.
+    // Call this on shutdown, after all tasks which modify chunks have stopped.
+    void flush();
+    
+    // Prevents the chunk for the specified index from being evicted until a
+    // matching call to unpin(). Pins nest.
+    // A chunk must be pinned while it is modified in place. Otherwise, it may
+    // be evicted before the changes are stored and the changes would be lost.
+    // The chunk may be pinned before it has been loaded.
+    void pin(Morton3 index);
+    
+    // Allows the chunk to be evicted again after a previous call to pin().
+    void unpin(Morton3 index);
+    
+    // Returns the number of bytes of memory used by chunks in the cache.
+    size_t getResidentBytes() const;
+    
+    // Returns the number of bytes of memory used by chunks in the cache which
+    // have changes that have not yet been saved to file.
+    size_t getDirtyBytes() const;
+    
+    // Returns the number of times a chunk has been written to file.
+    size_t getNumberOfChunkWrites() const;
     
     // Returns the chunk, creating it if necessary, but prefering to fetch it
     // from the map region file.
@@ -85,10 +133,77 @@ public:
     const GridIndexer& getChunkIndexer() const;
     
 private:
+    // Bookkeeping for one chunk in the cache.
+    struct Residency
+    {
+        // Number of bytes of memory used by the chunk, if it is resident.
+        size_t bytes = 0;
+        
+        // Number of outstanding calls to pin().
+        unsigned pinCount = 0;
+        
+        // Identifies the most recent modification which has not yet been
+        // saved to file. This is zero when the chunk is clean.
+        uint64_t dirtyGeneration = 0;
+        
+        // Is the chunk currently in the cache?
+        bool resident = false;
+    };
+    
     std::shared_ptr<spdlog::logger> _log;
-    ConcurrentSparseGrid<std::shared_ptr<VoxelDataChunk>> _chunks;
+    
+    // The world is bounded, so chunks are found in a dense directory.
+    ConcurrentSparseGrid<std::shared_ptr<VoxelDataChunk>, DenseGridDirectory<std::shared_ptr<VoxelDataChunk>>> _chunks;
     std::unique_ptr<MapRegionStore> _mapRegionStore;
     std::function<std::unique_ptr<VoxelDataChunk>(const AABB &cell, Morton3 index)> _factory;
+    std::shared_ptr<TaskDispatcher> _dispatcher;
+    const size_t _memoryBudget;
+    
+    // Protects the residency table, the LRU list, and the generation counter.
+    // Chunks are removed from `_chunks' only while holding this lock.
+    mutable std::mutex _mutexResidency;
+    std::unordered_map<Morton3, Residency> _residency;
+    GridLRU<Morton3> _lru;
+    uint64_t _nextGeneration;
+    
+    // Byte counts are kept outside the lock so they may be checked cheaply.
+    std::atomic<size_t> _residentBytes;
+    std::atomic<size_t> _dirtyBytes;
+    
+    // Only one thread evicts chunks at a time.
+    std::mutex _mutexEviction;
+    
+    // Saves modified chunks in the background. Chunks are saved in Morton
+    // order, which groups together the chunks of each map region, since map
+    // regions are aligned power-of-two blocks of chunks.
+    // This is declared last so it is destroyed, and flushed, first.
+    WriteBehindActor<Morton3, VoxelDataChunk> _saveActor;
+    
+    // Records that the chunk is now in the cache, possibly replacing a
+    // previous chunk at the same index.
+    void noteResident(Morton3 index, const VoxelDataChunk &chunk);
+    
+    // Records that the chunk has a modification which has not been saved.
+    // Returns an identifier for the modification.
+    uint64_t markDirty(Morton3 index, const VoxelDataChunk &chunk);
+    
+    // Marks the chunk as clean if the specified modification is still the most
+    // recent one. The caller must hold `_mutexResidency'.
+    void markCleanIfCurrent(Residency &residency, uint64_t generation);
+    
+    // Updates the resident and dirty byte counts for a change in the size of
+    // the chunk. The caller must hold `_mutexResidency'.
+    void setResidentBytes(Residency &residency, size_t bytes);
+    
+    // Removes the residency table entry if it no longer tracks anything.
+    // The caller must hold `_mutexResidency'.
+    void eraseIfUnused(Morton3 index);
+    
+    // Evicts chunks in LRU order until the resident bytes are under budget,
+    // saving dirty chunks to file first. Pinned chunks are skipped.
+    // If another thread is already evicting chunks then this returns
+    // immediately.
+    void enforceMemoryBudget();
 };
 
 #endif /* PersistentVoxelChunks_hpp */
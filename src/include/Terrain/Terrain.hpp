@@ -12,6 +12,7 @@
 #include "Preferences.hpp"
 #include "Renderer/GraphicsDevice.hpp"
 #include "TaskDispatcher.hpp"
+#include "ThreadPoolPolicy.hpp"
 #include "Terrain/Mesher.hpp"
 #include "Terrain/VoxelDataGenerator.hpp"
 #include "Terrain/TransactedVoxelData.hpp"
@@ -21,6 +22,7 @@
 #include "Terrain/TerrainHorizonDistance.hpp"
 #include "Terrain/TerrainConfig.hpp"
 #include "Terrain/TerrainJournal.hpp"
+#include "Terrain/TerrainPrefetcher.hpp"
 #include "RenderableStaticMesh.hpp"
 
 #include <entityx/entityx.h>
@@ -38,6 +40,7 @@ public:
             std::shared_ptr<spdlog::logger> log,
             const std::shared_ptr<GraphicsDevice> &graphicsDevice,
             const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher,
+            const ThreadPoolPolicy &threadPoolPolicy,
             entityx::EventManager &events,
             glm::vec3 initialCameraPosition);
     
@@ -58,22 +61,40 @@ public:
     float getFogDensity() const;
     
     // Perform an atomic transaction as a "reader" with read-only access to the
-    // underlying data in the specified region.
+    // underlying data in the specified region. This runs on the terrain
+    // dispatcher and no thread waits for the lock in the meantime.
     // region -- The region we will be reading from.
-    // fn -- Closure which will be doing the reading.
-    void readerTransaction(const AABB &region, std::function<void(Array3D<Voxel> &&data)> fn);
+    // priority -- The priority of the tasks which run the transaction.
+    // cancellationToken -- If this is cancelled then the transaction stops
+    //                      early and the future throws CancelledException.
+    // Returns a future for a copy of the voxels in the region.
+    Future<std::vector<Array3D<Voxel>>> asyncReaderTransaction(const AABB &region,
+                                                               TaskDispatcher::Priority priority,
+                                                               const CancellationToken &cancellationToken);
     
     // Perform an atomic transaction as a "writer" with read-write access to
-    // the underlying voxel data in the specified region.
+    // the underlying voxel data in the specified region. This runs on the
+    // terrain dispatcher and no thread waits for the lock in the meantime.
     // operation -- Describes the edits to be made.
-    void writerTransaction(const std::shared_ptr<TerrainOperation> &operation);
-    
+    // priority -- The priority of the tasks which run the transaction.
+    // Returns a future which becomes ready once the edits have been made.
+    Future<void> asyncWriterTransaction(const std::shared_ptr<TerrainOperation> &operation,
+                                        TaskDispatcher::Priority priority);
+    
+    // Returns the prioritized thread pool shared by all terrain work. This
+    // serves latency sensitive tasks at TaskDispatcher::HighPriority as well as
+    // bulk voxel generation at TaskDispatcher::NormalPriority.
+    inline const std::shared_ptr<TaskDispatcher>& getDispatcher() const
+    {
+        return _dispatcher;
+    }
+
 private:
     std::shared_ptr<GraphicsDevice> _graphicsDevice;
-    std::shared_ptr<TaskDispatcher> _dispatcherHighPriority;
-    std::shared_ptr<TaskDispatcher> _dispatcherVoxelData;
+    std::shared_ptr<TaskDispatcher> _dispatcher;
     std::shared_ptr<Mesher> _mesher;
     std::shared_ptr<TransactedVoxelData> _voxels;
+    std::shared_ptr<TerrainPrefetcher> _prefetcher;
     std::unique_ptr<TerrainMeshGrid> _meshes;
     std::shared_ptr<RenderableStaticMesh> _defaultMesh;
     std::unique_ptr<TerrainRebuildActor> _meshRebuildActor;
@@ -112,8 +133,9 @@ private:
     // by a change.
     void rebuildMeshInResponseToChanges(const AABB &affectedRegion);
     
-    // Rebuilds the next pending batch of meshes in the queue.
-    void rebuildNextMeshBatch(const TerrainRebuildActor::Batch &batch);
+    // Begins rebuilding the next pending batch of meshes in the queue.
+    // Returns a future which becomes ready when the batch is finished.
+    Future<void> rebuildNextMeshBatch(const TerrainRebuildActor::Batch &batch);
     
     std::unique_ptr<TransactedVoxelData>
     createVoxelData(const std::shared_ptr<TaskDispatcher> &dispatcher,
@@ -9,8 +9,20 @@
 #ifndef TerrainConfig_hpp
 #define TerrainConfig_hpp
 
+#include <cstddef>
+
 static constexpr unsigned TERRAIN_SIZE = 1024;
 static constexpr unsigned TERRAIN_CHUNK_SIZE = 32;
 static constexpr unsigned MAP_REGION_SIZE = 512;
 
+// Chunks are saved in Morton order to group together the chunks of each map
+// region. That only works when regions are power-of-two blocks of chunks.
+static_assert(MAP_REGION_SIZE % TERRAIN_CHUNK_SIZE == 0 &&
+              ((MAP_REGION_SIZE / TERRAIN_CHUNK_SIZE) & (MAP_REGION_SIZE / TERRAIN_CHUNK_SIZE - 1)) == 0,
+              "A map region must be a power-of-two block of chunks.");
+
+// Voxel chunks are evicted from memory in LRU order to stay under this many
+// bytes. This is a soft limit as chunks in use are never evicted.
+static constexpr size_t VOXEL_CHUNK_MEMORY_BUDGET = 512 * 1024 * 1024;
+
 #endif /* TerrainConfig_hpp */
@@ -50,7 +50,11 @@ public:
     RenderableStaticMesh getMesh() const;
     
     // Causes the mesh to be rebuilt using the specified voxel data.
-    void rebuild(const Array3D<Voxel> &voxels, TerrainProgressTracker &progress);
+    // If the cancellation token is cancelled during the rebuild then this
+    // throws CancelledException and the previous mesh is left in place.
+    void rebuild(const Array3D<Voxel> &voxels,
+                 TerrainProgressTracker &progress,
+                 const CancellationToken &cancellationToken = CancellationToken());
     
     inline const AABB& boundingBox() const
     {
@@ -45,7 +45,9 @@ public:
     }
     
     // Performs the operation.
-    virtual void perform(VoxelData &voxelData) = 0;
+    // Returns a bounding box which contains all voxels changed by the
+    // operation, including voxels whose lighting changed.
+    virtual AABB perform(VoxelData &voxelData) = 0;
     
     // Serialize the operation.
     template<typename Archive>
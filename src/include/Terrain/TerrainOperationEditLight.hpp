@@ -0,0 +1,50 @@
+//
+//  TerrainOperationEditLight.hpp
+//  PinkTopaz
+//
+
+#ifndef TerrainOperationEditLight_hpp
+#define TerrainOperationEditLight_hpp
+
+#include "TerrainOperation.hpp"
+#include "CerealGLM.hpp"
+
+class VoxelData;
+
+// An operation which places, changes, or removes the light emitter in a single
+// empty voxel. This is useful for placing torches with the mouse cursor.
+class TerrainOperationEditLight : public TerrainOperation
+{
+public:
+    // Default destructor.
+    virtual ~TerrainOperationEditLight() = default;
+    
+    // Default constructor
+    TerrainOperationEditLight() = default;
+    
+    // Constructor.
+    // location -- A point within the voxel which holds the emitter.
+    // light -- The torch light to emit, in [0, MAX_LIGHT]. Zero removes the
+    //          emitter.
+    TerrainOperationEditLight(glm::vec3 location, unsigned light);
+    
+    // Performs the operation.
+    AABB perform(VoxelData &voxelData) override;
+    
+    // Serialize the operation.
+    template<typename Archive>
+    void serialize(Archive &archive)
+    {
+        archive(cereal::base_class<TerrainOperation>(this),
+                cereal::make_nvp("location", _location),
+                cereal::make_nvp("light", _light));
+    }
+
+private:
+    glm::vec3 _location;
+    unsigned _light;
+};
+
+CEREAL_REGISTER_TYPE(TerrainOperationEditLight);
+
+#endif /* TerrainOperationEditLight_hpp */
@@ -29,7 +29,7 @@ public:
     TerrainOperationEditPoint(glm::vec3 location, Voxel newValue);
     
     // Performs the operation.
-    void perform(VoxelData &voxelData) override;
+    AABB perform(VoxelData &voxelData) override;
     
     // Serialize the operation.
     template<typename Archive>
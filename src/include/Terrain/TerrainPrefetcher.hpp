@@ -0,0 +1,162 @@
+//
+//  TerrainPrefetcher.hpp
+//  PinkTopaz
+//
+
+#ifndef TerrainPrefetcher_hpp
+#define TerrainPrefetcher_hpp
+
+#include "Terrain/TransactedVoxelData.hpp"
+#include "TaskDispatcher.hpp"
+
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+// Faults in voxel chunks ahead of the camera.
+//
+// Meshes are only rebuilt once the draw list finds them missing from the active
+// region. If the voxel chunks beneath those meshes must be generated first
+// then a fast moving camera always sees holes at the horizon. The prefetcher
+// estimates the camera's velocity, predicts where the active region will be a
+// little while from now, and loads chunks, and runs sunlight propagation, for
+// the part of the predicted region which is not yet active. This work runs at
+// TaskDispatcher::LowPriority so it never delays work the next frame needs.
+//
+// Prefetch tasks hold only a weak reference to the prefetcher, so it must be
+// owned by a std::shared_ptr. Tasks which run after the prefetcher has been
+// destroyed do nothing.
+class TerrainPrefetcher : public std::enable_shared_from_this<TerrainPrefetcher>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    // Returns true if the voxel data of the specified region is resident.
+    using ResidencyCheck = std::function<bool(const AABB &region)>;
+    
+    // Faults in the voxel data of the specified region. Returns false if the
+    // region could not be prefetched right now.
+    using Prefetch = std::function<bool(const AABB &region)>;
+    
+    // No default constructor.
+    TerrainPrefetcher() = delete;
+    
+    // Constructor.
+    // log -- The logger to use.
+    // voxels -- The voxel data to prefetch.
+    // dispatcher -- Dispatcher on which to run prefetch tasks.
+    // activeRegionSize -- Half the width of the active region around the
+    //                     camera, as used by the terrain.
+    // lookahead -- How far ahead, in seconds, to predict the camera position.
+    //              Zero disables prefetching.
+    TerrainPrefetcher(std::shared_ptr<spdlog::logger> log,
+                      std::shared_ptr<TransactedVoxelData> voxels,
+                      std::shared_ptr<TaskDispatcher> dispatcher,
+                      float activeRegionSize,
+                      float lookahead);
+    
+    // Constructor.
+    // log -- The logger to use.
+    // voxelIndexer -- Indexer for the grid of voxels to prefetch.
+    // isResident -- Closure which checks the residency of a region.
+    // prefetch -- Closure which prefetches a region.
+    // dispatcher -- Dispatcher on which to run prefetch tasks.
+    // activeRegionSize -- Half the width of the active region around the
+    //                     camera, as used by the terrain.
+    // lookahead -- How far ahead, in seconds, to predict the camera position.
+    //              Zero disables prefetching.
+    TerrainPrefetcher(std::shared_ptr<spdlog::logger> log,
+                      const GridIndexer &voxelIndexer,
+                      ResidencyCheck isResident,
+                      Prefetch prefetch,
+                      std::shared_ptr<TaskDispatcher> dispatcher,
+                      float activeRegionSize,
+                      float lookahead);
+    
+    // Updates the velocity estimate with a new camera position and queues
+    // prefetches for chunk columns ahead of the camera.
+    // cameraPosition -- The current position of the camera.
+    // now -- The time at which the camera was at that position.
+    void update(const glm::vec3 &cameraPosition, Clock::time_point now);
+    
+    // Returns the estimated velocity of the camera, in units per second.
+    glm::vec3 getVelocity() const;
+    
+    // Records whether the voxel data for a mesh rebuild was already resident
+    // when the rebuild began.
+    void noteRebuild(bool resident);
+    
+    // Returns the number of mesh rebuilds recorded by noteRebuild().
+    inline size_t getNumberOfRebuilds() const
+    {
+        return _numberOfRebuilds;
+    }
+    
+    // Returns the number of mesh rebuilds which found their voxel data already
+    // resident.
+    inline size_t getNumberOfResidentRebuilds() const
+    {
+        return _numberOfResidentRebuilds;
+    }
+    
+    // Returns the number of chunk columns which have been prefetched.
+    inline size_t getNumberOfPrefetches() const
+    {
+        return _numberOfPrefetches;
+    }
+
+private:
+    // The velocity estimate follows changes in velocity with this time
+    // constant, in seconds. This smooths over uneven frame times.
+    static constexpr float VelocityTimeConstant = 0.25f;
+    
+    // Below this speed, in units per second, the camera is considered to be
+    // standing still and nothing is prefetched.
+    static constexpr float MinimumSpeed = 1.0f;
+    
+    std::shared_ptr<spdlog::logger> _log;
+    ResidencyCheck _isResident;
+    Prefetch _prefetch;
+    std::shared_ptr<TaskDispatcher> _dispatcher;
+    const float _activeRegionSize;
+    const float _lookahead;
+    
+    // Each prefetch covers one column of chunks, which spans the full height
+    // of the world. Sunlight propagation works on whole columns anyway.
+    const GridIndexer _columns;
+    
+    // No more than this many columns are queued on the dispatcher at once.
+    // This is at least one, even on a dispatcher without worker threads.
+    const size_t _maxColumnsInFlight;
+    
+    // Protects the velocity estimate and the scheduling state.
+    mutable std::mutex _mutex;
+    bool _hasPreviousPosition;
+    glm::vec3 _previousPosition;
+    Clock::time_point _previousTime;
+    glm::vec3 _velocity;
+    bool _schedulingPending;
+    std::unordered_set<Morton3> _columnsInFlight;
+    
+    std::atomic<size_t> _numberOfRebuilds;
+    std::atomic<size_t> _numberOfResidentRebuilds;
+    std::atomic<size_t> _numberOfPrefetches;
+    
+    // Queues prefetches for the columns of the predicted active region which
+    // are outside the current active region, nearest to the prediction first.
+    // This runs on the dispatcher as it checks the residency of many chunks.
+    void schedulePrefetches();
+    
+    // Prefetches a single column and then removes it from the set of columns
+    // in flight.
+    void prefetchColumn(Morton3 index, const AABB &columnBox);
+    
+    // Returns the active region for a camera at the specified position.
+    AABB getActiveRegion(const glm::vec3 &cameraPosition) const;
+};
+
+#endif /* TerrainPrefetcher_hpp */
@@ -10,15 +10,18 @@
 #define TerrainRebuildActor_hpp
 
 #include <mutex>
-#include <deque>
+#include <list>
 #include <unordered_set>
-#include <boost/optional.hpp>
-#include <thread>
 #include <spdlog/spdlog.h>
 
 #include "TerrainProgressTracker.hpp"
+#include "Grid/DistanceBucketQueue.hpp"
 
 // Maintains an ordered list of meshes that need to be generated.
+//
+// The actor does not own any threads. Processing a batch returns a future and
+// the next batch is started when one finishes. So, a batch which is waiting
+// for a lock or for voxel data does not tie up a thread.
 class TerrainRebuildActor
 {
 public:
@@ -51,11 +54,14 @@ public:
     // where each one is associated with a bounding box and an index into the
     // mesh grid. In one operation, we request voxels for the union of the
     // bounding boxes and use the result to extract all the specified meshes.
+    // Each batch has a cancellation token which the actor cancels if the
+    // batch leaves the active region before it is finished.
     class Batch
     {
     public:
         Batch(std::vector<Cell> &&requestedCells)
-        : _requestedCells(std::move(requestedCells))
+        : _requestedCells(std::move(requestedCells)),
+          _cancellationToken(CancellationToken::create())
         {
             assert(!_requestedCells.empty());
             _boundingBox = _requestedCells.begin()->box;
@@ -79,54 +85,98 @@ public:
             return _requestedCells;
         }
         
+        inline const CancellationToken& cancellationToken() const
+        {
+            return _cancellationToken;
+        }
+        
+        // Returns true if any cell in the batch intersects the region.
+        bool intersects(const AABB &region) const
+        {
+            for (const Cell &cell : _requestedCells) {
+                if (doBoxesIntersect(cell.box, region)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    
     private:
         AABB _boundingBox;
         std::vector<Cell> _requestedCells;
+        CancellationToken _cancellationToken;
+    };
+    
+    // Gives the position of a batch for ordering by distance.
+    struct BatchCenter
+    {
+        inline glm::vec3 operator()(const Batch &batch) const
+        {
+            return batch.boundingBox().center;
+        }
     };
     
     ~TerrainRebuildActor();
     
     TerrainRebuildActor() = delete;
     
+    // Constructor.
+    // maxBatchesInFlight -- The maximum number of batches to process at once.
+    // processBatch -- Begins processing a batch and returns a future which
+    //                 becomes ready when the batch is finished. The batch
+    //                 remains valid until then.
     TerrainRebuildActor(std::shared_ptr<spdlog::logger> log,
-                        unsigned numThreads,
+                        unsigned maxBatchesInFlight,
                         glm::vec3 initialSearchPoint,
                         std::shared_ptr<TaskDispatcher> mainThreadDispatcher,
                         entityx::EventManager &events,
                         std::chrono::steady_clock::time_point appStartTime,
-                        std::function<void(const Batch &)> &&processBatch);
+                        std::function<Future<void>(const Batch &)> &&processBatch);
     
     // Add cells to the queue.
     // These will always be popped off the queue in order of increasing distance
     // from the search point.
     void push(const std::vector<std::pair<Morton3, AABB>> &cells);
     
-    // Set the search point.
-    void setSearchPoint(glm::vec3 searchPoint);
+    // Set the search point and the active region around it. Batches which no
+    // longer have any cells in the active region are cancelled, whether they
+    // are still queued or are already being processed.
+    void setSearchPoint(glm::vec3 searchPoint, const AABB &activeRegion);
     
+    // Stop processing batches. Batches which are already being processed are
+    // cancelled, and this waits for them to finish.
+    void shutdown();
+
 private:
     std::mutex _lock;
     std::condition_variable _cvar;
-    std::atomic<bool> _threadShouldExit;
-    std::function<void(const Batch &)> _processBatch;
-    std::deque<Batch> _pendingBatches;
+    bool _isShutdown;
+    bool _isStartingBatches;
+    const unsigned _maxBatchesInFlight;
+    std::function<Future<void>(const Batch &)> _processBatch;
+    DistanceBucketQueue<Batch, BatchCenter> _pendingBatches;
+    std::list<Batch> _batchesInFlight;
     std::unordered_set<AABB> _set;
     glm::vec3 _searchPoint;
-    std::vector<std::thread> _threads;
     std::shared_ptr<TaskDispatcher> _mainThreadDispatcher;
     entityx::EventManager &_events;
     std::shared_ptr<spdlog::logger> _log;
     std::chrono::steady_clock::time_point _appStartTime;
     
-    // Runs the worker thread.
-    void worker();
+    // Start processing pending batches until the limit on batches in flight
+    // is reached. Only one thread at a time does this. If the future for a
+    // batch is already ready then the batch finishes before the next one is
+    // started, without recursing.
+    void startBatches();
+    
+    // Called when processing of a batch has finished.
+    void finishBatch(std::list<Batch>::iterator batch, bool cancelled);
     
-    // Get the cell for the next mesh to generate. Waits for an item to be added
-    // to the queue.
-    boost::optional<Cell> pop();
+    // Cancel batches which have no cells in the active region. (unlocked)
+    void cancelBatchesOutside(const AABB &activeRegion);
     
-    // Immediately sort the list. (unlocked)
-    void sort();
+    // Forget about the cells of a batch which was cancelled. (unlocked)
+    void forgetCancelledBatch(Batch &batch);
 };
 
 #endif /* TerrainRebuildActor_hpp */
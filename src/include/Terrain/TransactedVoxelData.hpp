@@ -12,6 +12,7 @@
 #include <boost/signals2.hpp>
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "Grid/GridIndexer.hpp"
 #include "Grid/Array3D.hpp"
@@ -19,6 +20,8 @@
 #include "Terrain/Voxel.hpp"
 #include "Terrain/TerrainOperation.hpp"
 #include "Terrain/VoxelData.hpp"
+#include "CancellationToken.hpp"
+#include "TaskDispatcher.hpp"
 
 // A block of voxels in space. Concurrent edits are protected by a lock.
 class TransactedVoxelData : public GridIndexer
@@ -38,7 +41,11 @@ public:
     // underlying data in the specified region.
     // region -- The region we will be reading from.
     // fn -- Closure which will be doing the reading.
-    void readerTransaction(const AABB &region, std::function<void(Array3D<Voxel> &&data)> fn);
+    // cancellationToken -- If this is cancelled then the transaction stops
+    //                      early and throws CancelledException.
+    void readerTransaction(const AABB &region,
+                           std::function<void(Array3D<Voxel> &&data)> fn,
+                           const CancellationToken &cancellationToken = CancellationToken());
     
     // Perform an atomic transaction as a "reader" with read-only access to the
     // underlying data in the specified regions. This is a batch operation which
@@ -47,22 +54,112 @@ public:
     // fn -- Closure which will be doing the reading for each specified region.
     //       Parameters are the index of the region to process and the voxels
     //       associated with that region.
+    // cancellationToken -- This is checked before each region is read. If it
+    //                      is cancelled then the remaining regions are skipped
+    //                      and the transaction throws CancelledException.
     void readerTransaction(const std::vector<AABB> regions,
-                           std::function<void(size_t index, Array3D<Voxel> &&data)> fn);
+                           std::function<void(size_t index, Array3D<Voxel> &&data)> fn,
+                           const CancellationToken &cancellationToken = CancellationToken());
+    
+    // Perform a batch reader transaction asynchronously, in stages which run
+    // as separate tasks on the dispatcher. No thread is blocked while waiting
+    // for the lock, and the lock is held only while voxels are lit and copied.
+    // First, the chunks of the regions are faulted in without the lock.
+    // Second, once the lock is available, the regions are lit if necessary
+    // and their voxels are copied out. The caller reads the copies in a
+    // continuation on the returned future, after the lock has been released.
+    // dispatcher -- The dispatcher on which to run the transaction.
+    // priority -- The priority of the tasks which run the transaction.
+    // regions -- Collection of regions to read.
+    // cancellationToken -- If this is cancelled then the remaining regions
+    //                      are skipped and the future throws
+    //                      CancelledException.
+    // Returns a future for the voxels of each region, in the same order as
+    // the regions.
+    Future<std::vector<Array3D<Voxel>>> asyncReaderTransaction(const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                                               TaskDispatcher::Priority priority,
+                                                               std::vector<AABB> regions,
+                                                               const CancellationToken &cancellationToken = CancellationToken());
     
     // Perform an atomic transaction as a "writer" with read-write access to
     // the underlying voxel data in the specified region.
     // operation -- Describes the edits to be made.
     void writerTransaction(TerrainOperation &operation);
     
+    // Perform a writer transaction asynchronously. This is like
+    // writerTransaction() above except that no thread is blocked while
+    // waiting for the lock. Instead, the transaction is retried on the
+    // dispatcher whenever the locked region might have become available.
+    // dispatcher -- The dispatcher on which to run the transaction.
+    // priority -- The priority of the tasks which run the transaction.
+    // operation -- Describes the edits to be made.
+    // Returns a future which becomes ready once the edits have been made, the
+    // lock has been released, and `onWriterTransaction' has fired.
+    Future<void> asyncWriterTransaction(const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                        TaskDispatcher::Priority priority,
+                                        std::shared_ptr<TerrainOperation> operation);
+    
+    // Faults in the voxel data of the specified region, and performs initial
+    // sunlight propagation for it, so that a later reader transaction finds it
+    // in the cache. This is speculative. So, rather than wait for the lock, it
+    // gives up and returns false if the region is locked.
+    bool prefetch(const AABB &region);
+    
+    // Returns true if the voxel data of the specified region is already in the
+    // cache. This does not take the lock and the answer may be stale as soon
+    // as it is returned.
+    bool isResident(const AABB &region);
+    
+    // Saves all modified voxel data to file before returning.
+    // Call this on shutdown, after all transactions have finished.
+    void flush();
+    
     // This signal fires when a "writer" transaction finishes. This provides the
     // opportunity to respond to changes to data. For example, by rebuilding
     // meshes associated with underlying voxel data.
     boost::signals2::signal<void (const AABB &affectedRegion)> onWriterTransaction;
     
 private:
+    using RegionMutex = RegionMutualExclusionArbitrator::RegionMutex<RegionMutualExclusionArbitrator::WriterToken>;
+    
+    // State of a transaction started by asyncReaderTransaction().
+    struct AsyncReaderTransaction
+    {
+        std::shared_ptr<TaskDispatcher> dispatcher;
+        TaskDispatcher::Priority priority;
+        std::vector<AABB> regions;
+        CancellationToken cancellationToken;
+        RegionMutex mutex;
+        Promise<std::vector<Array3D<Voxel>>> promise;
+    };
+    
+    // State of a transaction started by asyncWriterTransaction().
+    struct AsyncWriterTransaction
+    {
+        std::shared_ptr<TaskDispatcher> dispatcher;
+        TaskDispatcher::Priority priority;
+        std::shared_ptr<TerrainOperation> operation;
+        RegionMutex mutex;
+        Promise<void> promise;
+    };
+    
     RegionMutualExclusionArbitrator _lockArbitrator;
     std::unique_ptr<VoxelData> _source;
+    
+    // Returns the region which must be locked to read the specified regions.
+    AABB getLockedRegion(const std::vector<AABB> &regions) const;
+    
+    // Fault in the chunks for the transaction without taking the lock, and
+    // then move on to attemptReaderTransaction().
+    void fetchReaderTransaction(const std::shared_ptr<AsyncReaderTransaction> &transaction);
+    
+    // Try to take the lock for the transaction and run it. If the lock is not
+    // available then try again later, once it might be.
+    void attemptReaderTransaction(const std::shared_ptr<AsyncReaderTransaction> &transaction);
+    
+    // Try to take the lock for the transaction and run it. If the lock is not
+    // available then try again later, once it might be.
+    void attemptWriterTransaction(const std::shared_ptr<AsyncWriterTransaction> &transaction);
 };
 
 #endif /* ConcurrentVoxelData_hpp */
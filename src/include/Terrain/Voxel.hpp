@@ -20,9 +20,14 @@ struct Voxel
     uint32_t sunLight:4;
     uint32_t torchLight:4;
     
-    Voxel() : value(0), sunLight(0), torchLight(0) {}
-    explicit Voxel(bool v) : value(v ? 1 : 0), sunLight(0), torchLight(0) {}
-    explicit Voxel(bool v, unsigned s, unsigned t) : value(v ? 1 : 0), sunLight(s), torchLight(t) {}
+    // The remaining bits are always zero. Voxels which compare equal then
+    // also have the same bytes, which matters for chunks which are rebuilt
+    // from a palette and for the bytes which are written to file.
+    uint32_t unused:23;
+    
+    Voxel() : value(0), sunLight(0), torchLight(0), unused(0) {}
+    explicit Voxel(bool v) : value(v ? 1 : 0), sunLight(0), torchLight(0), unused(0) {}
+    explicit Voxel(bool v, unsigned s, unsigned t) : value(v ? 1 : 0), sunLight(s), torchLight(t), unused(0) {}
     
     bool operator==(const Voxel &other) const
     {
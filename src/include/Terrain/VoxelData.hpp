@@ -15,8 +15,11 @@
 #include "TaskDispatcher.hpp"
 
 #include <spdlog/spdlog.h>
+#include <functional>
 #include <queue>
 
+class IncrementalLightPropagation;
+
 // Terrain voxels in space with flood-fill lighting.
 class VoxelData : public GridIndexer
 {
@@ -43,10 +46,42 @@ public:
     // data grid. This can be an arbitrary region of space with the bounds of
     // the grid.
     // May fault in missing voxels to satisfy the request.
-    Array3D<Voxel> load(const AABB &region);
+    // If the cancellation token is cancelled while voxels are being copied
+    // then this throws CancelledException. Sunlight propagation, which must
+    // not be left half-finished, always runs to completion.
+    Array3D<Voxel> load(const AABB &region,
+                        const CancellationToken &cancellationToken = CancellationToken());
+    
+    // Faults in the chunks of the specified region, and performs initial
+    // sunlight propagation for them, without copying out any voxels.
+    // This warms the cache ahead of a later call to load().
+    void prefetch(const AABB &region);
+    
+    // Faults in the chunks which a later call to load() for the specified
+    // region would need, generating them if necessary. Unlike load() and
+    // prefetch(), this does not light or modify any voxels, and so it may
+    // run without holding a lock on the region.
+    // If the cancellation token is cancelled then this throws
+    // CancelledException.
+    void fetch(const AABB &region,
+               const CancellationToken &cancellationToken = CancellationToken());
+    
+    // Returns true if every chunk in the specified region is in the cache.
+    bool isResident(const AABB &region);
+    
+    // Edits a single voxel and incrementally updates the lighting around it.
+    // The light values of `value' are ignored.
+    // Returns the region of voxels which changed, including lighting changes.
+    AABB editSingleVoxel(const glm::vec3 &point, const Voxel &value);
     
-    // Edits a single voxel.
-    void editSingleVoxel(const glm::vec3 &point, const Voxel &value);
+    // Places, changes, or removes the light emitter in a single empty voxel
+    // and incrementally updates the torch light around it. A light of zero
+    // removes the emitter.
+    // Returns the region of voxels which changed.
+    AABB editLightEmitter(const glm::vec3 &point, unsigned light);
+    
+    // Saves all modified chunks to file before returning.
+    void flush();
     
     // Return the region of voxels which may be accessed during the operation.
     // This is a worst-case estimate of the region of voxel which may be
@@ -82,6 +117,20 @@ private:
     // cell -- The bounding box of the chunk.
     // index -- An index into the chunk grid corresponding to the cell.
     std::unique_ptr<VoxelDataChunk> createNewChunk(const AABB &cell, Morton3 index);
+    
+    // Makes an edit at the specified point and incrementally updates lighting.
+    // The chunks around the point are lit and held in memory while the edit
+    // runs, and modified chunks are saved afterward, even if the edit fails.
+    // Returns the region of voxels which changed, as returned by `edit'.
+    AABB editWithIncrementalLighting(const glm::vec3 &point,
+                                     const std::function<AABB(IncrementalLightPropagation &)> &edit);
+    
+    // Saves the chunks which the lighting has modified in place.
+    void storeModifiedChunks(const IncrementalLightPropagation &lighting);
+    
+    // Returns the region whose lighting may be read or changed when voxels in
+    // the specified region are edited.
+    AABB getLightingRegion(const AABB &editedRegion) const;
 };
 
 #endif /* VoxelData_hpp */
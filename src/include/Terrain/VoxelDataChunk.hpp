@@ -10,9 +10,14 @@
 #define VoxelDataChunk_hpp
 
 #include "Grid/Array3D.hpp"
+#include "Grid/PalettedArray3D.hpp"
 #include "Grid/GridIndexerRange.hpp"
 #include "Terrain/Voxel.hpp"
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 static const Voxel SkyVoxel{
     /* .value = */ 0,
     /* .sunLight = */ MAX_LIGHT,
@@ -25,6 +30,33 @@ static const Voxel GroundVoxel{
     /* .torchLight = */ 0
 };
 
+// A point light source which emits torch light into a single empty voxel.
+struct LightEmitter
+{
+    // Cell coordinates of the voxel within its chunk.
+    uint8_t x, y, z;
+    
+    // The torch light emitted into the voxel, in [1, MAX_LIGHT].
+    uint8_t light;
+};
+
+static_assert(sizeof(LightEmitter) == 4, "LightEmitter is expected to be four bytes.");
+
+// A chunk of voxel data which is either an array of voxels, a paletted array
+// of voxels, or which is entirely sky or entirely ground.
+//
+// Most chunks contain only a handful of distinct voxel values, and these are
+// stored as a paletted array which is a fraction of the size of a full array.
+// A paletted chunk is promoted to a full array when it runs out of room in the
+// palette.
+//
+// The voxel arrays are copy-on-write. Copying a chunk is cheap as the copy
+// shares the array with the original. Either chunk makes a private copy of the
+// array the first time it is modified while the array is shared. So, a copy
+// taken for reading or saving is an immutable snapshot.
+//
+// The chunk also holds the light emitters placed within it. There are usually
+// none, or very few.
 class VoxelDataChunk : public GridIndexer
 {
 public:
@@ -33,29 +65,30 @@ public:
     enum Type {
         Array,
         Sky,
-        Ground
+        Ground,
+        Palette
     };
     
     VoxelDataChunk(const VoxelDataChunk &other)
      : GridIndexer(other.boundingBox(), other.gridResolution()),
        complete(other.complete),
-       _type(other._type)
+       _type(other._type),
+       _voxels(other._voxels),
+       _palettedVoxels(other._palettedVoxels),
+       _emitters(other._emitters)
     {
-        if (other._voxels) {
-            _voxels = std::make_unique<Array3D<Voxel>>(*other._voxels);
-        } else {
-            _voxels = nullptr;
-        }
-        assert((_type != Array && !_voxels) || (_type == Array && _voxels));
+        assertInvariants();
     }
     
     VoxelDataChunk(VoxelDataChunk &&other)
      : GridIndexer(other.boundingBox(), other.gridResolution()),
        complete(other.complete),
        _type(other._type),
-       _voxels(std::move(other._voxels))
+       _voxels(std::move(other._voxels)),
+       _palettedVoxels(std::move(other._palettedVoxels)),
+       _emitters(std::move(other._emitters))
     {
-        assert((_type != Array && !_voxels) || (_type == Array && _voxels));
+        assertInvariants();
     }
     
     VoxelDataChunk& operator=(const VoxelDataChunk &other)
@@ -63,12 +96,10 @@ public:
         if (&other != this) {
             complete = other.complete;
             _type = other._type;
-            if (other._voxels) {
-                _voxels = std::make_unique<Array3D<Voxel>>(*other._voxels);
-            } else {
-                _voxels = nullptr;
-            }
-            assert((_type != Array && !_voxels) || (_type == Array && _voxels));
+            _voxels = other._voxels;
+            _palettedVoxels = other._palettedVoxels;
+            _emitters = other._emitters;
+            assertInvariants();
         }
         return *this;
     }
@@ -86,6 +117,10 @@ public:
                 assert(_voxels);
                 return _voxels->reference(point);
                 
+            case Palette:
+                assert(_palettedVoxels);
+                return _palettedVoxels->get(point);
+            
             case Sky:
                 return SkyVoxel;
                 
@@ -102,28 +137,90 @@ public:
     {
         switch (_type) {
             case Array:
-                // nothing to do
+                assert(_voxels);
+                makeVoxelsUnique(_voxels);
+                _voxels->mutableReference(point) = value;
+                break;
+            
+            case Palette:
+                assert(_palettedVoxels);
+                makeVoxelsUnique(_palettedVoxels);
+                if (!_palettedVoxels->set(point, value)) {
+                    convertToArray();
+                    _voxels->mutableReference(point) = value;
+                }
                 break;
                 
             case Sky:
                 if (value != SkyVoxel) {
-                    convertToArray();
+                    convertToPalette();
+                    _palettedVoxels->set(point, value);
                 }
                 break;
                 
             case Ground:
                 if (value != GroundVoxel) {
-                    convertToArray();
+                    convertToPalette();
+                    _palettedVoxels->set(point, value);
                 }
                 break;
                 
             default:
                 assert(!"unreachable");
         }
+    }
+    
+    // Returns the light emitters placed in the chunk.
+    inline const std::vector<LightEmitter>& getEmitters() const
+    {
+        return _emitters;
+    }
+    
+    // Replaces all light emitters in the chunk.
+    inline void setEmitters(std::vector<LightEmitter> &&emitters)
+    {
+        _emitters = std::move(emitters);
+    }
+    
+    // Returns the torch light emitted into the voxel at the specified cell
+    // coordinates, or zero if there is no emitter there.
+    unsigned getEmittedLight(const glm::ivec3 &cellCoords) const
+    {
+        for (const LightEmitter &emitter : _emitters) {
+            if (emitter.x == cellCoords.x && emitter.y == cellCoords.y && emitter.z == cellCoords.z) {
+                return emitter.light;
+            }
+        }
+        return 0;
+    }
+    
+    // Places an emitter in the voxel at the specified cell coordinates,
+    // replacing any emitter which was already there. A light of zero removes
+    // the emitter instead.
+    // This does not change the light stored in any voxel.
+    void setEmitter(const glm::ivec3 &cellCoords, unsigned light)
+    {
+        assert(inbounds(cellCoords));
+        assert(light <= MAX_LIGHT);
         
-        if (_type == Array) {
-            assert(_voxels);
-            _voxels->mutableReference(point) = value;
+        for (auto iter = _emitters.begin(); iter != _emitters.end(); ++iter) {
+            if (iter->x == cellCoords.x && iter->y == cellCoords.y && iter->z == cellCoords.z) {
+                if (light == 0) {
+                    _emitters.erase(iter);
+                } else {
+                    iter->light = (uint8_t)light;
+                }
+                return;
+            }
+        }
+        
+        if (light != 0) {
+            _emitters.push_back(LightEmitter{
+                (uint8_t)cellCoords.x,
+                (uint8_t)cellCoords.y,
+                (uint8_t)cellCoords.z,
+                (uint8_t)light
+            });
         }
     }
     
@@ -131,11 +228,27 @@ public:
     {
         VoxelDataChunk chunk(voxels.boundingBox(), voxels.gridResolution());
         chunk._type = Array;
-        chunk._voxels = std::make_unique<Array3D<Voxel>>(std::move(voxels));
+        chunk._voxels = std::make_shared<Array3D<Voxel>>(std::move(voxels));
         assert(chunk._voxels);
         return chunk;
     }
     
+    // Creates a chunk using the most compact representation for the voxels.
+    // The chunk is a paletted array when there are few enough distinct voxel
+    // values, and otherwise is a full array.
+    static VoxelDataChunk createCompactChunk(Array3D<Voxel> &&voxels)
+    {
+        auto palettedVoxels = PalettedArray3D<Voxel>::fromArray(voxels);
+        if (!palettedVoxels) {
+            return createArrayChunk(std::move(voxels));
+        }
+        
+        VoxelDataChunk chunk(voxels.boundingBox(), voxels.gridResolution());
+        chunk._type = Palette;
+        chunk._palettedVoxels = std::make_shared<PalettedArray3D<Voxel>>(std::move(*palettedVoxels));
+        return chunk;
+    }
+    
     static VoxelDataChunk createSkyChunk(const AABB &boundingBox,
                                          const glm::ivec3 &gridResolution)
     {
@@ -152,21 +265,35 @@ public:
         return chunk;
     }
     
+    // Returns an estimate of the number of bytes of memory used by the chunk.
+    size_t getNumberOfResidentBytes() const
+    {
+        size_t numberOfBytes = sizeof(VoxelDataChunk);
+        if (_type == Array) {
+            const glm::ivec3 res = gridResolution();
+            numberOfBytes += res.x * res.y * res.z * sizeof(Voxel);
+        } else if (_type == Palette) {
+            numberOfBytes += sizeof(PalettedArray3D<Voxel>) + _palettedVoxels->getNumberOfBytes();
+        }
+        numberOfBytes += _emitters.capacity() * sizeof(LightEmitter);
+        return numberOfBytes;
+    }
+    
     // Get the uncompressed voxel bytes from the chunk.
+    // Paletted chunks are expanded to the same bytes as the equivalent array.
     std::vector<uint8_t> getUncompressedBytes() const
     {
         switch (_type) {
             case Array:
             {
                 assert(_voxels);
-                const glm::ivec3 res = gridResolution();
-                const size_t numberOfVoxelBytes = res.x * res.y * res.z * sizeof(Voxel);
-                std::vector<uint8_t> uncompressedBytes;
-                uncompressedBytes.resize(numberOfVoxelBytes);
-                memcpy((void *)uncompressedBytes.data(),
-                       (const void *)_voxels->data(),
-                       numberOfVoxelBytes);
-                return uncompressedBytes;
+                return getUncompressedBytes(*_voxels);
+            }
+            
+            case Palette:
+            {
+                assert(_palettedVoxels);
+                return getUncompressedBytes(_palettedVoxels->toArray());
             }
                 
             case Sky:
@@ -184,16 +311,21 @@ public:
     {
         assert(_type != Array);
         
-        _voxels = std::make_unique<Array3D<Voxel>>(boundingBox(), gridResolution());
-        
-        Voxel value;
         switch (_type) {
             case Sky:
-                value = SkyVoxel;
+                _voxels = std::make_shared<Array3D<Voxel>>(boundingBox(), gridResolution());
+                _voxels->fillCells(SkyVoxel, glm::ivec3(0, 0, 0), gridResolution());
                 break;
                 
             case Ground:
-                value = GroundVoxel;
+                _voxels = std::make_shared<Array3D<Voxel>>(boundingBox(), gridResolution());
+                _voxels->fillCells(GroundVoxel, glm::ivec3(0, 0, 0), gridResolution());
+                break;
+            
+            case Palette:
+                assert(_palettedVoxels);
+                _voxels = std::make_shared<Array3D<Voxel>>(_palettedVoxels->toArray());
+                _palettedVoxels.reset();
                 break;
                 
             case Array:
@@ -203,16 +335,105 @@ public:
                 assert(!"unreachable");
         }
         
-        for (const glm::ivec3 coord : slice(*_voxels, _voxels->boundingBox())) {
-            _voxels->mutableReference(coord) = value;
-        }
-        
         _type = Array;
     }
     
+    // Converts a sky or ground chunk to a paletted array with the same
+    // voxel value in every cell.
+    void convertToPalette()
+    {
+        assert(_type == Sky || _type == Ground);
+        const Voxel value = (_type == Sky) ? SkyVoxel : GroundVoxel;
+        _palettedVoxels = std::make_shared<PalettedArray3D<Voxel>>(boundingBox(), gridResolution(), value);
+        _type = Palette;
+    }
+    
+    // Copies the voxels which lie within the region into the destination
+    // array. The region must be aligned to voxel boundaries and must lie
+    // within both the chunk and the destination array.
+    // This is much faster than copying voxels one at a time with get() as it
+    // works in integer cell space and copies whole Morton-contiguous blocks
+    // at once. Sky and ground chunks fill the region instead.
+    void copyCellsTo(Array3D<Voxel> &dst, const AABB &region) const
+    {
+        // Take the cell coordinates at the centers of the corner voxels so
+        // that rounding error at the cell boundaries does not matter.
+        const glm::vec3 halfCell = cellDimensions() * 0.5f;
+        const glm::vec3 mins = region.mins() + halfCell;
+        const glm::vec3 maxs = region.maxs() - halfCell;
+        const glm::ivec3 srcOrigin = cellCoordsAtPoint(mins);
+        const glm::ivec3 dstOrigin = dst.cellCoordsAtPoint(mins);
+        const glm::ivec3 size = cellCoordsAtPoint(maxs) - srcOrigin + glm::ivec3(1, 1, 1);
+        
+        switch (_type) {
+            case Array:
+                assert(_voxels);
+                dst.copyCells(*_voxels, srcOrigin, dstOrigin, size);
+                break;
+            
+            case Palette:
+                assert(_palettedVoxels);
+                _palettedVoxels->copyCellsTo(dst, srcOrigin, dstOrigin, size);
+                break;
+            
+            case Sky:
+                dst.fillCells(SkyVoxel, dstOrigin, size);
+                break;
+            
+            case Ground:
+                dst.fillCells(GroundVoxel, dstOrigin, size);
+                break;
+            
+            default:
+                assert(!"unreachable");
+        }
+    }
+    
 private:
     Type _type;
-    std::unique_ptr<Array3D<Voxel>> _voxels;
+    
+    // The voxels of an Array chunk. Null for other types of chunk.
+    std::shared_ptr<Array3D<Voxel>> _voxels;
+    
+    // The voxels of a Palette chunk. Null for other types of chunk.
+    std::shared_ptr<PalettedArray3D<Voxel>> _palettedVoxels;
+    
+    // Light emitters placed in the chunk, in no particular order.
+    std::vector<LightEmitter> _emitters;
+    
+    inline void assertInvariants() const
+    {
+        assert((_type == Array) == (bool)_voxels);
+        assert((_type == Palette) == (bool)_palettedVoxels);
+    }
+    
+    static std::vector<uint8_t> getUncompressedBytes(const Array3D<Voxel> &voxels)
+    {
+        const glm::ivec3 res = voxels.gridResolution();
+        const size_t numberOfVoxelBytes = res.x * res.y * res.z * sizeof(Voxel);
+        std::vector<uint8_t> uncompressedBytes;
+        uncompressedBytes.resize(numberOfVoxelBytes);
+        memcpy((void *)uncompressedBytes.data(),
+               (const void *)voxels.data(),
+               numberOfVoxelBytes);
+        return uncompressedBytes;
+    }
+    
+    // Makes a private copy of the voxel array if it is shared with a snapshot.
+    // A snapshot is never taken while the chunk is being modified, as both
+    // happen under the chunk's region lock. So, once the use count drops to
+    // one it stays there.
+    template<typename ArrayType>
+    static void makeVoxelsUnique(std::shared_ptr<ArrayType> &voxels)
+    {
+        if (voxels.use_count() > 1) {
+            voxels = std::make_shared<ArrayType>(*voxels);
+        } else {
+            // Pairs with the release of the last snapshot so its reads of
+            // the array happen before our writes.
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+    }
     
     VoxelDataChunk(const AABB &boundingBox, const glm::ivec3 &gridResolution)
      : GridIndexer(boundingBox, gridResolution),
@@ -13,22 +13,50 @@
 #include "Grid/Array3D.hpp"
 #include "Voxel.hpp"
 #include "Noise/Noise.hpp"
+#include "TaskDispatcher.hpp"
 #include <memory>
 
 // Procedurally generates voxel data from pseudorandom noise.
 class VoxelDataGenerator : public GridIndexer
 {
 public:
-    VoxelDataGenerator(unsigned seed);
+    // Conservative classification of the voxels in a region.
+    enum Classification
+    {
+        // Every voxel is empty and nothing above the region casts a shadow
+        // onto it.
+        Sky,
+        
+        // Every voxel is solid.
+        Ground,
+        
+        // The region may hold a mix of empty and solid voxels.
+        Mixed
+    };
+    
+    // Constructor.
+    // seed -- Seed for the pseudorandom noise.
+    // dispatcher -- If provided, copy() generates blocks of voxels in parallel
+    //               on this dispatcher. Otherwise, it runs serially.
+    VoxelDataGenerator(unsigned seed,
+                       std::shared_ptr<TaskDispatcher> dispatcher = nullptr);
     VoxelDataGenerator() = delete;
     ~VoxelDataGenerator() = default;
     
     // Returns an array which holds a copy of the contents of the subregion.
     Array3D<Voxel> copy(const AABB &region) const;
     
+    // Classifies the voxels which copy() would return for the subregion.
+    // This uses known bounds on the amplitude of the noise instead of
+    // evaluating it, so it is cheap enough to call before every copy(). It is
+    // conservative: regions classified as Sky or Ground are certainly uniform,
+    // but a Mixed region may turn out to be uniform too.
+    Classification classify(const AABB &region) const;
+
 private:
     std::unique_ptr<Noise> _noiseSource0;
     std::unique_ptr<Noise> _noiseSource1;
+    std::shared_ptr<TaskDispatcher> _dispatcher;
 };
 
 #endif /* VoxelDataGenerator_hpp */
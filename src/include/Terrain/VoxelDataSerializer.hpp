@@ -76,7 +76,8 @@ public:
         // Version number for the serialized voxel data.
         uint32_t version;
         
-        // CRC32 checksum of the compressed voxel data.
+        // CRC32 checksum of the compressed bytes and the emitter table. This
+        // does not include any padding which follows them.
         uint32_t checksum;
         
         // The dimensions of the voxel grid.
@@ -92,6 +93,9 @@ public:
         uint32_t complete : 1;
         
         // The compressed voxel bytes.
+        // These are followed by the table of light emitters in the chunk,
+        // which is a uint32_t count and then that many LightEmitter structs.
+        // Version 2 of the format has no emitter table.
         uint8_t compressedBytes[0];
     };
     
@@ -112,7 +116,19 @@ public:
     std::vector<uint8_t> store(const VoxelDataChunk &chunk);
     
 private:
-    const uint32_t VOXEL_MAGIC, VOXEL_VERSION;
+    const uint32_t VOXEL_MAGIC, VOXEL_VERSION, VOXEL_VERSION_WITHOUT_EMITTERS;
+    
+    // Gets the number of bytes in the table of light emitters which begins at
+    // the specified offset. Throws an exception if the table is truncated.
+    static size_t getEmitterTableSize(const std::vector<uint8_t> &bytes,
+                                      size_t offset);
+    
+    // Reads the table of light emitters which follows the compressed bytes.
+    // The table must already be known to fit in `bytes'.
+    // Throws an exception if the table is malformed.
+    static std::vector<LightEmitter> loadEmitters(const std::vector<uint8_t> &bytes,
+                                                  size_t offset,
+                                                  const glm::ivec3 &gridResolution);
 };
 
 #endif /* VoxelDataSerializer_hpp */
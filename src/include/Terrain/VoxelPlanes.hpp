@@ -0,0 +1,281 @@
+//
+//  VoxelPlanes.hpp
+//  PinkTopaz
+//
+
+#ifndef VoxelPlanes_hpp
+#define VoxelPlanes_hpp
+
+#include "Grid/Array3D.hpp"
+#include "Terrain/Voxel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// A grid of voxels stored as separate planes rather than as an array of Voxel.
+// Occupancy is a bitset with one bit per voxel. Light is a plane with one byte
+// per voxel where sunlight is in the low nibble and torchlight is in the high
+// nibble. This is a little over a quarter the size of an Array3D<Voxel>, and
+// readers which only need occupancy touch a thirty-second of the memory.
+//
+// Voxels are stored in Morton order, like Array3D. So, each 64-bit word of the
+// occupancy bitset holds exactly one aligned block of 4x4x4 voxels. This makes
+// it cheap to check whether whole blocks are empty or solid.
+//
+// Voxel-based get() and set() are provided so existing code can migrate one
+// piece at a time.
+class VoxelPlanes : public GridIndexer
+{
+public:
+    // The number of voxels along each side of an occupancy block.
+    static constexpr int OccupancyBlockSize = 4;
+    
+    // An occupancy block where every voxel is occupied.
+    static constexpr uint64_t OccupancyBlockFull = ~(uint64_t)0;
+    
+    ~VoxelPlanes() = default;
+    
+    // No default constructor.
+    VoxelPlanes() = delete;
+    
+    // Constructor. Every voxel is initially empty and unlit.
+    // box -- The region of space this grid of voxels represents.
+    // res -- The number of voxels along each axis.
+    VoxelPlanes(const AABB &box, const glm::ivec3 &res)
+     : GridIndexer(box, res),
+       _maxValidIndex(Morton3::encode(res - glm::ivec3(1, 1, 1))),
+       _occupancy(_maxValidIndex / BitsPerWord + 1, 0),
+       _light(_maxValidIndex + 1, 0)
+    {}
+    
+    // Constructor. Copies the voxels from the specified array.
+    explicit VoxelPlanes(const Array3D<Voxel> &voxels)
+     : VoxelPlanes(voxels.boundingBox(), voxels.gridResolution())
+    {
+        const Voxel *cells = (const Voxel *)voxels.data();
+        for (size_t i = 0; i <= _maxValidIndex; ++i) {
+            const Voxel &voxel = cells[i];
+            _occupancy[i / BitsPerWord] |= (uint64_t)voxel.value << (i % BitsPerWord);
+            _light[i] = packLight(voxel.sunLight, voxel.torchLight);
+        }
+    }
+    
+    // Returns a copy of the voxels as an array of Voxel.
+    Array3D<Voxel> toArray() const
+    {
+        Array3D<Voxel> voxels(boundingBox(), gridResolution());
+        Voxel *cells = (Voxel *)voxels.data();
+        for (size_t i = 0; i <= _maxValidIndex; ++i) {
+            cells[i] = get(Morton3(i));
+        }
+        return voxels;
+    }
+    
+    // Returns true if the voxel is occupied.
+    inline bool isOccupied(Morton3 index) const
+    {
+        const size_t i = checkIndex(index);
+        return (_occupancy[i / BitsPerWord] >> (i % BitsPerWord)) & 1;
+    }
+    
+    // Returns true if the voxel at the specified cell coordinates is occupied.
+    inline bool isOccupied(const glm::ivec3 &cellCoords) const
+    {
+        return isOccupied(indexAtCellCoords(cellCoords));
+    }
+    
+    // Returns true if the voxel in which the point resides is occupied.
+    inline bool isOccupied(const glm::vec3 &point) const
+    {
+        return isOccupied(indexAtPoint(point));
+    }
+    
+    inline void setOccupied(Morton3 index, bool occupied)
+    {
+        const size_t i = checkIndex(index);
+        const uint64_t bit = (uint64_t)1 << (i % BitsPerWord);
+        uint64_t &word = _occupancy[i / BitsPerWord];
+        word = occupied ? (word | bit) : (word & ~bit);
+    }
+    
+    inline unsigned getSunLight(Morton3 index) const
+    {
+        return _light[checkIndex(index)] & 0xf;
+    }
+    
+    inline unsigned getTorchLight(Morton3 index) const
+    {
+        return _light[checkIndex(index)] >> 4;
+    }
+    
+    inline void setSunLight(Morton3 index, unsigned sunLight)
+    {
+        uint8_t &light = _light[checkIndex(index)];
+        light = packLight(sunLight, light >> 4);
+    }
+    
+    inline void setTorchLight(Morton3 index, unsigned torchLight)
+    {
+        uint8_t &light = _light[checkIndex(index)];
+        light = packLight(light & 0xf, torchLight);
+    }
+    
+    // Gets the voxel at the specified index as a Voxel.
+    inline Voxel get(Morton3 index) const
+    {
+        const size_t i = checkIndex(index);
+        const bool occupied = (_occupancy[i / BitsPerWord] >> (i % BitsPerWord)) & 1;
+        return Voxel(occupied, _light[i] & 0xf, _light[i] >> 4);
+    }
+    
+    // Gets the voxel at the specified cell coordinates as a Voxel.
+    inline Voxel get(const glm::ivec3 &cellCoords) const
+    {
+        return get(indexAtCellCoords(cellCoords));
+    }
+    
+    // Gets the voxel in which the point resides as a Voxel.
+    inline Voxel get(const glm::vec3 &point) const
+    {
+        return get(indexAtPoint(point));
+    }
+    
+    // Sets the voxel at the specified index from a Voxel.
+    inline void set(Morton3 index, const Voxel &voxel)
+    {
+        setOccupied(index, voxel.value != 0);
+        _light[(size_t)index] = packLight(voxel.sunLight, voxel.torchLight);
+    }
+    
+    // Sets the voxel at the specified cell coordinates from a Voxel.
+    inline void set(const glm::ivec3 &cellCoords, const Voxel &voxel)
+    {
+        set(indexAtCellCoords(cellCoords), voxel);
+    }
+    
+    // Sets the voxel in which the point resides from a Voxel.
+    inline void set(const glm::vec3 &point, const Voxel &voxel)
+    {
+        set(indexAtPoint(point), voxel);
+    }
+    
+    // Returns the number of occupancy blocks along each axis.
+    inline glm::ivec3 getOccupancyBlockResolution() const
+    {
+        const glm::ivec3 res = gridResolution();
+        return (res + glm::ivec3(OccupancyBlockSize - 1)) / OccupancyBlockSize;
+    }
+    
+    // Gets the occupancy of an aligned block of 4x4x4 voxels as a bitmask.
+    // Bit i is set when the voxel with Morton index i within the block is
+    // occupied. Voxels which fall outside the grid are unoccupied.
+    // blockCoords -- The coordinates of the block. The block contains the
+    //                voxels from OccupancyBlockSize*blockCoords up to, but
+    //                not including, OccupancyBlockSize*(blockCoords+1).
+    inline uint64_t getOccupancyBlock(const glm::ivec3 &blockCoords) const
+    {
+        // The Morton code of the block's first voxel is the Morton code of
+        // the block coordinates shifted left by three bits per axis.
+        const size_t wordIndex = (size_t)Morton3(blockCoords);
+        if constexpr (EnableVerboseBoundsChecking) {
+            if (wordIndex >= _occupancy.size()) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- boundingBox={} ; blockCoords={}",
+                                                       boundingBox(),
+                                                       glm::to_string(blockCoords)));
+            }
+        }
+        return _occupancy[wordIndex];
+    }
+    
+    // Returns the number of occupied voxels in the grid.
+    size_t countOccupied() const
+    {
+        size_t count = 0;
+        for (const uint64_t word : _occupancy) {
+            count += popcount(word);
+        }
+        return count;
+    }
+    
+    // Returns the number of occupied voxels in a box of voxels.
+    // Aligned occupancy blocks which lie entirely within the box are counted
+    // a whole word at a time.
+    // origin -- Cell coordinates of the minimum corner of the box.
+    // size -- The number of voxels along each axis of the box.
+    size_t countOccupied(const glm::ivec3 &origin, const glm::ivec3 &size) const
+    {
+        constexpr int mask = ~(OccupancyBlockSize - 1);
+        const glm::ivec3 end = origin + size;
+        size_t count = 0;
+        
+        for (int bz = origin.z & mask; bz < end.z; bz += OccupancyBlockSize) {
+            for (int by = origin.y & mask; by < end.y; by += OccupancyBlockSize) {
+                for (int bx = origin.x & mask; bx < end.x; bx += OccupancyBlockSize) {
+                    const glm::ivec3 blockMins(bx, by, bz);
+                    const glm::ivec3 blockEnd = blockMins + glm::ivec3(OccupancyBlockSize);
+                    
+                    if (blockMins.x >= origin.x && blockEnd.x <= end.x &&
+                        blockMins.y >= origin.y && blockEnd.y <= end.y &&
+                        blockMins.z >= origin.z && blockEnd.z <= end.z) {
+                        count += popcount(getOccupancyBlock(blockMins / OccupancyBlockSize));
+                        continue;
+                    }
+                    
+                    const glm::ivec3 mins = glm::max(blockMins, origin);
+                    const glm::ivec3 maxs = glm::min(blockEnd, end);
+                    for (int z = mins.z; z < maxs.z; ++z) {
+                        for (int y = mins.y; y < maxs.y; ++y) {
+                            for (int x = mins.x; x < maxs.x; ++x) {
+                                count += isOccupied(glm::ivec3(x, y, z)) ? 1 : 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        
+        return count;
+    }
+    
+    // Returns the number of bytes used to store the planes.
+    size_t getNumberOfBytes() const
+    {
+        return _occupancy.size() * sizeof(uint64_t) + _light.size() * sizeof(uint8_t);
+    }
+
+private:
+    static constexpr size_t BitsPerWord = 64;
+    
+    const size_t _maxValidIndex;
+    std::vector<uint64_t> _occupancy;
+    std::vector<uint8_t> _light;
+    
+    static inline uint8_t packLight(unsigned sunLight, unsigned torchLight)
+    {
+        return (uint8_t)((sunLight & 0xf) | ((torchLight & 0xf) << 4));
+    }
+    
+    static inline size_t popcount(uint64_t word)
+    {
+#if defined(_MSC_VER)
+        return __popcnt64(word);
+#else
+        return __builtin_popcountll(word);
+#endif
+    }
+    
+    inline size_t checkIndex(Morton3 index) const
+    {
+        if constexpr (EnableVerboseBoundsChecking) {
+            if ((size_t)index > _maxValidIndex) {
+                throw OutOfBoundsException(fmt::format("OutOfBoundsException -- boundingBox={} ; index={} ; maxValidIndex={}",
+                                                       boundingBox(),
+                                                       (size_t)index,
+                                                       _maxValidIndex));
+            }
+        }
+        return (size_t)index;
+    }
+};
+
+#endif /* VoxelPlanes_hpp */
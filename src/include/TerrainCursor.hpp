@@ -35,7 +35,7 @@ struct TerrainCursor
     
     // If there is a pending task to update the cursor asynchronously then
     // this cancellation token can be used to cancel it.
-    std::shared_ptr<std::atomic<bool>> cancellationToken;
+    CancellationToken cancellationToken;
     
     TerrainCursor() : active(false), pos(0.f), placePos(0.f) {}
 };
@@ -20,6 +20,7 @@
 #include <entityx/entityx.h>
 #include <glm/mat4x4.hpp>
 #include <queue>
+#include <mutex>
 #include <spdlog/spdlog.h>
 
 // System for updating terrain cursors.
@@ -55,8 +56,31 @@ private:
                              bool value,
                              bool usePlacePos);
     
-    std::shared_ptr<TaskDispatcher> _dispatcher;
+    // Places a torch light in the empty voxel in front of the cursor.
+    void placeLightUnderCursor(TerrainCursor &cursor);
+    
+    // Schedules an operation to be applied to the terrain asynchronously, in
+    // the order that operations were scheduled.
+    void scheduleOperation(entityx::Entity terrainEntity,
+                           std::shared_ptr<TerrainOperation> operation);
+    
+    // Terrain edits which have been made but not yet applied.
+    struct PendingEdits
+    {
+        std::mutex lock;
+        std::queue<std::pair<std::shared_ptr<Terrain>, std::shared_ptr<TerrainOperation>>> edits;
+        bool taskPending = false;
+    };
+    
+    // Starts the next queued terrain edit. When it finishes, the one after
+    // that is started, and so on until the queue is empty. No thread waits
+    // for an edit in the meantime. An edit which fails is logged and skipped
+    // so that later edits still go through.
+    static void applyNextPendingEdit(const std::shared_ptr<spdlog::logger> &log,
+                                     const std::shared_ptr<PendingEdits> &pendingEdits);
+    
     std::shared_ptr<TaskDispatcher> _mainThreadDispatcher;
+    std::shared_ptr<PendingEdits> _pendingEdits;
     entityx::Entity _activeCamera;
     bool _needsUpdate;
     int _mouseDownCounter;
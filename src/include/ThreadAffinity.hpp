@@ -0,0 +1,41 @@
+//
+//  ThreadAffinity.hpp
+//  PinkTopaz
+//
+
+#ifndef ThreadAffinity_hpp
+#define ThreadAffinity_hpp
+
+#include <vector>
+
+// The logical CPUs available to the process, grouped by NUMA node.
+struct CpuTopology
+{
+    // Each element lists the logical CPUs in one NUMA node. On a system
+    // without NUMA, or where the topology cannot be queried, there is one
+    // node with all available CPUs.
+    std::vector<std::vector<unsigned>> nodes;
+    
+    // Returns the total number of CPUs in all nodes.
+    unsigned numberOfCpus() const
+    {
+        unsigned count = 0;
+        for (const auto &node : nodes) {
+            count += (unsigned)node.size();
+        }
+        return count;
+    }
+};
+
+// Query the CPUs which the process is allowed to run on.
+CpuTopology getCpuTopology();
+
+// Returns true if setAffinityForCurrentThread() has any effect on this
+// platform.
+bool isThreadAffinitySupported();
+
+// Restrict the current thread to run only on the specified CPUs. This is a
+// no-op on platforms which do not support thread affinity.
+void setAffinityForCurrentThread(const std::vector<unsigned> &cpus);
+
+#endif /* ThreadAffinity_hpp */
@@ -0,0 +1,89 @@
+//
+//  ThreadPoolPolicy.hpp
+//  PinkTopaz
+//
+
+#ifndef ThreadPoolPolicy_hpp
+#define ThreadPoolPolicy_hpp
+
+#include "ThreadAffinity.hpp"
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Decides how many worker threads each subsystem's thread pool gets, and
+// which CPUs those threads run on.
+//
+// There is one policy for the whole process. The total number of workers is
+// limited by a budget, which is divided among subsystems in proportion to
+// their shares. The allotments add up to exactly the budget, unless there are
+// more subsystems than workers in the budget. This keeps the pools from oversubscribing the CPUs when each
+// one would otherwise size itself to the whole machine.
+class ThreadPoolPolicy
+{
+public:
+    struct Settings
+    {
+        // Total number of worker threads across all pools. Zero means one
+        // less than the number of available CPUs, which leaves a CPU for the
+        // main thread.
+        unsigned workerBudget = 0;
+        
+        // Pin worker threads to CPUs. Each pool gets its own slice of CPUs.
+        bool pinThreads = false;
+        
+        // When pinning, let each worker float over all CPUs of the NUMA node
+        // of its assigned CPU instead of pinning it to that one CPU.
+        bool groupByNumaNode = true;
+        
+        // The relative share of the worker budget given to each subsystem.
+        std::map<std::string, float> shares;
+    };
+    
+    ThreadPoolPolicy(const Settings &settings, const CpuTopology &topology);
+    
+    // Returns the total number of worker threads in the budget.
+    inline unsigned getWorkerBudget() const
+    {
+        return _workerBudget;
+    }
+    
+    // Returns the number of worker threads for the subsystem. This is always
+    // at least one, even for a subsystem which has no share.
+    unsigned getNumberOfThreads(const std::string &subsystem) const;
+    
+    // Returns the CPUs on which the specified worker of the subsystem should
+    // run. This is empty if the worker should not be pinned.
+    std::vector<unsigned> getAffinity(const std::string &subsystem,
+                                      unsigned workerIndex) const;
+    
+    // Returns a function suitable for TaskDispatcher's worker start hook. It
+    // pins each worker of the subsystem according to the policy. Returns an
+    // empty function if workers are not pinned.
+    std::function<void(unsigned workerIndex)> getWorkerStartHook(const std::string &subsystem) const;
+    
+    // Returns a human readable description of the topology and of the
+    // workers assigned to each subsystem.
+    std::string describe() const;
+
+private:
+    // Threads and CPUs allotted to one subsystem.
+    struct Allotment
+    {
+        unsigned numberOfThreads = 1;
+        
+        // CPUs, in order, which the subsystem's workers are assigned to.
+        std::vector<unsigned> cpus;
+    };
+    
+    Settings _settings;
+    CpuTopology _topology;
+    unsigned _workerBudget;
+    std::map<std::string, Allotment> _allotments;
+    
+    // Returns the NUMA node which contains the CPU.
+    const std::vector<unsigned>& nodeContaining(unsigned cpu) const;
+};
+
+#endif /* ThreadPoolPolicy_hpp */
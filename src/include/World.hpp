@@ -14,6 +14,7 @@
 #include "Renderer/GraphicsDevice.hpp"
 #include "TaskDispatcher.hpp"
 #include "Preferences.hpp"
+#include "ThreadPoolPolicy.hpp"
 
 // A World is the same thing as a game zone or level.
 // This is a collection of interacting entities and associated systems.
@@ -27,7 +28,8 @@ public:
     World(std::shared_ptr<spdlog::logger> log,
           const Preferences &preferences,
           const std::shared_ptr<GraphicsDevice> &graphicsDevice,
-          const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher);
+          const std::shared_ptr<TaskDispatcher> &mainThreadDispatcher,
+          const ThreadPoolPolicy &threadPoolPolicy);
         
     void update(entityx::TimeDelta dt);
     
@@ -0,0 +1,263 @@
+//
+//  WriteBehindActor.hpp
+//  PinkTopaz
+//
+
+#ifndef WriteBehindActor_hpp
+#define WriteBehindActor_hpp
+
+#include "TaskDispatcher.hpp"
+
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+// Saves values to a slow backing store in the background.
+//
+// There is at most one pending value for each key. Storing a value replaces
+// any pending value for the same key, so a key which is stored many times
+// before the actor gets around to it is only written once. Pending values are
+// written in batches on a task dispatcher, in the order given by `Compare', so
+// writes which go to the same place in the backing store are grouped together.
+//
+// Only one batch is written at a time and the actor does not own any threads.
+// Writes of the same key always happen in the same order as the stores.
+//
+// If a write fails then the failure is logged and the value remains pending,
+// unless it has been replaced in the meantime. It is tried again with the next
+// batch, or when the actor is flushed. Values which still fail to write when
+// the actor is destroyed are logged and dropped.
+template<typename KeyType, typename ValueType, typename Compare = std::less<KeyType>>
+class WriteBehindActor
+{
+public:
+    // Writes one value to the backing store.
+    using WriteFunction = std::function<void(const KeyType &key, const ValueType &value)>;
+    
+    // No default constructor.
+    WriteBehindActor() = delete;
+    
+    // Constructor.
+    // log -- The log to which write failures are reported.
+    // dispatcher -- Dispatcher on which batches are written.
+    // write -- Writes one value to the backing store. This is called on the
+    //          dispatcher, or on the thread which calls flush() or storeNow().
+    // compare -- Orders the keys in a batch.
+    WriteBehindActor(std::shared_ptr<spdlog::logger> log,
+                     std::shared_ptr<TaskDispatcher> dispatcher,
+                     WriteFunction write,
+                     Compare compare = Compare())
+     : _state(std::make_shared<State>(std::move(log), std::move(dispatcher), std::move(write), compare))
+    {}
+    
+    // Writes all pending values before returning. Nothing is written after
+    // this returns, so values which fail to write here are dropped.
+    ~WriteBehindActor()
+    {
+        std::scoped_lock writeLock(_state->mutexWrite);
+        writeAllPending(*_state);
+        
+        std::scoped_lock lock(_state->mutex);
+        _state->destroyed = true;
+        if (!_state->pending.empty()) {
+            _state->log->error("WriteBehindActor dropped {} values which failed to write.", _state->pending.size());
+            _state->pending.clear();
+        }
+    }
+    
+    // Queues the value to be written later, replacing any pending value for
+    // the same key.
+    // onWritten -- Called after the value has been written. This is not called
+    //              if the value is replaced before it is written.
+    void store(const KeyType &key, ValueType value, std::function<void()> onWritten = nullptr)
+    {
+        bool mustScheduleBatch = false;
+        {
+            std::scoped_lock lock(_state->mutex);
+            _state->numberOfStoreRequests++;
+            _state->pending.insert_or_assign(key, Entry{std::move(value), std::move(onWritten)});
+            if (!_state->isBatchScheduled) {
+                _state->isBatchScheduled = true;
+                mustScheduleBatch = true;
+            }
+        }
+        
+        if (mustScheduleBatch) {
+            scheduleBatch(_state);
+        }
+    }
+    
+    // Writes the value immediately on the calling thread. Any pending value
+    // for the same key is discarded as this one supersedes it. If a batch
+    // is being written then this waits for that to finish first.
+    void storeNow(const KeyType &key, const ValueType &value)
+    {
+        std::scoped_lock writeLock(_state->mutexWrite);
+        {
+            std::scoped_lock lock(_state->mutex);
+            _state->numberOfStoreRequests++;
+            _state->pending.erase(key);
+        }
+        _state->write(key, value);
+        
+        std::scoped_lock lock(_state->mutex);
+        _state->numberOfWrites++;
+    }
+    
+    // Writes all pending values on the calling thread. If a batch is being
+    // written then this waits for that to finish first. When this returns,
+    // every value stored before the call has been written, or has failed to
+    // write and is still pending.
+    void flush()
+    {
+        std::scoped_lock writeLock(_state->mutexWrite);
+        writeAllPending(*_state);
+    }
+    
+    // Returns the number of calls to store() and storeNow().
+    size_t getNumberOfStoreRequests() const
+    {
+        std::scoped_lock lock(_state->mutex);
+        return _state->numberOfStoreRequests;
+    }
+    
+    // Returns the number of values which have actually been written.
+    size_t getNumberOfWrites() const
+    {
+        std::scoped_lock lock(_state->mutex);
+        return _state->numberOfWrites;
+    }
+    
+    // Returns the number of values waiting to be written.
+    size_t getNumberOfPendingWrites() const
+    {
+        std::scoped_lock lock(_state->mutex);
+        return _state->pending.size();
+    }
+
+private:
+    struct Entry
+    {
+        ValueType value;
+        std::function<void()> onWritten;
+    };
+    
+    using EntryMap = std::map<KeyType, Entry, Compare>;
+    
+    // Tasks on the dispatcher share ownership of the state, so they can run
+    // after the actor has been destroyed. Such a task sees `destroyed' and
+    // returns without calling `write', which may refer to the actor's owner.
+    struct State
+    {
+        std::shared_ptr<spdlog::logger> log;
+        std::shared_ptr<TaskDispatcher> dispatcher;
+        WriteFunction write;
+        
+        // Held while writing so writes are never reordered.
+        std::mutex mutexWrite;
+        
+        // Protects the members below.
+        std::mutex mutex;
+        EntryMap pending;
+        bool isBatchScheduled;
+        bool destroyed;
+        size_t numberOfStoreRequests;
+        size_t numberOfWrites;
+        
+        State(std::shared_ptr<spdlog::logger> log,
+              std::shared_ptr<TaskDispatcher> dispatcher,
+              WriteFunction write,
+              Compare compare)
+         : log(std::move(log)),
+           dispatcher(std::move(dispatcher)),
+           write(std::move(write)),
+           pending(compare),
+           isBatchScheduled(false),
+           destroyed(false),
+           numberOfStoreRequests(0),
+           numberOfWrites(0)
+        {}
+    };
+    
+    std::shared_ptr<State> _state;
+    
+    // Post a task to write the next batch.
+    static void scheduleBatch(const std::shared_ptr<State> &state)
+    {
+        state->dispatcher->dispatch([state]{
+            writeBatch(state);
+        });
+    }
+    
+    // Writes all pending values, and then schedules another batch if more
+    // values were stored in the meantime.
+    static void writeBatch(const std::shared_ptr<State> &state)
+    {
+        size_t numberOfFailures;
+        {
+            std::scoped_lock writeLock(state->mutexWrite);
+            {
+                std::scoped_lock lock(state->mutex);
+                if (state->destroyed) {
+                    return;
+                }
+            }
+            numberOfFailures = writeAllPending(*state);
+        }
+        
+        // Values which failed to write are left for the next batch, so they
+        // do not cause another one to be scheduled on their own.
+        bool mustScheduleBatch;
+        {
+            std::scoped_lock lock(state->mutex);
+            mustScheduleBatch = state->pending.size() > numberOfFailures;
+            state->isBatchScheduled = mustScheduleBatch;
+        }
+        
+        if (mustScheduleBatch) {
+            scheduleBatch(state);
+        }
+    }
+    
+    // Takes all pending values and writes them in order. Values which fail to
+    // write are put back, unless a newer value was stored in the meantime.
+    // Returns the number of values which were put back.
+    // The caller must hold `mutexWrite'.
+    static size_t writeAllPending(State &state)
+    {
+        EntryMap batch(state.pending.key_comp());
+        {
+            std::scoped_lock lock(state.mutex);
+            batch.swap(state.pending);
+        }
+        
+        size_t numberOfWrites = 0;
+        size_t numberOfFailures = 0;
+        for (auto &[key, entry] : batch) {
+            try {
+                state.write(key, entry.value);
+            } catch (const std::exception &exception) {
+                state.log->error("WriteBehindActor failed to write a value: {}", exception.what());
+                std::scoped_lock lock(state.mutex);
+                if (state.pending.try_emplace(key, std::move(entry)).second) {
+                    numberOfFailures++;
+                }
+                continue;
+            }
+            
+            numberOfWrites++;
+            if (entry.onWritten) {
+                entry.onWritten();
+            }
+        }
+        
+        std::scoped_lock lock(state.mutex);
+        state.numberOfWrites += numberOfWrites;
+        return numberOfFailures;
+    }
+};
+
+#endif /* WriteBehindActor_hpp */
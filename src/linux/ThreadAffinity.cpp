@@ -0,0 +1,119 @@
+//
+//  ThreadAffinity.cpp
+//  PinkTopaz
+//
+
+#include "ThreadAffinity.hpp"
+#include "Exception.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Parse a CPU list such as "0-3,8-11" as found in sysfs.
+static std::vector<unsigned> parseCpuList(const std::string &list)
+{
+    std::vector<unsigned> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        try {
+            const unsigned first = (unsigned)std::stoul(range.substr(0, dash));
+            const unsigned last = (dash == std::string::npos) ? first : (unsigned)std::stoul(range.substr(dash + 1));
+            for (unsigned cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::logic_error &) {
+            // Ignore a malformed range.
+        }
+    }
+    return cpus;
+}
+
+// Returns the CPUs in the process's affinity mask.
+static std::vector<unsigned> getAllowedCpus()
+{
+    std::vector<unsigned> cpus;
+    
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    
+    if (cpus.empty()) {
+        const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    
+    return cpus;
+}
+
+CpuTopology getCpuTopology()
+{
+    std::vector<unsigned> remaining = getAllowedCpus();
+    CpuTopology topology;
+    
+    // NUMA nodes are numbered consecutively from zero in sysfs.
+    for (unsigned nodeIndex = 0; !remaining.empty(); ++nodeIndex) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(nodeIndex) + "/cpulist");
+        if (!file) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        
+        std::vector<unsigned> node;
+        for (unsigned cpu : parseCpuList(list)) {
+            auto iter = std::find(remaining.begin(), remaining.end(), cpu);
+            if (iter != remaining.end()) {
+                node.push_back(cpu);
+                remaining.erase(iter);
+            }
+        }
+        if (!node.empty()) {
+            topology.nodes.emplace_back(std::move(node));
+        }
+    }
+    
+    // Any CPUs which sysfs did not tell us about go in a node of their own.
+    if (!remaining.empty()) {
+        topology.nodes.emplace_back(std::move(remaining));
+    }
+    
+    return topology;
+}
+
+bool isThreadAffinitySupported()
+{
+    return true;
+}
+
+void setAffinityForCurrentThread(const std::vector<unsigned> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    
+    int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r != 0) {
+        throw Exception("setAffinityForCurrentThread: error {}", r);
+    }
+}
@@ -0,0 +1,33 @@
+//
+//  ThreadAffinity.cpp
+//  PinkTopaz
+//
+
+#include "ThreadAffinity.hpp"
+#include <algorithm>
+#include <thread>
+
+// macOS does not expose NUMA topology or let us pin threads to CPUs. The
+// scheduler only accepts affinity hints through the thread_policy API, and
+// Apple silicon ignores them, so we do not bother.
+
+CpuTopology getCpuTopology()
+{
+    CpuTopology topology;
+    topology.nodes.emplace_back();
+    const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < n; ++cpu) {
+        topology.nodes.front().push_back(cpu);
+    }
+    return topology;
+}
+
+bool isThreadAffinitySupported()
+{
+    return false;
+}
+
+void setAffinityForCurrentThread(const std::vector<unsigned> &)
+{
+    // nothing to do
+}
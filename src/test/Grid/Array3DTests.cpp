@@ -361,3 +361,85 @@ TEST_CASE("Test Indexing", "[Array3D]") {
     REQUIRE(myArray.reference(index) == 42);
     REQUIRE(myArray.reference(point) == 42);
 }
+
+// Fills the array so that each cell holds a value unique to its coordinates.
+static void fillWithCoordinates(Array3D<int> &array)
+{
+    const ivec3 res = array.gridResolution();
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                array.mutableReference(ivec3(x, y, z)) = (z * res.y + y) * res.x + x;
+            }
+        }
+    }
+}
+
+// Copies one cell at a time, for comparison with `copyCells'.
+static void copyCellsSlowly(Array3D<int> &dst,
+                            const Array3D<int> &src,
+                            const ivec3 &srcOrigin,
+                            const ivec3 &dstOrigin,
+                            const ivec3 &size)
+{
+    for (int z = 0; z < size.z; ++z) {
+        for (int y = 0; y < size.y; ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                const ivec3 offset(x, y, z);
+                dst.mutableReference(dstOrigin + offset) = src.reference(srcOrigin + offset);
+            }
+        }
+    }
+}
+
+TEST_CASE("Test Copy Cells", "[Array3D]") {
+    const AABB srcBox = {vec3(16.f, 16.f, 16.f), vec3(16.f, 16.f, 16.f)};
+    Array3D<int> src(srcBox, ivec3(32, 32, 32));
+    fillWithCoordinates(src);
+    
+    const AABB dstBox = {vec3(18.f, 18.f, 18.f), vec3(18.f, 18.f, 18.f)};
+    
+    // The offset between the boxes determines how large the Morton-contiguous
+    // blocks can be. Check aligned, partially aligned, and unaligned offsets
+    // as well as boxes with ragged edges.
+    const ivec3 srcOrigins[] = {ivec3(0, 0, 0), ivec3(8, 0, 16), ivec3(3, 5, 7), ivec3(1, 2, 0)};
+    const ivec3 dstOrigins[] = {ivec3(0, 0, 0), ivec3(4, 4, 4), ivec3(1, 1, 1), ivec3(2, 2, 2)};
+    const ivec3 sizes[] = {ivec3(32, 32, 32), ivec3(16, 16, 16), ivec3(13, 9, 17), ivec3(1, 1, 1), ivec3(0, 4, 4)};
+    
+    for (const ivec3 &srcOrigin : srcOrigins) {
+        for (const ivec3 &dstOrigin : dstOrigins) {
+            for (const ivec3 &size : sizes) {
+                if (glm::any(glm::greaterThan(srcOrigin + size, ivec3(32, 32, 32)))) {
+                    continue;
+                }
+                
+                Array3D<int> expected(dstBox, ivec3(36, 36, 36));
+                Array3D<int> actual(dstBox, ivec3(36, 36, 36));
+                copyCellsSlowly(expected, src, srcOrigin, dstOrigin, size);
+                actual.copyCells(src, srcOrigin, dstOrigin, size);
+                REQUIRE(expected == actual);
+            }
+        }
+    }
+}
+
+TEST_CASE("Test Fill Cells", "[Array3D]") {
+    const AABB box = {vec3(18.f, 18.f, 18.f), vec3(18.f, 18.f, 18.f)};
+    const ivec3 res(36, 36, 36);
+    Array3D<int> myArray(box, res);
+    
+    const ivec3 origin(3, 0, 9);
+    const ivec3 size(30, 17, 24);
+    myArray.fillCells(42, origin, size);
+    
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                const ivec3 cellCoords(x, y, z);
+                const bool inside = glm::all(glm::greaterThanEqual(cellCoords, origin)) &&
+                                    glm::all(glm::lessThan(cellCoords, origin + size));
+                REQUIRE(myArray.reference(cellCoords) == (inside ? 42 : 0));
+            }
+        }
+    }
+}
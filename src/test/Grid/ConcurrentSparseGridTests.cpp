@@ -0,0 +1,129 @@
+//
+//  ConcurrentSparseGridTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Grid/ConcurrentSparseGrid.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using glm::vec3;
+using glm::ivec3;
+
+static const AABB box = {vec3(32.f, 32.f, 32.f), vec3(32.f, 32.f, 32.f)};
+static const ivec3 res(64, 64, 64);
+
+TEST_CASE("Test Concurrent Sparse Grid Lookup Does Not Insert", "[ConcurrentSparseGrid]") {
+    ConcurrentSparseGrid<int> grid(box, res);
+    REQUIRE_FALSE(grid.get(Morton3(ivec3(1, 2, 3))).is_initialized());
+    REQUIRE(grid.size() == 0);
+}
+
+TEST_CASE("Test Concurrent Sparse Grid Set Get And Remove", "[ConcurrentSparseGrid]") {
+    ConcurrentSparseGrid<int> grid(box, res);
+    const Morton3 key(ivec3(1, 2, 3));
+    
+    grid.set(key, 42);
+    REQUIRE(grid.get(key).is_initialized());
+    REQUIRE(*grid.get(key) == 42);
+    REQUIRE(grid.size() == 1);
+    
+    grid.set(key, 43);
+    REQUIRE(*grid.get(key) == 43);
+    REQUIRE(grid.size() == 1);
+    
+    grid.remove(key);
+    REQUIRE_FALSE(grid.get(key).is_initialized());
+    REQUIRE(grid.size() == 0);
+}
+
+TEST_CASE("Test Concurrent Sparse Grid Grows To Hold Many Elements", "[ConcurrentSparseGrid]") {
+    ConcurrentSparseGrid<int> grid(box, res);
+    
+    for (int z = 0; z < 16; ++z) {
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                grid.set(Morton3(ivec3(x, y, z)), x + y*16 + z*256);
+            }
+        }
+    }
+    REQUIRE(grid.size() == 16*16*16);
+    
+    // Remove every other element, leaving tombstones behind.
+    for (int i = 0; i < 16*16*16; i += 2) {
+        grid.remove(Morton3(i));
+    }
+    REQUIRE(grid.size() == 16*16*16 / 2);
+    
+    for (int z = 0; z < 16; ++z) {
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                const Morton3 key(ivec3(x, y, z));
+                const auto value = grid.get(key);
+                if ((size_t)key % 2 == 0) {
+                    REQUIRE_FALSE(value.is_initialized());
+                } else {
+                    REQUIRE(value.is_initialized());
+                    REQUIRE(*value == x + y*16 + z*256);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Test Concurrent Sparse Grid Get Or Create Does Not Replace", "[ConcurrentSparseGrid]") {
+    ConcurrentSparseGrid<int> grid(box, res);
+    const Morton3 key(ivec3(1, 2, 3));
+    
+    int calls = 0;
+    REQUIRE(grid.getOrCreate(key, [&]{ ++calls; return 1; }) == 1);
+    REQUIRE(grid.getOrCreate(key, [&]{ ++calls; return 2; }) == 1);
+    REQUIRE(calls == 1);
+}
+
+TEST_CASE("Test Concurrent Sparse Grid Get Or Create Leaves Slot Empty On Failure", "[ConcurrentSparseGrid]") {
+    ConcurrentSparseGrid<int> grid(box, res);
+    const Morton3 key(ivec3(1, 2, 3));
+    
+    REQUIRE_THROWS_AS(grid.getOrCreate(key, []() -> int {
+        throw std::runtime_error("failed");
+    }), std::runtime_error);
+    REQUIRE_FALSE(grid.get(key).is_initialized());
+    REQUIRE(grid.getOrCreate(key, []{ return 2; }) == 2);
+}
+
+TEST_CASE("Test Concurrent Sparse Grid Calls The Factory Once Per Key", "[ConcurrentSparseGrid]") {
+    constexpr int numberOfThreads = 8;
+    constexpr int numberOfKeys = 512;
+    
+    ConcurrentSparseGrid<int> grid(box, res);
+    std::atomic<int> calls(0);
+    std::atomic<bool> mismatch(false);
+    
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numberOfThreads; ++t) {
+        threads.emplace_back([&]{
+            for (int i = 0; i < numberOfKeys; ++i) {
+                const int value = grid.getOrCreate(Morton3(i), [&]{
+                    ++calls;
+                    std::this_thread::yield();
+                    return i * 3;
+                });
+                if (value != i * 3) {
+                    mismatch = true;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    
+    REQUIRE_FALSE(mismatch);
+    REQUIRE(calls == numberOfKeys);
+    REQUIRE(grid.size() == numberOfKeys);
+}
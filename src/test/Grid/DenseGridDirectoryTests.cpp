@@ -0,0 +1,100 @@
+//
+//  DenseGridDirectoryTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Grid/DenseGridDirectory.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using glm::vec3;
+using glm::ivec3;
+
+using DenseGrid = ConcurrentSparseGrid<int, DenseGridDirectory<int>>;
+
+// A bounded grid whose resolution is not a power of two, like the chunk grid.
+static const AABB box = {vec3(17.f, 17.f, 17.f), vec3(17.f, 17.f, 17.f)};
+static const ivec3 res(34, 34, 34);
+
+TEST_CASE("Test Dense Grid Lookup Does Not Insert", "[DenseGridDirectory]") {
+    DenseGrid grid(box, res);
+    REQUIRE_FALSE(grid.get(Morton3(ivec3(1, 2, 3))).is_initialized());
+    REQUIRE_FALSE(grid.get(Morton3(ivec3(33, 33, 33))).is_initialized());
+    REQUIRE(grid.size() == 0);
+}
+
+TEST_CASE("Test Dense Grid Set Get And Remove", "[DenseGridDirectory]") {
+    DenseGrid grid(box, res);
+    
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                grid.set(Morton3(ivec3(x, y, z)), x + y*res.x + z*res.x*res.y);
+            }
+        }
+    }
+    REQUIRE(grid.size() == res.x * res.y * res.z);
+    
+    grid.remove(Morton3(ivec3(33, 0, 33)));
+    grid.remove(Morton3(ivec3(33, 0, 33)));
+    REQUIRE(grid.size() == res.x * res.y * res.z - 1);
+    REQUIRE_FALSE(grid.get(Morton3(ivec3(33, 0, 33))).is_initialized());
+    
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                if (ivec3(x, y, z) != ivec3(33, 0, 33)) {
+                    const auto value = grid.get(Morton3(ivec3(x, y, z)));
+                    REQUIRE(value.is_initialized());
+                    REQUIRE(*value == x + y*res.x + z*res.x*res.y);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Test Dense Grid Rejects Keys Outside The Grid", "[DenseGridDirectory]") {
+    DenseGrid grid(box, res);
+    const Morton3 outside(ivec3(64, 64, 64));
+    REQUIRE_FALSE(grid.get(outside).is_initialized());
+    grid.remove(outside);
+    if constexpr (EnableVerboseBoundsChecking) {
+        REQUIRE_THROWS_AS(grid.set(outside, 1), OutOfBoundsException);
+    }
+}
+
+TEST_CASE("Test Dense Grid Calls The Factory Once Per Key", "[DenseGridDirectory]") {
+    constexpr int numberOfThreads = 8;
+    
+    DenseGrid grid(box, res);
+    std::atomic<int> calls(0);
+    std::atomic<bool> mismatch(false);
+    
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numberOfThreads; ++t) {
+        threads.emplace_back([&]{
+            for (int x = 0; x < res.x; ++x) {
+                for (int z = 0; z < res.z; ++z) {
+                    const Morton3 key(ivec3(x, 5, z));
+                    const int value = grid.getOrCreate(key, [&]{
+                        ++calls;
+                        return x * 100 + z;
+                    });
+                    if (value != x * 100 + z) {
+                        mismatch = true;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    
+    REQUIRE_FALSE(mismatch);
+    REQUIRE(calls == res.x * res.z);
+    REQUIRE(grid.size() == res.x * res.z);
+}
@@ -0,0 +1,91 @@
+//
+//  DistanceBucketQueueTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Grid/DistanceBucketQueue.hpp"
+
+#include <vector>
+
+namespace {
+    struct Item
+    {
+        glm::vec3 position;
+        int id;
+    };
+    
+    struct ItemPosition
+    {
+        glm::vec3 operator()(const Item &item) const
+        {
+            return item.position;
+        }
+    };
+    
+    using Queue = DistanceBucketQueue<Item, ItemPosition>;
+    
+    std::vector<int> popAll(Queue &queue)
+    {
+        std::vector<int> ids;
+        while (!queue.empty()) {
+            ids.push_back(queue.pop().id);
+        }
+        return ids;
+    }
+}
+
+TEST_CASE("Test Distance Bucket Queue Pops Nearest First", "[DistanceBucketQueue]") {
+    Queue queue(1.f, glm::vec3(0.f));
+    queue.push(Item{glm::vec3(30.f, 0.f, 0.f), 3});
+    queue.push(Item{glm::vec3(0.f, 10.f, 0.f), 1});
+    queue.push(Item{glm::vec3(0.f, 0.f, 0.f), 0});
+    queue.push(Item{glm::vec3(0.f, 0.f, -20.f), 2});
+    REQUIRE(queue.size() == 4);
+    REQUIRE(popAll(queue) == std::vector<int>{0, 1, 2, 3});
+    REQUIRE(queue.size() == 0);
+}
+
+TEST_CASE("Test Distance Bucket Queue Is FIFO Within A Bucket", "[DistanceBucketQueue]") {
+    Queue queue(8.f, glm::vec3(0.f));
+    queue.push(Item{glm::vec3(5.f, 0.f, 0.f), 0});
+    queue.push(Item{glm::vec3(1.f, 0.f, 0.f), 1});
+    queue.push(Item{glm::vec3(7.f, 0.f, 0.f), 2});
+    REQUIRE(popAll(queue) == std::vector<int>{0, 1, 2});
+}
+
+TEST_CASE("Test Distance Bucket Queue Search Point Moves", "[DistanceBucketQueue]") {
+    Queue queue(1.f, glm::vec3(0.f));
+    for (int i = 0; i < 10; ++i) {
+        queue.push(Item{glm::vec3(10.f * i, 0.f, 0.f), i});
+    }
+    REQUIRE(queue.pop().id == 0);
+    
+    // Items are redistributed for the new search point on the next pop.
+    queue.setSearchPoint(glm::vec3(90.f, 0.f, 0.f));
+    queue.setSearchPoint(glm::vec3(100.f, 0.f, 0.f));
+    REQUIRE(queue.getSearchPoint() == glm::vec3(100.f, 0.f, 0.f));
+    REQUIRE(popAll(queue) == std::vector<int>{9, 8, 7, 6, 5, 4, 3, 2, 1});
+}
+
+TEST_CASE("Test Distance Bucket Queue Push After Pop", "[DistanceBucketQueue]") {
+    Queue queue(1.f, glm::vec3(0.f));
+    queue.push(Item{glm::vec3(5.f, 0.f, 0.f), 1});
+    queue.push(Item{glm::vec3(9.f, 0.f, 0.f), 2});
+    REQUIRE(queue.pop().id == 1);
+    queue.push(Item{glm::vec3(0.f, 0.f, 0.f), 0});
+    REQUIRE(popAll(queue) == std::vector<int>{0, 2});
+}
+
+TEST_CASE("Test Distance Bucket Queue Remove If", "[DistanceBucketQueue]") {
+    Queue queue(1.f, glm::vec3(0.f));
+    for (int i = 0; i < 10; ++i) {
+        queue.push(Item{glm::vec3((float)i, 0.f, 0.f), i});
+    }
+    const size_t numberRemoved = queue.removeIf([](const Item &item){
+        return item.id % 2 == 1;
+    });
+    REQUIRE(numberRemoved == 5);
+    REQUIRE(queue.size() == 5);
+    REQUIRE(popAll(queue) == std::vector<int>{0, 2, 4, 6, 8});
+}
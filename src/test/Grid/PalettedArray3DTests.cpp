@@ -0,0 +1,110 @@
+//
+//  PalettedArray3DTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Grid/PalettedArray3D.hpp"
+
+using glm::vec3;
+using glm::ivec3;
+
+static const AABB box = {vec3(8.f, 8.f, 8.f), vec3(8.f, 8.f, 8.f)};
+static const ivec3 res(16, 16, 16);
+
+TEST_CASE("Test Paletted Array Starts Filled With The Initial Value", "[PalettedArray3D]") {
+    const PalettedArray3D<int> myArray(box, res, 7);
+    REQUIRE(myArray.getPaletteSize() == 1);
+    REQUIRE(myArray.getBitsPerIndex() == 1);
+    REQUIRE(myArray.get(ivec3(0, 0, 0)) == 7);
+    REQUIRE(myArray.get(ivec3(15, 15, 15)) == 7);
+    REQUIRE(myArray.get(vec3(3.5f, 4.5f, 5.5f)) == 7);
+}
+
+TEST_CASE("Test Paletted Array Widens Indices As The Palette Grows", "[PalettedArray3D]") {
+    PalettedArray3D<int> myArray(box, res, 0);
+    
+    for (int value = 1; value < (int)PalettedArray3D<int>::MaxPaletteSize; ++value) {
+        REQUIRE(myArray.set(ivec3(value, value, value), value));
+    }
+    REQUIRE(myArray.getPaletteSize() == PalettedArray3D<int>::MaxPaletteSize);
+    REQUIRE(myArray.getBitsPerIndex() == 4);
+    
+    // Each value survives the widening of the indices.
+    for (int value = 1; value < (int)PalettedArray3D<int>::MaxPaletteSize; ++value) {
+        REQUIRE(myArray.get(ivec3(value, value, value)) == value);
+    }
+    REQUIRE(myArray.get(ivec3(0, 0, 0)) == 0);
+    REQUIRE(myArray.get(ivec3(1, 0, 0)) == 0);
+}
+
+TEST_CASE("Test Paletted Array Refuses Values When The Palette Is Full", "[PalettedArray3D]") {
+    PalettedArray3D<int> myArray(box, res, 0);
+    for (int value = 1; value < (int)PalettedArray3D<int>::MaxPaletteSize; ++value) {
+        REQUIRE(myArray.set(ivec3(value, 0, 0), value));
+    }
+    
+    REQUIRE_FALSE(myArray.set(ivec3(0, 1, 0), 100));
+    REQUIRE(myArray.get(ivec3(0, 1, 0)) == 0);
+    
+    // Values which are already in the palette are still accepted.
+    REQUIRE(myArray.set(ivec3(0, 1, 0), 5));
+    REQUIRE(myArray.get(ivec3(0, 1, 0)) == 5);
+}
+
+TEST_CASE("Test Paletted Array Drops Unused Values When The Palette Is Full", "[PalettedArray3D]") {
+    PalettedArray3D<int> myArray(box, res, 0);
+    
+    // Edit one cell back and forth. Only two values are in use at the end.
+    for (int value = 1; value < (int)PalettedArray3D<int>::MaxPaletteSize; ++value) {
+        REQUIRE(myArray.set(ivec3(1, 2, 3), value));
+    }
+    REQUIRE(myArray.getPaletteSize() == PalettedArray3D<int>::MaxPaletteSize);
+    
+    REQUIRE(myArray.set(ivec3(1, 2, 3), 100));
+    REQUIRE(myArray.getPaletteSize() == 2);
+    REQUIRE(myArray.getBitsPerIndex() == 1);
+    REQUIRE(myArray.get(ivec3(1, 2, 3)) == 100);
+    REQUIRE(myArray.get(ivec3(0, 0, 0)) == 0);
+    REQUIRE(myArray.get(ivec3(15, 15, 15)) == 0);
+}
+
+TEST_CASE("Test Paletted Array Round Trips Through Array3D", "[PalettedArray3D]") {
+    Array3D<int> original(box, res);
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                original.mutableReference(ivec3(x, y, z)) = (x + y + z) % 3;
+            }
+        }
+    }
+    
+    const auto paletted = PalettedArray3D<int>::fromArray(original);
+    REQUIRE(paletted.is_initialized());
+    REQUIRE(paletted->getPaletteSize() == 3);
+    REQUIRE(paletted->getBitsPerIndex() == 2);
+    REQUIRE(paletted->getNumberOfBytes() < res.x * res.y * res.z * sizeof(int) / 8);
+    REQUIRE(paletted->toArray() == original);
+}
+
+TEST_CASE("Test Paletted Array Cannot Hold Too Many Distinct Values", "[PalettedArray3D]") {
+    Array3D<int> original(box, res);
+    for (int x = 0; x < res.x; ++x) {
+        original.mutableReference(ivec3(x, 0, 0)) = x + 1;
+    }
+    REQUIRE_FALSE(PalettedArray3D<int>::fromArray(original).is_initialized());
+}
+
+TEST_CASE("Test Paletted Array Copies Cells Into An Array", "[PalettedArray3D]") {
+    PalettedArray3D<int> src(box, res, 1);
+    src.set(ivec3(2, 3, 4), 2);
+    
+    Array3D<int> dst({vec3(9.f, 9.f, 9.f), vec3(9.f, 9.f, 9.f)}, ivec3(18, 18, 18));
+    src.copyCellsTo(dst, ivec3(0, 0, 0), ivec3(1, 1, 1), res);
+    
+    REQUIRE(dst.reference(ivec3(0, 0, 0)) == 0);
+    REQUIRE(dst.reference(ivec3(1, 1, 1)) == 1);
+    REQUIRE(dst.reference(ivec3(3, 4, 5)) == 2);
+    REQUIRE(dst.reference(ivec3(16, 16, 16)) == 1);
+    REQUIRE(dst.reference(ivec3(17, 17, 17)) == 0);
+}
@@ -0,0 +1,85 @@
+//
+//  RegionMutualExclusionArbitratorTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Grid/RegionMutualExclusionArbitrator.hpp"
+
+#include <mutex>
+
+using glm::vec3;
+
+// Two regions which overlap, and a third which is far away from both.
+static const AABB regionA = {vec3(0.f), vec3(8.f)};
+static const AABB regionB = {vec3(4.f), vec3(8.f)};
+static const AABB regionC = {vec3(100.f), vec3(8.f)};
+
+TEST_CASE("Test Writer Try Lock Fails On Overlapping Region", "[RegionMutualExclusionArbitrator]") {
+    RegionMutualExclusionArbitrator arbitrator;
+    auto mutexA = arbitrator.writerMutex(regionA);
+    auto mutexB = arbitrator.writerMutex(regionB);
+    auto readerB = arbitrator.readerMutex(regionB);
+    
+    std::scoped_lock lock(mutexA);
+    REQUIRE(!mutexB.try_lock());
+    REQUIRE(!readerB.try_lock());
+}
+
+TEST_CASE("Test Writer Try Lock Succeeds On Disjoint Region", "[RegionMutualExclusionArbitrator]") {
+    RegionMutualExclusionArbitrator arbitrator;
+    auto mutexA = arbitrator.writerMutex(regionA);
+    auto mutexC = arbitrator.writerMutex(regionC);
+    
+    std::scoped_lock lock(mutexA);
+    REQUIRE(mutexC.try_lock());
+    mutexC.unlock();
+}
+
+TEST_CASE("Test Readers Share An Overlapping Region", "[RegionMutualExclusionArbitrator]") {
+    RegionMutualExclusionArbitrator arbitrator;
+    auto readerA = arbitrator.readerMutex(regionA);
+    auto readerB = arbitrator.readerMutex(regionB);
+    auto writerB = arbitrator.writerMutex(regionB);
+    
+    std::scoped_lock lock(readerA);
+    REQUIRE(readerB.try_lock());
+    readerB.unlock();
+    REQUIRE(!writerB.try_lock());
+}
+
+TEST_CASE("Test Waiter Is Called Once When The Region Is Unlocked", "[RegionMutualExclusionArbitrator]") {
+    RegionMutualExclusionArbitrator arbitrator;
+    auto mutexA = arbitrator.writerMutex(regionA);
+    auto mutexB = arbitrator.writerMutex(regionB);
+    auto mutexC = arbitrator.writerMutex(regionC);
+    
+    int numberOfCalls = 0;
+    mutexA.lock();
+    mutexB.notifyWhenAvailable([&]{ numberOfCalls++; });
+    REQUIRE(numberOfCalls == 0);
+    
+    // Releasing an unrelated region must not wake the waiter.
+    mutexC.lock();
+    mutexC.unlock();
+    REQUIRE(numberOfCalls == 0);
+    
+    mutexA.unlock();
+    REQUIRE(numberOfCalls == 1);
+    
+    // The waiter was removed when it was called.
+    mutexA.lock();
+    mutexA.unlock();
+    REQUIRE(numberOfCalls == 1);
+}
+
+TEST_CASE("Test Waiter Is Called Immediately When The Region Is Free", "[RegionMutualExclusionArbitrator]") {
+    RegionMutualExclusionArbitrator arbitrator;
+    auto mutexA = arbitrator.writerMutex(regionA);
+    auto mutexC = arbitrator.writerMutex(regionC);
+    
+    int numberOfCalls = 0;
+    std::scoped_lock lock(mutexC);
+    mutexA.notifyWhenAvailable([&]{ numberOfCalls++; });
+    REQUIRE(numberOfCalls == 1);
+}
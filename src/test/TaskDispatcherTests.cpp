@@ -0,0 +1,573 @@
+//
+//  TaskDispatcherTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "TaskDispatcher.hpp"
+
+#include <numeric>
+#include <future>
+#include <algorithm>
+
+static const TaskDispatcher::Scheduling allSchedulingPolicies[] = {
+    TaskDispatcher::SharedQueue,
+    TaskDispatcher::WorkStealing
+};
+
+TEST_CASE("Test Async Returns Result", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        auto future = dispatcher->async([]{ return 42; });
+        REQUIRE(future.get() == 42);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Map Over Range", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        std::vector<int> input(1000);
+        std::iota(input.begin(), input.end(), 0);
+        auto futures = dispatcher->map(input, [](int x){ return x * 2; });
+        REQUIRE(futures.size() == input.size());
+        for (size_t i = 0; i < futures.size(); ++i) {
+            REQUIRE(futures[i].get() == (int)i * 2);
+        }
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Tasks Posted From Worker Threads", "[TaskDispatcher]") {
+    // Each outer task posts inner tasks from the worker thread and then waits
+    // on them. With work stealing, those go onto the worker's own deque and
+    // other workers must steal them for the outer tasks to make progress.
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        std::atomic<int> counter(0);
+        auto outer = dispatcher->map((size_t)2, [&]{
+            auto inner = dispatcher->map((size_t)100, [&]{ counter++; });
+            waitForAll(inner);
+        });
+        waitForAll(outer);
+        REQUIRE(counter == 200);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Flush With Zero Threads", "[TaskDispatcher]") {
+    // A dispatcher with no threads only runs tasks when flushed.
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, TaskDispatcher::WorkStealing);
+    REQUIRE(dispatcher->getScheduling() == TaskDispatcher::SharedQueue);
+    int counter = 0;
+    dispatcher->async([&]{ counter++; });
+    dispatcher->async([&]{ counter++; });
+    REQUIRE(counter == 0);
+    dispatcher->flush();
+    REQUIRE(counter == 2);
+}
+
+TEST_CASE("Test Higher Priority Tasks Run First", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<int> order;
+    dispatcher->async(TaskDispatcher::LowPriority, [&]{ order.push_back(3); });
+    dispatcher->async(TaskDispatcher::NormalPriority, [&]{ order.push_back(2); });
+    dispatcher->async(TaskDispatcher::HighPriority, [&]{ order.push_back(1); });
+    dispatcher->flush();
+    REQUIRE(order == std::vector<int>{1, 2, 3});
+}
+
+TEST_CASE("Test Starvation Guard", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<int> order;
+    dispatcher->async(TaskDispatcher::NormalPriority, [&]{ order.push_back(2); });
+    for (int i = 0; i < 20; ++i) {
+        dispatcher->async(TaskDispatcher::HighPriority, [&]{ order.push_back(1); });
+    }
+    dispatcher->flush();
+    
+    // The normal priority task is passed over no more than StarvationLimit
+    // times before it gets a turn.
+    auto iter = std::find(order.begin(), order.end(), 2);
+    REQUIRE(iter != order.end());
+    REQUIRE(std::distance(order.begin(), iter) == TaskDispatcher::StarvationLimit);
+}
+
+TEST_CASE("Test Deadlines", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    const auto now = TaskDispatcher::Clock::now();
+    std::vector<int> order;
+    
+    // Tasks with a deadline go ahead of others in the same lane, earliest
+    // deadline first.
+    dispatcher->async(TaskDispatcher::NormalPriority, [&]{ order.push_back(4); });
+    dispatcher->async(TaskDispatcher::NormalPriority, now + std::chrono::hours(2), [&]{ order.push_back(3); });
+    dispatcher->async(TaskDispatcher::NormalPriority, now + std::chrono::hours(1), [&]{ order.push_back(2); });
+    
+    // A task whose deadline has passed goes ahead of every lane.
+    dispatcher->async(TaskDispatcher::HighPriority, [&]{ order.push_back(1); });
+    dispatcher->async(TaskDispatcher::LowPriority, now, [&]{ order.push_back(0); });
+    
+    dispatcher->flush();
+    REQUIRE(order == std::vector<int>{0, 1, 2, 3, 4});
+}
+
+TEST_CASE("Test Spawned Tasks Inherit Priority", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2, scheduling);
+        REQUIRE(dispatcher->getDefaultPriority() == TaskDispatcher::NormalPriority);
+        auto future = dispatcher->async(TaskDispatcher::HighPriority, [&]{
+            return dispatcher->getDefaultPriority();
+        });
+        REQUIRE(future.get() == TaskDispatcher::HighPriority);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Shutdown From Worker Thread", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2, scheduling);
+        auto future = dispatcher->async([dispatcher]{
+            dispatcher->shutdown();
+            return dispatcher->isShutdown();
+        });
+        REQUIRE(future.get());
+    }
+}
+
+TEST_CASE("Test Dispatch", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        std::atomic<int> counter(0);
+        std::promise<void> done;
+        for (int i = 0; i < 1000; ++i) {
+            dispatcher->dispatch([&]{
+                if (++counter == 1000) {
+                    done.set_value();
+                }
+            });
+        }
+        done.get_future().wait();
+        REQUIRE(counter == 1000);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Dispatch Large Function Object", "[TaskDispatcher]") {
+    // This is too large to be stored inline in the task node.
+    std::array<int, 256> values;
+    std::iota(values.begin(), values.end(), 0);
+    
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    int sum = 0;
+    dispatcher->dispatch([&sum, values]{
+        sum = std::accumulate(values.begin(), values.end(), 0);
+    });
+    dispatcher->flush();
+    REQUIRE(sum == 255 * 256 / 2);
+}
+
+TEST_CASE("Test Shutdown Breaks Promises", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    auto future = dispatcher->async([]{ return 42; });
+    dispatcher->shutdown();
+    REQUIRE_THROWS_AS(future.get(), BrokenPromiseException);
+}
+
+TEST_CASE("Test Then", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2, scheduling);
+        auto future = dispatcher->async([]{ return 20; })
+                                .then([](int x){ return x + 1; })
+                                .then([](int x){ return x * 2; });
+        REQUIRE(future.get() == 42);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Then Void", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    std::atomic<int> counter(0);
+    auto future = dispatcher->async([&]{ counter++; })
+                            .then([&]{ counter++; return counter.load(); });
+    REQUIRE(future.get() == 2);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Then On Another Dispatcher", "[TaskDispatcher]") {
+    // The continuation runs on the main thread dispatcher, which only runs
+    // tasks when flushed. Nothing waits on the first task in the meantime.
+    auto mainThreadDispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 1);
+    auto future = dispatcher->async([]{ return 41; })
+                            .then(mainThreadDispatcher, [](int x){ return x + 1; });
+    
+    // The pool's only thread must be free while the continuation is pending.
+    REQUIRE(dispatcher->async([]{ return 7; }).get() == 7);
+    
+    while (!future.isReady()) {
+        mainThreadDispatcher->flush();
+    }
+    REQUIRE(future.get() == 42);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Then Passes Exceptions Along", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    bool called = false;
+    auto future = dispatcher->async([]() -> int { throw BrokenPromiseException(); })
+                            .then([&](int x){ called = true; return x; });
+    REQUIRE_THROWS_AS(future.get(), BrokenPromiseException);
+    REQUIRE(!called);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test When All", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        std::vector<int> input(100);
+        std::iota(input.begin(), input.end(), 0);
+        auto futures = dispatcher->map(input, [](int x){ return x * 2; });
+        auto all = whenAll(futures);
+        REQUIRE(futures.empty());
+        const std::vector<int> results = all.get();
+        REQUIRE(results.size() == input.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            REQUIRE(results[i] == (int)i * 2);
+        }
+        
+        futures = dispatcher->map(input, [](int x){ return x * 2; });
+        auto sum = whenAll(futures).then([](std::vector<int> results){
+            return std::accumulate(results.begin(), results.end(), 0);
+        });
+        REQUIRE(sum.get() == 99 * 100);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test When All Void", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4);
+    std::atomic<int> counter(0);
+    auto futures = dispatcher->map((size_t)100, [&]{ counter++; });
+    whenAll(futures).get();
+    REQUIRE(counter == 100);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test When Any", "[TaskDispatcher]") {
+    auto mainThreadDispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<Future<int>> futures;
+    futures.emplace_back(mainThreadDispatcher->async([]{ return 10; }));
+    futures.emplace_back(mainThreadDispatcher->async([]{ return 11; }));
+    auto any = whenAny(futures);
+    REQUIRE(!any.isReady());
+    mainThreadDispatcher->flush();
+    REQUIRE(any.get() == std::make_pair((size_t)0, 10));
+}
+
+TEST_CASE("Test Parallel For", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        for (size_t grainSize : {0, 1, 7, 5000}) {
+            std::vector<int> visits(1000, 0);
+            dispatcher->parallelFor(10, visits.size(), [&](size_t i){
+                visits[i]++;
+            }, grainSize);
+            for (size_t i = 0; i < visits.size(); ++i) {
+                REQUIRE(visits[i] == (i < 10 ? 0 : 1));
+            }
+        }
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Parallel For Over Blocks", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4);
+    std::vector<std::vector<int>> blocks(50);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i].resize(i, (int)i);
+    }
+    std::atomic<int> sum(0);
+    dispatcher->parallelFor(blocks, [&](int x){ sum += x; });
+    int expected = 0;
+    for (int i = 0; i < 50; ++i) {
+        expected += i * i;
+    }
+    REQUIRE(sum == expected);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Parallel Reduce", "[TaskDispatcher]") {
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, scheduling);
+        const uint64_t sum = dispatcher->parallelReduce(0, 100000, (uint64_t)0,
+                                                        [](size_t i){ return (uint64_t)i; },
+                                                        std::plus<uint64_t>());
+        REQUIRE(sum == (uint64_t)99999 * 100000 / 2);
+        
+        // The blocks are combined in order so the reduction need not be
+        // commutative.
+        const std::string digits = dispatcher->parallelReduce(0, 10, std::string(),
+                                                              [](size_t i){ return std::to_string(i); },
+                                                              std::plus<std::string>(), 1);
+        REQUIRE(digits == "0123456789");
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Parallel For Nested In Workers", "[TaskDispatcher]") {
+    // Every worker is busy with a task which itself calls parallelFor(), and
+    // the inner loops call parallelFor() again. None of this may deadlock.
+    for (auto scheduling : allSchedulingPolicies) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2, scheduling);
+        std::atomic<int> counter(0);
+        auto outer = dispatcher->map((size_t)4, [&]{
+            dispatcher->parallelFor(0, 10, [&](size_t){
+                dispatcher->parallelFor(0, 10, [&](size_t){ counter++; });
+            });
+        });
+        waitForAll(outer);
+        REQUIRE(counter == 400);
+        dispatcher->shutdown();
+    }
+}
+
+TEST_CASE("Test Parallel For With Zero Threads", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    int counter = 0;
+    dispatcher->parallelFor(0, 100, [&](size_t){ counter++; });
+    REQUIRE(counter == 100);
+}
+
+TEST_CASE("Test Parallel For Rethrows Exceptions", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4);
+    REQUIRE_THROWS_AS(dispatcher->parallelFor(0, 1000, [](size_t i){
+        if (i == 500) {
+            throw Exception("failed");
+        }
+    }), Exception);
+    
+    // The dispatcher is still usable afterward.
+    std::atomic<int> counter(0);
+    dispatcher->parallelFor(0, 1000, [&](size_t){ counter++; });
+    REQUIRE(counter == 1000);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Cancellation Token", "[TaskDispatcher]") {
+    CancellationToken none;
+    none.cancel();
+    REQUIRE(!none.isCancelled());
+    REQUIRE_NOTHROW(none.throwIfCancelled());
+    
+    CancellationToken token = CancellationToken::create();
+    CancellationToken copy = token;
+    REQUIRE(!copy.isCancelled());
+    token.cancel();
+    REQUIRE(copy.isCancelled());
+    REQUIRE_THROWS_AS(copy.throwIfCancelled(), CancelledException);
+}
+
+TEST_CASE("Test Async With Cancellation Token", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    
+    CancellationToken token = CancellationToken::create();
+    bool didRun = false;
+    auto cancelled = dispatcher->async(token, [&]{ didRun = true; });
+    auto notCancelled = dispatcher->async(CancellationToken::create(), []{ return 42; });
+    token.cancel();
+    dispatcher->flush();
+    
+    REQUIRE(!didRun);
+    REQUIRE_THROWS_AS(cancelled.get(), CancelledException);
+    REQUIRE(notCancelled.get() == 42);
+}
+
+TEST_CASE("Test Cancelling A Running Task", "[TaskDispatcher]") {
+    // The task polls the token and stops early once it has been cancelled.
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    CancellationToken token = CancellationToken::create();
+    std::promise<void> started;
+    auto future = dispatcher->async(TaskDispatcher::NormalPriority, token, [&, token]{
+        started.set_value();
+        while (true) {
+            token.throwIfCancelled();
+            std::this_thread::yield();
+        }
+    });
+    started.get_future().wait();
+    token.cancel();
+    REQUIRE_THROWS_AS(future.get(), CancelledException);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Promise", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    
+    Promise<int> promise;
+    auto future = promise.getFuture(dispatcher).then([](int value){
+        return value + 1;
+    });
+    REQUIRE(!future.isReady());
+    
+    promise.setValue(41);
+    dispatcher->flush();
+    REQUIRE(future.get() == 42);
+}
+
+TEST_CASE("Test Promise Set Result Of", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    
+    Promise<void> promise;
+    auto future = promise.getFuture(dispatcher);
+    promise.setResultOf([]{
+        throw CancelledException();
+    });
+    REQUIRE_THROWS_AS(future.get(), CancelledException);
+}
+
+TEST_CASE("Test Broken Promise", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    
+    auto promise = std::make_unique<Promise<int>>();
+    auto future = promise->getFuture(dispatcher);
+    promise.reset();
+    REQUIRE_THROWS_AS(future.get(), BrokenPromiseException);
+}
+
+TEST_CASE("Test Promise Fulfilled From Another Thread", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    
+    Promise<int> promise;
+    auto future = promise.getFuture(dispatcher).then([](int value){
+        return value * 2;
+    });
+    std::thread thread([promise=std::move(promise)]() mutable {
+        promise.setValue(21);
+    });
+    REQUIRE(future.get() == 42);
+    thread.join();
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Inbox Runs Tasks In Order", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, TaskDispatcher::Inbox);
+    REQUIRE(dispatcher->getScheduling() == TaskDispatcher::Inbox);
+    
+    std::vector<int> order;
+    for (int i = 0; i < 100; ++i) {
+        dispatcher->dispatch([&order, i]{ order.push_back(i); });
+    }
+    REQUIRE(dispatcher->getNumberOfPendingTasks() == 100);
+    dispatcher->flush();
+    
+    REQUIRE(dispatcher->getNumberOfPendingTasks() == 0);
+    REQUIRE(order.size() == 100);
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(order[i] == i);
+    }
+}
+
+TEST_CASE("Test Inbox Honors Priorities", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, TaskDispatcher::Inbox);
+    
+    std::vector<int> order;
+    dispatcher->dispatch(TaskDispatcher::LowPriority, [&]{ order.push_back(2); });
+    dispatcher->dispatch(TaskDispatcher::NormalPriority, [&]{ order.push_back(1); });
+    dispatcher->dispatch(TaskDispatcher::HighPriority, [&]{ order.push_back(0); });
+    dispatcher->flush();
+    
+    REQUIRE(order == std::vector<int>{0, 1, 2});
+}
+
+TEST_CASE("Test Inbox Requires Zero Threads", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2, TaskDispatcher::Inbox);
+    REQUIRE(dispatcher->getScheduling() == TaskDispatcher::SharedQueue);
+    REQUIRE(dispatcher->async([]{ return 42; }).get() == 42);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Flush Budget Rolls Over", "[TaskDispatcher]") {
+    for (auto scheduling : {TaskDispatcher::SharedQueue, TaskDispatcher::Inbox}) {
+        auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, scheduling);
+        
+        size_t counter = 0;
+        for (int i = 0; i < 10; ++i) {
+            dispatcher->dispatch([&]{
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                counter++;
+            });
+        }
+        
+        // At least one task runs even with no budget at all.
+        REQUIRE(dispatcher->flush(std::chrono::milliseconds(0)) == 1);
+        REQUIRE(counter == 1);
+        REQUIRE(dispatcher->getNumberOfPendingTasks() == 9);
+        
+        const size_t numberRun = dispatcher->flush(std::chrono::milliseconds(5));
+        REQUIRE(numberRun >= 1);
+        REQUIRE(numberRun < 9);
+        REQUIRE(dispatcher->getNumberOfPendingTasks() == 9 - numberRun);
+        
+        dispatcher->flush();
+        REQUIRE(counter == 10);
+        REQUIRE(dispatcher->getNumberOfPendingTasks() == 0);
+    }
+}
+
+TEST_CASE("Test Inbox With Many Producers", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, TaskDispatcher::Inbox);
+    constexpr size_t numProducers = 4;
+    constexpr size_t numTasksPerProducer = 10000;
+    
+    // Tasks from each producer must run in the order that producer posted
+    // them.
+    std::array<size_t, numProducers> next{};
+    bool inOrder = true;
+    size_t counter = 0;
+    
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i < numProducers; ++i) {
+        producers.emplace_back([&, i]{
+            for (size_t j = 0; j < numTasksPerProducer; ++j) {
+                dispatcher->dispatch([&, i, j]{
+                    inOrder = inOrder && (next[i] == j);
+                    next[i] = j + 1;
+                    counter++;
+                });
+            }
+        });
+    }
+    while (counter < numProducers * numTasksPerProducer) {
+        dispatcher->flush(std::chrono::milliseconds(1));
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    
+    REQUIRE(inOrder);
+    REQUIRE(dispatcher->getNumberOfPendingTasks() == 0);
+}
+
+TEST_CASE("Test Inbox Shutdown Breaks Promises", "[TaskDispatcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0, TaskDispatcher::Inbox);
+    auto future = dispatcher->async([]{ return 42; });
+    dispatcher->shutdown();
+    REQUIRE_THROWS_AS(future.get(), BrokenPromiseException);
+    
+    auto late = dispatcher->async([]{ return 42; });
+    REQUIRE_THROWS_AS(late.get(), BrokenPromiseException);
+}
+
+TEST_CASE("Test Worker Start Hook", "[TaskDispatcher]") {
+    std::mutex mutex;
+    std::vector<unsigned> indices;
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4, TaskDispatcher::SharedQueue, [&](unsigned index){
+        std::scoped_lock lock(mutex);
+        indices.push_back(index);
+    });
+    dispatcher->shutdown();
+    
+    std::sort(indices.begin(), indices.end());
+    REQUIRE(indices == std::vector<unsigned>{0, 1, 2, 3});
+}
@@ -0,0 +1,305 @@
+//
+//  IncrementalLightPropagationTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/IncrementalLightPropagation.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+using glm::ivec3;
+using glm::vec3;
+
+// A small world of 2x2x2 chunks held in memory.
+using Chunks = std::vector<std::unique_ptr<VoxelDataChunk>>;
+
+static constexpr int chunkSize = 32;
+static constexpr int worldSize = 2 * chunkSize;
+static const GridIndexer voxelIndexer(AABB{vec3(worldSize / 2.f), vec3(worldSize / 2.f)}, ivec3(worldSize));
+static const GridIndexer chunkIndexer(AABB{vec3(worldSize / 2.f), vec3(worldSize / 2.f)}, ivec3(2));
+
+// A torch light emitter which is placed when the world is created.
+static const ivec3 torchCellCoords(20, 24, 20);
+
+static VoxelDataChunk* chunkAt(Chunks &chunks, const ivec3 &chunkCellCoords)
+{
+    return chunks[chunkCellCoords.x + chunkCellCoords.y * 2 + chunkCellCoords.z * 4].get();
+}
+
+static Voxel getVoxel(Chunks &chunks, const ivec3 &cellCoords)
+{
+    const ivec3 chunkCellCoords = cellCoords / chunkSize;
+    return chunkAt(chunks, chunkCellCoords)->get(cellCoords - chunkCellCoords * chunkSize);
+}
+
+static void setVoxel(Chunks &chunks, const ivec3 &cellCoords, const Voxel &value)
+{
+    const ivec3 chunkCellCoords = cellCoords / chunkSize;
+    chunkAt(chunks, chunkCellCoords)->set(cellCoords - chunkCellCoords * chunkSize, value);
+}
+
+// Makes a world of sky, with the torch, and without any lighting.
+static Chunks makeChunks()
+{
+    Chunks chunks;
+    for (int i = 0; i < 8; ++i) {
+        const ivec3 chunkCellCoords(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        auto chunk = VoxelDataChunk::createSkyChunk(chunkIndexer.cellAtCellCoords(chunkCellCoords), ivec3(chunkSize));
+        chunk.convertToArray();
+        chunks.push_back(std::make_unique<VoxelDataChunk>(std::move(chunk)));
+    }
+    const ivec3 chunkCellCoords = torchCellCoords / chunkSize;
+    chunkAt(chunks, chunkCellCoords)->setEmitter(torchCellCoords - chunkCellCoords * chunkSize, MAX_LIGHT);
+    return chunks;
+}
+
+// Computes lighting for the whole world from scratch, following the same
+// rules as initial sunlight propagation.
+static std::vector<Voxel> computeReferenceLighting(Chunks &chunks)
+{
+    auto index = [](const ivec3 &c){
+        return (size_t)(c.x + c.y * worldSize + c.z * worldSize * worldSize);
+    };
+    
+    std::vector<Voxel> voxels(worldSize * worldSize * worldSize);
+    for (int z = 0; z < worldSize; ++z) {
+        for (int y = 0; y < worldSize; ++y) {
+            for (int x = 0; x < worldSize; ++x) {
+                voxels[index(ivec3(x, y, z))] = Voxel(getVoxel(chunks, ivec3(x, y, z)).value, 0, 0);
+            }
+        }
+    }
+    
+    static const ivec3 deltas[] = {
+        ivec3(-1, 0, 0), ivec3(+1, 0, 0),
+        ivec3(0, 0, -1), ivec3(0, 0, +1),
+        ivec3(0, -1, 0), ivec3(0, +1, 0)
+    };
+    
+    // Sunlight falls from the top of the world, and never flows upward.
+    std::vector<ivec3> queue;
+    for (int z = 0; z < worldSize; ++z) {
+        for (int x = 0; x < worldSize; ++x) {
+            Voxel &voxel = voxels[index(ivec3(x, worldSize - 1, z))];
+            if (voxel.value == 0) {
+                voxel.sunLight = MAX_LIGHT;
+                queue.push_back(ivec3(x, worldSize - 1, z));
+            }
+        }
+    }
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const unsigned light = voxels[index(queue[i])].sunLight;
+        for (int k = 0; k < 5; ++k) {
+            const ivec3 neighborCellCoords = queue[i] + deltas[k];
+            if (!voxelIndexer.inbounds(neighborCellCoords)) {
+                continue;
+            }
+            Voxel &neighbor = voxels[index(neighborCellCoords)];
+            const unsigned received = (deltas[k].y < 0 && light == MAX_LIGHT) ? MAX_LIGHT : light - 1;
+            if (neighbor.value == 0 && received > neighbor.sunLight) {
+                neighbor.sunLight = received;
+                queue.push_back(neighborCellCoords);
+            }
+        }
+    }
+    
+    // Torch light flows in all directions from every emitter.
+    queue.clear();
+    for (int i = 0; i < 8; ++i) {
+        const ivec3 chunkCellCoords(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        for (const LightEmitter &emitter : chunkAt(chunks, chunkCellCoords)->getEmitters()) {
+            const ivec3 cellCoords = chunkCellCoords * chunkSize + ivec3(emitter.x, emitter.y, emitter.z);
+            Voxel &voxel = voxels[index(cellCoords)];
+            REQUIRE(voxel.value == 0);
+            voxel.torchLight = std::max((unsigned)voxel.torchLight, (unsigned)emitter.light);
+            queue.push_back(cellCoords);
+        }
+    }
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const unsigned light = voxels[index(queue[i])].torchLight;
+        for (const ivec3 &delta : deltas) {
+            const ivec3 neighborCellCoords = queue[i] + delta;
+            if (!voxelIndexer.inbounds(neighborCellCoords)) {
+                continue;
+            }
+            Voxel &neighbor = voxels[index(neighborCellCoords)];
+            if (neighbor.value == 0 && light - 1 > neighbor.torchLight) {
+                neighbor.torchLight = light - 1;
+                queue.push_back(neighborCellCoords);
+            }
+        }
+    }
+    
+    return voxels;
+}
+
+// Replaces the lighting of the world with the reference lighting.
+static void relightFromScratch(Chunks &chunks)
+{
+    const std::vector<Voxel> voxels = computeReferenceLighting(chunks);
+    for (int z = 0; z < worldSize; ++z) {
+        for (int y = 0; y < worldSize; ++y) {
+            for (int x = 0; x < worldSize; ++x) {
+                setVoxel(chunks, ivec3(x, y, z), voxels[x + y * worldSize + z * worldSize * worldSize]);
+            }
+        }
+    }
+}
+
+// Returns the number of voxels whose lighting does not match the reference
+// lighting.
+static size_t countMismatchedVoxels(Chunks &chunks)
+{
+    const std::vector<Voxel> voxels = computeReferenceLighting(chunks);
+    size_t count = 0;
+    for (int z = 0; z < worldSize; ++z) {
+        for (int y = 0; y < worldSize; ++y) {
+            for (int x = 0; x < worldSize; ++x) {
+                const Voxel expected = voxels[x + y * worldSize + z * worldSize * worldSize];
+                const Voxel actual = getVoxel(chunks, ivec3(x, y, z));
+                if (expected.value != actual.value) {
+                    count++;
+                } else if (expected.value == 0 && expected != actual) {
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+static AABB editVoxel(Chunks &chunks, const ivec3 &cellCoords, bool value)
+{
+    IncrementalLightPropagation lighting(voxelIndexer, chunkIndexer, [&](const ivec3 &chunkCellCoords){
+        return chunkAt(chunks, chunkCellCoords);
+    });
+    const vec3 point = voxelIndexer.cellCenterAtCellCoords(cellCoords);
+    return lighting.editVoxel(point, Voxel(value));
+}
+
+static AABB editEmitters(Chunks &chunks, const std::vector<std::pair<ivec3, unsigned>> &emitters)
+{
+    IncrementalLightPropagation lighting(voxelIndexer, chunkIndexer, [&](const ivec3 &chunkCellCoords){
+        return chunkAt(chunks, chunkCellCoords);
+    });
+    std::vector<IncrementalLightPropagation::EmitterEdit> edits;
+    for (const auto &[cellCoords, light] : emitters) {
+        edits.push_back({voxelIndexer.cellCenterAtCellCoords(cellCoords), light});
+    }
+    return lighting.editEmitters(edits);
+}
+
+TEST_CASE("Test Incremental Lighting Shades The Column Below A New Block", "[IncrementalLightPropagation]") {
+    Chunks chunks = makeChunks();
+    for (int z = 0; z < worldSize; ++z) {
+        for (int x = 0; x < worldSize; ++x) {
+            setVoxel(chunks, ivec3(x, 0, z), Voxel(true));
+        }
+    }
+    relightFromScratch(chunks);
+    REQUIRE(getVoxel(chunks, ivec3(30, 1, 30)).sunLight == MAX_LIGHT);
+    
+    const AABB modified = editVoxel(chunks, ivec3(30, 40, 30), true);
+    REQUIRE(countMismatchedVoxels(chunks) == 0);
+    REQUIRE(getVoxel(chunks, ivec3(30, 1, 30)).sunLight == MAX_LIGHT - 1);
+    
+    // Changes reach all the way down, but not far to the side.
+    REQUIRE(modified.mins().y <= 1.f);
+    REQUIRE(modified.maxs().x <= 31.f + MAX_LIGHT);
+    
+    editVoxel(chunks, ivec3(30, 40, 30), false);
+    REQUIRE(countMismatchedVoxels(chunks) == 0);
+    REQUIRE(getVoxel(chunks, ivec3(30, 1, 30)).sunLight == MAX_LIGHT);
+}
+
+TEST_CASE("Test Incremental Lighting Matches Lighting From Scratch", "[IncrementalLightPropagation]") {
+    Chunks chunks = makeChunks();
+    
+    // Rolling ground, a floating slab to cast a shadow, and scattered blocks.
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> coordinate(0, worldSize - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    for (int z = 0; z < worldSize; ++z) {
+        for (int y = 0; y < worldSize; ++y) {
+            for (int x = 0; x < worldSize; ++x) {
+                const bool ground = y < 12 + (x * z) % 7;
+                const bool slab = y >= 40 && y < 42 && x > 10 && x < 50 && z > 5 && z < 40;
+                const bool scattered = percent(generator) < 5;
+                const bool solid = (ground || slab || scattered) && ivec3(x, y, z) != torchCellCoords;
+                setVoxel(chunks, ivec3(x, y, z), Voxel(solid));
+            }
+        }
+    }
+    relightFromScratch(chunks);
+    
+    for (int i = 0; i < 40; ++i) {
+        const ivec3 cellCoords(coordinate(generator), coordinate(generator), coordinate(generator));
+        editVoxel(chunks, cellCoords, percent(generator) < 50);
+        REQUIRE(countMismatchedVoxels(chunks) == 0);
+    }
+}
+
+TEST_CASE("Test Incremental Lighting Removes The Emitter In A New Block", "[IncrementalLightPropagation]") {
+    Chunks chunks = makeChunks();
+    relightFromScratch(chunks);
+    REQUIRE(getVoxel(chunks, torchCellCoords).torchLight == MAX_LIGHT);
+    REQUIRE(getVoxel(chunks, torchCellCoords + ivec3(3, 0, 0)).torchLight == MAX_LIGHT - 3);
+    
+    editVoxel(chunks, torchCellCoords, true);
+    REQUIRE(countMismatchedVoxels(chunks) == 0);
+    REQUIRE(getVoxel(chunks, torchCellCoords + ivec3(3, 0, 0)).torchLight == 0);
+    
+    editVoxel(chunks, torchCellCoords, false);
+    REQUIRE(countMismatchedVoxels(chunks) == 0);
+    REQUIRE(getVoxel(chunks, torchCellCoords).torchLight == 0);
+}
+
+TEST_CASE("Test Incremental Lighting Matches Lighting From Scratch For Emitters", "[IncrementalLightPropagation]") {
+    Chunks chunks = makeChunks();
+    
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> coordinate(0, worldSize - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<unsigned> light(0, MAX_LIGHT);
+    for (int z = 0; z < worldSize; ++z) {
+        for (int y = 0; y < worldSize; ++y) {
+            for (int x = 0; x < worldSize; ++x) {
+                const bool ground = y < 12 + (x * z) % 7;
+                const bool scattered = percent(generator) < 10;
+                const bool solid = (ground || scattered) && ivec3(x, y, z) != torchCellCoords;
+                setVoxel(chunks, ivec3(x, y, z), Voxel(solid));
+            }
+        }
+    }
+    relightFromScratch(chunks);
+    
+    // Place, dim, brighten, and remove emitters in batches of varying size.
+    // Emitters are placed close together so their light overlaps.
+    std::uniform_int_distribution<int> nearby(10, 40);
+    std::vector<ivec3> placed;
+    for (int i = 0; i < 30; ++i) {
+        std::vector<std::pair<ivec3, unsigned>> edits;
+        const int numberOfEdits = 1 + percent(generator) % 20;
+        for (int j = 0; j < numberOfEdits; ++j) {
+            if (!placed.empty() && percent(generator) < 40) {
+                edits.emplace_back(placed[percent(generator) % placed.size()], light(generator));
+            } else {
+                const ivec3 cellCoords(nearby(generator), nearby(generator), nearby(generator));
+                edits.emplace_back(cellCoords, light(generator));
+                placed.push_back(cellCoords);
+            }
+        }
+        editEmitters(chunks, edits);
+        REQUIRE(countMismatchedVoxels(chunks) == 0);
+        
+        // Blocks placed on emitters remove them.
+        if (i % 5 == 0) {
+            editVoxel(chunks, placed[percent(generator) % placed.size()], true);
+            REQUIRE(countMismatchedVoxels(chunks) == 0);
+        }
+    }
+}
@@ -0,0 +1,211 @@
+//
+//  InitialSunlightPropagationOperationTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/InitialSunlightPropagationOperation.hpp"
+#include "Grid/GridIndexerRange.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+using glm::ivec3;
+using glm::vec3;
+
+using Operation = InitialSunlightPropagationOperation;
+
+// A small world of 9x2x3 chunks, which is nine columns of chunks wide, three
+// columns deep, and two chunks tall.
+using Chunks = std::vector<VoxelDataChunk>;
+
+static constexpr int chunkSize = TERRAIN_CHUNK_SIZE;
+static const ivec3 worldSizeInChunks(9, 2, 3);
+static const ivec3 worldResolution = worldSizeInChunks * chunkSize;
+static const AABB worldBoundingBox{vec3(worldResolution) / 2.f, vec3(worldResolution) / 2.f};
+static const GridIndexer chunkIndexer(worldBoundingBox, worldSizeInChunks);
+
+// Returns the region which covers the specified columns of chunks, from the
+// bottom of the world to the top.
+// minColumnCoords -- The X and Z coordinates of the first column.
+// maxColumnCoords -- The X and Z coordinates of the last column, exclusive.
+static AABB regionOfColumns(const ivec3 &minColumnCoords, const ivec3 &maxColumnCoords)
+{
+    const vec3 mins(minColumnCoords.x * chunkSize, 0.f, minColumnCoords.z * chunkSize);
+    const vec3 maxs(maxColumnCoords.x * chunkSize, worldResolution.y, maxColumnCoords.z * chunkSize);
+    return AABB{(maxs + mins) / 2.f, (maxs - mins) / 2.f};
+}
+
+static const VoxelDataChunk& chunkAt(const Chunks &chunks, const ivec3 &chunkCellCoords)
+{
+    return chunks[chunkCellCoords.x + (chunkCellCoords.z + chunkCellCoords.y * worldSizeInChunks.z) * worldSizeInChunks.x];
+}
+
+// Makes unlit terrain from the seed. A roof with holes in it covers the
+// ground, so light under the roof has to spread sideways from the holes, and
+// often from a neighboring column. Slabs float above the roof in every other
+// column of chunks, so the top chunks of the remaining columns are sky.
+static Chunks makeTerrain(unsigned seed)
+{
+    const ivec3 res = worldResolution;
+    std::vector<bool> solid(res.x * res.y * res.z, false);
+    auto fill = [&](const ivec3 &mins, const ivec3 &maxs, bool value){
+        for (int z = mins.z; z < std::min(maxs.z, res.z); ++z) {
+            for (int y = mins.y; y < std::min(maxs.y, res.y); ++y) {
+                for (int x = mins.x; x < std::min(maxs.x, res.x); ++x) {
+                    solid[x + (z + y * res.z) * res.x] = value;
+                }
+            }
+        }
+    };
+    
+    std::mt19937 rng(seed);
+    
+    constexpr int step = 4;
+    std::uniform_int_distribution<int> groundHeight(2, 14);
+    for (int z = 0; z < res.z; z += step) {
+        for (int x = 0; x < res.x; x += step) {
+            fill(ivec3(x, 0, z), ivec3(x + step, groundHeight(rng), z + step), true);
+        }
+    }
+    
+    constexpr int roofBottom = 22, roofTop = 24;
+    constexpr int numberOfHoles = 150;
+    fill(ivec3(0, roofBottom, 0), ivec3(res.x, roofTop, res.z), true);
+    std::uniform_int_distribution<int> holeX(0, res.x - 1), holeZ(0, res.z - 1), holeSize(1, 2);
+    for (int i = 0; i < numberOfHoles; ++i) {
+        const ivec3 mins(holeX(rng), roofBottom, holeZ(rng));
+        fill(mins, mins + ivec3(holeSize(rng), roofTop - roofBottom, holeSize(rng)), false);
+    }
+    
+    constexpr int numberOfSlabs = 60;
+    std::uniform_int_distribution<int> slabX(0, res.x - 1), slabY(chunkSize, res.y - 4), slabZ(0, res.z - 1);
+    std::uniform_int_distribution<int> slabSize(3, 24), slabThickness(1, 3);
+    for (int i = 0; i < numberOfSlabs; ++i) {
+        const ivec3 mins(slabX(rng), slabY(rng), slabZ(rng));
+        const ivec3 maxs = mins + ivec3(slabSize(rng), slabThickness(rng), slabSize(rng));
+        const ivec3 columnCoords = mins / chunkSize;
+        if ((columnCoords.x + columnCoords.z) % 2 == 0) {
+            fill(mins, glm::min(maxs, (columnCoords + ivec3(1)) * chunkSize), true);
+        }
+    }
+    
+    // Chunks with no solid voxels are sky chunks, as with generated terrain.
+    Chunks chunks;
+    for (int y = 0; y < worldSizeInChunks.y; ++y) {
+        for (int z = 0; z < worldSizeInChunks.z; ++z) {
+            for (int x = 0; x < worldSizeInChunks.x; ++x) {
+                const ivec3 chunkCellCoords(x, y, z);
+                const AABB cell = chunkIndexer.cellAtCellCoords(chunkCellCoords);
+                Array3D<Voxel> voxels(cell, ivec3(chunkSize));
+                bool empty = true;
+                for (const ivec3 cellCoords : slice(voxels, cell)) {
+                    const ivec3 p = chunkCellCoords * chunkSize + cellCoords;
+                    const bool isSolid = solid[p.x + (p.z + p.y * res.z) * res.x];
+                    voxels.mutableReference(cellCoords) = Voxel(isSolid);
+                    empty = empty && !isSolid;
+                }
+                if (empty) {
+                    chunks.push_back(VoxelDataChunk::createSkyChunk(cell, ivec3(chunkSize)));
+                } else {
+                    chunks.push_back(VoxelDataChunk::createCompactChunk(std::move(voxels)));
+                }
+            }
+        }
+    }
+    return chunks;
+}
+
+// Lights the region in a world made from the terrain, starting from a cold
+// chunk cache and an empty map directory, and returns the voxels of the
+// region. Only the columns in the region are sure to be fully lit.
+static Array3D<Voxel> lightRegion(const Chunks &terrain,
+                                  const AABB &region,
+                                  Operation::PropagationMode mode,
+                                  Operation::PropagationKernel kernel)
+{
+    auto log = std::make_shared<spdlog::logger>("InitialSunlightPropagationOperationTests", std::make_shared<spdlog::sinks::null_sink_mt>());
+    
+    // The Parallel mode needs more than one thread, else it runs Batched.
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(mapDirectory);
+    auto chunks = std::make_unique<PersistentVoxelChunks>(log,
+                                                          worldBoundingBox,
+                                                          worldResolution,
+                                                          chunkSize,
+                                                          std::make_unique<MapRegionStore>(log, mapDirectory, worldBoundingBox, ivec3(1)),
+                                                          [&terrain](const AABB &, Morton3 index){
+                                                              return std::make_unique<VoxelDataChunk>(chunkAt(terrain, index.decode()));
+                                                          },
+                                                          dispatcher,
+                                                          std::numeric_limits<size_t>::max());
+    
+    {
+        Operation operation(log, *chunks, dispatcher, mode, kernel);
+        operation.performInitialSunlightPropagationIfNecessary(region);
+    }
+    Array3D<Voxel> voxels = chunks->loadSubRegion(region);
+    
+    // Finish saving chunks before removing the map directory.
+    chunks.reset();
+    dispatcher->shutdown();
+    boost::filesystem::remove_all(mapDirectory);
+    
+    return voxels;
+}
+
+// Returns true if some voxel is lit by sunlight which spilled sideways,
+// rather than falling straight down. Otherwise, a comparison of two ways
+// of lighting the region would show very little.
+static bool hasPartialSunlight(const Array3D<Voxel> &voxels)
+{
+    for (const ivec3 cellCoords : slice(voxels, voxels.boundingBox())) {
+        const unsigned sunLight = voxels.reference(cellCoords).sunLight;
+        if (sunLight > 0 && sunLight < MAX_LIGHT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST_CASE("Test Batched Sunlight Matches PerColumn Sunlight", "[InitialSunlightPropagationOperation]") {
+    const Chunks terrain = makeTerrain(1);
+    const AABB region = regionOfColumns(ivec3(1, 0, 1), ivec3(4, 0, 2));
+    const auto perColumn = lightRegion(terrain, region, Operation::PerColumn, Operation::Scalar);
+    const auto batched = lightRegion(terrain, region, Operation::Batched, Operation::Scalar);
+    REQUIRE(hasPartialSunlight(perColumn));
+    REQUIRE(batched == perColumn);
+}
+
+TEST_CASE("Test Batched Sunlight Matches PerColumn Sunlight At The Edge Of The World", "[InitialSunlightPropagationOperation]") {
+    // The region touches the minimum X and Z sides of the world, so some
+    // neighboring columns are out of bounds and are never seeded.
+    const Chunks terrain = makeTerrain(1);
+    const AABB region = regionOfColumns(ivec3(0, 0, 0), ivec3(3, 0, 1));
+    const auto perColumn = lightRegion(terrain, region, Operation::PerColumn, Operation::Scalar);
+    const auto batched = lightRegion(terrain, region, Operation::Batched, Operation::Scalar);
+    REQUIRE(hasPartialSunlight(perColumn));
+    REQUIRE(batched == perColumn);
+}
+
+TEST_CASE("Test Every Mode And Kernel Matches PerColumn Scalar Sunlight", "[InitialSunlightPropagationOperation]") {
+    // The region is seven columns wide, so it has two groups of 3x3 columns
+    // which the Parallel mode lights concurrently.
+    const AABB region = regionOfColumns(ivec3(1, 0, 1), ivec3(8, 0, 2));
+    
+    for (const unsigned seed : {2u, 3u, 4u}) {
+        const Chunks terrain = makeTerrain(seed);
+        const auto reference = lightRegion(terrain, region, Operation::PerColumn, Operation::Scalar);
+        REQUIRE(hasPartialSunlight(reference));
+        REQUIRE(lightRegion(terrain, region, Operation::Batched, Operation::Scalar) == reference);
+        REQUIRE(lightRegion(terrain, region, Operation::Batched, Operation::Shafts) == reference);
+        REQUIRE(lightRegion(terrain, region, Operation::Parallel, Operation::Shafts) == reference);
+    }
+}
@@ -0,0 +1,159 @@
+//
+//  PersistentVoxelChunksTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/PersistentVoxelChunks.hpp"
+#include "Terrain/TerrainConfig.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <boost/filesystem.hpp>
+#include <memory>
+
+using glm::ivec3;
+using glm::vec3;
+
+// The number of bytes used by one chunk which has been generated.
+static size_t chunkBytes()
+{
+    auto chunk = VoxelDataChunk::createSkyChunk(AABB{vec3(16.f), vec3(16.f)}, ivec3(TERRAIN_CHUNK_SIZE));
+    chunk.convertToArray();
+    return chunk.getNumberOfResidentBytes();
+}
+
+// Makes a row of four chunks, persisted to the specified directory, with room
+// in the memory budget for two. Counts the chunks which are generated.
+static std::unique_ptr<PersistentVoxelChunks> makeRowOfChunks(const boost::filesystem::path &mapDirectory,
+                                                              const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                                              size_t &numberOfChunksCreated)
+{
+    auto log = std::make_shared<spdlog::logger>("PersistentVoxelChunksTests", std::make_shared<spdlog::sinks::null_sink_mt>());
+    const AABB boundingBox{vec3(64.f, 16.f, 16.f), vec3(64.f, 16.f, 16.f)};
+    const ivec3 gridResolution(boundingBox.extent * 2.f);
+    boost::filesystem::create_directories(mapDirectory);
+    return std::make_unique<PersistentVoxelChunks>(log,
+                                                   boundingBox,
+                                                   gridResolution,
+                                                   TERRAIN_CHUNK_SIZE,
+                                                   std::make_unique<MapRegionStore>(log, mapDirectory, boundingBox, ivec3(1)),
+                                                   [&numberOfChunksCreated](const AABB &cell, Morton3){
+                                                       numberOfChunksCreated++;
+                                                       auto chunk = VoxelDataChunk::createSkyChunk(cell, ivec3(TERRAIN_CHUNK_SIZE));
+                                                       chunk.convertToArray();
+                                                       return std::make_unique<VoxelDataChunk>(std::move(chunk));
+                                                   },
+                                                   dispatcher,
+                                                   2 * chunkBytes());
+}
+
+static Morton3 indexOfChunk(PersistentVoxelChunks &chunks, int i)
+{
+    return chunks.getChunkIndexer().indexAtCellCoords(ivec3(i, 0, 0));
+}
+
+static std::shared_ptr<VoxelDataChunk> getChunk(PersistentVoxelChunks &chunks, int i)
+{
+    const AABB cell = chunks.getChunkIndexer().cellAtCellCoords(ivec3(i, 0, 0));
+    return chunks.get(cell, indexOfChunk(chunks, i));
+}
+
+static bool isResident(PersistentVoxelChunks &chunks, int i)
+{
+    return (bool)chunks.getIfExists(indexOfChunk(chunks, i));
+}
+
+TEST_CASE("Test Persistent Chunks Are Evicted In LRU Order", "[PersistentVoxelChunks]") {
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    size_t numberOfChunksCreated = 0;
+    auto chunks = makeRowOfChunks(mapDirectory, dispatcher, numberOfChunksCreated);
+
+    getChunk(*chunks, 0);
+    getChunk(*chunks, 1);
+    getChunk(*chunks, 0);
+    REQUIRE(chunks->getResidentBytes() == 2 * chunkBytes());
+
+    // Chunk 1 was used least recently.
+    getChunk(*chunks, 2);
+    REQUIRE(isResident(*chunks, 0));
+    REQUIRE(!isResident(*chunks, 1));
+    REQUIRE(isResident(*chunks, 2));
+
+    // Now chunk 0 was used least recently.
+    getChunk(*chunks, 3);
+    REQUIRE(!isResident(*chunks, 0));
+    REQUIRE(isResident(*chunks, 2));
+    REQUIRE(isResident(*chunks, 3));
+    REQUIRE(chunks->getResidentBytes() == 2 * chunkBytes());
+
+    // Clean chunks are dropped without being saved.
+    REQUIRE(chunks->getNumberOfChunkWrites() == 0);
+
+    chunks.reset();
+    boost::filesystem::remove_all(mapDirectory);
+}
+
+TEST_CASE("Test Pinned Persistent Chunks Survive Over Budget", "[PersistentVoxelChunks]") {
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    size_t numberOfChunksCreated = 0;
+    auto chunks = makeRowOfChunks(mapDirectory, dispatcher, numberOfChunksCreated);
+
+    for (int i = 0; i < 3; ++i) {
+        chunks->pin(indexOfChunk(*chunks, i));
+        getChunk(*chunks, i);
+    }
+    REQUIRE(isResident(*chunks, 0));
+    REQUIRE(isResident(*chunks, 1));
+    REQUIRE(isResident(*chunks, 2));
+    REQUIRE(chunks->getResidentBytes() == 3 * chunkBytes());
+
+    // Unpinning the least recently used chunk allows it to be evicted.
+    chunks->unpin(indexOfChunk(*chunks, 0));
+    REQUIRE(!isResident(*chunks, 0));
+    REQUIRE(isResident(*chunks, 1));
+    REQUIRE(isResident(*chunks, 2));
+    REQUIRE(chunks->getResidentBytes() == 2 * chunkBytes());
+
+    chunks->unpin(indexOfChunk(*chunks, 1));
+    chunks->unpin(indexOfChunk(*chunks, 2));
+
+    chunks.reset();
+    boost::filesystem::remove_all(mapDirectory);
+}
+
+TEST_CASE("Test Dirty Persistent Chunks Are Saved Before Eviction", "[PersistentVoxelChunks]") {
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    size_t numberOfChunksCreated = 0;
+    auto chunks = makeRowOfChunks(mapDirectory, dispatcher, numberOfChunksCreated);
+
+    // Modify a chunk in place and queue a save of it, as a terrain operation
+    // would. The dispatcher has no threads so the save does not run yet.
+    const Morton3 index = indexOfChunk(*chunks, 0);
+    chunks->pin(index);
+    getChunk(*chunks, 0)->set(ivec3(1, 2, 3), Voxel(true));
+    chunks->store(index);
+    chunks->unpin(index);
+    REQUIRE(chunks->getDirtyBytes() == chunkBytes());
+    REQUIRE(chunks->getNumberOfChunkWrites() == 0);
+
+    getChunk(*chunks, 1);
+    getChunk(*chunks, 2);
+    REQUIRE(!isResident(*chunks, 0));
+    REQUIRE(chunks->getNumberOfChunkWrites() == 1);
+    REQUIRE(chunks->getDirtyBytes() == 0);
+
+    // The chunk comes back from file, changes and all.
+    const size_t numberOfChunksCreatedBefore = numberOfChunksCreated;
+    REQUIRE(getChunk(*chunks, 0)->get(ivec3(1, 2, 3)) == Voxel(true));
+    REQUIRE(numberOfChunksCreated == numberOfChunksCreatedBefore);
+
+    // The save which was queued earlier was superseded by the eviction.
+    dispatcher->flush();
+    REQUIRE(chunks->getNumberOfChunkWrites() == 1);
+
+    chunks.reset();
+    boost::filesystem::remove_all(mapDirectory);
+}
@@ -0,0 +1,156 @@
+//
+//  TerrainPrefetcherTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/TerrainPrefetcher.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using glm::ivec3;
+using glm::vec3;
+
+// A world which is 16x16 columns of chunks, and one chunk high.
+static const GridIndexer voxelIndexer(AABB{vec3(0.f), vec3(256.f, 16.f, 256.f)}, ivec3(512, 32, 512));
+static constexpr float activeRegionSize = 64.f;
+
+// Makes a prefetcher which stands in for the voxel data with a list of
+// prefetched columns. Columns become resident once prefetched, or right away
+// when everythingResident is set. Tests use a dispatcher with no threads, so
+// tasks only run when it is flushed.
+static std::shared_ptr<TerrainPrefetcher> createPrefetcher(const std::shared_ptr<TaskDispatcher> &dispatcher,
+                                                           std::vector<AABB> &prefetchedColumns,
+                                                           bool everythingResident,
+                                                           float lookahead)
+{
+    auto log = std::make_shared<spdlog::logger>("TerrainPrefetcherTests", std::make_shared<spdlog::sinks::null_sink_mt>());
+    return std::make_shared<TerrainPrefetcher>(log,
+                                               voxelIndexer,
+                                               [&prefetchedColumns, everythingResident](const AABB &region){
+                                                   return everythingResident ||
+                                                          std::any_of(prefetchedColumns.begin(), prefetchedColumns.end(), [&](const AABB &column){
+                                                              return column.center == region.center;
+                                                          });
+                                               },
+                                               [&prefetchedColumns](const AABB &region){
+                                                   prefetchedColumns.push_back(region);
+                                                   return true;
+                                               },
+                                               dispatcher,
+                                               activeRegionSize,
+                                               lookahead);
+}
+
+// Moves the camera along +X at 64 units per second, starting at the origin,
+// for long enough that the velocity estimate settles. Returns the time of the
+// last update.
+static TerrainPrefetcher::Clock::time_point accelerate(TerrainPrefetcher &prefetcher)
+{
+    const auto start = TerrainPrefetcher::Clock::now();
+    auto now = start;
+    for (int i = 0; i <= 20; ++i) {
+        now = start + std::chrono::milliseconds(100 * i);
+        prefetcher.update(vec3(6.4f * i, 0.f, 0.f), now);
+    }
+    return now;
+}
+
+TEST_CASE("Test Prefetcher Does Nothing While The Camera Is Still", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 1.f);
+    const auto start = TerrainPrefetcher::Clock::now();
+    for (int i = 0; i <= 20; ++i) {
+        prefetcher->update(vec3(0.f), start + std::chrono::milliseconds(100 * i));
+    }
+    dispatcher->flush();
+    REQUIRE(prefetcher->getVelocity() == vec3(0.f));
+    REQUIRE(prefetchedColumns.empty());
+    REQUIRE(prefetcher->getNumberOfPrefetches() == 0);
+}
+
+TEST_CASE("Test Prefetcher Does Nothing When Lookahead Is Zero", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 0.f);
+    accelerate(*prefetcher);
+    dispatcher->flush();
+    REQUIRE(prefetchedColumns.empty());
+}
+
+TEST_CASE("Test Prefetcher Fetches The Column Ahead Of The Camera", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 1.f);
+    accelerate(*prefetcher);
+    REQUIRE(prefetcher->getVelocity().x == Approx(64.f).epsilon(0.01));
+    
+    // The camera is at X=128 and is predicted to be at X=192 in one second.
+    // The current active region reaches X=192 already. So, the nearest
+    // column which is about to enter it spans X=192 to X=224.
+    dispatcher->flush();
+    REQUIRE(prefetchedColumns.size() == 1);
+    REQUIRE(prefetchedColumns[0].center.x == 208.f);
+    REQUIRE(std::abs(prefetchedColumns[0].center.z) == 16.f);
+    REQUIRE(prefetcher->getNumberOfPrefetches() == 1);
+}
+
+TEST_CASE("Test Prefetcher Without Worker Threads Fetches One Column At A Time", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 1.f);
+    auto now = accelerate(*prefetcher);
+    
+    // Each update queues one pass of scheduling, which may only put a single
+    // column in flight. Columns which are already resident are skipped.
+    for (size_t i = 1; i <= 4; ++i) {
+        dispatcher->flush();
+        REQUIRE(prefetchedColumns.size() == i);
+        REQUIRE(dispatcher->getNumberOfPendingTasks() == 0);
+        now += std::chrono::milliseconds(10);
+        prefetcher->update(vec3(128.f + 0.64f * i, 0.f, 0.f), now);
+    }
+    
+    for (size_t i = 0; i < prefetchedColumns.size(); ++i) {
+        const AABB &column = prefetchedColumns[i];
+        REQUIRE(column.mins().x >= 192.f);
+        for (size_t j = 0; j < i; ++j) {
+            REQUIRE(column.center != prefetchedColumns[j].center);
+        }
+    }
+}
+
+TEST_CASE("Test Prefetcher Skips Resident Columns", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, true, 1.f);
+    accelerate(*prefetcher);
+    dispatcher->flush();
+    REQUIRE(prefetchedColumns.empty());
+    REQUIRE(prefetcher->getNumberOfPrefetches() == 0);
+}
+
+TEST_CASE("Test Prefetcher Counts Rebuilds", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 1.f);
+    prefetcher->noteRebuild(true);
+    prefetcher->noteRebuild(false);
+    prefetcher->noteRebuild(true);
+    REQUIRE(prefetcher->getNumberOfRebuilds() == 3);
+    REQUIRE(prefetcher->getNumberOfResidentRebuilds() == 2);
+}
+
+TEST_CASE("Test Prefetcher Tasks Outlive The Prefetcher", "[TerrainPrefetcher]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    std::vector<AABB> prefetchedColumns;
+    auto prefetcher = createPrefetcher(dispatcher, prefetchedColumns, false, 1.f);
+    accelerate(*prefetcher);
+    prefetcher.reset();
+    dispatcher->flush();
+    REQUIRE(prefetchedColumns.empty());
+}
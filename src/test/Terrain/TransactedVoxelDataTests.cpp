@@ -0,0 +1,74 @@
+//
+//  TransactedVoxelDataTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/TransactedVoxelData.hpp"
+#include "Terrain/TerrainConfig.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <boost/filesystem.hpp>
+#include <memory>
+
+using glm::vec3;
+
+// Makes voxel data from generated terrain, persisted to the specified
+// directory. The voxel data saves chunks on its own dispatcher, which has
+// threads, so the tests are free to use one which only runs when flushed.
+static std::unique_ptr<TransactedVoxelData> createVoxelData(const boost::filesystem::path &mapDirectory,
+                                                            const std::shared_ptr<TaskDispatcher> &dispatcher)
+{
+    auto log = std::make_shared<spdlog::logger>("TransactedVoxelDataTests", std::make_shared<spdlog::sinks::null_sink_mt>());
+    auto generator = std::make_unique<VoxelDataGenerator>(0);
+    const AABB boundingBox = generator->boundingBox();
+    boost::filesystem::create_directories(mapDirectory);
+    auto voxelData = std::make_unique<VoxelData>(log,
+                                                 std::move(generator),
+                                                 TERRAIN_CHUNK_SIZE,
+                                                 std::make_unique<MapRegionStore>(log, mapDirectory, boundingBox, glm::ivec3(1)),
+                                                 dispatcher);
+    return std::make_unique<TransactedVoxelData>(std::move(voxelData));
+}
+
+TEST_CASE("Test Async Reader Transaction Cancelled Before Fetching", "[TransactedVoxelData]") {
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto voxelDispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    {
+        auto data = createVoxelData(mapDirectory, voxelDispatcher);
+        const AABB region = {data->boundingBox().center, vec3(8.f)};
+        
+        CancellationToken token = CancellationToken::create();
+        auto future = data->asyncReaderTransaction(dispatcher, TaskDispatcher::NormalPriority, {region}, token);
+        token.cancel();
+        dispatcher->flush();
+        REQUIRE(future.isReady());
+        REQUIRE_THROWS_AS(future.get(), CancelledException);
+    }
+    voxelDispatcher->shutdown();
+    boost::filesystem::remove_all(mapDirectory);
+}
+
+TEST_CASE("Test Async Reader Transaction Cancelled After Fetching", "[TransactedVoxelData]") {
+    const auto mapDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto voxelDispatcher = std::make_shared<TaskDispatcher>("Test", 2);
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    {
+        auto data = createVoxelData(mapDirectory, voxelDispatcher);
+        const AABB region = {data->boundingBox().center, vec3(8.f)};
+        
+        // Run only the task which fetches the chunks, so the transaction is
+        // cancelled while its attempt to take the lock waits in the queue.
+        CancellationToken token = CancellationToken::create();
+        auto future = data->asyncReaderTransaction(dispatcher, TaskDispatcher::NormalPriority, {region}, token);
+        REQUIRE(dispatcher->flush(TaskDispatcher::Clock::duration::zero()) == 1);
+        REQUIRE(!future.isReady());
+        token.cancel();
+        dispatcher->flush();
+        REQUIRE(future.isReady());
+        REQUIRE_THROWS_AS(future.get(), CancelledException);
+    }
+    voxelDispatcher->shutdown();
+    boost::filesystem::remove_all(mapDirectory);
+}
@@ -0,0 +1,148 @@
+//
+//  VoxelDataChunkTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/VoxelDataChunk.hpp"
+
+static const AABB region{{16, 16, 16},{16, 16, 16}};
+static const glm::ivec3 gridResolution(32);
+static const Voxel EditedVoxel{
+    /* .value = */ 1,
+    /* .sunLight = */ 0,
+    /* .torchLight = */ 0
+};
+
+static VoxelDataChunk createSkyArrayChunk()
+{
+    VoxelDataChunk chunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    chunk.convertToArray();
+    return chunk;
+}
+
+TEST_CASE("Test Voxel Data Chunk Copy Is Unaffected By Edits To The Original", "[VoxelDataChunk]") {
+    VoxelDataChunk original = createSkyArrayChunk();
+    const VoxelDataChunk snapshot(original);
+    original.set(glm::ivec3(1, 2, 3), EditedVoxel);
+    REQUIRE(original.get(glm::ivec3(1, 2, 3)) == EditedVoxel);
+    REQUIRE(snapshot.get(glm::ivec3(1, 2, 3)) == SkyVoxel);
+}
+
+TEST_CASE("Test Voxel Data Chunk Original Is Unaffected By Edits To The Copy", "[VoxelDataChunk]") {
+    const VoxelDataChunk original = createSkyArrayChunk();
+    VoxelDataChunk copy(original);
+    copy.set(glm::ivec3(1, 2, 3), EditedVoxel);
+    REQUIRE(copy.get(glm::ivec3(1, 2, 3)) == EditedVoxel);
+    REQUIRE(original.get(glm::ivec3(1, 2, 3)) == SkyVoxel);
+}
+
+TEST_CASE("Test Voxel Data Chunk Assignment Shares Until Edited", "[VoxelDataChunk]") {
+    const VoxelDataChunk original = createSkyArrayChunk();
+    VoxelDataChunk copy = VoxelDataChunk::createGroundChunk(region, gridResolution);
+    copy = original;
+    REQUIRE(copy.getType() == VoxelDataChunk::Array);
+    REQUIRE(copy.getUncompressedBytes() == original.getUncompressedBytes());
+    
+    copy.set(glm::ivec3(0, 0, 0), EditedVoxel);
+    REQUIRE(copy.getUncompressedBytes() != original.getUncompressedBytes());
+}
+
+TEST_CASE("Test Voxel Data Chunk Snapshot Of A Sky Chunk Stays Sky", "[VoxelDataChunk]") {
+    VoxelDataChunk original = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    const VoxelDataChunk snapshot(original);
+    original.set(glm::ivec3(1, 2, 3), EditedVoxel);
+    REQUIRE(original.getType() == VoxelDataChunk::Palette);
+    REQUIRE(snapshot.getType() == VoxelDataChunk::Sky);
+}
+
+TEST_CASE("Test Voxel Data Chunk Copies Cells Into A Larger Array", "[VoxelDataChunk]") {
+    VoxelDataChunk chunk = createSkyArrayChunk();
+    chunk.set(glm::ivec3(0, 0, 0), EditedVoxel);
+    chunk.set(glm::ivec3(31, 31, 31), EditedVoxel);
+    
+    // The destination extends one voxel past the chunk on every side, as the
+    // mesher's regions do.
+    Array3D<Voxel> dst(AABB{{16, 16, 16},{17, 17, 17}}, glm::ivec3(34));
+    chunk.copyCellsTo(dst, region);
+    
+    REQUIRE(dst.reference(glm::ivec3(1, 1, 1)) == EditedVoxel);
+    REQUIRE(dst.reference(glm::ivec3(32, 32, 32)) == EditedVoxel);
+    REQUIRE(dst.reference(glm::ivec3(2, 1, 1)) == SkyVoxel);
+    REQUIRE(dst.reference(glm::ivec3(0, 0, 0)) == Voxel());
+    REQUIRE(dst.reference(glm::ivec3(33, 33, 33)) == Voxel());
+}
+
+TEST_CASE("Test Voxel Data Chunk Ground Chunk Fills The Region", "[VoxelDataChunk]") {
+    const VoxelDataChunk chunk = VoxelDataChunk::createGroundChunk(region, gridResolution);
+    Array3D<Voxel> dst(AABB{{16, 16, 16},{17, 17, 17}}, glm::ivec3(34));
+    
+    // Only copy the part of the chunk with z < 8.
+    const AABB subRegion{{16, 16, 4},{16, 16, 4}};
+    chunk.copyCellsTo(dst, subRegion);
+    
+    REQUIRE(dst.reference(glm::ivec3(1, 1, 1)) == GroundVoxel);
+    REQUIRE(dst.reference(glm::ivec3(32, 32, 8)) == GroundVoxel);
+    REQUIRE(dst.reference(glm::ivec3(32, 32, 9)) == Voxel());
+}
+
+TEST_CASE("Test Voxel Data Chunk Edited Sky Chunk Is Paletted", "[VoxelDataChunk]") {
+    VoxelDataChunk chunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    chunk.set(glm::ivec3(1, 2, 3), EditedVoxel);
+    REQUIRE(chunk.getType() == VoxelDataChunk::Palette);
+    REQUIRE(chunk.get(glm::ivec3(1, 2, 3)) == EditedVoxel);
+    REQUIRE(chunk.get(glm::ivec3(3, 2, 1)) == SkyVoxel);
+    
+    const size_t fullArrayBytes = gridResolution.x * gridResolution.y * gridResolution.z * sizeof(Voxel);
+    REQUIRE(chunk.getNumberOfResidentBytes() < fullArrayBytes / 4);
+}
+
+TEST_CASE("Test Voxel Data Chunk Promotes To Array When Palette Is Full", "[VoxelDataChunk]") {
+    VoxelDataChunk chunk = VoxelDataChunk::createGroundChunk(region, gridResolution);
+    
+    // Ground and sixteen distinct sunlight values for sky make seventeen.
+    for (unsigned sunLight = 0; sunLight <= MAX_LIGHT; ++sunLight) {
+        chunk.set(glm::ivec3(sunLight, 0, 0), Voxel(false, sunLight, 0));
+    }
+    REQUIRE(chunk.getType() == VoxelDataChunk::Array);
+    
+    for (unsigned sunLight = 0; sunLight <= MAX_LIGHT; ++sunLight) {
+        REQUIRE(chunk.get(glm::ivec3(sunLight, 0, 0)) == Voxel(false, sunLight, 0));
+    }
+    REQUIRE(chunk.get(glm::ivec3(0, 1, 0)) == GroundVoxel);
+}
+
+TEST_CASE("Test Voxel Data Chunk Compact Chunk Round Trips The Voxels", "[VoxelDataChunk]") {
+    VoxelDataChunk arrayChunk = createSkyArrayChunk();
+    arrayChunk.set(glm::ivec3(4, 5, 6), EditedVoxel);
+    const std::vector<uint8_t> expected = arrayChunk.getUncompressedBytes();
+    
+    Array3D<Voxel> voxels(region, gridResolution);
+    memcpy(voxels.data(), expected.data(), expected.size());
+    const VoxelDataChunk compactChunk = VoxelDataChunk::createCompactChunk(std::move(voxels));
+    REQUIRE(compactChunk.getType() == VoxelDataChunk::Palette);
+    REQUIRE(compactChunk.getUncompressedBytes() == expected);
+}
+
+TEST_CASE("Test Voxel Data Chunk Places, Changes, And Removes Emitters", "[VoxelDataChunk]") {
+    VoxelDataChunk chunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    chunk.setEmitter(glm::ivec3(1, 2, 3), MAX_LIGHT);
+    chunk.setEmitter(glm::ivec3(3, 2, 1), 7);
+    REQUIRE(chunk.getEmitters().size() == 2);
+    REQUIRE(chunk.getEmittedLight(glm::ivec3(1, 2, 3)) == MAX_LIGHT);
+    REQUIRE(chunk.getEmittedLight(glm::ivec3(3, 2, 1)) == 7);
+    REQUIRE(chunk.getEmittedLight(glm::ivec3(2, 2, 2)) == 0);
+    
+    // A snapshot keeps the emitters it was taken with.
+    const VoxelDataChunk copy(chunk);
+    chunk.setEmitter(glm::ivec3(1, 2, 3), 3);
+    chunk.setEmitter(glm::ivec3(3, 2, 1), 0);
+    REQUIRE(chunk.getEmitters().size() == 1);
+    REQUIRE(chunk.getEmittedLight(glm::ivec3(1, 2, 3)) == 3);
+    REQUIRE(chunk.getEmittedLight(glm::ivec3(3, 2, 1)) == 0);
+    REQUIRE(copy.getEmittedLight(glm::ivec3(1, 2, 3)) == MAX_LIGHT);
+    REQUIRE(copy.getEmittedLight(glm::ivec3(3, 2, 1)) == 7);
+    
+    // Emitters do not change the voxels.
+    REQUIRE(chunk.getType() == VoxelDataChunk::Sky);
+}
@@ -0,0 +1,61 @@
+//
+//  VoxelDataGeneratorTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/VoxelDataGenerator.hpp"
+#include "Terrain/TerrainConfig.hpp"
+#include "Grid/GridIndexerRange.hpp"
+
+using glm::vec3;
+
+static constexpr float chunkSize = TERRAIN_CHUNK_SIZE;
+
+// Returns the box of the chunk whose minimum corner is at the given point.
+static AABB chunkAt(float x, float y, float z)
+{
+    const vec3 extent(chunkSize / 2.f);
+    return {vec3(x, y, z) + extent, extent};
+}
+
+TEST_CASE("Test Voxel Data Generator Classifies Flat Terrain", "[VoxelDataGenerator]") {
+    const VoxelDataGenerator generator(0);
+    
+    // Far from the floating mountain.
+    REQUIRE(generator.classify(chunkAt(-512, -64, -512)) == VoxelDataGenerator::Ground);
+    REQUIRE(generator.classify(chunkAt(-512, -32, -512)) == VoxelDataGenerator::Ground);
+    REQUIRE(generator.classify(chunkAt(-512, 0, -512)) == VoxelDataGenerator::Mixed);
+    REQUIRE(generator.classify(chunkAt(-512, 32, -512)) == VoxelDataGenerator::Sky);
+    REQUIRE(generator.classify(chunkAt(-512, 64, -512)) == VoxelDataGenerator::Sky);
+    
+    // Around the floating mountain, and above its flattened top.
+    REQUIRE(generator.classify(chunkAt(32, 32, 64)) == VoxelDataGenerator::Mixed);
+    REQUIRE(generator.classify(chunkAt(32, 64, 64)) == VoxelDataGenerator::Sky);
+}
+
+TEST_CASE("Test Voxel Data Generator Classification Agrees With Generated Voxels", "[VoxelDataGenerator]") {
+    for (unsigned seed = 0; seed < 2; ++seed) {
+        const VoxelDataGenerator generator(seed);
+        
+        // A block of chunks which covers the floating mountain and the
+        // surface of the ground beneath it.
+        for (float z = -32; z < 160; z += chunkSize) {
+            for (float y = -32; y < 96; y += chunkSize) {
+                for (float x = -32; x < 128; x += chunkSize) {
+                    const AABB box = chunkAt(x, y, z);
+                    const auto classification = generator.classify(box);
+                    if (classification == VoxelDataGenerator::Mixed) {
+                        continue;
+                    }
+                    
+                    const Array3D<Voxel> voxels = generator.copy(box);
+                    const unsigned expected = (classification == VoxelDataGenerator::Ground) ? 1 : 0;
+                    for (const auto cellCoords : slice(voxels, voxels.boundingBox())) {
+                        REQUIRE(voxels.reference(cellCoords).value == expected);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -40,3 +40,44 @@ TEST_CASE("Test Voxel Serializer Round Trip for Ground Chunks", "[VoxelDataSeria
     const VoxelDataChunk reconstructedChunk = serializer.load(region, serializedBytes);
     REQUIRE(originalChunk.getUncompressedBytes() == reconstructedChunk.getUncompressedBytes());
 }
+
+TEST_CASE("Test Voxel Serializer Round Trip for Light Emitters", "[VoxelDataSerializer]") {
+    VoxelDataSerializer serializer;
+    const AABB region{{16, 16, 16},{16, 16, 16}};
+    const glm::ivec3 gridResolution(32);
+    VoxelDataChunk originalChunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    originalChunk.set(glm::ivec3(1, 2, 3), Voxel(false, 0, MAX_LIGHT));
+    originalChunk.setEmitter(glm::ivec3(1, 2, 3), MAX_LIGHT);
+    originalChunk.setEmitter(glm::ivec3(31, 0, 31), 4);
+    const auto serializedBytes = serializer.store(originalChunk);
+    const VoxelDataChunk reconstructedChunk = serializer.load(region, serializedBytes);
+    REQUIRE(originalChunk.getUncompressedBytes() == reconstructedChunk.getUncompressedBytes());
+    REQUIRE(reconstructedChunk.getEmitters().size() == 2);
+    REQUIRE(reconstructedChunk.getEmittedLight(glm::ivec3(1, 2, 3)) == MAX_LIGHT);
+    REQUIRE(reconstructedChunk.getEmittedLight(glm::ivec3(31, 0, 31)) == 4);
+}
+
+TEST_CASE("Test Voxel Serializer Rejects A Corrupt Emitter Table", "[VoxelDataSerializer]") {
+    VoxelDataSerializer serializer;
+    const AABB region{{16, 16, 16},{16, 16, 16}};
+    const glm::ivec3 gridResolution(32);
+    VoxelDataChunk originalChunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    originalChunk.setEmitter(glm::ivec3(1, 2, 3), MAX_LIGHT);
+    auto serializedBytes = serializer.store(originalChunk);
+    serializedBytes.back() ^= 0xff;
+    REQUIRE_THROWS_AS(serializer.load(region, serializedBytes), VoxelDataException);
+}
+
+TEST_CASE("Test Voxel Serializer Loads Bytes Padded By The Data Store", "[VoxelDataSerializer]") {
+    VoxelDataSerializer serializer;
+    const AABB region{{16, 16, 16},{16, 16, 16}};
+    const glm::ivec3 gridResolution(32);
+    VoxelDataChunk originalChunk = VoxelDataChunk::createSkyChunk(region, gridResolution);
+    originalChunk.set(glm::ivec3(1, 2, 3), Voxel(true));
+    originalChunk.setEmitter(glm::ivec3(4, 5, 6), MAX_LIGHT);
+    auto serializedBytes = serializer.store(originalChunk);
+    serializedBytes.resize(serializedBytes.size() + 13, 0);
+    const VoxelDataChunk reconstructedChunk = serializer.load(region, serializedBytes);
+    REQUIRE(originalChunk.getUncompressedBytes() == reconstructedChunk.getUncompressedBytes());
+    REQUIRE(reconstructedChunk.getEmittedLight(glm::ivec3(4, 5, 6)) == MAX_LIGHT);
+}
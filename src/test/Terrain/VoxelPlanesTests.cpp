@@ -0,0 +1,86 @@
+//
+//  VoxelPlanesTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "Terrain/VoxelPlanes.hpp"
+
+using glm::vec3;
+using glm::ivec3;
+
+static const AABB box = {vec3(8.f, 8.f, 8.f), vec3(8.f, 8.f, 8.f)};
+static const ivec3 res(16, 16, 16);
+
+TEST_CASE("Test Voxel Planes Round Trip Through Array3D", "[VoxelPlanes]") {
+    Array3D<Voxel> voxels(box, res);
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                voxels.mutableReference(ivec3(x, y, z)) = Voxel((x + y) % 2 == 0, z % 16, (x + z) % 16);
+            }
+        }
+    }
+    
+    const VoxelPlanes planes(voxels);
+    REQUIRE(planes.toArray() == voxels);
+    REQUIRE(planes.get(ivec3(2, 4, 7)) == voxels.reference(ivec3(2, 4, 7)));
+    REQUIRE(planes.getNumberOfBytes() < res.x * res.y * res.z * sizeof(Voxel) / 3);
+}
+
+TEST_CASE("Test Voxel Planes Accessors", "[VoxelPlanes]") {
+    VoxelPlanes planes(box, res);
+    const Morton3 index(ivec3(3, 4, 5));
+    REQUIRE(!planes.isOccupied(index));
+    
+    planes.setOccupied(index, true);
+    planes.setSunLight(index, 9);
+    planes.setTorchLight(index, 15);
+    REQUIRE(planes.isOccupied(index));
+    REQUIRE(planes.getSunLight(index) == 9);
+    REQUIRE(planes.getTorchLight(index) == 15);
+    REQUIRE(planes.get(index) == Voxel(true, 9, 15));
+    
+    planes.setSunLight(index, 2);
+    REQUIRE(planes.getTorchLight(index) == 15);
+    
+    planes.set(index, Voxel(false, 1, 0));
+    REQUIRE(!planes.isOccupied(index));
+    REQUIRE(planes.getSunLight(index) == 1);
+    REQUIRE(planes.getTorchLight(index) == 0);
+}
+
+TEST_CASE("Test Voxel Planes Occupancy Blocks", "[VoxelPlanes]") {
+    VoxelPlanes planes(box, res);
+    REQUIRE(planes.getOccupancyBlockResolution() == ivec3(4, 4, 4));
+    
+    for (int z = 4; z < 8; ++z) {
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 8; x < 12; ++x) {
+                planes.set(ivec3(x, y, z), Voxel(true));
+            }
+        }
+    }
+    planes.set(ivec3(0, 0, 0), Voxel(true));
+    
+    REQUIRE(planes.getOccupancyBlock(ivec3(2, 0, 1)) == VoxelPlanes::OccupancyBlockFull);
+    REQUIRE(planes.getOccupancyBlock(ivec3(0, 0, 0)) == 1);
+    REQUIRE(planes.getOccupancyBlock(ivec3(1, 1, 1)) == 0);
+}
+
+TEST_CASE("Test Voxel Planes Count Occupied", "[VoxelPlanes]") {
+    VoxelPlanes planes(box, res);
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < 5; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                planes.set(ivec3(x, y, z), Voxel(true));
+            }
+        }
+    }
+    
+    REQUIRE(planes.countOccupied() == 16 * 5 * 16);
+    REQUIRE(planes.countOccupied(ivec3(0, 0, 0), res) == 16 * 5 * 16);
+    REQUIRE(planes.countOccupied(ivec3(1, 3, 2), ivec3(9, 7, 11)) == 9 * 2 * 11);
+    REQUIRE(planes.countOccupied(ivec3(4, 8, 4), ivec3(8, 8, 8)) == 0);
+    REQUIRE(planes.countOccupied(ivec3(4, 0, 4), ivec3(8, 4, 8)) == 8 * 4 * 8);
+}
@@ -0,0 +1,121 @@
+//
+//  ThreadPoolPolicyTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "ThreadPoolPolicy.hpp"
+
+static CpuTopology makeTopology(unsigned numberOfNodes, unsigned cpusPerNode)
+{
+    CpuTopology topology;
+    for (unsigned node = 0; node < numberOfNodes; ++node) {
+        topology.nodes.emplace_back();
+        for (unsigned i = 0; i < cpusPerNode; ++i) {
+            topology.nodes.back().push_back(node * cpusPerNode + i);
+        }
+    }
+    return topology;
+}
+
+TEST_CASE("Test Default Worker Budget Leaves A CPU For The Main Thread", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.shares = {{"terrain", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(1, 8));
+    REQUIRE(policy.getWorkerBudget() == 7);
+    REQUIRE(policy.getNumberOfThreads("terrain") == 7);
+}
+
+TEST_CASE("Test Worker Budget On A Single CPU", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.shares = {{"terrain", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(1, 1));
+    REQUIRE(policy.getWorkerBudget() == 1);
+    REQUIRE(policy.getNumberOfThreads("terrain") == 1);
+}
+
+TEST_CASE("Test Worker Budget Is Divided By Share", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.workerBudget = 8;
+    settings.shares = {{"terrain", 3.f}, {"audio", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(1, 16));
+    REQUIRE(policy.getNumberOfThreads("terrain") == 6);
+    REQUIRE(policy.getNumberOfThreads("audio") == 2);
+    
+    // A subsystem without a share still gets one thread.
+    REQUIRE(policy.getNumberOfThreads("unknown") == 1);
+}
+
+TEST_CASE("Test Worker Allotments Add Up To The Budget", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.workerBudget = 8;
+    settings.shares = {{"terrain", 1.f}, {"audio", 1.f}, {"physics", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(1, 16));
+    
+    // Rounding each share separately would give three workers apiece.
+    const unsigned total = policy.getNumberOfThreads("terrain")
+                         + policy.getNumberOfThreads("audio")
+                         + policy.getNumberOfThreads("physics");
+    REQUIRE(total == 8);
+    REQUIRE(policy.getNumberOfThreads("terrain") >= 2);
+    REQUIRE(policy.getNumberOfThreads("audio") >= 2);
+    REQUIRE(policy.getNumberOfThreads("physics") >= 2);
+}
+
+TEST_CASE("Test A Tiny Share Still Gets A Worker Within The Budget", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.workerBudget = 4;
+    settings.shares = {{"terrain", 100.f}, {"audio", 0.01f}};
+    ThreadPoolPolicy policy(settings, makeTopology(1, 8));
+    REQUIRE(policy.getNumberOfThreads("terrain") == 3);
+    REQUIRE(policy.getNumberOfThreads("audio") == 1);
+}
+
+TEST_CASE("Test Workers Are Not Pinned By Default", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.shares = {{"terrain", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(2, 4));
+    REQUIRE(policy.getAffinity("terrain", 0).empty());
+    REQUIRE(!policy.getWorkerStartHook("terrain"));
+}
+
+TEST_CASE("Test Pinning Workers To CPUs", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.workerBudget = 4;
+    settings.pinThreads = true;
+    settings.groupByNumaNode = false;
+    settings.shares = {{"terrain", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(2, 4));
+    
+    // The first CPU is left for the main thread.
+    REQUIRE(policy.getAffinity("terrain", 0) == std::vector<unsigned>{1});
+    REQUIRE(policy.getAffinity("terrain", 1) == std::vector<unsigned>{2});
+    REQUIRE(policy.getAffinity("terrain", 2) == std::vector<unsigned>{3});
+    REQUIRE(policy.getAffinity("terrain", 3) == std::vector<unsigned>{4});
+}
+
+TEST_CASE("Test Pinning Workers To NUMA Nodes", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    settings.workerBudget = 4;
+    settings.pinThreads = true;
+    settings.groupByNumaNode = true;
+    settings.shares = {{"terrain", 1.f}};
+    ThreadPoolPolicy policy(settings, makeTopology(2, 4));
+    
+    const std::vector<unsigned> node0{0, 1, 2, 3};
+    const std::vector<unsigned> node1{4, 5, 6, 7};
+    REQUIRE(policy.getAffinity("terrain", 0) == node0);
+    REQUIRE(policy.getAffinity("terrain", 2) == node0);
+    REQUIRE(policy.getAffinity("terrain", 3) == node1);
+}
+
+TEST_CASE("Test Policy Rejects An Empty Topology", "[ThreadPoolPolicy]") {
+    ThreadPoolPolicy::Settings settings;
+    REQUIRE_THROWS(ThreadPoolPolicy(settings, CpuTopology()));
+}
+
+TEST_CASE("Test Querying The CPU Topology", "[ThreadPoolPolicy]") {
+    const CpuTopology topology = getCpuTopology();
+    REQUIRE(!topology.nodes.empty());
+    REQUIRE(topology.numberOfCpus() > 0);
+}
@@ -0,0 +1,218 @@
+//
+//  WriteBehindActorTests.cpp
+//  PinkTopaz
+//
+
+#include "catch.hpp"
+#include "WriteBehindActor.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using Writes = std::vector<std::pair<int, int>>;
+
+static std::shared_ptr<spdlog::logger> makeNullLog()
+{
+    return std::make_shared<spdlog::logger>("WriteBehindActorTests", std::make_shared<spdlog::sinks::null_sink_mt>());
+}
+
+TEST_CASE("Test Write Behind Coalesces Repeated Stores", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        writes.emplace_back(key, value);
+    });
+    
+    actor.store(1, 10);
+    actor.store(1, 11);
+    actor.store(1, 12);
+    REQUIRE(writes.empty());
+    REQUIRE(actor.getNumberOfPendingWrites() == 1);
+    
+    dispatcher->flush();
+    REQUIRE(writes == Writes{{1, 12}});
+    REQUIRE(actor.getNumberOfStoreRequests() == 3);
+    REQUIRE(actor.getNumberOfWrites() == 1);
+}
+
+TEST_CASE("Test Write Behind Writes A Batch In Key Order", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        writes.emplace_back(key, value);
+    });
+    
+    actor.store(3, 30);
+    actor.store(1, 10);
+    actor.store(2, 20);
+    dispatcher->flush();
+    REQUIRE(writes == Writes{{1, 10}, {2, 20}, {3, 30}});
+}
+
+TEST_CASE("Test Write Behind Calls Back Only For Written Values", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [](const int &, const int &){});
+    
+    bool firstWasWritten = false;
+    bool secondWasWritten = false;
+    actor.store(1, 10, [&]{ firstWasWritten = true; });
+    actor.store(1, 11, [&]{ secondWasWritten = true; });
+    dispatcher->flush();
+    REQUIRE(!firstWasWritten);
+    REQUIRE(secondWasWritten);
+}
+
+TEST_CASE("Test Write Behind Store Now Supersedes Pending Value", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        writes.emplace_back(key, value);
+    });
+    
+    actor.store(1, 10);
+    actor.storeNow(1, 11);
+    REQUIRE(writes == Writes{{1, 11}});
+    
+    dispatcher->flush();
+    REQUIRE(writes == Writes{{1, 11}});
+    REQUIRE(actor.getNumberOfWrites() == 1);
+}
+
+TEST_CASE("Test Write Behind Flush Writes Everything Now", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        writes.emplace_back(key, value);
+    });
+    
+    actor.store(2, 20);
+    actor.store(1, 10);
+    actor.flush();
+    REQUIRE(writes == Writes{{1, 10}, {2, 20}});
+    REQUIRE(actor.getNumberOfPendingWrites() == 0);
+    
+    // The batch which was scheduled earlier finds nothing left to do.
+    dispatcher->flush();
+    REQUIRE(writes.size() == 2);
+}
+
+TEST_CASE("Test Write Behind Flushes On Destruction", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    {
+        WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+            writes.emplace_back(key, value);
+        });
+        actor.store(1, 10);
+    }
+    REQUIRE(writes == Writes{{1, 10}});
+    
+    // The scheduled batch outlives the actor and must be harmless.
+    dispatcher->flush();
+    REQUIRE(writes.size() == 1);
+}
+
+TEST_CASE("Test Write Behind Stores From Many Threads", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 4);
+    std::mutex mutex;
+    std::map<int, int> backingStore;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        std::scoped_lock lock(mutex);
+        backingStore[key] = value;
+    });
+    
+    constexpr int numberOfKeys = 16;
+    constexpr int numberOfVersions = 100;
+    std::vector<int> keys(numberOfKeys);
+    std::iota(keys.begin(), keys.end(), 0);
+    auto futures = dispatcher->map(keys, [&](int key){
+        for (int version = 1; version <= numberOfVersions; ++version) {
+            actor.store(key, version);
+        }
+    });
+    waitForAll(futures);
+    actor.flush();
+    
+    REQUIRE(backingStore.size() == numberOfKeys);
+    for (const auto &[key, value] : backingStore) {
+        REQUIRE(value == numberOfVersions);
+    }
+    REQUIRE(actor.getNumberOfWrites() <= numberOfKeys * numberOfVersions);
+    dispatcher->shutdown();
+}
+
+TEST_CASE("Test Write Behind Keeps Values Which Failed To Write", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    bool mustFail = true;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        if (key == 2 && mustFail) {
+            throw std::runtime_error("write failed");
+        }
+        writes.emplace_back(key, value);
+    });
+    
+    bool failedValueWasWritten = false;
+    actor.store(1, 10);
+    actor.store(2, 20, [&]{ failedValueWasWritten = true; });
+    actor.store(3, 30);
+    dispatcher->flush();
+    
+    // The failure does not stop the rest of the batch.
+    REQUIRE(writes == Writes{{1, 10}, {3, 30}});
+    REQUIRE(actor.getNumberOfWrites() == 2);
+    REQUIRE(actor.getNumberOfPendingWrites() == 1);
+    REQUIRE(!failedValueWasWritten);
+    
+    // The next store schedules another batch, which retries the failed value.
+    mustFail = false;
+    actor.store(4, 40);
+    dispatcher->flush();
+    REQUIRE(writes == Writes{{1, 10}, {3, 30}, {2, 20}, {4, 40}});
+    REQUIRE(actor.getNumberOfPendingWrites() == 0);
+    REQUIRE(failedValueWasWritten);
+}
+
+TEST_CASE("Test Write Behind Does Not Retry A Replaced Value", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    Writes writes;
+    bool mustFail = true;
+    std::function<void()> storeDuringWrite;
+    WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &key, const int &value){
+        if (mustFail) {
+            mustFail = false;
+            storeDuringWrite();
+            throw std::runtime_error("write failed");
+        }
+        writes.emplace_back(key, value);
+    });
+    
+    // A newer value is stored while the older one is being written.
+    storeDuringWrite = [&]{ actor.store(1, 11); };
+    actor.store(1, 10);
+    dispatcher->flush();
+    REQUIRE(writes == Writes{{1, 11}});
+    REQUIRE(actor.getNumberOfPendingWrites() == 0);
+}
+
+TEST_CASE("Test Write Behind Does Not Write After Destruction", "[WriteBehindActor]") {
+    auto dispatcher = std::make_shared<TaskDispatcher>("Test", 0);
+    size_t numberOfAttempts = 0;
+    {
+        WriteBehindActor<int, int> actor(makeNullLog(), dispatcher, [&](const int &, const int &){
+            numberOfAttempts++;
+            throw std::runtime_error("write failed");
+        });
+        actor.store(1, 10);
+    }
+    
+    // The destructor tried once, and dropped the value when that failed. The
+    // batch which was scheduled by store() must not try again.
+    REQUIRE(numberOfAttempts == 1);
+    REQUIRE(dispatcher->getNumberOfPendingTasks() == 1);
+    dispatcher->flush();
+    REQUIRE(numberOfAttempts == 1);
+}
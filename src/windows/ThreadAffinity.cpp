@@ -0,0 +1,56 @@
+//
+//  ThreadAffinity.cpp
+//  PinkTopaz
+//
+
+#include "ThreadAffinity.hpp"
+#include "Exception.hpp"
+#include <windows.h>
+#include <algorithm>
+#include <thread>
+
+// We only deal with the first processor group, i.e., the first 64 logical
+// processors, and treat them as a single node.
+
+CpuTopology getCpuTopology()
+{
+    CpuTopology topology;
+    topology.nodes.emplace_back();
+    
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for (unsigned cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu) {
+            if (processMask & ((DWORD_PTR)1 << cpu)) {
+                topology.nodes.front().push_back(cpu);
+            }
+        }
+    }
+    
+    if (topology.nodes.front().empty()) {
+        const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n; ++cpu) {
+            topology.nodes.front().push_back(cpu);
+        }
+    }
+    
+    return topology;
+}
+
+bool isThreadAffinitySupported()
+{
+    return true;
+}
+
+void setAffinityForCurrentThread(const std::vector<unsigned> &cpus)
+{
+    DWORD_PTR mask = 0;
+    for (unsigned cpu : cpus) {
+        if (cpu < sizeof(DWORD_PTR) * 8) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    
+    if (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        throw Exception("setAffinityForCurrentThread: error {}", GetLastError());
+    }
+}